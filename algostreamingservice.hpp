@@ -36,6 +36,9 @@ public:
     // Change attributes to strings
     vector<string> ToStrings() const;
 
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
 private:
     double price;
     long visibleQuantity;
@@ -77,16 +80,7 @@ vector<string> PriceStreamOrder::ToStrings() const
     string _price = ConvertPrice(price);
     string _visibleQuantity = to_string(visibleQuantity);
     string _hiddenQuantity = to_string(hiddenQuantity);
-    string _side;
-    switch (side)
-    {
-        case BID:
-            _side = "BID";
-            break;
-        case OFFER:
-            _side = "OFFER";
-            break;
-    }
+    string _side(PRICING_SIDE_NAMES[side]);
 
     vector<string> _strings;
     _strings.push_back(_price);
@@ -96,6 +90,14 @@ vector<string> PriceStreamOrder::ToStrings() const
     return _strings;
 }
 
+void PriceStreamOrder::Format(RowFormatter& _formatter) const
+{
+    _formatter.PriceField(price);
+    _formatter.IntegerField(visibleQuantity);
+    _formatter.IntegerField(hiddenQuantity);
+    _formatter.Field(PRICING_SIDE_NAMES[side]);
+}
+
 /**
 * Price Stream with a two-way market.
 * Type T is the product type.
@@ -119,13 +121,26 @@ public:
     // Get the offer order
     const PriceStreamOrder& GetOfferOrder() const;
 
+    // Set both orders, keeping the product
+    void SetOrders(const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
+
     // Change attributes to strings
     vector<string> ToStrings() const;
 
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
+    // Get the time the price entered the system, in monotonic nanoseconds
+    long GetTimestamp() const;
+
+    // Set the time the price entered the system
+    void SetTimestamp(long _timestamp);
+
 private:
     T product;
     PriceStreamOrder bidOrder;
     PriceStreamOrder offerOrder;
+    long timestamp = 0;
 
 };
 
@@ -153,6 +168,25 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
     return offerOrder;
 }
 
+template<typename T>
+void PriceStream<T>::SetOrders(const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder)
+{
+    bidOrder = _bidOrder;
+    offerOrder = _offerOrder;
+}
+
+template<typename T>
+long PriceStream<T>::GetTimestamp() const
+{
+    return timestamp;
+}
+
+template<typename T>
+void PriceStream<T>::SetTimestamp(long _timestamp)
+{
+    timestamp = _timestamp;
+}
+
 template<typename T>
 vector<string> PriceStream<T>::ToStrings() const
 {
@@ -167,8 +201,16 @@ vector<string> PriceStream<T>::ToStrings() const
     return _strings;
 }
 
+template<typename T>
+void PriceStream<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    bidOrder.Format(_formatter);
+    offerOrder.Format(_formatter);
+}
+
 /**
-* An algo streaming that process algo streaming.
+* An algo streaming that process algo streaming, owning its price stream by value.
 * Type T is the product type.
 */
 template<typename T>
@@ -182,21 +224,28 @@ public:
     AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
 
     // Get the order
-    PriceStream<T>* GetPriceStream() const;
+    const PriceStream<T>& GetPriceStream() const;
+    PriceStream<T>& GetPriceStream();
 
 private:
-    PriceStream<T>* priceStream;
+    PriceStream<T> priceStream;
 
 };
 
 template<typename T>
-AlgoStream<T>::AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder)
+AlgoStream<T>::AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
+        priceStream(_product, _bidOrder, _offerOrder)
 {
-    priceStream = new PriceStream<T>(_product, _bidOrder, _offerOrder);
 }
 
 template<typename T>
-PriceStream<T>* AlgoStream<T>::GetPriceStream() const
+const PriceStream<T>& AlgoStream<T>::GetPriceStream() const
+{
+    return priceStream;
+}
+
+template<typename T>
+PriceStream<T>& AlgoStream<T>::GetPriceStream()
 {
     return priceStream;
 }
@@ -218,7 +267,8 @@ class AlgoStreamingService : public Service<string, AlgoStream<T>>
 
 private:
 
-    map<string, AlgoStream<T>> algoStreams;
+    ProductStore<AlgoStream<T>> algoStreams;
+    AlgoStream<T> missing;
     vector<ServiceListener<AlgoStream<T>>*> listeners;
     ServiceListener<Price<T>>* listener;
     long count;
@@ -229,8 +279,8 @@ public:
     AlgoStreamingService();
     ~AlgoStreamingService();
 
-    // Get data on our service given a key
-    AlgoStream<T>& GetData(string _key);
+    // Get data on our service given a key, a default value if none was stored for it
+    AlgoStream<T>& GetData(const string& _key);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(AlgoStream<T>& _data);
@@ -247,12 +297,18 @@ public:
     // Publish two-way prices
     void AlgoPublishPrice(Price<T>& _price);
 
+    // Get the number of prices published, which alternates their quantities
+    long GetCount() const;
+
+    // Set the number of prices published, as restored from a snapshot
+    void SetCount(long _count);
+
 };
 
 template<typename T>
 AlgoStreamingService<T>::AlgoStreamingService()
 {
-    algoStreams = map<string, AlgoStream<T>>();
+    algoStreams = ProductStore<AlgoStream<T>>();
     listeners = vector<ServiceListener<AlgoStream<T>>*>();
     listener = new AlgoStreamingToPricingListener<T>(this);
     count = 0;
@@ -262,15 +318,16 @@ template<typename T>
 AlgoStreamingService<T>::~AlgoStreamingService() {}
 
 template<typename T>
-AlgoStream<T>& AlgoStreamingService<T>::GetData(string _key)
+AlgoStream<T>& AlgoStreamingService<T>::GetData(const string& _key)
 {
-    return algoStreams[_key];
+    AlgoStream<T>* _algoStream = algoStreams.Find(_key);
+    return _algoStream ? *_algoStream : missing;
 }
 
 template<typename T>
 void AlgoStreamingService<T>::OnMessage(AlgoStream<T>& _data)
 {
-    algoStreams[_data.GetPriceStream()->GetProduct().GetProductId()] = _data;
+    algoStreams.Get(_data.GetPriceStream().GetProduct()) = _data;
 }
 
 template<typename T>
@@ -291,11 +348,22 @@ ServiceListener<Price<T>>* AlgoStreamingService<T>::GetListener()
     return listener;
 }
 
+template<typename T>
+long AlgoStreamingService<T>::GetCount() const
+{
+    return count;
+}
+
+template<typename T>
+void AlgoStreamingService<T>::SetCount(long _count)
+{
+    count = _count;
+}
+
 template<typename T>
 void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& _price)
 {
-    T _product = _price.GetProduct();
-    string _productId = _product.GetProductId();
+    const T& _product = _price.GetProduct();
 
     double _mid = _price.GetMid();
     double _bidOfferSpread = _price.GetBidOfferSpread();
@@ -307,8 +375,13 @@ void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& _price)
     count++;
     PriceStreamOrder _bidOrder(_bidPrice, _visibleQuantity, _hiddenQuantity, BID);
     PriceStreamOrder _offerOrder(_offerPrice, _visibleQuantity, _hiddenQuantity, OFFER);
-    AlgoStream<T> _algoStream(_product, _bidOrder, _offerOrder);
-    algoStreams[_productId] = _algoStream;
+
+    // The stream is built in the product's slot, copying the product only the first time
+    AlgoStream<T>& _algoStream = algoStreams.Get(_product);
+    PriceStream<T>& _priceStream = _algoStream.GetPriceStream();
+    if (_priceStream.GetProduct().GetProductId() != _product.GetProductId()) _priceStream = PriceStream<T>(_product, _bidOrder, _offerOrder);
+    else _priceStream.SetOrders(_bidOrder, _offerOrder);
+    _priceStream.SetTimestamp(_price.GetTimestamp());
 
     for (auto& l : listeners)
     {
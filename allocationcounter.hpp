@@ -0,0 +1,121 @@
+/**
+ * allocationcounter.hpp
+ * Counts heap allocations by replacing the global allocation functions.
+ * Include this header in exactly one translation unit of a program.
+ *
+ */
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+atomic<long> ALLOCATION_COUNT(0);
+
+// Get the number of heap allocations made so far
+long GetAllocationCount()
+{
+    return ALLOCATION_COUNT.load(memory_order_relaxed);
+}
+
+// Allocate a counted block of memory, aligned beyond the default if an alignment is given.
+// Kept out of line with its release, so every new is paired with a delete as the compiler sees it.
+__attribute__((noinline)) void* AllocateCounted(size_t _size, size_t _align = 0)
+{
+    ALLOCATION_COUNT.fetch_add(1, memory_order_relaxed);
+    if (_size == 0) _size = 1;
+    void* _pointer = _align ? aligned_alloc(_align, (_size + _align - 1) / _align * _align) : malloc(_size);
+    if (!_pointer) throw bad_alloc();
+    return _pointer;
+}
+
+// Release a block from AllocateCounted
+__attribute__((noinline)) void ReleaseCounted(void* _pointer) noexcept
+{
+    free(_pointer);
+}
+
+void* operator new(size_t _size)
+{
+    return AllocateCounted(_size);
+}
+
+void* operator new[](size_t _size)
+{
+    return AllocateCounted(_size);
+}
+
+void* operator new(size_t _size, align_val_t _alignment)
+{
+    return AllocateCounted(_size, size_t(_alignment));
+}
+
+void* operator new[](size_t _size, align_val_t _alignment)
+{
+    return AllocateCounted(_size, size_t(_alignment));
+}
+
+void* operator new(size_t _size, const nothrow_t&) noexcept
+{
+    try { return AllocateCounted(_size); } catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t _size, const nothrow_t&) noexcept
+{
+    try { return AllocateCounted(_size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void* _pointer) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete[](void* _pointer) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete(void* _pointer, size_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete[](void* _pointer, size_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete(void* _pointer, align_val_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete[](void* _pointer, align_val_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete(void* _pointer, size_t, align_val_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete[](void* _pointer, size_t, align_val_t) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete(void* _pointer, const nothrow_t&) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+void operator delete[](void* _pointer, const nothrow_t&) noexcept
+{
+    ReleaseCounted(_pointer);
+}
+
+#endif
@@ -0,0 +1,75 @@
+//
+// Backtest harness for the algo execution.
+// Loads recorded market data once into a tick store, replays it through the market data service,
+// then backtests a grid of algo execution parameters over the shared store in parallel.
+//
+// Usage: backtest [marketdata file] [speed, a multiple of real time, 0 for as fast as possible] [threads]
+//
+
+#include <iostream>
+#include <iomanip>
+
+#include "soa.hpp"
+#include "products.hpp"
+#include "marketdataservice.hpp"
+#include "executionservice.hpp"
+#include "replay.hpp"
+
+using namespace std;
+
+// Print the results of a sweep, one variant to a row
+void PrintResults(const vector<AlgoBacktestResult>& _results)
+{
+    cout << left << setw(12) << "Spread" << setw(8) << "First" << right << setw(10) << "Orders" << setw(10) << "Buys" << setw(10) << "Sells"
+         << setw(16) << "Quantity" << setw(14) << "Position" << setw(16) << "PnL" << setw(12) << "ms" << endl;
+    for (auto& r : _results)
+    {
+        cout << left << setw(12) << to_string(lround(r.parameters.spread * 256)) + "/256" << setw(8) << (r.parameters.firstSide == BID ? "BID" : "OFFER")
+             << right << setw(10) << r.orders << setw(10) << r.buys << setw(10) << r.sells
+             << setw(16) << r.quantity << setw(14) << r.position << setw(16) << fixed << setprecision(2) << r.pnl
+             << setw(12) << setprecision(1) << r.nanos / 1e6 << endl;
+        cout.unsetf(ios::fixed);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    string _path = (argc > 1) ? argv[1] : "marketdata.txt";
+    double _speed = (argc > 2) ? stod(argv[2]) : 0;
+    int _threads = (argc > 3) ? stoi(argv[3]) : 0;
+
+    GetProductRegistry().Load("bonds.txt");
+
+    cout << TimeStamp() << "Ticks Loading..." << endl;
+    TickStore _store;
+    long _start = GetNanoseconds();
+    size_t _ticks = _store.Load(_path);
+    cout << TimeStamp() << "Ticks Loaded: " << _ticks << " in " << (GetNanoseconds() - _start) / 1e6 << " ms." << endl;
+    if (_ticks == 0) return 1;
+
+    cout << TimeStamp() << "Ticks Replaying..." << endl;
+    MarketDataService<Bond> _marketDataService;
+    MarketDataReplay<MarketDataService<Bond>> _replay(_store, &_marketDataService);
+    long _nanos = _replay.Run(_speed);
+    cout << TimeStamp() << "Ticks Replayed in " << _nanos / 1e6 << " ms, " << long(_ticks * 1e9 / max(1L, _nanos)) << " ticks/sec." << endl;
+
+    // Spreads from one tick to four 128ths, starting on either side
+    vector<AlgoExecutionParameters> _variants;
+    for (int _ticks256 : { 1, 2, 3, 4, 6, 8 })
+    {
+        for (PricingSide _side : { BID, OFFER })
+        {
+            AlgoExecutionParameters _parameters;
+            _parameters.spread = _ticks256 / 256.0;
+            _parameters.firstSide = _side;
+            _variants.push_back(_parameters);
+        }
+    }
+
+    cout << TimeStamp() << "Parameters Sweeping..." << endl;
+    _start = GetNanoseconds();
+    vector<AlgoBacktestResult> _results = RunAlgoSweep(_store, _variants, _threads);
+    cout << TimeStamp() << "Parameters Swept: " << _results.size() << " variants in " << (GetNanoseconds() - _start) / 1e6 << " ms." << endl;
+    PrintResults(_results);
+    return 0;
+}
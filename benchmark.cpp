@@ -0,0 +1,574 @@
+//
+// Benchmark harness for the trading system.
+// Generates synthetic input files, drives each connector alone and the full service graph,
+// and runs microbenchmarks of the hot paths.
+//
+// Usage: benchmark [prices] [trades] [orderbooks] [inquiries] [cusips] [repetitions]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+
+#include "allocationcounter.hpp"
+#include "compactmessages.hpp"
+#include "soa.hpp"
+#include "products.hpp"
+#include "algostreamingservice.hpp"
+#include "bondanalytics.hpp"
+#include "executionservice.hpp"
+#include "guiservice.hpp"
+#include "historicaldataservice.hpp"
+#include "ingest.hpp"
+#include "inquiryservice.hpp"
+#include "marketdataservice.hpp"
+#include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "replay.hpp"
+#include "riskservice.hpp"
+#include "sharedmemory.hpp"
+#include "streamingservice.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+/**
+* Sizes of the synthetic data set.
+*/
+struct BenchmarkConfig
+{
+    long prices = 600000;
+    long trades = 60000;
+    long orderBooks = 60000;
+    long inquiries = 60000;
+    int cusips = 6;
+    int repetitions = 1000000;
+};
+
+// Keeps results of microbenchmarks alive
+volatile double BENCHMARK_SINK = 0;
+
+// Print the header of the result table
+void PrintHeader(const string& _title)
+{
+    cout << endl << _title << endl;
+    cout << left << setw(44) << "Benchmark" << right << setw(12) << "Messages" << setw(14) << "msgs/sec"
+         << setw(12) << "ns/msg" << setw(14) << "allocs/msg" << endl;
+}
+
+// Run a body handling _messages messages, and print its throughput, latency and allocations
+template<typename F>
+void Measure(const string& _name, long _messages, F _body)
+{
+    long _allocations = GetAllocationCount();
+    long _start = GetNanoseconds();
+    _body();
+    long _nanos = GetNanoseconds() - _start;
+    _allocations = GetAllocationCount() - _allocations;
+
+    double _messagesPerSecond = (_nanos > 0) ? _messages * 1e9 / _nanos : 0;
+    cout << left << setw(44) << _name << right << setw(12) << _messages
+         << setw(14) << fixed << setprecision(0) << _messagesPerSecond
+         << setw(12) << setprecision(1) << double(_nanos) / max(_messages, 1L)
+         << setw(14) << setprecision(3) << double(_allocations) / max(_messages, 1L) << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Get the CUSIPs of the data set, registering synthetic bonds past the six treasuries
+vector<string> GenerateCusips(int _count)
+{
+    ProductRegistry& _registry = GetProductRegistry();
+    vector<double> _randoms = GenerateUniform(_count, 17);
+    for (int i = _registry.GetSize(); i < _count; i++)
+    {
+        string _cusip = to_string(100000000 + i).substr(1);
+        double _coupon = 0.01 + int(_randoms[i] * 16) / 400.0;
+        date _maturity = from_string("2018/05/15") + boost::gregorian::months(6 * (1 + i % 60));
+        _registry.AddBond(Bond(_cusip, CUSIP, "SYN" + to_string(i), _coupon, _maturity));
+    }
+
+    vector<string> _cusips;
+    for (int i = 0; i < _count; i++)
+    {
+        _cusips.push_back(_registry.GetBond(i).GetProductId());
+    }
+    return _cusips;
+}
+
+// Get a random price around par, on the 1/256 grid
+double GeneratePrice(double _random)
+{
+    return 99 + int(_random * 512) / 256.0;
+}
+
+// Get a random 12-character identifier
+string GenerateRandomId(const double* _randoms)
+{
+    string _base = "0123456789QWERTYUIOPASDFGHJKLZXCVBNM";
+    string _id;
+    for (int i = 0; i < 12; i++)
+    {
+        _id.push_back(_base[int(_randoms[i] * 36)]);
+    }
+    return _id;
+}
+
+// Write _count prices, grouped by CUSIP like prices.txt
+void GeneratePrices(const string& _path, long _count, const vector<string>& _cusips)
+{
+    ofstream _file(_path);
+    vector<double> _randoms = GenerateUniform(_count, 11);
+    for (long i = 0; i < _count; i++)
+    {
+        const string& _cusip = _cusips[i * _cusips.size() / _count];
+        double _mid = GeneratePrice(_randoms[i]);
+        double _spread = (i % 2 == 0) ? 1.0 / 128 : 1.0 / 64;
+        _file << _cusip << "," << ConvertPrice(_mid - _spread / 2) << "," << ConvertPrice(_mid + _spread / 2) << "\n";
+    }
+}
+
+// Write _count trades, grouped by CUSIP like trades.txt
+void GenerateTrades(const string& _path, long _count, const vector<string>& _cusips)
+{
+    ofstream _file(_path);
+    vector<double> _randoms = GenerateUniform(_count * 14, 13);
+    string _books[] = { "TRSY1", "TRSY2", "TRSY3" };
+    for (long i = 0; i < _count; i++)
+    {
+        const double* _row = &_randoms[i * 14];
+        const string& _cusip = _cusips[i * _cusips.size() / _count];
+        _file << _cusip << "," << GenerateRandomId(_row) << "," << ConvertPrice(GeneratePrice(_row[12])) << ","
+              << _books[i % 3] << "," << (i % 5 + 1) * 1000000 << "," << ((i % 2 == 0) ? "BUY" : "SELL") << "\n";
+    }
+}
+
+// Write _count order books of five levels a side, grouped by CUSIP like marketdata.txt
+void GenerateMarketData(const string& _path, long _count, const vector<string>& _cusips)
+{
+    ofstream _file(_path);
+    vector<double> _randoms = GenerateUniform(_count, 19);
+    for (long i = 0; i < _count; i++)
+    {
+        const string& _cusip = _cusips[i * _cusips.size() / _count];
+        double _mid = GeneratePrice(_randoms[i]);
+        double _spread = 1.0 / 128 * (i % 4 + 1);
+        for (int level = 0; level < 5; level++)
+        {
+            long _quantity = (level + 1) * 10000000;
+            _file << _cusip << "," << ConvertPrice(_mid - _spread / 2 - level / 128.0) << "," << _quantity << ",BID\n";
+            _file << _cusip << "," << ConvertPrice(_mid + _spread / 2 + level / 128.0) << "," << _quantity << ",OFFER\n";
+        }
+    }
+}
+
+// Write _count inquiries, grouped by CUSIP like inquiries.txt
+void GenerateInquiries(const string& _path, long _count, const vector<string>& _cusips)
+{
+    ofstream _file(_path);
+    vector<double> _randoms = GenerateUniform(_count * 13, 23);
+    for (long i = 0; i < _count; i++)
+    {
+        const double* _row = &_randoms[i * 13];
+        const string& _cusip = _cusips[i * _cusips.size() / _count];
+        _file << GenerateRandomId(_row) << "," << _cusip << "," << ((i % 2 == 0) ? "BUY" : "SELL") << ","
+              << (i % 5 + 1) * 1000000 << "," << ConvertPrice(GeneratePrice(_row[12])) << ",RECEIVED\n";
+    }
+}
+
+// Time the hot paths one at a time
+void RunMicrobenchmarks(const BenchmarkConfig& _config, const vector<string>& _cusips)
+{
+    PrintHeader("Microbenchmarks");
+    long _repetitions = _config.repetitions;
+
+    vector<string> _prices;
+    vector<double> _randoms = GenerateUniform(1024, 29);
+    for (auto& r : _randoms) _prices.push_back(ConvertPrice(GeneratePrice(r)));
+
+    Measure("ConvertPrice(string_view)", _repetitions, [&]
+    {
+        double _sum = 0;
+        for (long i = 0; i < _repetitions; i++) _sum += ConvertPrice(string_view(_prices[i & 1023]));
+        BENCHMARK_SINK = _sum;
+    });
+
+    Measure("FormatPrice", _repetitions, [&]
+    {
+        char _buffer[32];
+        size_t _sum = 0;
+        for (long i = 0; i < _repetitions; i++) _sum += FormatPrice(GeneratePrice(_randoms[i & 1023]), _buffer);
+        BENCHMARK_SINK = _sum;
+    });
+
+    Measure("ConvertPrice(double)", _repetitions, [&]
+    {
+        size_t _sum = 0;
+        for (long i = 0; i < _repetitions; i++) _sum += ConvertPrice(GeneratePrice(_randoms[i & 1023])).size();
+        BENCHMARK_SINK = _sum;
+    });
+
+    const Bond& _bond = GetBond(_cusips[0]);
+    vector<Order> _bidStack;
+    vector<Order> _offerStack;
+    for (int level = 0; level < 5; level++)
+    {
+        _bidStack.push_back(Order(99 - level / 128.0, (level + 1) * 10000000, BID));
+        _offerStack.push_back(Order(99 + (level + 1) / 128.0, (level + 1) * 10000000, OFFER));
+    }
+    OrderBook<Bond> _orderBook(_bond, _bidStack, _offerStack);
+
+    Measure("OrderBook::GetBidOffer", _repetitions, [&]
+    {
+        double _sum = 0;
+        for (long i = 0; i < _repetitions; i++) _sum += _orderBook.GetBidOffer().GetBidOrder().GetPrice();
+        BENCHMARK_SINK = _sum;
+    });
+
+    Measure("OrderBook::OrderBook", _repetitions / 10, [&]
+    {
+        double _sum = 0;
+        for (long i = 0; i < _repetitions / 10; i++)
+        {
+            OrderBook<Bond> _book(_bond, _bidStack, _offerStack);
+            _sum += _book.GetBidOffer().GetOfferOrder().GetPrice();
+        }
+        BENCHMARK_SINK = _sum;
+    });
+
+    // Books through a ring buffer as full messages, then as compact ones
+    SPSCQueue<OrderBook<Bond>> _bookQueue(1024);
+    Measure("SPSCQueue OrderBook", _repetitions / 10, [&]
+    {
+        OrderBook<Bond> _book;
+        double _sum = 0;
+        for (long i = 0; i < _repetitions / 10; i++)
+        {
+            _bookQueue.TryPush(_orderBook);
+            _bookQueue.TryPop(_book);
+            _sum += _book.GetBidOffer().GetOfferOrder().GetPrice();
+        }
+        BENCHMARK_SINK = _sum;
+    });
+    CompactOrderBook _compactBook = ToCompact(_orderBook);
+    SPSCQueue<CompactOrderBook> _compactQueue(1024);
+    Measure("SPSCQueue CompactOrderBook", _repetitions / 10, [&]
+    {
+        CompactOrderBook _book = {};
+        double _sum = 0;
+        for (long i = 0; i < _repetitions / 10; i++)
+        {
+            _compactQueue.TryPush(_compactBook);
+            _compactQueue.TryPop(_book);
+            _sum += _book.offerStack[0].price;
+        }
+        BENCHMARK_SINK = _sum;
+    });
+
+    string _books[] = { "TRSY1", "TRSY2", "TRSY3" };
+    vector<Trade<Bond>> _trades;
+    for (int i = 0; i < 1024; i++)
+    {
+        _trades.push_back(Trade<Bond>(GetBond(_cusips[i % _cusips.size()]), "T" + to_string(i), 99, _books[i % 3], 1000000, (i % 2 == 0) ? BUY : SELL));
+    }
+    PositionService<Bond> _positionService;
+    Measure("PositionService::AddTrade", _repetitions, [&]
+    {
+        for (long i = 0; i < _repetitions; i++) _positionService.AddTrade(_trades[i & 1023]);
+    });
+
+    // A session of distinct trade IDs, stored without bound and within the default retention
+    vector<string> _tradeIds(_repetitions);
+    for (long i = 0; i < _repetitions; i++) _tradeIds[i] = "T" + to_string(i);
+    {
+        IdHashTable<Trade<Bond>> _unbounded;
+        Measure("IdHashTable insert, unbounded", _repetitions, [&]
+        {
+            for (long i = 0; i < _repetitions; i++) _unbounded[_tradeIds[i]] = _trades[i & 1023];
+        });
+    }
+    {
+        RetentionStore<Trade<Bond>> _retained(RetentionPolicy{ TRADE_RETENTION_ENTRIES, 0 });
+        Measure("RetentionStore insert, " + to_string(TRADE_RETENTION_ENTRIES) + " retained", _repetitions, [&]
+        {
+            for (long i = 0; i < _repetitions; i++) _retained[_tradeIds[i]] = _trades[i & 1023];
+        });
+        Measure("RetentionStore lookup", _repetitions, [&]
+        {
+            long _found = 0;
+            for (long i = 0; i < _repetitions; i++) _found += _retained.Find(_tradeIds[i]) != nullptr;
+            BENCHMARK_SINK = _found;
+        });
+    }
+
+    // Latest values through seqlock slots in shared memory, as written by the services and read by a dashboard
+    SharedMemoryPublisher _publisher("/tradingsystem-benchmark");
+    SharedMemoryReader _reader("/tradingsystem-benchmark");
+    Position<Bond> _position(_bond);
+    _position.AddPosition("TRSY1", 1000000);
+    PV01<Bond> _risk(_bond, 0.0195, 10000000);
+    Measure("SharedMemoryPublisher::Publish Position", _repetitions, [&]
+    {
+        for (long i = 0; i < _repetitions; i++) _publisher.Publish(_position);
+    });
+    Measure("SharedMemoryPublisher::Publish PV01", _repetitions, [&]
+    {
+        for (long i = 0; i < _repetitions; i++) _publisher.Publish(_risk);
+    });
+    int _index = _reader.GetIndex(_bond.GetProductId());
+    Measure("SharedMemoryReader::Read PV01", _repetitions, [&]
+    {
+        SharedRisk _shared;
+        double _sum = 0;
+        for (long i = 0; i < _repetitions; i++)
+        {
+            if (_reader.Read(uint32_t(_index), _shared)) _sum += _shared.pv01;
+        }
+        BENCHMARK_SINK = _sum;
+    });
+    _publisher.Unlink();
+
+    long _records = _repetitions / 10;
+    PV01<Bond> _pv01(_bond, 0.0195, 10000000);
+    HistoricalDataService<PV01<Bond>> _binaryService(RISK, false, BINARY, "benchmark_");
+    Measure("HistoricalDataConnector::Publish binary", _records, [&]
+    {
+        for (long i = 0; i < _records; i++) _binaryService.GetConnector()->Publish(_pv01);
+    });
+    ExecutionOrder<Bond> _executionOrder(_bond, BID, "0H7FLDK4IMVU", MARKET, 99.5, 1000000, 0, "", false);
+    Measure("ExecutionOrder::ToStrings", _records, [&]
+    {
+        size_t _size = 0;
+        for (long i = 0; i < _records; i++) _size += _executionOrder.ToStrings().size();
+        BENCHMARK_SINK = _size;
+    });
+    char _row[ROW_CAPACITY];
+    Measure("ExecutionOrder::Format", _records, [&]
+    {
+        size_t _size = 0;
+        for (long i = 0; i < _records; i++)
+        {
+            RowFormatter _formatter(_row, ROW_CAPACITY);
+            _executionOrder.Format(_formatter);
+            _size += _formatter.GetRow().size();
+        }
+        BENCHMARK_SINK = _size;
+    });
+    HistoricalDataService<PV01<Bond>> _textService(RISK, false, TEXT, "benchmark_");
+    Measure("HistoricalDataConnector::Publish text", _records, [&]
+    {
+        for (long i = 0; i < _records; i++) _textService.GetConnector()->Publish(_pv01);
+    });
+}
+
+// Drive each connector into its service alone, without listeners
+void RunConnectors(const BenchmarkConfig& _config)
+{
+    PrintHeader("Connectors");
+
+    PricingService<Bond> _pricingService;
+    Measure("PricingConnector", _config.prices, [&]
+    {
+        _pricingService.GetConnector()->SubscribeFile("prices.txt");
+    });
+
+    // Prices through algo streaming into full streams, then into conflated deltas
+    for (StreamingMode _mode : { FULL_STREAMS, DELTA_STREAMS })
+    {
+        PricingService<Bond> _streamPricingService;
+        AlgoStreamingService<Bond> _algoStreamingService;
+        StreamingService<Bond> _streamingService;
+        _streamPricingService.AddListener(_algoStreamingService.GetListener());
+        _algoStreamingService.AddListener(_streamingService.GetListener());
+        _streamingService.SetMode(_mode);
+        Measure(_mode == FULL_STREAMS ? "StreamingService full streams" : "StreamingService delta streams", _config.prices, [&]
+        {
+            _streamPricingService.GetConnector()->SubscribeFile("prices.txt");
+            _streamingService.Stop();
+        });
+    }
+
+    TradeBookingService<Bond> _tradeBookingService;
+    Measure("TradeBookingConnector", _config.trades, [&]
+    {
+        _tradeBookingService.GetConnector()->SubscribeFile("trades.txt");
+    });
+    TradeBookingService<Bond> _batchedService;
+    Measure("TradeBookingConnector batches of 256", _config.trades, [&]
+    {
+        _batchedService.GetConnector()->SubscribeFile("trades.txt", 256);
+    });
+
+    MarketDataService<Bond> _marketDataService;
+    Measure("MarketDataConnector 1 thread", _config.orderBooks, [&]
+    {
+        _marketDataService.GetConnector()->SubscribeFile("marketdata.txt", 1);
+    });
+    int _threads = max(2, int(thread::hardware_concurrency()));
+    Measure("MarketDataConnector " + to_string(_threads) + " threads", _config.orderBooks, [&]
+    {
+        _marketDataService.GetConnector()->SubscribeFile("marketdata.txt", _threads);
+    });
+
+    // Books loaded once into a tick store, then replayed from memory
+    TickStore _store;
+    _store.Load("marketdata.txt");
+    MarketDataService<Bond> _replayService;
+    MarketDataReplay<MarketDataService<Bond>> _replay(_store, &_replayService);
+    Measure("MarketDataReplay", long(_store.GetSize()), [&]
+    {
+        _replay.Run();
+    });
+    vector<AlgoExecutionParameters> _variants(8);
+    for (size_t i = 0; i < _variants.size(); i++) _variants[i].spread = (i + 1) / 256.0;
+    Measure("AlgoSweep " + to_string(_variants.size()) + " variants", long(_store.GetSize() * _variants.size()), [&]
+    {
+        BENCHMARK_SINK = RunAlgoSweep(_store, _variants)[0].pnl;
+    });
+
+    InquiryService<Bond> _inquiryService;
+    Measure("InquiryConnector", _config.inquiries, [&]
+    {
+        _inquiryService.GetConnector()->SubscribeFile("inquiries.txt");
+    });
+
+    InquiryService<Bond> _quotedInquiryService;
+    MidQuoter<Bond> _quoter(&_pricingService);
+    _quotedInquiryService.SetQuoter(&_quoter);
+    Measure("InquiryService quoting from mids", _config.inquiries, [&]
+    {
+        _quotedInquiryService.GetConnector()->SubscribeFile("inquiries.txt");
+    });
+
+    // The four inputs one after another, then read at once and merged by a sequencer
+    long _records = _config.prices + _config.trades + _config.orderBooks + _config.inquiries;
+    Measure("Connectors one after another", _records, [&]
+    {
+        PricingService<Bond> _ingestPricingService;
+        TradeBookingService<Bond> _ingestTradeBookingService;
+        MarketDataService<Bond> _ingestMarketDataService;
+        InquiryService<Bond> _ingestInquiryService;
+        _ingestPricingService.GetConnector()->SubscribeFile("prices.txt");
+        _ingestTradeBookingService.GetConnector()->SubscribeFile("trades.txt");
+        _ingestMarketDataService.GetConnector()->SubscribeFile("marketdata.txt", 1);
+        _ingestInquiryService.GetConnector()->SubscribeFile("inquiries.txt", 1);
+    });
+    for (IngestOrder _order : { ARRIVAL_ORDER, TIMESTAMP_ORDER })
+    {
+        Measure(_order == ARRIVAL_ORDER ? "IngestSequencer arrival order" : "IngestSequencer timestamp order", _records, [&]
+        {
+            PricingService<Bond> _ingestPricingService;
+            TradeBookingService<Bond> _ingestTradeBookingService;
+            MarketDataService<Bond> _ingestMarketDataService;
+            InquiryService<Bond> _ingestInquiryService;
+            IngestSequencer _sequencer(_order);
+            _sequencer.AddFeed(MakePriceFeed("prices.txt", &_ingestPricingService, _order));
+            _sequencer.AddFeed(MakeTradeFeed("trades.txt", &_ingestTradeBookingService, _order));
+            _sequencer.AddFeed(MakeOrderBookFeed("marketdata.txt", &_ingestMarketDataService, _order));
+            _sequencer.AddFeed(MakeInquiryFeed("inquiries.txt", &_ingestInquiryService, _order));
+            _sequencer.Run();
+        });
+    }
+}
+
+// Drive the full service graph, wired as in the trading system
+void RunPipeline(const BenchmarkConfig& _config)
+{
+    PrintHeader("Pipeline");
+
+    PricingService<Bond> pricingService;
+    TradeBookingService<Bond> tradeBookingService;
+    PositionService<Bond> positionService;
+    RiskService<Bond> riskService;
+    MarketDataService<Bond> marketDataService;
+    AlgoExecutionService<Bond> algoExecutionService;
+    AlgoStreamingService<Bond> algoStreamingService;
+    GUIService<Bond> guiService;
+    ExecutionService<Bond> executionService;
+    StreamingService<Bond> streamingService;
+    InquiryService<Bond> inquiryService;
+    HistoricalDataService<Position<Bond>> historicalPositionService(POSITION, true, BINARY | TEXT);
+    HistoricalDataService<PV01<Bond>> historicalRiskService(RISK, true, BINARY | TEXT);
+    HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION, true, BINARY | TEXT);
+    HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING, true, BINARY | TEXT);
+    HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY, true, BINARY | TEXT);
+    BondAnalytics bondAnalytics(from_string("2017/12/01"));
+    bondAnalytics.Load();
+    BondAnalyticsToPricingListener bondAnalyticsListener(&bondAnalytics, &riskService);
+
+    AsyncServiceListener<OrderBook<Bond>> algoExecutionStage(Instrument("AlgoExecution", algoExecutionService.GetListener()), 4096, 1);
+    algoExecutionStage.Prime(SampleOrderBook<Bond>(marketDataService.GetBookDepth()));
+    AsyncServiceListener<Position<Bond>> riskStage(Instrument("Risk", riskService.GetListener()), 4096, 2);
+    pricingService.AddListener(Instrument("AlgoStreaming", algoStreamingService.GetListener()));
+    pricingService.AddListener(Instrument("GUI", guiService.GetListener()));
+    pricingService.AddListener(Instrument("BondAnalytics", &bondAnalyticsListener));
+    algoStreamingService.AddListener(Instrument("Streaming", streamingService.GetListener()));
+    streamingService.AddListener(Instrument("HistoricalStreaming", historicalStreamingService.GetListener()));
+    marketDataService.AddListener(&algoExecutionStage);
+    algoExecutionService.AddListener(Instrument("Execution", executionService.GetListener()));
+    executionService.AddListener(Instrument("TradeBooking", tradeBookingService.GetListener()));
+    executionService.AddListener(Instrument("HistoricalExecution", historicalExecutionService.GetListener()));
+    tradeBookingService.AddListener(Instrument("Position", positionService.GetListener()));
+    positionService.AddListener(&riskStage);
+    positionService.AddListener(Instrument("HistoricalPosition", historicalPositionService.GetListener()));
+    riskService.AddListener(Instrument("HistoricalRisk", historicalRiskService.GetListener()));
+    inquiryService.AddListener(Instrument("HistoricalInquiry", historicalInquiryService.GetListener()));
+
+    Measure("Prices", _config.prices, [&]
+    {
+        pricingService.GetConnector()->SubscribeFile("prices.txt");
+        bondAnalyticsListener.Recompute();
+    });
+    Measure("Trades", _config.trades, [&]
+    {
+        tradeBookingService.GetConnector()->SubscribeFile("trades.txt");
+        riskStage.Drain();
+    });
+    Measure("Market data", _config.orderBooks, [&]
+    {
+        marketDataService.GetConnector()->SubscribeFile("marketdata.txt", thread::hardware_concurrency());
+        algoExecutionStage.Drain();
+        riskStage.Drain();
+    });
+    Measure("Inquiries", _config.inquiries, [&]
+    {
+        inquiryService.GetConnector()->SubscribeFile("inquiries.txt");
+    });
+
+    algoExecutionStage.Stop();
+    riskStage.Stop();
+    guiService.Stop();
+    ShutdownHistoricalWriters();
+
+    cout << endl;
+    DumpMetrics(cout);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkConfig _config;
+    if (argc > 1) _config.prices = stol(argv[1]);
+    if (argc > 2) _config.trades = stol(argv[2]);
+    if (argc > 3) _config.orderBooks = stol(argv[3]);
+    if (argc > 4) _config.inquiries = stol(argv[4]);
+    if (argc > 5) _config.cusips = stoi(argv[5]);
+    if (argc > 6) _config.repetitions = stoi(argv[6]);
+
+    // Inputs and outputs live in a scratch directory
+    filesystem::remove_all("benchmark_data");
+    filesystem::create_directories("benchmark_data");
+    filesystem::current_path("benchmark_data");
+
+    cout << TimeStamp() << "Benchmark Data Generating..." << endl;
+    vector<string> _cusips = GenerateCusips(_config.cusips);
+    GeneratePrices("prices.txt", _config.prices, _cusips);
+    GenerateTrades("trades.txt", _config.trades, _cusips);
+    GenerateMarketData("marketdata.txt", _config.orderBooks, _cusips);
+    GenerateInquiries("inquiries.txt", _config.inquiries, _cusips);
+    cout << TimeStamp() << "Benchmark Data Generated." << endl;
+
+    RunMicrobenchmarks(_config, _cusips);
+    RunConnectors(_config);
+    RunPipeline(_config);
+    return 0;
+}
@@ -0,0 +1,335 @@
+/**
+ * bondanalytics.hpp
+ * Defines the batch calculator of yield, duration and PV01 for the bonds of the product registry.
+ *
+ */
+#ifndef BOND_ANALYTICS_HPP
+#define BOND_ANALYTICS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include "soa.hpp"
+#include "products.hpp"
+#include "productregistry.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+
+using namespace std;
+
+/**
+* Bond Analytics computing yield to maturity, modified duration and PV01 for every bond
+* of the product registry from clean prices, with semi-annual compounding.
+* Data is kept in structure-of-arrays layout. Bonds are sorted by their number of
+* remaining coupons and grouped in blocks of LANES; the cashflows of a block are stored
+* period by period, so the inner loop runs over the bonds of a block and vectorizes.
+* Cashflow schedules are computed once, at Load; a recompute is a fixed number of
+* Newton iterations, each a few multiply-adds per cashflow.
+*/
+class BondAnalytics
+{
+
+public:
+
+    static const int LANES = 8;
+
+    // Constructor for a settlement date
+    BondAnalytics(const date& _settlement);
+
+    // Build the cashflow schedules of every bond of the registry
+    void Load();
+
+    // Set the clean price of the bond at a product index
+    void SetPrice(int _index, double _price);
+
+    // Recompute yield, duration and PV01 of every bond from its latest price
+    void Recompute();
+
+    // Get the yield, modified duration and PV01 (per 100 face) of the bond at a product index
+    double GetYield(int _index) const;
+    double GetDuration(int _index) const;
+    double GetPV01(int _index) const;
+
+    // Get the number of bonds
+    size_t GetSize() const;
+
+private:
+
+    static const int ITERATIONS = 8;
+
+    // Compute the dirty price, and the sum of the cashflow times weighted by their
+    // present value, of each bond of a block at its current yield
+    void ValuateBlock(int _block, double* _prices, double* _weighted) const;
+
+    date settlement;
+
+    // Per bond, in sorted order, padded to a whole number of blocks
+    vector<double> prices;
+    vector<double> accrued;
+    vector<double> fractions;
+    vector<double> yields;
+    vector<double> durations;
+    vector<double> pv01s;
+
+    // Per block, the offset of its cashflows and its number of periods
+    vector<size_t> blockOffsets;
+    vector<int> blockPeriods;
+
+    // Cashflow amounts, block by block, period by period, lane by lane
+    vector<double> cashflows;
+
+    // Position of each product index in sorted order
+    vector<int> positions;
+
+};
+
+BondAnalytics::BondAnalytics(const date& _settlement) : settlement(_settlement) {}
+
+void BondAnalytics::Load()
+{
+    ProductRegistry& _registry = GetProductRegistry();
+    size_t _size = _registry.GetSize();
+
+    // Remaining coupon dates of each bond, and the fraction of the current period left
+    vector<int> _periods(_size);
+    vector<double> _fractions(_size);
+    for (size_t i = 0; i < _size; i++)
+    {
+        const Bond& _bond = _registry.GetBond(int(i));
+        date _next = _bond.GetMaturityDate();
+        int _count = 0;
+        if (_next > settlement)
+        {
+            date _previous = _next;
+            while (_previous > settlement)
+            {
+                _next = _previous;
+                _previous = _previous - boost::gregorian::months(6);
+                _count++;
+            }
+            _fractions[i] = double((_next - settlement).days()) / double((_next - _previous).days());
+        }
+        _periods[i] = _count;
+    }
+
+    vector<int> _order(_size);
+    iota(_order.begin(), _order.end(), 0);
+    stable_sort(_order.begin(), _order.end(), [&](int a, int b) { return _periods[a] < _periods[b]; });
+
+    size_t _blocks = (_size + LANES - 1) / LANES;
+    size_t _padded = _blocks * LANES;
+    prices = vector<double>(_padded, 100);
+    accrued = vector<double>(_padded, 0);
+    fractions = vector<double>(_padded, 1);
+    yields = vector<double>(_padded, 0);
+    durations = vector<double>(_padded, 0);
+    pv01s = vector<double>(_padded, 0);
+    positions = vector<int>(_size, -1);
+    blockOffsets = vector<size_t>(_blocks);
+    blockPeriods = vector<int>(_blocks, 0);
+
+    size_t _offset = 0;
+    for (size_t b = 0; b < _blocks; b++)
+    {
+        for (int l = 0; l < LANES && b * LANES + l < _size; l++)
+        {
+            blockPeriods[b] = max(blockPeriods[b], _periods[_order[b * LANES + l]]);
+        }
+        blockOffsets[b] = _offset;
+        _offset += size_t(blockPeriods[b]) * LANES;
+    }
+    cashflows = vector<double>(_offset, 0);
+
+    for (size_t p = 0; p < _size; p++)
+    {
+        int i = _order[p];
+        const Bond& _bond = _registry.GetBond(i);
+        double _coupon = 100 * _bond.GetCoupon() / 2;
+        positions[i] = p;
+        fractions[p] = _fractions[i];
+        accrued[p] = _coupon * (1 - _fractions[i]);
+        yields[p] = _bond.GetCoupon();
+
+        size_t _block = p / LANES;
+        int _lane = p % LANES;
+        double* _flows = &cashflows[blockOffsets[_block]];
+        for (int k = 0; k < _periods[i]; k++)
+        {
+            _flows[k * LANES + _lane] = _coupon;
+        }
+        if (_periods[i] > 0) _flows[(_periods[i] - 1) * LANES + _lane] += 100;
+    }
+}
+
+void BondAnalytics::SetPrice(int _index, double _price)
+{
+    if (_index < 0 || size_t(_index) >= positions.size()) return;
+    prices[positions[_index]] = _price;
+}
+
+void BondAnalytics::ValuateBlock(int _block, double* _prices, double* _weighted) const
+{
+    const double* _flows = &cashflows[blockOffsets[_block]];
+    const double* _yields = &yields[_block * LANES];
+    const double* _fractions = &fractions[_block * LANES];
+
+    // Discount factor of the first cashflow, then one period more per cashflow
+    // Accumulate in locals, which the compiler knows do not alias the cashflows
+    double _factors[LANES];
+    double _discounts[LANES];
+    double _times[LANES];
+    double _sums[LANES] = {};
+    double _weights[LANES] = {};
+    for (int l = 0; l < LANES; l++)
+    {
+        _factors[l] = 1 / (1 + _yields[l] / 2);
+        _discounts[l] = pow(_factors[l], _fractions[l]);
+        _times[l] = _fractions[l];
+    }
+
+    int _periods = blockPeriods[_block];
+    for (int k = 0; k < _periods; k++)
+    {
+        const double* _amounts = _flows + k * LANES;
+        for (int l = 0; l < LANES; l++)
+        {
+            double _value = _amounts[l] * _discounts[l];
+            _sums[l] += _value;
+            _weights[l] += _value * _times[l];
+            _discounts[l] *= _factors[l];
+            _times[l] += 1;
+        }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+        _prices[l] = _sums[l];
+        _weighted[l] = _weights[l];
+    }
+}
+
+void BondAnalytics::Recompute()
+{
+    double _prices[LANES];
+    double _weighted[LANES];
+    for (size_t b = 0; b < blockOffsets.size(); b++)
+    {
+        double* _yields = &yields[b * LANES];
+        const double* _targets = &prices[b * LANES];
+        const double* _accrued = &accrued[b * LANES];
+
+        // Newton iterations on the yield: dP/dy = -weighted / (2 (1 + y/2))
+        for (int n = 0; n < ITERATIONS; n++)
+        {
+            ValuateBlock(b, _prices, _weighted);
+            for (int l = 0; l < LANES; l++)
+            {
+                double _slope = _weighted[l] / (2 + _yields[l]);
+                if (_slope > 0) _yields[l] += (_prices[l] - _accrued[l] - _targets[l]) / _slope;
+            }
+        }
+
+        ValuateBlock(b, _prices, _weighted);
+        for (int l = 0; l < LANES; l++)
+        {
+            double _slope = _weighted[l] / (2 + _yields[l]);
+            durations[b * LANES + l] = (_prices[l] > 0) ? _slope / _prices[l] : 0;
+            pv01s[b * LANES + l] = _slope * 0.0001;
+        }
+    }
+}
+
+double BondAnalytics::GetYield(int _index) const
+{
+    return yields[positions[_index]];
+}
+
+double BondAnalytics::GetDuration(int _index) const
+{
+    return durations[positions[_index]];
+}
+
+double BondAnalytics::GetPV01(int _index) const
+{
+    return pv01s[positions[_index]];
+}
+
+size_t BondAnalytics::GetSize() const
+{
+    return positions.size();
+}
+
+/**
+* Bond Analytics Listener feeding mid prices from the Pricing Service to the analytics.
+* The universe is recomputed once per round of prices: when a price arrives for a bond
+* already priced since the last recompute. New PV01 values go to the product registry
+* and to the Risk Service, which must be risking positions on the same thread or
+* between pipeline drains.
+*/
+class BondAnalyticsToPricingListener : public ServiceListener<Price<Bond>>
+{
+
+private:
+
+    BondAnalytics* analytics;
+    RiskService<Bond>* risk;
+    vector<char> priced;
+
+public:
+
+    // Connector and Destructor
+    BondAnalyticsToPricingListener(BondAnalytics* _analytics, RiskService<Bond>* _risk);
+    ~BondAnalyticsToPricingListener();
+
+    // Listener callback to process an add event to the Service
+    void ProcessAdd(Price<Bond>& _data);
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(Price<Bond>& _data);
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(Price<Bond>& _data);
+
+    // Recompute the universe and publish the PV01 values
+    void Recompute();
+
+};
+
+BondAnalyticsToPricingListener::BondAnalyticsToPricingListener(BondAnalytics* _analytics, RiskService<Bond>* _risk)
+{
+    analytics = _analytics;
+    risk = _risk;
+    priced = vector<char>(_analytics->GetSize(), 0);
+}
+
+BondAnalyticsToPricingListener::~BondAnalyticsToPricingListener() {}
+
+void BondAnalyticsToPricingListener::ProcessAdd(Price<Bond>& _data)
+{
+    int _index = ResolveProductIndex(_data.GetProduct());
+    if (_index < 0 || size_t(_index) >= priced.size()) return;
+    if (priced[_index]) Recompute();
+    analytics->SetPrice(_index, _data.GetMid());
+    priced[_index] = 1;
+}
+
+void BondAnalyticsToPricingListener::ProcessRemove(Price<Bond>& _data) {}
+
+void BondAnalyticsToPricingListener::ProcessUpdate(Price<Bond>& _data) {}
+
+void BondAnalyticsToPricingListener::Recompute()
+{
+    analytics->Recompute();
+    ProductRegistry& _registry = GetProductRegistry();
+    for (size_t i = 0; i < priced.size(); i++)
+    {
+        if (!priced[i]) continue;
+        double _pv01 = analytics->GetPV01(i);
+        _registry.SetPV01(i, _pv01);
+        risk->UpdatePV01(i, _pv01);
+        priced[i] = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,347 @@
+/**
+ * compactmessages.hpp
+ * Defines compact, trivially copyable messages for the hot path, resolved to full messages at the edges.
+ *
+ */
+#ifndef COMPACT_MESSAGES_HPP
+#define COMPACT_MESSAGES_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include "products.hpp"
+#include "productregistry.hpp"
+#include "servicestore.hpp"
+#include "pricingservice.hpp"
+#include "marketdataservice.hpp"
+#include "tradebookingservice.hpp"
+#include "positionservice.hpp"
+#include "executionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "inquiryservice.hpp"
+
+using namespace std;
+
+/**
+* Compact messages carry a 32-bit product handle, the product's index in the product registry,
+* instead of a Bond; prices as integer ticks of 1/256, the finest fraction of the price format;
+* 64-bit quantities; and identifiers inline, of up to 16 characters as in the binary records.
+* A message with a longer identifier, or a trade on a book the registry cannot take, has no
+* compact form: it is not truncated, which would let two messages collide, but carried in full.
+* They fit one or two cache lines, except the order book with three, and copy with a memcpy,
+* so they can go through ring buffers and be written to binary files as they are.
+* Full messages are built from them only where the Bond is needed.
+*/
+typedef uint32_t ProductHandle;
+
+const ProductHandle UNKNOWN_PRODUCT = UINT32_MAX;
+const int PRICE_TICKS = 256;
+const int COMPACT_ID_SIZE = 16;
+const int COMPACT_BOOK_DEPTH = 5;
+const uint8_t UNREGISTERED_BOOK = UINT8_MAX;
+static_assert(BookRegistry::MAX_BOOKS < UNREGISTERED_BOOK);
+
+// Get the handle of a product, UNKNOWN_PRODUCT if it is not in the registry
+ProductHandle GetProductHandle(const Product& _product)
+{
+    int _index = ResolveProductIndex(_product);
+    return (_index < 0) ? UNKNOWN_PRODUCT : ProductHandle(_index);
+}
+
+// Get the bond of a handle, a default bond if it is unknown
+const Bond& ResolveProduct(ProductHandle _handle)
+{
+    ProductRegistry& _registry = GetProductRegistry();
+    if (_handle == UNKNOWN_PRODUCT || _handle >= _registry.GetSize()) return _registry.GetBond(string_view());
+    return _registry.GetBond(int(_handle));
+}
+
+// Get a price as a count of ticks, rounded to the nearest tick
+int32_t ToPriceTicks(double _price)
+{
+    return int32_t(lround(_price * PRICE_TICKS));
+}
+
+// Get the price of a count of ticks
+double FromPriceTicks(int32_t _ticks)
+{
+    return double(_ticks) / PRICE_TICKS;
+}
+
+// Copy an identifier inline, return false if it is longer than COMPACT_ID_SIZE characters and is left empty
+bool CopyCompactId(const string& _id, char* _chars)
+{
+    memset(_chars, 0, COMPACT_ID_SIZE);
+    if (_id.size() > size_t(COMPACT_ID_SIZE)) return false;
+    memcpy(_chars, _id.data(), _id.size());
+    return true;
+}
+
+// Get an inline identifier as a string
+string GetCompactId(const char* _chars)
+{
+    return string(_chars, strnlen(_chars, COMPACT_ID_SIZE));
+}
+
+/**
+* Compact price, holding the bid and offer so an odd spread keeps its half-tick mid.
+*/
+struct CompactPrice
+{
+    ProductHandle product;
+    int32_t bid;
+    int32_t offer;
+    int64_t timestamp;
+};
+
+/**
+* Compact level of an order book; the side is the stack it is on.
+*/
+struct CompactOrder
+{
+    int32_t price;
+    int64_t quantity;
+};
+
+/**
+* Compact order book of up to COMPACT_BOOK_DEPTH levels a side; deeper levels are dropped.
+*/
+struct CompactOrderBook
+{
+    ProductHandle product;
+    uint8_t bids;
+    uint8_t offers;
+    int64_t timestamp;
+    CompactOrder bidStack[COMPACT_BOOK_DEPTH];
+    CompactOrder offerStack[COMPACT_BOOK_DEPTH];
+};
+
+/**
+* Compact trade, with its book as an index in the book registry, UNREGISTERED_BOOK if it has none.
+*/
+struct CompactTrade
+{
+    ProductHandle product;
+    int32_t price;
+    int64_t quantity;
+    uint8_t side;
+    uint8_t book;
+    char tradeId[COMPACT_ID_SIZE];
+};
+
+/**
+* Compact execution order.
+*/
+struct CompactExecutionOrder
+{
+    ProductHandle product;
+    int32_t price;
+    int64_t visibleQuantity;
+    int64_t hiddenQuantity;
+    int64_t timestamp;
+    uint8_t side;
+    uint8_t orderType;
+    uint8_t isChildOrder;
+    char orderId[COMPACT_ID_SIZE];
+    char parentOrderId[COMPACT_ID_SIZE];
+};
+
+/**
+* Compact side of a price stream.
+*/
+struct CompactStreamOrder
+{
+    int32_t price;
+    int64_t visibleQuantity;
+    int64_t hiddenQuantity;
+};
+
+/**
+* Compact price stream.
+*/
+struct CompactPriceStream
+{
+    ProductHandle product;
+    int64_t timestamp;
+    CompactStreamOrder bidOrder;
+    CompactStreamOrder offerOrder;
+};
+
+/**
+* Compact inquiry.
+*/
+struct CompactInquiry
+{
+    ProductHandle product;
+    int32_t price;
+    int64_t quantity;
+    uint8_t side;
+    uint8_t state;
+    char inquiryId[COMPACT_ID_SIZE];
+};
+
+static_assert(is_trivially_copyable_v<CompactPrice> && sizeof(CompactPrice) <= 64);
+static_assert(is_trivially_copyable_v<CompactOrderBook> && sizeof(CompactOrderBook) <= 192);
+static_assert(is_trivially_copyable_v<CompactTrade> && sizeof(CompactTrade) <= 64);
+static_assert(is_trivially_copyable_v<CompactExecutionOrder> && sizeof(CompactExecutionOrder) <= 128);
+static_assert(is_trivially_copyable_v<CompactPriceStream> && sizeof(CompactPriceStream) <= 64);
+static_assert(is_trivially_copyable_v<CompactInquiry> && sizeof(CompactInquiry) <= 64);
+
+// Get the compact message of a price
+CompactPrice ToCompact(const Price<Bond>& _price)
+{
+    double _halfSpread = _price.GetBidOfferSpread() / 2;
+    return { GetProductHandle(_price.GetProduct()), ToPriceTicks(_price.GetMid() - _halfSpread), ToPriceTicks(_price.GetMid() + _halfSpread), _price.GetTimestamp() };
+}
+
+// Get the price of a compact message
+Price<Bond> FromCompact(const CompactPrice& _price)
+{
+    Price<Bond> _full(ResolveProduct(_price.product), FromPriceTicks(_price.bid + _price.offer) / 2, FromPriceTicks(_price.offer - _price.bid));
+    _full.SetTimestamp(_price.timestamp);
+    return _full;
+}
+
+// Get the compact message of an order book
+CompactOrderBook ToCompact(const OrderBook<Bond>& _orderBook)
+{
+    CompactOrderBook _compact = {};
+    _compact.product = GetProductHandle(_orderBook.GetProduct());
+    _compact.timestamp = _orderBook.GetTimestamp();
+    for (auto& o : _orderBook.GetBidStack())
+    {
+        if (_compact.bids == COMPACT_BOOK_DEPTH) break;
+        _compact.bidStack[_compact.bids++] = { ToPriceTicks(o.GetPrice()), o.GetQuantity() };
+    }
+    for (auto& o : _orderBook.GetOfferStack())
+    {
+        if (_compact.offers == COMPACT_BOOK_DEPTH) break;
+        _compact.offerStack[_compact.offers++] = { ToPriceTicks(o.GetPrice()), o.GetQuantity() };
+    }
+    return _compact;
+}
+
+/**
+* Builder of full order books from compact messages, reusing its stacks.
+* A book handed to the market data service by move comes back with the stacks
+* of the book it replaced, so steady-state expansion does not allocate.
+*/
+class OrderBookExpander
+{
+
+public:
+
+    // Rebuild a book in place from a compact message
+    void Expand(const CompactOrderBook& _compact, OrderBook<Bond>& _orderBook)
+    {
+        bidStack.clear();
+        offerStack.clear();
+        for (int i = 0; i < _compact.bids; i++) bidStack.emplace_back(FromPriceTicks(_compact.bidStack[i].price), _compact.bidStack[i].quantity, BID);
+        for (int i = 0; i < _compact.offers; i++) offerStack.emplace_back(FromPriceTicks(_compact.offerStack[i].price), _compact.offerStack[i].quantity, OFFER);
+        _orderBook.Assign(ResolveProduct(_compact.product), bidStack, offerStack);
+        _orderBook.SetTimestamp(_compact.timestamp);
+    };
+
+private:
+
+    vector<Order> bidStack;
+    vector<Order> offerStack;
+
+};
+
+// Get the order book of a compact message
+OrderBook<Bond> FromCompact(const CompactOrderBook& _compact)
+{
+    OrderBook<Bond> _orderBook;
+    OrderBookExpander().Expand(_compact, _orderBook);
+    return _orderBook;
+}
+
+// Get the compact message of a trade, return false if the trade has no compact form:
+// its ID is too long, or its book is not in the registry and the registry is full
+bool ToCompact(const Trade<Bond>& _trade, CompactTrade& _compact)
+{
+    _compact = {};
+    _compact.product = GetProductHandle(_trade.GetProduct());
+    _compact.price = ToPriceTicks(_trade.GetPrice());
+    _compact.quantity = _trade.GetQuantity();
+    _compact.side = uint8_t(_trade.GetSide());
+    int _book = GetBookRegistry().GetIndex(_trade.GetBook());
+    _compact.book = (_book < 0) ? UNREGISTERED_BOOK : uint8_t(_book);
+    return CopyCompactId(_trade.GetTradeId(), _compact.tradeId) && _book >= 0;
+}
+
+// Get the trade of a compact message, which has a registered book
+Trade<Bond> FromCompact(const CompactTrade& _trade)
+{
+    return Trade<Bond>(ResolveProduct(_trade.product), GetCompactId(_trade.tradeId), FromPriceTicks(_trade.price), GetBookRegistry().GetName(_trade.book), _trade.quantity, Side(_trade.side));
+}
+
+// Get the compact message of an execution order, return false if one of its IDs is too long
+bool ToCompact(const ExecutionOrder<Bond>& _order, CompactExecutionOrder& _compact)
+{
+    _compact = {};
+    _compact.product = GetProductHandle(_order.GetProduct());
+    _compact.price = ToPriceTicks(_order.GetPrice());
+    _compact.visibleQuantity = _order.GetVisibleQuantity();
+    _compact.hiddenQuantity = _order.GetHiddenQuantity();
+    _compact.timestamp = _order.GetTimestamp();
+    _compact.side = uint8_t(_order.GetPricingSide());
+    _compact.orderType = uint8_t(_order.GetOrderType());
+    _compact.isChildOrder = _order.IsChildOrder();
+    bool _orderId = CopyCompactId(_order.GetOrderId(), _compact.orderId);
+    bool _parentOrderId = CopyCompactId(_order.GetParentOrderId(), _compact.parentOrderId);
+    return _orderId && _parentOrderId;
+}
+
+// Get the execution order of a compact message
+ExecutionOrder<Bond> FromCompact(const CompactExecutionOrder& _order)
+{
+    ExecutionOrder<Bond> _full(ResolveProduct(_order.product), PricingSide(_order.side), GetCompactId(_order.orderId), OrderType(_order.orderType), FromPriceTicks(_order.price), _order.visibleQuantity, _order.hiddenQuantity, GetCompactId(_order.parentOrderId), _order.isChildOrder);
+    _full.SetTimestamp(_order.timestamp);
+    return _full;
+}
+
+// Get the compact message of a price stream
+CompactPriceStream ToCompact(const PriceStream<Bond>& _priceStream)
+{
+    const PriceStreamOrder& _bid = _priceStream.GetBidOrder();
+    const PriceStreamOrder& _offer = _priceStream.GetOfferOrder();
+    return { GetProductHandle(_priceStream.GetProduct()), _priceStream.GetTimestamp(),
+             { ToPriceTicks(_bid.GetPrice()), _bid.GetVisibleQuantity(), _bid.GetHiddenQuantity() },
+             { ToPriceTicks(_offer.GetPrice()), _offer.GetVisibleQuantity(), _offer.GetHiddenQuantity() } };
+}
+
+// Get the price stream of a compact message
+PriceStream<Bond> FromCompact(const CompactPriceStream& _priceStream)
+{
+    const CompactStreamOrder& _bid = _priceStream.bidOrder;
+    const CompactStreamOrder& _offer = _priceStream.offerOrder;
+    PriceStream<Bond> _full(ResolveProduct(_priceStream.product),
+                            PriceStreamOrder(FromPriceTicks(_bid.price), _bid.visibleQuantity, _bid.hiddenQuantity, BID),
+                            PriceStreamOrder(FromPriceTicks(_offer.price), _offer.visibleQuantity, _offer.hiddenQuantity, OFFER));
+    _full.SetTimestamp(_priceStream.timestamp);
+    return _full;
+}
+
+// Get the compact message of an inquiry, return false if its ID is too long
+bool ToCompact(const Inquiry<Bond>& _inquiry, CompactInquiry& _compact)
+{
+    _compact = {};
+    _compact.product = GetProductHandle(_inquiry.GetProduct());
+    _compact.price = ToPriceTicks(_inquiry.GetPrice());
+    _compact.quantity = _inquiry.GetQuantity();
+    _compact.side = uint8_t(_inquiry.GetSide());
+    _compact.state = uint8_t(_inquiry.GetState());
+    return CopyCompactId(_inquiry.GetInquiryId(), _compact.inquiryId);
+}
+
+// Get the inquiry of a compact message
+Inquiry<Bond> FromCompact(const CompactInquiry& _inquiry)
+{
+    return Inquiry<Bond>(GetCompactId(_inquiry.inquiryId), ResolveProduct(_inquiry.product), Side(_inquiry.side), _inquiry.quantity, FromPriceTicks(_inquiry.price), InquiryState(_inquiry.state));
+}
+
+#endif
@@ -0,0 +1,102 @@
+//
+// Compact message test for the trading system.
+// Checks that messages without a compact form go through the ingest feeds in full: trades and
+// inquiries whose IDs share their first 16 characters stay apart, and trades on books past the
+// book registry keep their books instead of landing on the first one.
+//
+// Usage: compactmessagestest
+//
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+
+#include "soa.hpp"
+#include "products.hpp"
+#include "ingest.hpp"
+#include "inquiryservice.hpp"
+#include "positionservice.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+/**
+* Listener keeping the IDs of the inquiries a service finishes.
+*/
+class InquiryIdListener : public ServiceListener<Inquiry<Bond>>
+{
+
+public:
+
+    vector<string> inquiryIds;
+
+    void ProcessAdd(Inquiry<Bond>& _data) override { inquiryIds.push_back(_data.GetInquiryId()); }
+    void ProcessRemove(Inquiry<Bond>& _data) override {}
+    void ProcessUpdate(Inquiry<Bond>& _data) override {}
+
+};
+
+// Check a condition, reporting it if it fails
+bool Check(bool _condition, const string& _message)
+{
+    if (!_condition) cerr << _message << endl;
+    return _condition;
+}
+
+int main()
+{
+    char _root[] = "/tmp/compactmessagestestXXXXXX";
+    if (!mkdtemp(_root) || chdir(_root) != 0)
+    {
+        cerr << "Cannot create a working directory" << endl;
+        return 1;
+    }
+
+    // Two trades and two inquiries with a shared 16-character prefix, and one trade on each of
+    // more books than the registry holds
+    const string& _cusip = GetProductRegistry().GetBond(0).GetProductId();
+    const string _longTrade = "TRADE_WITH_A_LONG_ID_";
+    const string _longInquiry = "INQUIRY_WITH_A_LONG_ID_";
+    const int _books = BookRegistry::MAX_BOOKS + 4;
+    {
+        ofstream _trades("trades.txt");
+        _trades << _cusip << "," << _longTrade << "1,99-000,TRSY1,1000000,BUY" << endl;
+        _trades << _cusip << "," << _longTrade << "2,99-000,TRSY1,2000000,BUY" << endl;
+        for (int b = 0; b < _books; b++) _trades << _cusip << ",TRADE" << b << ",99-000,BOOK" << b << "," << (b + 1) << ",BUY" << endl;
+        ofstream _inquiries("inquiries.txt");
+        _inquiries << _longInquiry << "1," << _cusip << ",BUY,1000000,99-000,RECEIVED" << endl;
+        _inquiries << _longInquiry << "2," << _cusip << ",BUY,1000000,99-000,RECEIVED" << endl;
+    }
+
+    TradeBookingService<Bond> tradeBookingService;
+    PositionService<Bond> positionService;
+    InquiryService<Bond> inquiryService;
+    InquiryIdListener inquiryIdListener;
+    tradeBookingService.AddListener(positionService.GetListener());
+    inquiryService.AddListener(&inquiryIdListener);
+
+    IngestSequencer _sequencer(TIMESTAMP_ORDER);
+    _sequencer.AddFeed(MakeTradeFeed("trades.txt", &tradeBookingService, TIMESTAMP_ORDER));
+    _sequencer.AddFeed(MakeInquiryFeed("inquiries.txt", &inquiryService, TIMESTAMP_ORDER));
+    _sequencer.Run();
+
+    bool _passed = true;
+    _passed &= Check(tradeBookingService.Find(_longTrade + "1") && tradeBookingService.Find(_longTrade + "2"), "Trades with long IDs were not both booked under their IDs");
+    _passed &= Check(tradeBookingService.GetRetainedCount() == size_t(2 + _books), "Trades with long IDs overwrote each other");
+    _passed &= Check(inquiryIdListener.inquiryIds == vector<string>{ _longInquiry + "1", _longInquiry + "2" }, "Inquiries with long IDs were not both finished under their IDs");
+
+    const Position<Bond>& _position = positionService.GetData(0);
+    _passed &= Check(_position.GetPosition("TRSY1") == 3000000, "Trades past the book registry were booked to the first book");
+    for (int b = 0; b < _books; b++)
+    {
+        string _book = "BOOK" + to_string(b);
+        _passed &= Check(_position.GetPosition(_book) == b + 1, "Trade on " + _book + " was not booked to its book");
+    }
+    _passed &= Check(_position.GetAggregatePosition() == 3000000 + long(_books) * (_books + 1) / 2, "Aggregate position is off");
+
+    if (!_passed) return 1;
+    cout << "Messages without a compact form are carried in full" << endl;
+    filesystem::remove_all(_root);
+    return 0;
+}
@@ -11,9 +11,13 @@
 #include "soa.hpp"
 #include "marketdataservice.hpp"
 #include "functions.hpp"
+#include "metrics.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
+// Names of the order types, by type
+constexpr string_view ORDER_TYPE_NAMES[] = { "FOK", "IOC", "MARKET", "LIMIT", "STOP" };
+
 enum Market { BROKERTEC, ESPEED, CME };
 
 /**
@@ -26,7 +30,7 @@ public:
     // Constructor
     ExecutionOrder() = default;
     ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder)
-            : product(_product), side(_side), orderId(_orderId), orderType(_orderType), price(_price), visibleQuantity(_visibleQuantity), hiddenQuantity(_hiddenQuantity), parentOrderId(_parentOrderId), isChildOrder(_isChildOrder) {}
+            : product(_product), side(_side), orderId(move(_orderId)), orderType(_orderType), price(_price), visibleQuantity(_visibleQuantity), hiddenQuantity(_hiddenQuantity), parentOrderId(move(_parentOrderId)), isChildOrder(_isChildOrder) {}
 
     // Get the product
     const T& GetProduct() const {
@@ -74,6 +78,19 @@ public:
     }
     // Change attributes to strings
     vector<string> ToStrings() const;
+
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
+    // Get the time the order's market data entered the system, in monotonic nanoseconds
+    long GetTimestamp() const {
+        return timestamp;
+    }
+
+    // Set the time the order's market data entered the system
+    void SetTimestamp(long _timestamp) {
+        timestamp = _timestamp;
+    }
 private:
     T product;
     PricingSide side;
@@ -84,25 +101,31 @@ private:
     double hiddenQuantity;
     string parentOrderId;
     bool isChildOrder;
+    long timestamp = 0;
 };
 
-template<typename T>
+template<typename T, typename... L>
+class ExecutionService;
+
+template<typename T, typename S = ExecutionService<T>>
 class ExecutionToAlgoExecutionListener;
 
 /**
  * Service for executing orders on an exchange.
  * Keyed on product identifier.
- * Type T is the product type.
+ * Type T is the product type, types L the listener types dispatched statically.
  */
-template<typename T>
+template<typename T, typename... L>
 class ExecutionService : public Service<string, ExecutionOrder<T>>
 {
 
 private:
 
-    map<string, ExecutionOrder<T>> executionOrders;
-    vector<ServiceListener<ExecutionOrder<T>>*> listeners;
-    ExecutionToAlgoExecutionListener<T>* listener;
+    ProductStore<ExecutionOrder<T>> executionOrders;
+    ExecutionOrder<T> missing;
+    ListenerList<ExecutionOrder<T>, L...> listeners;
+    ExecutionToAlgoExecutionListener<T, ExecutionService>* listener;
+    StageMetrics& tickToTrade;
 
 public:
 
@@ -110,8 +133,11 @@ public:
     ExecutionService();
     ~ExecutionService();
 
-    // Get data on our service given a key
-    ExecutionOrder<T>& GetData(string _key);
+    // Get data on our service given a key, a default value if none was stored for it
+    ExecutionOrder<T>& GetData(const string& _key);
+
+    // Get data on our service given a product index
+    ExecutionOrder<T>& GetData(int _index);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(ExecutionOrder<T>& _data);
@@ -119,68 +145,83 @@ public:
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<ExecutionOrder<T>>* _listener);
 
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners);
+
     // Get all listeners on the Service
     const vector<ServiceListener<ExecutionOrder<T>>*>& GetListeners() const;
 
     // Get the listener of the service
-    ExecutionToAlgoExecutionListener<T>* GetListener();
+    ExecutionToAlgoExecutionListener<T, ExecutionService>* GetListener();
 
-    // Execute an order on a market
+    // Execute an order on a market, storing it and notifying listeners with the stored order
     void ExecuteOrder(ExecutionOrder<T>& _executionOrder);
 
 };
 
-template<typename T>
-ExecutionService<T>::ExecutionService()
+template<typename T, typename... L>
+ExecutionService<T, L...>::ExecutionService() : tickToTrade(GetStageMetrics("TickToTrade"))
 {
-    executionOrders = map<string, ExecutionOrder<T>>();
-    listeners = vector<ServiceListener<ExecutionOrder<T>>*>();
-    listener = new ExecutionToAlgoExecutionListener<T>(this);
+    executionOrders = ProductStore<ExecutionOrder<T>>();
+    listener = new ExecutionToAlgoExecutionListener<T, ExecutionService>(this);
 }
 
-template<typename T>
-ExecutionService<T>::~ExecutionService() {}
+template<typename T, typename... L>
+ExecutionService<T, L...>::~ExecutionService() {}
 
-template<typename T>
-ExecutionOrder<T>& ExecutionService<T>::GetData(string _key)
+template<typename T, typename... L>
+ExecutionOrder<T>& ExecutionService<T, L...>::GetData(const string& _key)
 {
-    return executionOrders[_key];
+    ExecutionOrder<T>* _executionOrder = executionOrders.Find(_key);
+    return _executionOrder ? *_executionOrder : missing;
 }
 
-template<typename T>
-void ExecutionService<T>::OnMessage(ExecutionOrder<T>& _data)
+template<typename T, typename... L>
+ExecutionOrder<T>& ExecutionService<T, L...>::GetData(int _index)
 {
-    executionOrders[_data.GetProduct().GetProductId()] = _data;
+    return executionOrders[_index];
 }
 
-template<typename T>
-void ExecutionService<T>::AddListener(ServiceListener<ExecutionOrder<T>>* _listener)
+template<typename T, typename... L>
+void ExecutionService<T, L...>::OnMessage(ExecutionOrder<T>& _data)
 {
-    listeners.push_back(_listener);
+    executionOrders.Get(_data.GetProduct()) = _data;
 }
 
-template<typename T>
-const vector<ServiceListener<ExecutionOrder<T>>*>& ExecutionService<T>::GetListeners() const
+template<typename T, typename... L>
+void ExecutionService<T, L...>::AddListener(ServiceListener<ExecutionOrder<T>>* _listener)
 {
-    return listeners;
+    listeners.Add(_listener);
 }
 
-template<typename T>
-ExecutionToAlgoExecutionListener<T>* ExecutionService<T>::GetListener()
+template<typename T, typename... L>
+void ExecutionService<T, L...>::BindListeners(L*... _listeners)
+{
+    listeners.Bind(_listeners...);
+}
+
+template<typename T, typename... L>
+const vector<ServiceListener<ExecutionOrder<T>>*>& ExecutionService<T, L...>::GetListeners() const
+{
+    return listeners.GetDynamic();
+}
+
+template<typename T, typename... L>
+ExecutionToAlgoExecutionListener<T, ExecutionService<T, L...>>* ExecutionService<T, L...>::GetListener()
 {
     return listener;
 }
 
-template<typename T>
-void ExecutionService<T>::ExecuteOrder(ExecutionOrder<T>& _executionOrder)
+template<typename T, typename... L>
+void ExecutionService<T, L...>::ExecuteOrder(ExecutionOrder<T>& _executionOrder)
 {
-    string _productId = _executionOrder.GetProduct().GetProductId();
-    executionOrders[_productId] = _executionOrder;
+    ExecutionOrder<T>& _stored = executionOrders.Get(_executionOrder.GetProduct());
+    _stored = _executionOrder;
 
-    for (auto& l : listeners)
-    {
-        l->ProcessAdd(_executionOrder);
-    }
+    listeners.ProcessAdd(_stored);
+
+    // Time from the market data tick to the executed, persisted order
+    if (_stored.GetTimestamp() > 0) tickToTrade.Record(GetNanoseconds() - _stored.GetTimestamp());
 }
 
 
@@ -192,132 +233,205 @@ template<typename T>
 vector<string> ExecutionOrder<T>::ToStrings() const
 {
     string _product = product.GetProductId();
-
-    map<PricingSide, string> sideMap = {{BID, "BID"}, {OFFER, "OFFER"}};
-    map<OrderType, string> orderTypeMap = {{FOK, "FOK"}, {IOC, "IOC"}, {MARKET, "MARKET"}, {LIMIT, "LIMIT"}, {STOP, "STOP"}};
-    map<bool, string> isChildOrderMap = {{true, "YES"}, {false, "NO"}};
-
-    string _side = sideMap[side];
+    string _side(PRICING_SIDE_NAMES[side]);
     string _orderId = orderId;
-    string _orderType = orderTypeMap[orderType];
+    string _orderType(ORDER_TYPE_NAMES[orderType]);
     string _price = ConvertPrice(price);
     string _visibleQuantity = to_string(visibleQuantity);
     string _hiddenQuantity = to_string(hiddenQuantity);
     string _parentOrderId = parentOrderId;
-    string _isChildOrder = isChildOrderMap[isChildOrder];
+    string _isChildOrder = isChildOrder ? "YES" : "NO";
 
     vector<string> _strings = {_product, _side, _orderId, _orderType, _price, _visibleQuantity, _hiddenQuantity, _parentOrderId, _isChildOrder};
     return _strings;
 };
 
+template<typename T>
+void ExecutionOrder<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    _formatter.Field(PRICING_SIDE_NAMES[side]);
+    _formatter.Field(orderId);
+    _formatter.Field(ORDER_TYPE_NAMES[orderType]);
+    _formatter.PriceField(price);
+    _formatter.DecimalField(visibleQuantity);
+    _formatter.DecimalField(hiddenQuantity);
+    _formatter.Field(parentOrderId);
+    _formatter.Field(isChildOrder ? "YES" : "NO");
+}
+
+/**
+ * An algo execution owning the execution order it sends, held by value.
+ * Type T is the product type.
+ */
 template<typename T>
 class AlgoExecution
 {
 public:
     // ctor for an order
     AlgoExecution() = default;
-    AlgoExecution(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder)
+    AlgoExecution(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
+        executionOrder(_product, _side, move(_orderId), _orderType, _price, _visibleQuantity, _hiddenQuantity, move(_parentOrderId), _isChildOrder)
     {
-        executionOrder = new ExecutionOrder<T>(_product, _side, _orderId, _orderType, _price, _visibleQuantity, _hiddenQuantity, _parentOrderId, _isChildOrder);
     }
     // Get the order
-    ExecutionOrder<T>* GetExecutionOrder() const
+    const ExecutionOrder<T>& GetExecutionOrder() const
+    {
+        return executionOrder;
+    };
+    ExecutionOrder<T>& GetExecutionOrder()
     {
         return executionOrder;
     };
 private:
-    ExecutionOrder<T>* executionOrder;
+    ExecutionOrder<T> executionOrder;
 };
 
 
-template<typename T>
+/**
+* Parameters of the algo execution: the widest spread it crosses, and the side of its
+* first order, after which it alternates sides.
+*/
+struct AlgoExecutionParameters
+{
+    double spread = 1.0 / 128.0;
+    PricingSide firstSide = BID;
+};
+
+template<typename T, typename... L>
+class AlgoExecutionService;
+
+template<typename T, typename S = AlgoExecutionService<T>>
 class AlgoExecutionToMarketDataListener;
 
-template<typename T>
+/**
+ * Service for algo executions, crossing the spread when it is tight enough.
+ * Keyed on product identifier.
+ * Type T is the product type, types L the listener types dispatched statically.
+ */
+template<typename T, typename... L>
 class AlgoExecutionService : public Service<string, AlgoExecution<T>>
 {
 
 private:
 
-    map<string, AlgoExecution<T>> algoExecutions;
-    vector<ServiceListener<AlgoExecution<T>>*> listeners;
-    AlgoExecutionToMarketDataListener<T>* listener;
-    double spread;
+    ProductStore<AlgoExecution<T>> algoExecutions;
+    AlgoExecution<T> missing;
+    ListenerList<AlgoExecution<T>, L...> listeners;
+    AlgoExecutionToMarketDataListener<T, AlgoExecutionService>* listener;
+    AlgoExecutionParameters parameters;
     long count;
 
 public:
 
     // Constructor and destructor
-    AlgoExecutionService();
+    AlgoExecutionService(const AlgoExecutionParameters& _parameters = AlgoExecutionParameters());
     ~AlgoExecutionService(){};
 
-    // Get data on our service given a key
-    AlgoExecution<T>& GetData(string _key)
+    // Get data on our service given a key, a default value if none was stored for it
+    AlgoExecution<T>& GetData(const string& _key)
+    {
+        AlgoExecution<T>* _algoExecution = algoExecutions.Find(_key);
+        return _algoExecution ? *_algoExecution : missing;
+    };
+
+    // Get data on our service given a product index
+    AlgoExecution<T>& GetData(int _index)
     {
-        return algoExecutions[_key];
+        return algoExecutions[_index];
     };
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(AlgoExecution<T>& _data)
     {
-        algoExecutions[_data.GetExecutionOrder()->GetProduct().GetProductId()] = _data;
+        algoExecutions.Get(_data.GetExecutionOrder().GetProduct()) = _data;
     };
 
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<AlgoExecution<T>>* _listener)
     {
-        listeners.push_back(_listener);
+        listeners.Add(_listener);
+    };
+
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners)
+    {
+        listeners.Bind(_listeners...);
     };
 
     // Get all listeners on the Service
     const vector<ServiceListener<AlgoExecution<T>>*>& GetListeners() const
     {
-        return listeners;
+        return listeners.GetDynamic();
     };
 
     // Get the listener of the service
-    AlgoExecutionToMarketDataListener<T>* GetListener()
+    AlgoExecutionToMarketDataListener<T, AlgoExecutionService>* GetListener()
     {
         return listener;
     };
 
+    // Get the parameters of the algo execution
+    const AlgoExecutionParameters& GetParameters() const
+    {
+        return parameters;
+    };
+
+    // Set the parameters of the algo execution, restarting the alternation of sides
+    void SetParameters(const AlgoExecutionParameters& _parameters)
+    {
+        parameters = _parameters;
+        count = 0;
+    };
+
+    // Get the number of orders executed, which alternates their sides
+    long GetCount() const
+    {
+        return count;
+    };
+
+    // Set the number of orders executed, as restored from a snapshot
+    void SetCount(long _count)
+    {
+        count = _count;
+    };
+
     // Execute an order on a market
     void AlgoExecuteOrder(OrderBook<T>& _orderBook);
 
 };
 
-template<typename T>
-AlgoExecutionService<T>::AlgoExecutionService()
+template<typename T, typename... L>
+AlgoExecutionService<T, L...>::AlgoExecutionService(const AlgoExecutionParameters& _parameters)
 {
-    algoExecutions = map<string, AlgoExecution<T>>();
-    listeners = vector<ServiceListener<AlgoExecution<T>>*>();
-    listener = new AlgoExecutionToMarketDataListener<T>(this);
-    spread = 1.0 / 128.0;
+    algoExecutions = ProductStore<AlgoExecution<T>>();
+    listener = new AlgoExecutionToMarketDataListener<T, AlgoExecutionService>(this);
+    parameters = _parameters;
     count = 0;
 }
 
-template<typename T>
-void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
+template<typename T, typename... L>
+void AlgoExecutionService<T, L...>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
 {
-    T _product = _orderBook.GetProduct();
-    string _productId = _product.GetProductId();
+    const T& _product = _orderBook.GetProduct();
     PricingSide _side;
     string _orderId = GenerateId();
     double _price;
     long _quantity;
 
-    BidOffer _bidOffer = _orderBook.GetBidOffer();
+    // Top of book is cached on the order book, no rescan needed
+    const BidOffer& _bidOffer = _orderBook.GetBidOffer();
 
-    Order _bidOrder = _bidOffer.GetBidOrder();
+    const Order& _bidOrder = _bidOffer.GetBidOrder();
     double _bidPrice = _bidOrder.GetPrice();
     long _bidQuantity = _bidOrder.GetQuantity();
-    Order _offerOrder = _bidOffer.GetOfferOrder();
+    const Order& _offerOrder = _bidOffer.GetOfferOrder();
     double _offerPrice = _offerOrder.GetPrice();
     long _offerQuantity = _offerOrder.GetQuantity();
 
-    if (_offerPrice - _bidPrice <=spread)
+    if (_offerPrice - _bidPrice <= parameters.spread)
     {
-        switch (count % 2)
+        switch ((count + parameters.firstSide) % 2)
         {
             case 0:
                 _price = _bidPrice;
@@ -331,28 +445,31 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
                 break;
         }
         count++;
-        AlgoExecution<T> _algoExecution(_product, _side, _orderId, MARKET, _price, _quantity, 0, "", false);
-        algoExecutions[_productId] = _algoExecution;
+        // Build the algo execution in its slot and notify listeners with the stored one
+        AlgoExecution<T>& _algoExecution = algoExecutions.Get(_product);
+        _algoExecution = AlgoExecution<T>(_product, _side, move(_orderId), MARKET, _price, _quantity, 0, "", false);
+        _algoExecution.GetExecutionOrder().SetTimestamp(_orderBook.GetTimestamp());
 
-        for (auto& l : listeners)
-        {
-            l->ProcessAdd(_algoExecution);
-        }
+        listeners.ProcessAdd(_algoExecution);
     }
 }
 
-template<typename T>
-class AlgoExecutionToMarketDataListener : public ServiceListener<OrderBook<T>>
+/**
+* Algo Execution Service Listener subscribing data from Market Data Service to Algo Execution Service.
+* Type T is the product type, type S the algo execution service type.
+*/
+template<typename T, typename S>
+class AlgoExecutionToMarketDataListener final : public ServiceListener<OrderBook<T>>
 {
 
 private:
 
-    AlgoExecutionService<T>* service;
+    S* service;
 
 public:
 
     // Connector and Destructor
-    AlgoExecutionToMarketDataListener(AlgoExecutionService<T>* _service)
+    AlgoExecutionToMarketDataListener(S* _service)
     {
         service = _service;
     };
@@ -367,8 +484,11 @@ public:
     // Listener callback to process a remove event to the Service
     void ProcessRemove(OrderBook<T>& _data){};
 
-    // Listener callback to process an update event to the Service
-    void ProcessUpdate(OrderBook<T>& _data){};
+    // Listener callback to process an update event to the Service, an incrementally updated book
+    void ProcessUpdate(OrderBook<T>& _data)
+    {
+        service->AlgoExecuteOrder(_data);
+    };
 
 };
 
@@ -376,20 +496,20 @@ public:
 /****************************************************************************************/
 /**
 * Execution Service Listener subscribing data from Algo Execution Service to Execution Service.
-* Type T is the product type.
+* Type T is the product type, type S the execution service type.
 */
-template<typename T>
-class ExecutionToAlgoExecutionListener : public ServiceListener<AlgoExecution<T>>
+template<typename T, typename S>
+class ExecutionToAlgoExecutionListener final : public ServiceListener<AlgoExecution<T>>
 {
 
 private:
 
-    ExecutionService<T>* service;
+    S* service;
 
 public:
 
     // Connector and Destructor
-    ExecutionToAlgoExecutionListener(ExecutionService<T>* _service);
+    ExecutionToAlgoExecutionListener(S* _service);
     ~ExecutionToAlgoExecutionListener();
 
     // Listener callback to process an add event to the Service
@@ -403,29 +523,28 @@ public:
 
 };
 
-template<typename T>
-ExecutionToAlgoExecutionListener<T>::ExecutionToAlgoExecutionListener(ExecutionService<T>* _service)
+template<typename T, typename S>
+ExecutionToAlgoExecutionListener<T, S>::ExecutionToAlgoExecutionListener(S* _service)
 {
     service = _service;
 }
 
-template<typename T>
-ExecutionToAlgoExecutionListener<T>::~ExecutionToAlgoExecutionListener() {}
+template<typename T, typename S>
+ExecutionToAlgoExecutionListener<T, S>::~ExecutionToAlgoExecutionListener() {}
 
-template<typename T>
-void ExecutionToAlgoExecutionListener<T>::ProcessAdd(AlgoExecution<T>& _data)
+template<typename T, typename S>
+void ExecutionToAlgoExecutionListener<T, S>::ProcessAdd(AlgoExecution<T>& _data)
 {
-    // Get the execution order from the algo execution
-    ExecutionOrder<T>* _executionOrder = _data.GetExecutionOrder();
-    service->OnMessage(*_executionOrder);
-    service->ExecuteOrder(*_executionOrder);
+    // Get the execution order from the algo execution; executing it stores it
+    ExecutionOrder<T>& _executionOrder = _data.GetExecutionOrder();
+    service->ExecuteOrder(_executionOrder);
 }
 
-template<typename T>
-void ExecutionToAlgoExecutionListener<T>::ProcessRemove(AlgoExecution<T>& _data) {}
+template<typename T, typename S>
+void ExecutionToAlgoExecutionListener<T, S>::ProcessRemove(AlgoExecution<T>& _data) {}
 
-template<typename T>
-void ExecutionToAlgoExecutionListener<T>::ProcessUpdate(AlgoExecution<T>& _data) {}
+template<typename T, typename S>
+void ExecutionToAlgoExecutionListener<T, S>::ProcessUpdate(AlgoExecution<T>& _data) {}
 
 
 
@@ -0,0 +1,257 @@
+/**
+ * filereader.hpp
+ * Defines a memory-mapped file with a line reader and a string_view tokenizer shared by all connectors.
+ *
+ */
+#ifndef FILE_READER_HPP
+#define FILE_READER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+* Read-only view of a whole file.
+* The file is memory-mapped; if mapping is not possible it is read into memory instead.
+*/
+class MappedFile
+{
+
+public:
+
+    // Constructor and destructor
+    MappedFile(const string& _path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Check if the file could be opened
+    bool IsOpen() const;
+
+    // Get the contents of the file
+    string_view GetData() const;
+
+private:
+
+    const char* data;
+    size_t size;
+    bool mapped;
+    bool open;
+    vector<char> fallback;
+
+};
+
+MappedFile::MappedFile(const string& _path)
+{
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    open = false;
+
+    int _fd = ::open(_path.c_str(), O_RDONLY);
+    if (_fd < 0) return;
+    open = true;
+
+    struct stat _stat;
+    if (fstat(_fd, &_stat) == 0 && _stat.st_size > 0)
+    {
+        size = _stat.st_size;
+        void* _map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (_map != MAP_FAILED)
+        {
+            madvise(_map, size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(_map);
+            mapped = true;
+        }
+    }
+    ::close(_fd);
+
+    if (!mapped)
+    {
+        ifstream _file(_path, ios::binary);
+        fallback.assign(istreambuf_iterator<char>(_file), istreambuf_iterator<char>());
+        data = fallback.data();
+        size = fallback.size();
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (mapped) munmap(const_cast<char*>(data), size);
+}
+
+bool MappedFile::IsOpen() const
+{
+    return open;
+}
+
+string_view MappedFile::GetData() const
+{
+    return string_view(data, size);
+}
+
+/**
+* Line reader over a block of text, handing out each line as a string_view.
+* Trailing carriage returns are stripped.
+*/
+class LineReader
+{
+
+public:
+
+    // Constructor
+    LineReader(string_view _data) : data(_data), offset(0) {};
+
+    // Get the next line, return false at the end of the data
+    bool Next(string_view& _line);
+
+    // Get the offset of the next unread line
+    size_t GetOffset() const
+    {
+        return offset;
+    };
+
+private:
+
+    string_view data;
+    size_t offset;
+
+};
+
+bool LineReader::Next(string_view& _line)
+{
+    if (offset >= data.size()) return false;
+    size_t _end = data.find('\n', offset);
+    if (_end == string_view::npos) _end = data.size();
+    _line = data.substr(offset, _end - offset);
+    if (!_line.empty() && _line.back() == '\r') _line.remove_suffix(1);
+    offset = _end + 1;
+    return true;
+}
+
+/**
+* Offsets of the input files read from a tracked position, by path.
+* A tracked file is read from its offset, which then moves to the end of the data read,
+* so a snapshot can record how much of each input its state covers. Untracked files are read whole.
+*/
+class InputOffsets
+{
+
+public:
+
+    // Start tracking a file from an offset
+    void Track(const string& _path, size_t _offset = 0);
+
+    // Get the data of a tracked file from its offset, or all of it if it is untracked
+    string_view GetTail(const string& _path, string_view _data) const;
+
+    // Move the offset of a tracked file to the end of its data
+    void Advance(const string& _path, size_t _size);
+
+    // Get the tracked files and their offsets
+    const map<string, size_t>& GetOffsets() const;
+
+private:
+
+    map<string, size_t> offsets;
+
+};
+
+void InputOffsets::Track(const string& _path, size_t _offset)
+{
+    offsets[_path] = _offset;
+}
+
+string_view InputOffsets::GetTail(const string& _path, string_view _data) const
+{
+    auto _it = offsets.find(_path);
+    if (_it == offsets.end()) return _data;
+
+    // A file shorter than its offset was replaced, and is read from the start
+    return (_it->second <= _data.size()) ? _data.substr(_it->second) : _data;
+}
+
+void InputOffsets::Advance(const string& _path, size_t _size)
+{
+    auto _it = offsets.find(_path);
+    if (_it != offsets.end()) _it->second = _size;
+}
+
+const map<string, size_t>& InputOffsets::GetOffsets() const
+{
+    return offsets;
+}
+
+// Get the input offsets shared by all connectors
+InputOffsets& GetInputOffsets()
+{
+    static InputOffsets _offsets;
+    return _offsets;
+}
+
+// Split a line into at most _max cells on a delimiter, return the number of cells.
+size_t SplitCells(string_view _line, string_view* _cells, size_t _max, char _delimiter = ',')
+{
+    size_t _count = 0;
+    size_t _start = 0;
+    while (_count < _max)
+    {
+        size_t _end = _line.find(_delimiter, _start);
+        if (_end == string_view::npos)
+        {
+            if (_start < _line.size()) _cells[_count++] = _line.substr(_start);
+            break;
+        }
+        _cells[_count++] = _line.substr(_start, _end - _start);
+        _start = _end + 1;
+    }
+    return _count;
+}
+
+// Parse an integer from a cell
+long ParseLong(string_view _cell)
+{
+    long _value = 0;
+    from_chars(_cell.data(), _cell.data() + _cell.size(), _value);
+    return _value;
+}
+
+// Run every line of a stream through a line handler, reusing one line buffer.
+template<typename F>
+void ForEachLine(istream& _data, F&& _handler)
+{
+    string _line;
+    while (getline(_data, _line))
+    {
+        string_view _view(_line);
+        if (!_view.empty() && _view.back() == '\r') _view.remove_suffix(1);
+        _handler(_view);
+    }
+}
+
+// Run every line of a memory-mapped file through a line handler.
+template<typename F>
+bool ForEachLine(const string& _path, F&& _handler)
+{
+    MappedFile _file(_path);
+    if (!_file.IsOpen()) return false;
+    LineReader _reader(GetInputOffsets().GetTail(_path, _file.GetData()));
+    string_view _line;
+    while (_reader.Next(_line))
+    {
+        _handler(_line);
+    }
+    GetInputOffsets().Advance(_path, _file.GetData().size());
+    return true;
+}
+
+#endif
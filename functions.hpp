@@ -7,8 +7,14 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cmath>
 #include <chrono>
 #include "products.hpp"
+#include "productregistry.hpp"
+#include "idgenerator.hpp"
 
 using namespace std;
 using namespace chrono;
@@ -34,111 +40,262 @@ vector<double> GenerateUniform(long N, long seed = 0)
     return result;
 }
 
-// Get Bond object for US Treasury 2Y, 3Y, 5Y, 7Y, 10Y, and 30Y.
-Bond GetBond(string _cusip)
+// Get the interned Bond object of a CUSIP from the product registry.
+const Bond& GetBond(string_view _cusip)
 {
-    Bond _bond;
-    if (_cusip == "9128283H1") _bond = Bond("9128283H1", CUSIP, "US2Y", 0.01750, from_string("2019/11/30"));
-    if (_cusip == "9128283L2") _bond = Bond("9128283L2", CUSIP, "US3Y", 0.01875, from_string("2020/12/15"));
-    if (_cusip == "912828M80") _bond = Bond("912828M80", CUSIP, "US5Y", 0.02000, from_string("2022/11/30"));
-    if (_cusip == "9128283J7") _bond = Bond("9128283J7", CUSIP, "US7Y", 0.02125, from_string("2024/11/30"));
-    if (_cusip == "9128283F5") _bond = Bond("9128283F5", CUSIP, "US10Y", 0.02250, from_string("2027/12/15"));
-    if (_cusip == "912810RZ3") _bond = Bond("912810RZ3", CUSIP, "US30Y", 0.02750, from_string("2047/12/15"));
-    return _bond;
+    return GetProductRegistry().GetBond(_cusip);
 }
 
-// Get PV01 value for US Treasury 2Y, 3Y, 5Y, 7Y, 10Y, and 30Y.
-double GetPV01Value(string _cusip)
+// Get the dense product index of a CUSIP, -1 if it is unknown.
+int GetProductIndex(string_view _cusip)
 {
-    double _pv01 = 0;
-    if (_cusip == "9128283H1") _pv01 = 0.01948992;
-    if (_cusip == "9128283L2") _pv01 = 0.02865304;
-    if (_cusip == "912828M80") _pv01 = 0.04581119;
-    if (_cusip == "9128283J7") _pv01 = 0.06127718;
-    if (_cusip == "9128283F5") _pv01 = 0.08161449;
-    if (_cusip == "912810RZ3") _pv01 = 0.15013155;
-    return _pv01;
+    return GetProductRegistry().GetIndex(_cusip);
 }
 
-// Convert fraction price to decimal price
-double ConvertPrice(string _stringPrice)
+// Get PV01 value of a CUSIP from the product registry.
+double GetPV01Value(string_view _cusip)
 {
-    // empty string and push letter in it
-    string _stringPrice100 = "";
-    string _stringPrice32  = "";
-    string _stringPrice8   = "";
+    int _index = GetProductIndex(_cusip);
+    return (_index < 0) ? 0 : GetProductRegistry().GetPV01(_index);
+}
+
+// Tables used to format the 32nds and 256ths digits of a fractional price
+static constexpr char PRICE_32NDS[] =
+    "00010203040506070809101112131415"
+    "16171819202122232425262728293031";
+static constexpr char PRICE_256THS[] = "0123+567";
 
-    int count= 0;
+// Parse fraction price such as "99-31+" into a count of 1/256 ticks, without allocating.
+// Return false if the string is not in the 100-32nds-256ths format.
+bool ParsePriceTicks(string_view _stringPrice, long& _ticks)
+{
+    size_t _dash = _stringPrice.find('-');
+    if (_dash == string_view::npos || _dash == 0 || _stringPrice.size() != _dash + 4) return false;
 
-    // logic to split the string
-    for (int i = 0; i < _stringPrice.size(); i++)
+    long _price100 = 0;
+    for (size_t i = 0; i < _dash; i++)
     {
-        if (_stringPrice[i] == '-')
-        {
-            count++;
-            continue;
-        }
-        if (count == 0)
-        {
-            _stringPrice100.push_back(_stringPrice[i]);
-        }
-        else if (count == 1 || count == 2)
-        {
-            _stringPrice32.push_back(_stringPrice[i]);
-            count++;
-        }
-        else if (count == 3)
-        {
-            _stringPrice8.push_back(_stringPrice[i] == '+' ? '4' : _stringPrice[i]);
-        }
+        char c = _stringPrice[i];
+        if (c < '0' || c > '9') return false;
+        _price100 = _price100 * 10 + (c - '0');
     }
 
-    // string to decimal
-    double _doublePrice100 = stod(_stringPrice100);
-    double _doublePrice32 = stod(_stringPrice32);
-    double _doublePrice8 = stod(_stringPrice8);
-    //
-    double _doublePrice = _doublePrice100 + _doublePrice32 * 1.0 / 32.0 + _doublePrice8 * 1.0 / 256.0;
+    char _c1 = _stringPrice[_dash + 1];
+    char _c2 = _stringPrice[_dash + 2];
+    char _c3 = _stringPrice[_dash + 3];
+    if (_c1 < '0' || _c1 > '9' || _c2 < '0' || _c2 > '9') return false;
+    long _price32 = (_c1 - '0') * 10 + (_c2 - '0');
+    long _price8;
+    if (_c3 == '+') _price8 = 4;
+    else if (_c3 >= '0' && _c3 <= '7') _price8 = _c3 - '0';
+    else return false;
+
+    _ticks = _price100 * 256 + _price32 * 8 + _price8;
+    return true;
+}
+
+// Convert fraction price to decimal price.
+// Prices not in the fractional format fall back to a plain decimal parse.
+double ConvertPrice(string_view _stringPrice)
+{
+    long _ticks;
+    if (ParsePriceTicks(_stringPrice, _ticks)) return _ticks / 256.0;
+
+    double _doublePrice = 0;
+    from_chars(_stringPrice.data(), _stringPrice.data() + _stringPrice.size(), _doublePrice);
     return _doublePrice;
 }
 
-// Convert decimal price to fraction price
-string ConvertPrice(double _doublePrice) {
-    int _doublePrice100 = floor(_doublePrice);
+// Format decimal price as fraction price into a caller-supplied buffer of at least 24 chars.
+// Return the number of chars written.
+size_t FormatPrice(double _doublePrice, char* _buffer)
+{
+    long _doublePrice100 = floor(_doublePrice);
     int _doublePrice256 = floor((_doublePrice - _doublePrice100) * 256.0);
-    int _doublePrice32 = floor(_doublePrice256 / 8.0);
+    int _doublePrice32 = _doublePrice256 / 8;
     int _doublePrice8 = _doublePrice256 % 8;
 
-    string _stringPrice100 = to_string(_doublePrice100);
-    string _stringPrice32 = to_string(_doublePrice32);
-    string _stringPrice8 = to_string(_doublePrice8);
+    char* _end = _buffer;
+    unsigned long _magnitude = _doublePrice100 < 0 ? -(unsigned long)_doublePrice100 : _doublePrice100;
+    if (_doublePrice100 < 0) *_end++ = '-';
+    char _digits[20];
+    int n = 0;
+    do
+    {
+        _digits[n++] = '0' + _magnitude % 10;
+        _magnitude /= 10;
+    } while (_magnitude > 0);
+    while (n > 0) *_end++ = _digits[--n];
 
-    // We then apply the special rule of Bond price on it
-    if (_doublePrice32 < 10) _stringPrice32 = "0" + _stringPrice32;
-    if (_doublePrice8 == 4) _stringPrice8 = "+";
+    *_end++ = '-';
+    *_end++ = PRICE_32NDS[_doublePrice32 * 2];
+    *_end++ = PRICE_32NDS[_doublePrice32 * 2 + 1];
+    *_end++ = PRICE_256THS[_doublePrice8];
+    return _end - _buffer;
+}
 
-    string _stringPrice = _stringPrice100 + "-" + _stringPrice32 + _stringPrice8;
-    return _stringPrice;
+// Convert decimal price to fraction price
+string ConvertPrice(double _doublePrice)
+{
+    char _buffer[24];
+    size_t _size = FormatPrice(_doublePrice, _buffer);
+    return string(_buffer, _size);
 }
 
-// Convert string to date
-string TimeStamp()
+// Format the local time as a timestamp with milliseconds and a trailing space into a caller-supplied buffer of at least 32 chars.
+// Return the number of chars written.
+size_t FormatTimeStamp(char* _buffer)
 {
     auto _timePoint = system_clock::now();
     auto _sec = chrono::time_point_cast<chrono::seconds>(_timePoint);
     auto _millisec = chrono::duration_cast<chrono::milliseconds>(_timePoint - _sec);
-    auto _millisecCount = _millisec.count();
-    auto _milliString = to_string(_millisecCount);
-
-    if (_millisecCount < 10) _milliString = "00" + _milliString;
-    else if (_millisecCount < 100) _milliString = "0" + _milliString;
+    int _millisecCount = int(_millisec.count());
 
     auto _timeT = system_clock::to_time_t(_timePoint);
-    char _timeChar[24];
-    strftime(_timeChar, 24, "%F %T", localtime(&_timeT));
-    string _timeString = string(_timeChar) + "." + _milliString + " ";
+    tm _tm;
+    localtime_r(&_timeT, &_tm);
+    size_t _size = strftime(_buffer, 24, "%F %T", &_tm);
+    _buffer[_size++] = '.';
+    _buffer[_size++] = '0' + _millisecCount / 100;
+    _buffer[_size++] = '0' + _millisecCount / 10 % 10;
+    _buffer[_size++] = '0' + _millisecCount % 10;
+    _buffer[_size++] = ' ';
+    return _size;
+}
 
-    return _timeString;
+// Convert string to date
+string TimeStamp()
+{
+    char _buffer[32];
+    size_t _size = FormatTimeStamp(_buffer);
+    return string(_buffer, _size);
+}
+
+// Capacity of the buffers output rows are formatted into
+const size_t ROW_CAPACITY = 1024;
+
+/**
+* Formatter writing the comma-terminated fields of an output row into a caller-supplied buffer.
+* Numbers and prices are formatted in place, so a row is built without allocating. A field
+* that does not fit is dropped and the row marked truncated, so the caller can fall back.
+* Decimals are written as to_string writes them, so rows match the string forms.
+*/
+class RowFormatter
+{
+
+public:
+
+    // ctor for a formatter writing into a buffer of a capacity
+    RowFormatter(char* _buffer, size_t _capacity);
+
+    // Append chars as they are
+    void Append(string_view _chars);
+
+    // Append the local timestamp
+    void AppendTimeStamp();
+
+    // Append a field of chars
+    void Field(string_view _chars);
+
+    // Append a field of an integer
+    void IntegerField(long _value);
+
+    // Append a field of a decimal with six places
+    void DecimalField(double _value);
+
+    // Append a field of a decimal price as a fraction price
+    void PriceField(double _price);
+
+    // Get the row written so far
+    string_view GetRow() const;
+
+    // Check if a field did not fit in the buffer
+    bool IsTruncated() const;
+
+private:
+
+    // Check that a number of chars fits, marking the row truncated if not
+    bool Reserve(size_t _size);
+
+    char* buffer;
+    char* cursor;
+    char* end;
+    bool truncated;
+
+};
+
+RowFormatter::RowFormatter(char* _buffer, size_t _capacity) :
+        buffer(_buffer), cursor(_buffer), end(_buffer + _capacity), truncated(false)
+{
+}
+
+bool RowFormatter::Reserve(size_t _size)
+{
+    if (size_t(end - cursor) >= _size) return true;
+    truncated = true;
+    return false;
+}
+
+void RowFormatter::Append(string_view _chars)
+{
+    if (!Reserve(_chars.size())) return;
+    memcpy(cursor, _chars.data(), _chars.size());
+    cursor += _chars.size();
+}
+
+void RowFormatter::AppendTimeStamp()
+{
+    if (Reserve(32)) cursor += FormatTimeStamp(cursor);
+}
+
+void RowFormatter::Field(string_view _chars)
+{
+    if (!Reserve(_chars.size() + 1)) return;
+    memcpy(cursor, _chars.data(), _chars.size());
+    cursor += _chars.size();
+    *cursor++ = ',';
+}
+
+void RowFormatter::IntegerField(long _value)
+{
+    if (!Reserve(21)) return;
+    cursor = to_chars(cursor, end, _value).ptr;
+    *cursor++ = ',';
+}
+
+void RowFormatter::DecimalField(double _value)
+{
+    to_chars_result _result = to_chars(cursor, end, _value, chars_format::fixed, 6);
+    if (_result.ec != errc() || _result.ptr == end)
+    {
+        truncated = true;
+        return;
+    }
+    cursor = _result.ptr;
+    *cursor++ = ',';
+}
+
+void RowFormatter::PriceField(double _price)
+{
+    if (!Reserve(25)) return;
+    cursor += FormatPrice(_price, cursor);
+    *cursor++ = ',';
+}
+
+string_view RowFormatter::GetRow() const
+{
+    return string_view(buffer, cursor - buffer);
+}
+
+bool RowFormatter::IsTruncated() const
+{
+    return truncated;
+}
+
+// Get the wall-clock time in nanoseconds since the epoch
+long GetEpochNanoseconds()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(system_clock::now().time_since_epoch()).count();
 }
 
 //long GerMillesecond()
@@ -158,18 +315,10 @@ long GetMilliseconds()
     return chrono::duration_cast<chrono::milliseconds>(duration).count() % 1000;
 }
 
-// Generate Random IDs for data
+// Generate unique IDs for data
 string GenerateId()
 {
-    string _base = "0123456789QWERTYUIOPASDFGHJKLZXCVBNM";
-    vector<double> _randoms = GenerateUniform(12, GetMilliseconds());
-    string _id = "";
-    for (auto& r : _randoms)
-    {
-        int i = r*36;
-        _id.push_back(_base[i]);
-    }
-    return _id;
+    return GetIdGenerator().Generate();
 }
 
 #endif //TRADINGSYSTEM_FUNCTIONS_HPP
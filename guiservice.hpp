@@ -7,8 +7,13 @@
 #ifndef GUI_SERVICE_HPP
 #define GUI_SERVICE_HPP
 
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "soa.hpp"
 #include "pricingservice.hpp"
+#include "historicalwriter.hpp"
+#include "metrics.hpp"
 
 /**
 * Pre-declearations to avoid errors.
@@ -20,6 +25,9 @@ class GUIToPricingListener;
 
 /**
 * Service for outputing GUI with a certain throttle.
+* Prices are conflated: only the latest price of each product is kept, and a timer
+* thread publishes the products updated since the last tick once per throttle interval.
+* The pricing thread only takes a short lock to store the price, and never waits on I/O.
 * Keyed on product identifier.
 * Type T is the product type.
 */
@@ -29,12 +37,28 @@ class GUIService : Service<string, Price<T>>
 
 private:
 
-	map<string, Price<T>> guis;
+	ProductStore<Price<T>> guis;
+	Price<T> missing;
 	vector<ServiceListener<Price<T>>*> listeners;
 	GUIConnector<T>* connector;
 	ServiceListener<Price<T>>* listener;
 	int throttle;
-	long millisec;
+
+	mutex latestMutex;
+	condition_variable wakeup;
+	vector<int> dirty;
+	vector<char> dirtyFlags;
+	map<string, Price<T>> dirtyOverflow;
+	vector<Price<T>> snapshot;
+	vector<ServiceListener<Price<T>>*> snapshotListeners;
+	bool stopping;
+	thread timer;
+
+	// Body of the timer thread
+	void Run();
+
+	// Publish the products updated since the last tick, to the connector and the listeners
+	void PublishDirty();
 
 public:
 
@@ -42,8 +66,12 @@ public:
 	GUIService();
 	~GUIService();
 
-	// Get data on our service given a key
-	Price<T>& GetData(string _key);
+	// Get data on our service given a key, a default price if none was stored for it.
+	// A later price overwrites it in place; use Lookup for a stable copy from another thread.
+	Price<T>& GetData(const string& _key);
+
+	// Get a copy of the latest price of a product, taken under the lock, empty if none was stored
+	optional<Price<T>> Lookup(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(Price<T>& _data);
@@ -60,47 +88,76 @@ public:
 	// Get the listener of the service
 	ServiceListener<Price<T>>* GetListener();
 
-	// Get the throttle of the service
+	// Get the throttle of the service in milliseconds
 	int GetThrottle() const;
 
-	// Get the millisec of the service
-	long GetMillisec() const;
-
-	// Set the millisec of the service
-	void SetMillisec(long _millisec);
+	// Publish the latest prices still pending, stop the timer thread and close the output
+	void Stop();
 
 };
 
 template<typename T>
 GUIService<T>::GUIService()
 {
-	guis = map<string, Price<T>>();
+	guis = ProductStore<Price<T>>();
 	listeners = vector<ServiceListener<Price<T>>*>();
 	connector = new GUIConnector<T>(this);
 	listener = new GUIToPricingListener<T>(this);
 	throttle = 300;
-	millisec = 0;
+	stopping = false;
+	timer = thread(&GUIService<T>::Run, this);
 }
 
 template<typename T>
-GUIService<T>::~GUIService() {}
+GUIService<T>::~GUIService()
+{
+	Stop();
+}
 
 template<typename T>
-Price<T>& GUIService<T>::GetData(string _key)
+Price<T>& GUIService<T>::GetData(const string& _key)
 {
-	return guis[_key];
+	lock_guard<mutex> _lock(latestMutex);
+	Price<T>* _data = guis.Find(_key);
+	return _data ? *_data : missing;
+}
+
+template<typename T>
+optional<Price<T>> GUIService<T>::Lookup(string_view _key)
+{
+	lock_guard<mutex> _lock(latestMutex);
+	Price<T>* _data = guis.Find(_key);
+	if (!_data) return nullopt;
+	return *_data;
 }
 
 template<typename T>
 void GUIService<T>::OnMessage(Price<T>& _data)
 {
-	guis[_data.GetProduct().GetProductId()] = _data;
-	connector->Publish(_data);
+	const T& _product = _data.GetProduct();
+	int _index = ResolveProductIndex(_product);
+	lock_guard<mutex> _lock(latestMutex);
+	if (_index < 0)
+	{
+		guis.Get(_product) = _data;
+		dirtyOverflow.insert_or_assign(_product.GetProductId(), _data);
+		return;
+	}
+
+	guis[_index] = _data;
+	if (size_t(_index) >= dirtyFlags.size()) dirtyFlags.resize(_index + 1, 0);
+	if (!dirtyFlags[_index])
+	{
+		dirtyFlags[_index] = 1;
+		dirty.push_back(_index);
+	}
 }
 
 template<typename T>
 void GUIService<T>::AddListener(ServiceListener<Price<T>>* _listener)
 {
+	// The timer thread takes its copy of the listeners under the same lock
+	lock_guard<mutex> _lock(latestMutex);
 	listeners.push_back(_listener);
 }
 
@@ -129,15 +186,59 @@ int GUIService<T>::GetThrottle() const
 }
 
 template<typename T>
-long GUIService<T>::GetMillisec() const
+void GUIService<T>::Stop()
+{
+	{
+		lock_guard<mutex> _lock(latestMutex);
+		if (stopping) return;
+		stopping = true;
+	}
+	wakeup.notify_one();
+	timer.join();
+	connector->Close();
+}
+
+template<typename T>
+void GUIService<T>::Run()
 {
-	return millisec;
+	steady_clock::time_point _next = steady_clock::now() + milliseconds(throttle);
+	bool _stopping = false;
+	while (!_stopping)
+	{
+		{
+			unique_lock<mutex> _lock(latestMutex);
+			wakeup.wait_until(_lock, _next, [this] { return stopping; });
+			_stopping = stopping;
+
+			// Take the pending prices under the lock, publish them outside of it
+			snapshot.clear();
+			snapshotListeners = listeners;
+			for (int i : dirty)
+			{
+				snapshot.push_back(guis[i]);
+				dirtyFlags[i] = 0;
+			}
+			dirty.clear();
+			for (auto& p : dirtyOverflow) snapshot.push_back(move(p.second));
+			dirtyOverflow.clear();
+		}
+		PublishDirty();
+
+		// Skip the ticks missed while publishing rather than bursting to catch up
+		_next += milliseconds(throttle);
+		steady_clock::time_point _now = steady_clock::now();
+		if (_next < _now) _next = _now + milliseconds(throttle);
+	}
 }
 
 template<typename T>
-void GUIService<T>::SetMillisec(long _millisec)
+void GUIService<T>::PublishDirty()
 {
-	millisec = _millisec;
+	for (auto& p : snapshot)
+	{
+		connector->Publish(p);
+		for (auto& l : snapshotListeners) l->ProcessAdd(p);
+	}
 }
 
 
@@ -152,6 +253,10 @@ class GUIConnector : public Connector<Price<T>>
 private:
 
 	GUIService<T>* service;
+	HistoricalWriter writer;
+	string record;
+	char row[ROW_CAPACITY];
+	StageMetrics& publishStage;
 
 public:
 
@@ -162,13 +267,16 @@ public:
 	// Publish data to the Connector
 	void Publish(Price<T>& _data);
 
+	// Flush and close the output file
+	void Close();
+
 	// Subscribe data from the Connector
 	void Subscribe(ifstream& _data);
 
 };
 
 template<typename T>
-GUIConnector<T>::GUIConnector(GUIService<T>* _service)
+GUIConnector<T>::GUIConnector(GUIService<T>* _service) : writer("gui.txt"), publishStage(GetStageMetrics("GUIConnector::Publish"))
 {
 	service = _service;
 }
@@ -179,24 +287,35 @@ GUIConnector<T>::~GUIConnector() {}
 template<typename T>
 void GUIConnector<T>::Publish(Price<T>& _data)
 {
-	int _throttle = service->GetThrottle();
-	long _millisec = service->GetMillisec();
-	long _millisecNow = GetMilliseconds();
-	while (_millisecNow < _millisec) _millisecNow += 1000;
-	if (_millisecNow - _millisec >= _throttle)
+	ScopedLatency _latency(publishStage);
+	RowFormatter _formatter(row, ROW_CAPACITY);
+	_formatter.AppendTimeStamp();
+	_formatter.Append(",");
+	_data.Format(_formatter);
+	_formatter.Append("\n");
+	if (!_formatter.IsTruncated())
 	{
-		service->SetMillisec(_millisecNow);
-		ofstream _file;
-		_file.open("gui.txt", ios::app);
+		string_view _row = _formatter.GetRow();
+		writer.Write(_row.data(), _row.size());
+		return;
+	}
 
-		_file << TimeStamp() << ",";
-		vector<string> _strings = _data.ToStrings();
-		for (auto& s : _strings)
-		{
-			_file << s << ",";
-		}
-		_file << endl;
+	record = TimeStamp();
+	record += ",";
+	vector<string> _strings = _data.ToStrings();
+	for (auto& s : _strings)
+	{
+		record += s;
+		record += ",";
 	}
+	record += "\n";
+	writer.Write(record);
+}
+
+template<typename T>
+void GUIConnector<T>::Close()
+{
+	writer.Shutdown();
 }
 
 template<typename T>
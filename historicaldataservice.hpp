@@ -9,9 +9,56 @@
 #ifndef HISTORICAL_DATA_SERVICE_HPP
 #define HISTORICAL_DATA_SERVICE_HPP
 
+#include <memory>
+#include <functional>
 #include "soa.hpp"
+#include "historicalwriter.hpp"
+#include "historicalrecord.hpp"
+#include "metrics.hpp"
 
-enum ServiceType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY };
+// Get the file that historical data from a service type is persisted to, in a format
+const char* GetHistoricalFile(ServiceType _type, HistoricalFormat _format = TEXT)
+{
+    bool _text = (_format == TEXT);
+    switch (_type)
+    {
+        case POSITION: return _text ? "positions.txt" : "positions.bin";
+        case RISK: return _text ? "risk.txt" : "risk.bin";
+        case EXECUTION: return _text ? "executions.txt" : "executions.bin";
+        case STREAMING: return _text ? "streaming.txt" : "streaming.bin";
+        case INQUIRY: return _text ? "allinquiries.txt" : "allinquiries.bin";
+        case MARKET_DATA: return _text ? "orderbooks.txt" : "orderbooks.bin";
+        case TRADE: return _text ? "alltrades.txt" : "alltrades.bin";
+    }
+    return "";
+}
+
+// Get the long-lived writers of all services, kept open for the whole program
+vector<unique_ptr<HistoricalWriter>>& GetHistoricalWriters()
+{
+    static vector<unique_ptr<HistoricalWriter>> _writers;
+    return _writers;
+}
+
+// Get a new long-lived writer on a file, owned by one service and closed by ShutdownHistoricalWriters
+HistoricalWriter& MakeHistoricalWriter(const string& _path)
+{
+    return *GetHistoricalWriters().emplace_back(make_unique<HistoricalWriter>(_path));
+}
+
+// Get the callbacks writing out the partly filled binary blocks of every connector
+vector<function<void()>>& GetHistoricalFlushers()
+{
+    static vector<function<void()>> _flushers;
+    return _flushers;
+}
+
+// Write out partly filled blocks, then drain and close the writers of all services.
+void ShutdownHistoricalWriters()
+{
+    for (auto& f : GetHistoricalFlushers()) f();
+    for (auto& w : GetHistoricalWriters()) w->Shutdown();
+}
 
 /**
 * Pre-declearations to avoid errors.
@@ -23,6 +70,10 @@ class HistoricalDataListener;
 
 /**
 * Service for processing and persisting historical data to a persistent store.
+* Data is persisted as binary blocks, as text rows, or both; binary files replay
+* back through the connector's Subscribe, into the service and its listeners.
+* Each service writes its own files, named after its service type behind an optional
+* prefix; two services of a type in one program need different prefixes.
 * Keyed on some persistent key.
 * Type V is the data type to persist.
 */
@@ -32,21 +83,31 @@ class HistoricalDataService : Service<string, V>
 
 private:
 
-    map<string, V> historicalDatas;
+    ProductStore<V> historicalDatas;
+    V missing;
     vector<ServiceListener<V>*> listeners;
     HistoricalDataConnector<V>* connector;
     ServiceListener<V>* listener;
     ServiceType type;
+    int formats;
+    string prefix;
+    HistoricalWriter* writers[2];
+
+    // Open the writers of the persisted formats
+    void OpenWriters();
 
 public:
 
     // Constructor and destructor
     HistoricalDataService();
-    HistoricalDataService(ServiceType _type);
+    HistoricalDataService(ServiceType _type, bool _async = false, int _formats = BINARY, const string& _prefix = "");
     ~HistoricalDataService();
 
-    // Get data on our service given a key
-    V& GetData(string _key);
+    // Get data on our service given a key, a default value if none was stored for it
+    V& GetData(const string& _key);
+
+    // Get a copy of the data stored for a key without inserting, empty if none was
+    optional<V> Lookup(string_view _key);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(V& _data);
@@ -66,44 +127,89 @@ public:
     // Get the service type that historical data comes from
     ServiceType GetServiceType() const;
 
+    // Get the formats data is persisted in, a combination of HistoricalFormat flags
+    int GetFormats() const;
+
+    // Get the prefix on the files data is persisted to
+    const string& GetPrefix() const;
+
+    // Get the writer of a format, null if data is not persisted in it
+    HistoricalWriter* GetWriter(HistoricalFormat _format);
+
+    // Store replayed data and notify the listeners
+    void Replay(V& _data);
+
+    // Store a batch of replayed data and notify the listeners with the batch
+    void Replay(span<V> _data);
+
     // Persist data to a store
     void PersistData(string _persistKey, V& _data);
 
+    // Persist a batch of data to a store
+    void PersistBatch(span<V> _data);
+
 };
 
 template<typename V>
 HistoricalDataService<V>::HistoricalDataService()
 {
-    historicalDatas = map<string, V>();
+    historicalDatas = ProductStore<V>();
     listeners = vector<ServiceListener<V>*>();
+    type = INQUIRY;
+    formats = BINARY;
+    OpenWriters();
     connector = new HistoricalDataConnector<V>(this);
     listener = new HistoricalDataListener<V>(this);
-    type = INQUIRY;
 }
 
 template<typename V>
-HistoricalDataService<V>::HistoricalDataService(ServiceType _type)
+HistoricalDataService<V>::HistoricalDataService(ServiceType _type, bool _async, int _formats, const string& _prefix)
 {
-    historicalDatas = map<string, V>();
+    historicalDatas = ProductStore<V>();
     listeners = vector<ServiceListener<V>*>();
+    type = _type;
+    formats = _formats;
+    prefix = _prefix;
+    OpenWriters();
     connector = new HistoricalDataConnector<V>(this);
     listener = new HistoricalDataListener<V>(this);
-    type = _type;
+    if (!_async) return;
+    for (auto w : writers)
+    {
+        if (w) w->StartAsync();
+    }
+}
+
+template<typename V>
+void HistoricalDataService<V>::OpenWriters()
+{
+    // Writers outlive the service, as its connector stays registered to flush its blocks at shutdown
+    writers[0] = (formats & TEXT) ? &MakeHistoricalWriter(prefix + GetHistoricalFile(type, TEXT)) : nullptr;
+    writers[1] = (formats & BINARY) ? &MakeHistoricalWriter(prefix + GetHistoricalFile(type, BINARY)) : nullptr;
 }
 
 template<typename V>
 HistoricalDataService<V>::~HistoricalDataService() {}
 
 template<typename V>
-V& HistoricalDataService<V>::GetData(string _key)
+V& HistoricalDataService<V>::GetData(const string& _key)
+{
+    V* _data = historicalDatas.Find(_key);
+    return _data ? *_data : missing;
+}
+
+template<typename V>
+optional<V> HistoricalDataService<V>::Lookup(string_view _key)
 {
-    return historicalDatas[_key];
+    V* _data = historicalDatas.Find(_key);
+    if (!_data) return nullopt;
+    return *_data;
 }
 
 template<typename V>
 void HistoricalDataService<V>::OnMessage(V& _data)
 {
-    historicalDatas[_data.GetProduct().GetProductId()] = _data;
+    historicalDatas.Get(_data.GetProduct()) = _data;
 }
 
 template<typename V>
@@ -136,12 +242,59 @@ ServiceType HistoricalDataService<V>::GetServiceType() const
     return type;
 }
 
+template<typename V>
+int HistoricalDataService<V>::GetFormats() const
+{
+    return formats;
+}
+
+template<typename V>
+const string& HistoricalDataService<V>::GetPrefix() const
+{
+    return prefix;
+}
+
+template<typename V>
+HistoricalWriter* HistoricalDataService<V>::GetWriter(HistoricalFormat _format)
+{
+    return writers[_format == BINARY];
+}
+
+template<typename V>
+void HistoricalDataService<V>::Replay(V& _data)
+{
+    OnMessage(_data);
+    for (auto& l : listeners)
+    {
+        l->ProcessAdd(_data);
+    }
+}
+
+template<typename V>
+void HistoricalDataService<V>::Replay(span<V> _data)
+{
+    for (auto& d : _data)
+    {
+        OnMessage(d);
+    }
+    for (auto& l : listeners)
+    {
+        l->ProcessAddBatch(_data);
+    }
+}
+
 template<typename V>
 void HistoricalDataService<V>::PersistData(string _persistKey, V& _data)
 {
     connector->Publish(_data);
 }
 
+template<typename V>
+void HistoricalDataService<V>::PersistBatch(span<V> _data)
+{
+    connector->PublishBatch(_data);
+}
+
 /**
 * Historical Data Connector publishing data from Historical Data Service.
 * Type V is the data type to persist.
@@ -153,56 +306,128 @@ class HistoricalDataConnector : public Connector<V>
 private:
 
     HistoricalDataService<V>* service;
+    string record;
+    char row[ROW_CAPACITY];
+    StageMetrics& stage;
+    unique_ptr<HistoricalBlockWriter<V>> blocks;
+
+    // Append the text row of a record to the reused buffer
+    void AppendRecord(V& _data);
 
 public:
 
     // Connector and Destructor
-    HistoricalDataConnector(HistoricalDataService<V>* _service) : service(_service) {};
+    HistoricalDataConnector(HistoricalDataService<V>* _service);
 
     // Publish data to the Connector
     void Publish(V& _data);
 
-    // Subscribe data from the Connector
+    // Publish a batch of data to the Connector, with one write to the text file
+    void PublishBatch(span<V> _data);
+
+    // Replay the binary records of a stream into the service
     void Subscribe(ifstream& _data);
 
+    // Replay the binary records of a file into the service
+    void SubscribeFile(const string& _path);
+
 };
 
+template<typename V>
+HistoricalDataConnector<V>::HistoricalDataConnector(HistoricalDataService<V>* _service) :
+        service(_service), stage(GetStageMetrics("HistoricalDataConnector::Publish " + _service->GetPrefix() + GetHistoricalFile(_service->GetServiceType())))
+{
+    if (service->GetFormats() & BINARY)
+    {
+        blocks = make_unique<HistoricalBlockWriter<V>>(*service->GetWriter(BINARY));
+        GetHistoricalFlushers().push_back([this] { blocks->Flush(); });
+    }
+}
+
 template<typename V>
 void HistoricalDataConnector<V>::Publish(V& _data)
 {
-    ServiceType _type = service->GetServiceType();
-    ofstream _file;
-    switch (_type)
+    // Build the row in a reused buffer and hand it to the long-lived writer of the service
+    ScopedLatency _latency(stage);
+    if (blocks) blocks->Append(_data, GetEpochNanoseconds());
+    if (!(service->GetFormats() & TEXT)) return;
+
+    record.clear();
+    AppendRecord(_data);
+    service->GetWriter(TEXT)->Write(record);
+}
+
+template<typename V>
+void HistoricalDataConnector<V>::PublishBatch(span<V> _data)
+{
+    if (_data.empty()) return;
+    long _start = GetNanoseconds();
+    long _timestamp = GetEpochNanoseconds();
+    if (blocks)
+    {
+        for (auto& d : _data) blocks->Append(d, _timestamp);
+    }
+    if (service->GetFormats() & TEXT)
+    {
+        record.clear();
+        for (auto& d : _data) AppendRecord(d);
+        service->GetWriter(TEXT)->Write(record);
+    }
+
+    // Each record is counted at the batch's mean latency
+    long _nanos = (GetNanoseconds() - _start) / long(_data.size());
+    for (size_t i = 0; i < _data.size(); i++) stage.Record(_nanos);
+}
+
+template<typename V>
+void HistoricalDataConnector<V>::AppendRecord(V& _data)
+{
+    // Rows are formatted in place; only a row too long for the buffer is built from strings
+    RowFormatter _formatter(row, ROW_CAPACITY);
+    _formatter.AppendTimeStamp();
+    _formatter.Append(",");
+    _data.Format(_formatter);
+    _formatter.Append("\n");
+    if (!_formatter.IsTruncated())
     {
-        // Write data to different files based on the service type
-        case POSITION:
-            _file.open("positions.txt", ios::app);
-            break;
-        case RISK:
-            _file.open("risk.txt", ios::app);
-            break;
-        case EXECUTION:
-            _file.open("executions.txt", ios::app);
-            break;
-        case STREAMING:
-            _file.open("streaming.txt", ios::app);
-            break;
-        case INQUIRY:
-            _file.open("allinquiries.txt", ios::app);
-            break;
+        record += _formatter.GetRow();
+        return;
     }
 
-    _file << TimeStamp() << ",";
+    record += TimeStamp();
+    record += ",";
     vector<string> _strings = _data.ToStrings();
     for (auto& s : _strings)
     {
-        _file << s << ",";
+        record += s;
+        record += ",";
     }
-    _file << endl;
+    record += "\n";
 }
 
 template<typename V>
-void HistoricalDataConnector<V>::Subscribe(ifstream& _data) {}
+void HistoricalDataConnector<V>::Subscribe(ifstream& _data)
+{
+    // Records are replayed a block's worth at a time
+    HistoricalBlockReader<V> _reader(_data);
+    vector<V> _records(HISTORICAL_BLOCK_ROWS);
+    size_t _count = 0;
+    long _timestamp;
+    while (_reader.Next(_records[_count], _timestamp))
+    {
+        if (++_count < _records.size()) continue;
+        service->Replay(span<V>(_records.data(), _count));
+        _count = 0;
+    }
+    if (_count > 0) service->Replay(span<V>(_records.data(), _count));
+}
+
+template<typename V>
+void HistoricalDataConnector<V>::SubscribeFile(const string& _path)
+{
+    ifstream _file(_path, ios::binary);
+    Subscribe(_file);
+}
 
 /**
 * Historical Data Service Listener subscribing data to Historical Data.
@@ -228,6 +453,9 @@ public:
     // Listener callback to process an add event to the Service
     void ProcessAdd(V& _data);
 
+    // Listener callback to process add events for a batch, persisted together
+    void ProcessAddBatch(span<V> _data);
+
     void ProcessRemove(V& _data){};
 
     void ProcessUpdate(V& _data){};
@@ -242,4 +470,10 @@ void HistoricalDataListener<V>::ProcessAdd(V& _data)
     service->PersistData(_persistKey, _data);
 }
 
+template<typename V>
+void HistoricalDataListener<V>::ProcessAddBatch(span<V> _data)
+{
+    service->PersistBatch(_data);
+}
+
 #endif
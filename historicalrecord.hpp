@@ -0,0 +1,494 @@
+/**
+ * historicalrecord.hpp
+ * Defines the binary block-columnar format of historical data, and its readers and writers.
+ *
+ */
+#ifndef HISTORICAL_RECORD_HPP
+#define HISTORICAL_RECORD_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <algorithm>
+#include "productregistry.hpp"
+#include "historicalwriter.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "executionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "inquiryservice.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+enum ServiceType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY, MARKET_DATA, TRADE };
+
+enum HistoricalFormat { TEXT = 1, BINARY = 2 };
+
+/**
+* Header of a block of historical records.
+* A block holds up to HISTORICAL_BLOCK_ROWS records of one service type, stored column
+* by column: the header is followed by the arrays of `rows` 8-byte cells of the columns
+* flagged in `present`. Columns that are zero throughout the block, such as unused books
+* or empty parent order IDs, are not written. Every record starts with two cells, a wall-clock timestamp in nanoseconds and a
+* product index, UNREGISTERED_PRODUCT for a product outside the registry; identifiers take two cells of up to 16 characters.
+*/
+struct HistoricalBlockHeader
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t columns;
+    uint32_t rows;
+    uint32_t reserved;
+    uint64_t present;
+};
+
+const uint32_t HISTORICAL_BLOCK_MAGIC = 0x324b4c48;
+const int HISTORICAL_BLOCK_ROWS = 4096;
+const int HISTORICAL_MAX_COLUMNS = 64;
+const uint64_t UNREGISTERED_PRODUCT = ~uint64_t(0);
+
+// Store the registry index of a product, UNREGISTERED_PRODUCT if it has none
+uint64_t EncodeProduct(int _index)
+{
+    return (_index < 0) ? UNREGISTERED_PRODUCT : uint64_t(_index);
+}
+
+// Check if a product cell holds an index of the registry; records of other products are skipped on read
+bool IsRegisteredProduct(uint64_t _cell)
+{
+    return _cell != UNREGISTERED_PRODUCT && _cell < GetProductRegistry().GetSize();
+}
+
+// Store a double in a cell
+uint64_t EncodeDouble(double _value)
+{
+    uint64_t _cell;
+    memcpy(&_cell, &_value, sizeof(_cell));
+    return _cell;
+}
+
+// Load a double from a cell
+double DecodeDouble(uint64_t _cell)
+{
+    double _value;
+    memcpy(&_value, &_cell, sizeof(_value));
+    return _value;
+}
+
+// Store an identifier in two cells, truncated to 16 characters
+void EncodeId(const string& _id, uint64_t* _cells)
+{
+    char _chars[16] = {};
+    memcpy(_chars, _id.data(), min(_id.size(), sizeof(_chars)));
+    memcpy(_cells, _chars, sizeof(_chars));
+}
+
+// Load an identifier from two cells
+string DecodeId(const uint64_t* _cells)
+{
+    char _chars[16];
+    memcpy(_chars, _cells, sizeof(_chars));
+    return string(_chars, strnlen(_chars, sizeof(_chars)));
+}
+
+/**
+* Binary record layout of a historical data type.
+* Each specialization gives the service type tag, the number of columns, and the
+* conversions between a value and a row of cells.
+* Type V is the data type.
+*/
+template<typename V>
+struct HistoricalRecord;
+
+/**
+* Position records: up to BookRegistry::MAX_BOOKS books, each as its book id in two cells
+* and its quantity, so records do not depend on the order books were registered in.
+* Books past the registry's capacity are not recorded.
+*/
+template<typename T>
+struct HistoricalRecord<Position<T>>
+{
+    static const ServiceType TYPE = POSITION;
+    static const int COLUMNS = 2 + 3 * BookRegistry::MAX_BOOKS;
+
+    static void Encode(const Position<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        BookRegistry& _registry = GetBookRegistry();
+        int _slot = 0;
+        for (int b = 0; b < BookRegistry::MAX_BOOKS; b++)
+        {
+            if (!_data.HasBook(b)) continue;
+            EncodeId(_registry.GetName(b), _row + 2 + 3 * _slot);
+            _row[4 + 3 * _slot] = _data.GetBookPosition(b);
+            _slot++;
+        }
+        fill(_row + 2 + 3 * _slot, _row + COLUMNS, 0);
+    }
+
+    static Position<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        Position<T> _data(GetProductRegistry().GetBond(int(_row[1])));
+        for (int _slot = 0; _slot < BookRegistry::MAX_BOOKS; _slot++)
+        {
+            const uint64_t* _book = _row + 2 + 3 * _slot;
+            if (_book[0] == 0 && _book[1] == 0) break;
+            _data.AddPosition(DecodeId(_book), long(_book[2]));
+        }
+        return _data;
+    }
+};
+
+/**
+* PV01 records: the PV01 value and the quantity.
+*/
+template<typename T>
+struct HistoricalRecord<PV01<T>>
+{
+    static const ServiceType TYPE = RISK;
+    static const int COLUMNS = 4;
+
+    static void Encode(const PV01<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        _row[2] = EncodeDouble(_data.GetPV01());
+        _row[3] = _data.GetQuantity();
+    }
+
+    static PV01<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        return PV01<T>(GetProductRegistry().GetBond(int(_row[1])), DecodeDouble(_row[2]), long(_row[3]));
+    }
+};
+
+/**
+* Execution order records: side, order ID, order type, price, quantities, parent order ID
+* and the child order flag.
+*/
+template<typename T>
+struct HistoricalRecord<ExecutionOrder<T>>
+{
+    static const ServiceType TYPE = EXECUTION;
+    static const int COLUMNS = 12;
+
+    static void Encode(const ExecutionOrder<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        _row[2] = _data.GetPricingSide();
+        EncodeId(_data.GetOrderId(), _row + 3);
+        _row[5] = _data.GetOrderType();
+        _row[6] = EncodeDouble(_data.GetPrice());
+        _row[7] = _data.GetVisibleQuantity();
+        _row[8] = _data.GetHiddenQuantity();
+        EncodeId(_data.GetParentOrderId(), _row + 9);
+        _row[11] = _data.IsChildOrder();
+    }
+
+    static ExecutionOrder<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        return ExecutionOrder<T>(GetProductRegistry().GetBond(int(_row[1])), PricingSide(_row[2]), DecodeId(_row + 3), OrderType(_row[5]),
+                                 DecodeDouble(_row[6]), long(_row[7]), long(_row[8]), DecodeId(_row + 9), _row[11] != 0);
+    }
+};
+
+/**
+* Price stream records: price and quantities of the bid and offer orders.
+*/
+template<typename T>
+struct HistoricalRecord<PriceStream<T>>
+{
+    static const ServiceType TYPE = STREAMING;
+    static const int COLUMNS = 8;
+
+    static void Encode(const PriceStream<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        const PriceStreamOrder& _bidOrder = _data.GetBidOrder();
+        const PriceStreamOrder& _offerOrder = _data.GetOfferOrder();
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        _row[2] = EncodeDouble(_bidOrder.GetPrice());
+        _row[3] = _bidOrder.GetVisibleQuantity();
+        _row[4] = _bidOrder.GetHiddenQuantity();
+        _row[5] = EncodeDouble(_offerOrder.GetPrice());
+        _row[6] = _offerOrder.GetVisibleQuantity();
+        _row[7] = _offerOrder.GetHiddenQuantity();
+    }
+
+    static PriceStream<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        PriceStreamOrder _bidOrder(DecodeDouble(_row[2]), long(_row[3]), long(_row[4]), BID);
+        PriceStreamOrder _offerOrder(DecodeDouble(_row[5]), long(_row[6]), long(_row[7]), OFFER);
+        return PriceStream<T>(GetProductRegistry().GetBond(int(_row[1])), _bidOrder, _offerOrder);
+    }
+};
+
+/**
+* Inquiry records: inquiry ID, side, quantity, price and state.
+*/
+template<typename T>
+struct HistoricalRecord<Inquiry<T>>
+{
+    static const ServiceType TYPE = INQUIRY;
+    static const int COLUMNS = 8;
+
+    static void Encode(const Inquiry<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        EncodeId(_data.GetInquiryId(), _row + 2);
+        _row[4] = _data.GetSide();
+        _row[5] = _data.GetQuantity();
+        _row[6] = EncodeDouble(_data.GetPrice());
+        _row[7] = _data.GetState();
+    }
+
+    static Inquiry<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        return Inquiry<T>(DecodeId(_row + 2), GetProductRegistry().GetBond(int(_row[1])), Side(_row[4]), long(_row[5]),
+                          DecodeDouble(_row[6]), InquiryState(_row[7]));
+    }
+};
+
+/**
+* Trade records: trade ID, price, book ID, quantity and side.
+*/
+template<typename T>
+struct HistoricalRecord<Trade<T>>
+{
+    static const ServiceType TYPE = TRADE;
+    static const int COLUMNS = 9;
+
+    static void Encode(const Trade<T>& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(ResolveProductIndex(_data.GetProduct()));
+        EncodeId(_data.GetTradeId(), _row + 2);
+        _row[4] = EncodeDouble(_data.GetPrice());
+        EncodeId(_data.GetBook(), _row + 5);
+        _row[7] = _data.GetQuantity();
+        _row[8] = _data.GetSide();
+    }
+
+    static Trade<T> Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        return Trade<T>(GetProductRegistry().GetBond(int(_row[1])), DecodeId(_row + 2), DecodeDouble(_row[4]), DecodeId(_row + 5),
+                        long(_row[7]), Side(_row[8]));
+    }
+};
+
+/**
+* One order of the order book of a product, the unit order books are recorded in.
+*/
+struct OrderBookLevel
+{
+    int productIndex;
+    Order order;
+};
+
+/**
+* Order book level records: side, price and quantity of one order. A book is recorded
+* as its bid orders then its offer orders, in stack order.
+*/
+template<>
+struct HistoricalRecord<OrderBookLevel>
+{
+    static const ServiceType TYPE = MARKET_DATA;
+    static const int COLUMNS = 5;
+
+    static void Encode(const OrderBookLevel& _data, long _timestamp, uint64_t* _row)
+    {
+        _row[0] = _timestamp;
+        _row[1] = EncodeProduct(_data.productIndex);
+        _row[2] = _data.order.GetSide();
+        _row[3] = EncodeDouble(_data.order.GetPrice());
+        _row[4] = _data.order.GetQuantity();
+    }
+
+    static OrderBookLevel Decode(const uint64_t* _row, long& _timestamp)
+    {
+        _timestamp = _row[0];
+        return { int(_row[1]), Order(DecodeDouble(_row[3]), long(_row[4]), PricingSide(_row[2])) };
+    }
+};
+
+/**
+* Historical Block Writer collecting records into a column-major block and writing
+* each full block to a historical writer, header and columns in one write so that
+* blocks from writers sharing a file never interleave.
+* Type V is the data type.
+*/
+template<typename V>
+class HistoricalBlockWriter
+{
+
+public:
+
+    // Constructor for the writer that receives the blocks
+    HistoricalBlockWriter(HistoricalWriter& _writer);
+
+    // Append a record stamped with a wall-clock time in nanoseconds
+    void Append(const V& _data, long _timestamp);
+
+    // Write the records of the current block
+    void Flush();
+
+private:
+
+    typedef HistoricalRecord<V> Record;
+
+    HistoricalWriter& writer;
+    vector<uint64_t> block;
+    vector<char> output;
+    uint64_t row[Record::COLUMNS];
+    int rows;
+
+    static_assert(Record::COLUMNS <= HISTORICAL_MAX_COLUMNS, "a block flags its columns in 64 bits");
+
+};
+
+template<typename V>
+HistoricalBlockWriter<V>::HistoricalBlockWriter(HistoricalWriter& _writer) :
+        writer(_writer), block(size_t(Record::COLUMNS) * HISTORICAL_BLOCK_ROWS),
+        output(sizeof(HistoricalBlockHeader) + block.size() * sizeof(uint64_t))
+{
+    rows = 0;
+}
+
+template<typename V>
+void HistoricalBlockWriter<V>::Append(const V& _data, long _timestamp)
+{
+    Record::Encode(_data, _timestamp, row);
+    for (int c = 0; c < Record::COLUMNS; c++)
+    {
+        block[size_t(c) * HISTORICAL_BLOCK_ROWS + rows] = row[c];
+    }
+    if (++rows == HISTORICAL_BLOCK_ROWS) Flush();
+}
+
+template<typename V>
+void HistoricalBlockWriter<V>::Flush()
+{
+    if (rows == 0) return;
+    uint64_t _present = 0;
+    for (int c = 0; c < Record::COLUMNS; c++)
+    {
+        const uint64_t* _column = block.data() + size_t(c) * HISTORICAL_BLOCK_ROWS;
+        for (int i = 0; i < rows; i++)
+        {
+            if (_column[i] == 0) continue;
+            _present |= uint64_t(1) << c;
+            break;
+        }
+    }
+    HistoricalBlockHeader _header = { HISTORICAL_BLOCK_MAGIC, uint16_t(Record::TYPE), uint16_t(Record::COLUMNS), uint32_t(rows), 0, _present };
+    memcpy(output.data(), &_header, sizeof(_header));
+    size_t _size = sizeof(_header);
+
+    // Columns are laid out for a full block; copy only the rows in use of each
+    for (int c = 0; c < Record::COLUMNS; c++)
+    {
+        if (!(_present & (uint64_t(1) << c))) continue;
+        memcpy(output.data() + _size, block.data() + size_t(c) * HISTORICAL_BLOCK_ROWS, size_t(rows) * sizeof(uint64_t));
+        _size += size_t(rows) * sizeof(uint64_t);
+    }
+    writer.Write(output.data(), _size);
+    rows = 0;
+}
+
+/**
+* Historical Block Reader decoding the records of a stream of blocks in order.
+* Blocks of another service type are skipped.
+* Type V is the data type.
+*/
+template<typename V>
+class HistoricalBlockReader
+{
+
+public:
+
+    // Constructor for a binary stream positioned at a block header
+    HistoricalBlockReader(istream& _input);
+
+    // Read the next record and its timestamp, false at the end of the stream
+    bool Next(V& _data, long& _timestamp);
+
+private:
+
+    typedef HistoricalRecord<V> Record;
+
+    // Read the next block of the service type
+    bool ReadBlock();
+
+    istream& input;
+    vector<uint64_t> block;
+    uint64_t row[Record::COLUMNS];
+    uint32_t rows;
+    uint32_t next;
+
+};
+
+template<typename V>
+HistoricalBlockReader<V>::HistoricalBlockReader(istream& _input) : input(_input)
+{
+    rows = 0;
+    next = 0;
+}
+
+template<typename V>
+bool HistoricalBlockReader<V>::ReadBlock()
+{
+    HistoricalBlockHeader _header;
+    while (input.read(reinterpret_cast<char*>(&_header), sizeof(_header)))
+    {
+        if (_header.magic != HISTORICAL_BLOCK_MAGIC || _header.columns > HISTORICAL_MAX_COLUMNS) return false;
+        size_t _columns = __builtin_popcountll(_header.present);
+        if (_header.type != Record::TYPE || _header.columns != Record::COLUMNS || _header.rows == 0)
+        {
+            if (!input.ignore(_columns * _header.rows * sizeof(uint64_t))) return false;
+            continue;
+        }
+
+        // Read the columns written, zeros for the others
+        block.assign(size_t(Record::COLUMNS) * _header.rows, 0);
+        for (int c = 0; c < Record::COLUMNS; c++)
+        {
+            if (!(_header.present & (uint64_t(1) << c))) continue;
+            if (!input.read(reinterpret_cast<char*>(block.data() + size_t(c) * _header.rows), _header.rows * sizeof(uint64_t))) return false;
+        }
+        rows = _header.rows;
+        next = 0;
+        return true;
+    }
+    return false;
+}
+
+template<typename V>
+bool HistoricalBlockReader<V>::Next(V& _data, long& _timestamp)
+{
+    do
+    {
+        if (next == rows && !ReadBlock()) return false;
+        for (int c = 0; c < Record::COLUMNS; c++)
+        {
+            row[c] = block[size_t(c) * rows + next];
+        }
+        next++;
+    }
+    while (!IsRegisteredProduct(row[1]));
+    _data = Record::Decode(row, _timestamp);
+    return true;
+}
+
+#endif
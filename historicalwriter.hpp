@@ -0,0 +1,273 @@
+/**
+ * historicalwriter.hpp
+ * Defines a buffered, optionally asynchronous file writer for persisting historical data.
+ *
+ */
+#ifndef HISTORICAL_WRITER_HPP
+#define HISTORICAL_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+using namespace chrono;
+
+/**
+* Historical Writer keeping one long-lived file handle open in append mode.
+* Records are copied into a large buffer, which is flushed to the file when it is
+* full or when the flush interval has elapsed since the last flush.
+* In asynchronous mode, records are copied into a bounded byte queue instead and
+* a background thread drains the queue into the buffer and the file, so the caller
+* never waits on disk I/O unless the queue is full. Each asynchronous write stays
+* whole in the file when several threads write; a synchronous writer serves one thread.
+*/
+class HistoricalWriter
+{
+
+public:
+
+    // Constructor and destructor
+    HistoricalWriter(const string& _path, size_t _bufferSize = 1 << 20, long _flushMillisec = 1000);
+    ~HistoricalWriter();
+
+    // Start the background writer thread fed by a bounded queue of _queueSize bytes
+    void StartAsync(size_t _queueSize = 1 << 22);
+
+    // Write a record to the file
+    void Write(const char* _record, size_t _size);
+    void Write(const string& _record);
+
+    // Flush everything written so far to the file
+    void Flush();
+
+    // Drain everything still queued, flush the buffer and close the file.
+    // Must be called from the thread that writes records.
+    void Shutdown();
+
+    // Get the path of the file
+    const string& GetPath() const;
+
+    // Check if the writer runs on a background thread
+    bool IsAsync() const;
+
+private:
+
+    // Append bytes to the buffer, flushing on size or time
+    void Append(const char* _data, size_t _size);
+
+    // Write the buffer to the file
+    void FlushBuffer();
+
+    // Body of the background writer thread
+    void Run();
+
+    string path;
+    ofstream file;
+    vector<char> buffer;
+    size_t used;
+    steady_clock::duration flushInterval;
+    steady_clock::time_point lastFlush;
+
+    bool async;
+    bool stopping;
+    vector<char> queue;
+    size_t head;
+    size_t tail;
+    size_t flushRequested;
+    size_t flushCompleted;
+    mutex writeMutex;
+    mutex queueMutex;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    thread worker;
+
+};
+
+HistoricalWriter::HistoricalWriter(const string& _path, size_t _bufferSize, long _flushMillisec) :
+        path(_path), buffer(_bufferSize)
+{
+    file.open(path, ios::app | ios::binary);
+    used = 0;
+    flushInterval = milliseconds(_flushMillisec);
+    lastFlush = steady_clock::now();
+    async = false;
+    stopping = false;
+    head = 0;
+    tail = 0;
+    flushRequested = 0;
+    flushCompleted = 0;
+}
+
+HistoricalWriter::~HistoricalWriter()
+{
+    Shutdown();
+}
+
+void HistoricalWriter::StartAsync(size_t _queueSize)
+{
+    if (async || stopping) return;
+    queue = vector<char>(_queueSize);
+    head = 0;
+    tail = 0;
+    async = true;
+    worker = thread(&HistoricalWriter::Run, this);
+}
+
+void HistoricalWriter::Write(const char* _record, size_t _size)
+{
+    if (!async)
+    {
+        Append(_record, _size);
+        return;
+    }
+
+    // Copy the record into the ring, waiting for the writer thread only when the queue is full;
+    // writers take turns so that a record copied in chunks is not split by another
+    lock_guard<mutex> _writing(writeMutex);
+    size_t _capacity = queue.size();
+    while (_size > 0)
+    {
+        unique_lock<mutex> _lock(queueMutex);
+        notFull.wait(_lock, [&] { return tail - head < _capacity; });
+
+        size_t _free = _capacity - (tail - head);
+        size_t _chunk = _size < _free ? _size : _free;
+        size_t _offset = tail % _capacity;
+        size_t _first = _chunk < _capacity - _offset ? _chunk : _capacity - _offset;
+        memcpy(queue.data() + _offset, _record, _first);
+        memcpy(queue.data(), _record + _first, _chunk - _first);
+        tail += _chunk;
+        _lock.unlock();
+        notEmpty.notify_one();
+
+        _record += _chunk;
+        _size -= _chunk;
+    }
+}
+
+void HistoricalWriter::Write(const string& _record)
+{
+    Write(_record.data(), _record.size());
+}
+
+void HistoricalWriter::Flush()
+{
+    if (async)
+    {
+        // Ask the writer thread to flush and wait until everything queued so far is on disk
+        unique_lock<mutex> _lock(queueMutex);
+        size_t _request = ++flushRequested;
+        notEmpty.notify_one();
+        notFull.wait(_lock, [&] { return flushCompleted >= _request; });
+        return;
+    }
+    FlushBuffer();
+}
+
+void HistoricalWriter::Shutdown()
+{
+    if (async)
+    {
+        {
+            lock_guard<mutex> _lock(queueMutex);
+            stopping = true;
+        }
+        notEmpty.notify_one();
+        notFull.notify_all();
+        if (worker.joinable()) worker.join();
+        async = false;
+    }
+    stopping = true;
+    FlushBuffer();
+    if (file.is_open()) file.close();
+}
+
+const string& HistoricalWriter::GetPath() const
+{
+    return path;
+}
+
+bool HistoricalWriter::IsAsync() const
+{
+    return async;
+}
+
+void HistoricalWriter::Append(const char* _data, size_t _size)
+{
+    while (_size > 0)
+    {
+        size_t _free = buffer.size() - used;
+        size_t _chunk = _size < _free ? _size : _free;
+        memcpy(buffer.data() + used, _data, _chunk);
+        used += _chunk;
+        _data += _chunk;
+        _size -= _chunk;
+        if (used == buffer.size()) FlushBuffer();
+    }
+    if (steady_clock::now() - lastFlush >= flushInterval) FlushBuffer();
+}
+
+void HistoricalWriter::FlushBuffer()
+{
+    if (used > 0 && file.is_open())
+    {
+        file.write(buffer.data(), used);
+        file.flush();
+    }
+    used = 0;
+    lastFlush = steady_clock::now();
+}
+
+void HistoricalWriter::Run()
+{
+    size_t _capacity = queue.size();
+    unique_lock<mutex> _lock(queueMutex);
+    while (true)
+    {
+        notEmpty.wait_for(_lock, flushInterval, [&] { return head != tail || stopping || flushRequested > flushCompleted; });
+
+        // Move everything queued into the file buffer, releasing the lock for the disk write
+        while (head != tail)
+        {
+            size_t _offset = head % _capacity;
+            size_t _chunk = tail - head;
+            if (_chunk > _capacity - _offset) _chunk = _capacity - _offset;
+            size_t _free = buffer.size() - used;
+            if (_chunk > _free) _chunk = _free;
+            memcpy(buffer.data() + used, queue.data() + _offset, _chunk);
+            used += _chunk;
+            head += _chunk;
+            if (used == buffer.size())
+            {
+                _lock.unlock();
+                notFull.notify_all();
+                FlushBuffer();
+                _lock.lock();
+            }
+        }
+        notFull.notify_all();
+
+        bool _stop = stopping;
+        size_t _request = flushRequested;
+        if (_stop || _request > flushCompleted || steady_clock::now() - lastFlush >= flushInterval)
+        {
+            _lock.unlock();
+            FlushBuffer();
+            _lock.lock();
+            if (_request > flushCompleted)
+            {
+                flushCompleted = _request;
+                notFull.notify_all();
+            }
+        }
+        if (_stop && head == tail) break;
+    }
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * idgenerator.hpp
+ * Defines the generator of unique 12-character order and trade identifiers.
+ *
+ */
+#ifndef ID_GENERATOR_HPP
+#define ID_GENERATOR_HPP
+
+#include <string>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+/**
+* ID Generator producing unique 12-character base-36 identifiers without locks or allocation.
+* An identifier encodes a node, the session start in milliseconds, and a sequence number.
+* Threads claim blocks of sequence numbers from a shared atomic counter and then count
+* within their block, so identifiers are unique across threads. A session that starts
+* later starts further up the sequence space: identifiers stay unique across restarts
+* as long as a session averages fewer than 2^14 identifiers per millisecond of uptime.
+*/
+class IdGenerator
+{
+
+public:
+
+    static const int ID_LENGTH = 12;
+    static const int NODES = 64;
+
+    // Constructor for a node, 0 to NODES - 1
+    IdGenerator(int _node = 0);
+
+    // Write the next identifier into a buffer of ID_LENGTH characters
+    void Generate(char* _buffer);
+
+    // Get the next identifier; it fits the string's inline buffer
+    string Generate();
+
+    // Set the node of identifiers generated from now on
+    void SetNode(int _node);
+
+private:
+
+    static const long BLOCK = 1024;
+    static const int SEQUENCE_BITS = 14;
+
+    // Claim the first sequence number of a block for the calling thread
+    long ClaimBlock();
+
+    atomic<long> nextBlock;
+    atomic<int> node;
+    long session;
+
+};
+
+IdGenerator::IdGenerator(int _node) : nextBlock(0), node(_node % NODES)
+{
+    // Milliseconds since 2024-01-01, which leaves room for about 69 years in 12 characters
+    long _millisec = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count() - 1704067200000L;
+    session = (_millisec > 0) ? _millisec : 0;
+}
+
+void IdGenerator::SetNode(int _node)
+{
+    node.store(_node % NODES, memory_order_relaxed);
+}
+
+long IdGenerator::ClaimBlock()
+{
+    return nextBlock.fetch_add(BLOCK, memory_order_relaxed);
+}
+
+void IdGenerator::Generate(char* _buffer)
+{
+    static const char _base[] = "0123456789QWERTYUIOPASDFGHJKLZXCVBNM";
+
+    // Each thread counts through its own block; the generator owning a block is
+    // remembered so threads using several generators do not mix their blocks
+    thread_local const IdGenerator* _owner = nullptr;
+    thread_local long _sequence = 0;
+    thread_local long _end = 0;
+    if (_owner != this || _sequence == _end)
+    {
+        _owner = this;
+        _sequence = ClaimBlock();
+        _end = _sequence + BLOCK;
+    }
+
+    unsigned long _value = ((unsigned long)(session) << SEQUENCE_BITS) + _sequence++;
+    _value = _value * NODES + node.load(memory_order_relaxed);
+    for (int i = ID_LENGTH - 1; i >= 0; i--)
+    {
+        _buffer[i] = _base[_value % 36];
+        _value /= 36;
+    }
+}
+
+string IdGenerator::Generate()
+{
+    char _buffer[ID_LENGTH];
+    Generate(_buffer);
+    return string(_buffer, ID_LENGTH);
+}
+
+// Get the identifier generator of the process
+IdGenerator& GetIdGenerator()
+{
+    static IdGenerator _generator;
+    return _generator;
+}
+
+#endif
@@ -0,0 +1,374 @@
+/**
+ * ingest.hpp
+ * Defines concurrent ingest of input feeds, each read on its own thread and merged by one sequencer.
+ *
+ */
+#ifndef INGEST_HPP
+#define INGEST_HPP
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include "soa.hpp"
+#include "filereader.hpp"
+#include "metrics.hpp"
+#include "compactmessages.hpp"
+
+using namespace std;
+
+// Orders in which the sequencer merges the records of its feeds
+enum IngestOrder { ARRIVAL_ORDER, TIMESTAMP_ORDER };
+
+// States of the next record of a feed
+enum FeedState { FEED_READY, FEED_EMPTY, FEED_DONE };
+
+// Length of the session the records of a file are spread over when merged in timestamp order
+const double INGEST_SESSION_NANOS = 86400e9;
+
+// Get the session time of a record ending at an offset of a file, the share of the file read spread over the session
+long GetSessionTimestamp(size_t _offset, size_t _size)
+{
+    return long(double(_offset) / double(_size) * INGEST_SESSION_NANOS);
+}
+
+/**
+* Feed of records read on its own thread and delivered by the sequencer.
+*/
+class IngestFeed
+{
+
+public:
+
+    virtual ~IngestFeed() = default;
+
+    // Start reading the feed on its own thread
+    virtual void Start() = 0;
+
+    // Get the state of the next record, and its timestamp if it is ready
+    virtual FeedState Peek(long& _timestamp) = 0;
+
+    // Deliver the next record downstream, on the calling thread
+    virtual void Deliver() = 0;
+
+    // Wait for the thread of the feed to finish
+    virtual void Join() = 0;
+
+};
+
+/**
+* Feed of the records parsed from a memory-mapped file, handed to the sequencer over a queue.
+* The input files carry no timestamps. In arrival order a record is stamped when it is parsed;
+* in timestamp order it is stamped with the position of its end in the file, spread over one
+* session, so every file spans the same session and the merge does not depend on thread timing.
+* Positions are taken in the whole file, so a file read from a snapshot offset keeps its stamps.
+* Type V is the record type.
+*/
+template<typename V>
+class FileFeed : public IngestFeed
+{
+
+public:
+
+    // ctor for a feed parsing the lines of a file into records, delivered to a handler on the sequencer thread
+    FileFeed(const string& _path, function<bool(string_view, V&)> _parser, function<void(V&)> _handler, IngestOrder _order, size_t _capacity = 4096);
+    ~FileFeed();
+
+    // Start reading the feed on its own thread
+    void Start() override;
+
+    // Get the state of the next record, and its timestamp if it is ready
+    FeedState Peek(long& _timestamp) override;
+
+    // Deliver the next record downstream, on the calling thread
+    void Deliver() override;
+
+    // Wait for the thread of the feed to finish
+    void Join() override;
+
+private:
+
+    struct Record
+    {
+        long timestamp;
+        V data;
+    };
+
+    // Body of the reading thread
+    void Run();
+
+    string path;
+    function<bool(string_view, V&)> parser;
+    function<void(V&)> handler;
+    IngestOrder order;
+    SPSCQueue<Record> records;
+    Record parsed;
+    Record next;
+    bool hasNext;
+    atomic<bool> done;
+    thread reader;
+
+};
+
+template<typename V>
+FileFeed<V>::FileFeed(const string& _path, function<bool(string_view, V&)> _parser, function<void(V&)> _handler, IngestOrder _order, size_t _capacity) :
+        path(_path), parser(move(_parser)), handler(move(_handler)), order(_order), records(_capacity), hasNext(false), done(false)
+{
+}
+
+template<typename V>
+FileFeed<V>::~FileFeed()
+{
+    Join();
+}
+
+template<typename V>
+void FileFeed<V>::Start()
+{
+    reader = thread(&FileFeed<V>::Run, this);
+}
+
+template<typename V>
+FeedState FileFeed<V>::Peek(long& _timestamp)
+{
+    if (!hasNext)
+    {
+        // Done is read before the queue, so a feed is only done once its last record is taken
+        bool _done = done.load(memory_order_acquire);
+        if (!records.TryPop(next)) return _done ? FEED_DONE : FEED_EMPTY;
+        hasNext = true;
+    }
+    _timestamp = next.timestamp;
+    return FEED_READY;
+}
+
+template<typename V>
+void FileFeed<V>::Deliver()
+{
+    hasNext = false;
+    handler(next.data);
+}
+
+template<typename V>
+void FileFeed<V>::Join()
+{
+    if (reader.joinable()) reader.join();
+}
+
+template<typename V>
+void FileFeed<V>::Run()
+{
+    MappedFile _file(path);
+    if (_file.IsOpen())
+    {
+        string_view _data = _file.GetData();
+        string_view _tail = GetInputOffsets().GetTail(path, _data);
+        size_t _start = _tail.data() - _data.data();
+        LineReader _reader(_tail);
+        string_view _line;
+        while (_reader.Next(_line))
+        {
+            if (!parser(_line, parsed.data)) continue;
+            if (order == TIMESTAMP_ORDER) parsed.timestamp = GetSessionTimestamp(_start + _reader.GetOffset(), _data.size());
+            else parsed.timestamp = GetNanoseconds();
+            while (!records.TryPush(parsed)) this_thread::yield();
+        }
+        GetInputOffsets().Advance(path, _data.size());
+    }
+    done.store(true, memory_order_release);
+}
+
+/**
+* Record of a feed carried as a compact message, or as the full message when it has no compact form.
+* The full message is only allocated for such records, so the common case stays a copy of the compact one.
+* Type C is the compact message type, type V the full message type.
+*/
+template<typename C, typename V>
+struct CompactRecord
+{
+    C compact;
+    shared_ptr<V> full;
+};
+
+/**
+* Sequencer merging the records of several feeds into the downstream services on one thread.
+* In arrival order the earliest record ready is delivered, and an idle feed holds no one back.
+* In timestamp order a record is delivered only once every unfinished feed has one ready,
+* the earliest first and ties to the feed added first, so a run is reproducible.
+*/
+class IngestSequencer
+{
+
+public:
+
+    // ctor for a sequencer merging in an order
+    IngestSequencer(IngestOrder _order);
+
+    // Add a feed to merge
+    void AddFeed(unique_ptr<IngestFeed> _feed);
+
+    // Start the feeds and deliver their records until all are done, return the number of records delivered
+    long Run();
+
+    // Get the order the sequencer merges in
+    IngestOrder GetOrder() const;
+
+private:
+
+    vector<unique_ptr<IngestFeed>> feeds;
+    IngestOrder order;
+
+};
+
+IngestSequencer::IngestSequencer(IngestOrder _order) : order(_order)
+{
+}
+
+void IngestSequencer::AddFeed(unique_ptr<IngestFeed> _feed)
+{
+    feeds.push_back(move(_feed));
+}
+
+long IngestSequencer::Run()
+{
+    for (auto& f : feeds) f->Start();
+    long _delivered = 0;
+    while (true)
+    {
+        int _earliest = -1;
+        long _earliestTimestamp = 0;
+        bool _live = false;
+        bool _waiting = false;
+        for (size_t i = 0; i < feeds.size(); i++)
+        {
+            long _timestamp;
+            FeedState _state = feeds[i]->Peek(_timestamp);
+            if (_state == FEED_DONE) continue;
+            _live = true;
+            if (_state == FEED_EMPTY)
+            {
+                _waiting = true;
+                continue;
+            }
+            if (_earliest < 0 || _timestamp < _earliestTimestamp)
+            {
+                _earliest = int(i);
+                _earliestTimestamp = _timestamp;
+            }
+        }
+        if (!_live) break;
+        if (_earliest < 0 || (_waiting && order == TIMESTAMP_ORDER))
+        {
+            this_thread::yield();
+            continue;
+        }
+        feeds[_earliest]->Deliver();
+        _delivered++;
+    }
+    for (auto& f : feeds) f->Join();
+    return _delivered;
+}
+
+IngestOrder IngestSequencer::GetOrder() const
+{
+    return order;
+}
+
+// Get a feed of the prices of a file, carried as compact messages, for a pricing service
+template<typename S>
+unique_ptr<IngestFeed> MakePriceFeed(const string& _path, S* _service, IngestOrder _order)
+{
+    auto _connector = _service->GetConnector();
+    return make_unique<FileFeed<CompactPrice>>(_path,
+        [_connector](string_view _line, CompactPrice& _compact)
+        {
+            Price<Bond> _price;
+            if (!_connector->ParseLine(_line, _price)) return false;
+            _compact = ToCompact(_price);
+            return true;
+        },
+        [_service](CompactPrice& _compact) { _service->OnMessage(FromCompact(_compact)); }, _order);
+}
+
+// Get a feed of the trades of a file, carried as compact messages, for a trade booking service.
+// A trade with a long ID, or on a book past the registry, is carried in full and booked as read.
+template<typename S>
+unique_ptr<IngestFeed> MakeTradeFeed(const string& _path, S* _service, IngestOrder _order)
+{
+    auto _connector = _service->GetConnector();
+    return make_unique<FileFeed<CompactRecord<CompactTrade, Trade<Bond>>>>(_path,
+        [_connector](string_view _line, CompactRecord<CompactTrade, Trade<Bond>>& _record)
+        {
+            Trade<Bond> _trade;
+            if (!_connector->ParseLine(_line, _trade)) return false;
+            if (ToCompact(_trade, _record.compact)) _record.full.reset();
+            else _record.full = make_shared<Trade<Bond>>(move(_trade));
+            return true;
+        },
+        [_connector](CompactRecord<CompactTrade, Trade<Bond>>& _record)
+        {
+            if (_record.full)
+            {
+                _connector->Deliver(*_record.full);
+                _record.full.reset();
+                return;
+            }
+            Trade<Bond> _trade = FromCompact(_record.compact);
+            _connector->Deliver(_trade);
+        }, _order);
+}
+
+// Get a feed of the order books of a file, carried as compact messages, for a market data service.
+// The parser and the expander keep their stacks, so neither thread allocates per book.
+template<typename S>
+unique_ptr<IngestFeed> MakeOrderBookFeed(const string& _path, S* _service, IngestOrder _order)
+{
+    auto _connector = _service->GetConnector();
+    auto _parser = make_shared<OrderBookParser<Bond>>(_service->GetBookDepth());
+    auto _parsed = make_shared<OrderBook<Bond>>();
+    auto _expander = make_shared<OrderBookExpander>();
+    auto _expanded = make_shared<OrderBook<Bond>>();
+    return make_unique<FileFeed<CompactOrderBook>>(_path,
+        [_parser, _parsed](string_view _line, CompactOrderBook& _compact)
+        {
+            if (!_parser->ParseLine(_line, *_parsed)) return false;
+            _compact = ToCompact(*_parsed);
+            return true;
+        },
+        [_connector, _expander, _expanded](CompactOrderBook& _compact)
+        {
+            _expander->Expand(_compact, *_expanded);
+            _connector->Deliver(*_expanded);
+        }, _order);
+}
+
+// Get a feed of the inquiries of a file, carried as compact messages, for an inquiry service.
+// An inquiry with a long ID is carried in full.
+template<typename S>
+unique_ptr<IngestFeed> MakeInquiryFeed(const string& _path, S* _service, IngestOrder _order)
+{
+    auto _connector = _service->GetConnector();
+    return make_unique<FileFeed<CompactRecord<CompactInquiry, Inquiry<Bond>>>>(_path,
+        [_connector](string_view _line, CompactRecord<CompactInquiry, Inquiry<Bond>>& _record)
+        {
+            Inquiry<Bond> _inquiry;
+            if (!_connector->ParseLine(_line, _inquiry)) return false;
+            if (ToCompact(_inquiry, _record.compact)) _record.full.reset();
+            else _record.full = make_shared<Inquiry<Bond>>(move(_inquiry));
+            return true;
+        },
+        [_service](CompactRecord<CompactInquiry, Inquiry<Bond>>& _record)
+        {
+            if (_record.full)
+            {
+                _service->OnMessage(*_record.full);
+                _record.full.reset();
+                return;
+            }
+            Inquiry<Bond> _inquiry = FromCompact(_record.compact);
+            _service->OnMessage(_inquiry);
+        }, _order);
+}
+
+#endif
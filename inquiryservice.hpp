@@ -8,11 +8,54 @@
 #define INQUIRY_SERVICE_HPP
 
 #include "soa.hpp"
+#include "filereader.hpp"
+#include <deque>
 #include "tradebookingservice.hpp"
+#include "pricingservice.hpp"
+#include "metrics.hpp"
 
 // Various inqyury states
 enum InquiryState { RECEIVED, QUOTED, DONE, REJECTED, CUSTOMER_REJECTED };
 
+// Names of the inquiry states, by state
+constexpr string_view INQUIRY_STATE_NAMES[] = { "RECEIVED", "QUOTED", "DONE", "REJECTED", "CUSTOMER_REJECTED" };
+
+// Events moving an inquiry between states
+enum InquiryEvent { QUOTE, ACCEPT, REJECT, CUSTOMER_REJECT, TIMEOUT };
+
+const int INQUIRY_STATES = CUSTOMER_REJECTED + 1;
+const int INQUIRY_EVENTS = TIMEOUT + 1;
+const int NO_TRANSITION = -1;
+
+// Next state for each state and event, NO_TRANSITION where the event does not apply.
+// An inquiry timing out before it is quoted is rejected by us; a quote timing out lapses with the client.
+constexpr int INQUIRY_TRANSITIONS[INQUIRY_STATES][INQUIRY_EVENTS] =
+{
+    //                        QUOTE          ACCEPT         REJECT         CUSTOMER_REJECT    TIMEOUT
+    /* RECEIVED */          { QUOTED,        NO_TRANSITION, REJECTED,      CUSTOMER_REJECTED, REJECTED },
+    /* QUOTED */            { QUOTED,        DONE,          REJECTED,      CUSTOMER_REJECTED, CUSTOMER_REJECTED },
+    /* DONE */              { NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,     NO_TRANSITION },
+    /* REJECTED */          { NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,     NO_TRANSITION },
+    /* CUSTOMER_REJECTED */ { NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,     NO_TRANSITION }
+};
+
+// Get whether an inquiry state is final
+constexpr bool IsTerminal(InquiryState _state)
+{
+    return _state == DONE || _state == REJECTED || _state == CUSTOMER_REJECTED;
+}
+
+// Get the event a client message carries for an inquiry we already hold
+constexpr InquiryEvent GetClientEvent(InquiryState _state)
+{
+    switch (_state)
+    {
+        case REJECTED: return REJECT;
+        case CUSTOMER_REJECTED: return CUSTOMER_REJECT;
+        default: return ACCEPT;
+    }
+}
+
 /**
  * Inquiry object modeling a customer inquiry from a client.
  * Type T is the product type.
@@ -48,9 +91,15 @@ public:
   // Set the current state on the inquiry
   void SetState(InquiryState _state);
 
+  // Set the price that we respond back with
+  void SetPrice(double _price);
+
   // Change attributes to strings
   vector<string> ToStrings() const;
 
+  // Write attributes as the fields of a row
+  void Format(RowFormatter& _formatter) const;
+
 
 private:
   string inquiryId;
@@ -68,7 +117,7 @@ template<typename T>
 Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
   product(_product)
 {
-  inquiryId = _inquiryId;
+  inquiryId = move(_inquiryId);
   side = _side;
   quantity = _quantity;
   price = _price;
@@ -117,60 +166,171 @@ void Inquiry<T>::SetState(InquiryState _state)
     state = _state;
 }
 
+template<typename T>
+void Inquiry<T>::SetPrice(double _price)
+{
+    price = _price;
+}
+
 template<typename T>
 vector<string> Inquiry<T>::ToStrings() const
 {
     string _inquiryId = inquiryId;
     string _product = product.GetProductId();
-    string _side;
-    if (side == BUY) {
-        _side = "BUY";
-    }
-    else {
-        _side = "SELL";
-    }
-
+    string _side(SIDE_NAMES[side]);
     string _quantity = to_string(quantity);
     string _price = ConvertPrice(price);
-    string _state;
-    switch(state)
-    {
-    case RECEIVED:
-        _state = "RECEIVED";
-        break;
-    case QUOTED:
-        _state = "QUOTED";
-        break;
-    case DONE:
-        _state = "DONE";
-        break;
-    case REJECTED:
-        _state = "REJECTED";
-        break;
-    case CUSTOMER_REJECTED:
-        _state = "CUSTOMER_REJECTED";
-        break;
-    }
+    string _state(INQUIRY_STATE_NAMES[state]);
 
     vector<string> _strings = {_inquiryId, _product, _side, _quantity, _price, _state};
     return _strings;
 }
 
+template<typename T>
+void Inquiry<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(inquiryId);
+    _formatter.Field(product.GetProductId());
+    _formatter.Field(SIDE_NAMES[side]);
+    _formatter.IntegerField(quantity);
+    _formatter.PriceField(price);
+    _formatter.Field(INQUIRY_STATE_NAMES[state]);
+}
+
 template<typename T>
 class InquiryConnector;
 
+/**
+ * Quoting hook pricing a batch of inquiries at once.
+ * Type T is the product type.
+ */
+template<typename T>
+class InquiryQuoter
+{
+
+public:
+
+    virtual ~InquiryQuoter() = default;
+
+    // Fill the price to quote for each inquiry of a batch
+    virtual void Quote(span<Inquiry<T>* const> _inquiries, span<double> _prices) = 0;
+
+};
+
+/**
+ * Quoter pricing inquiries off the mids and bid/offer spreads of the Pricing Service:
+ * a client buying is quoted our offer, a client selling our bid.
+ * Products without a price are quoted back at the client's price.
+ * Type T is the product type.
+ */
+template<typename T>
+class MidQuoter : public InquiryQuoter<T>
+{
+
+private:
+
+    PricingService<T>* pricing;
+
+public:
+
+    MidQuoter(PricingService<T>* _pricing)
+    {
+        pricing = _pricing;
+    };
+
+    // Fill the price to quote for each inquiry of a batch
+    void Quote(span<Inquiry<T>* const> _inquiries, span<double> _prices) override;
+
+};
+
+template<typename T>
+void MidQuoter<T>::Quote(span<Inquiry<T>* const> _inquiries, span<double> _prices)
+{
+    for (size_t i = 0; i < _inquiries.size(); i++)
+    {
+        const Inquiry<T>& _inquiry = *_inquiries[i];
+        int _index = ResolveProductIndex(_inquiry.GetProduct());
+        Price<T>& _price = (_index >= 0) ? pricing->GetData(_index) : pricing->GetData(_inquiry.GetProduct().GetProductId());
+        double _mid = _price.GetMid();
+        if (_mid <= 0)
+        {
+            _prices[i] = _inquiry.GetPrice();
+            continue;
+        }
+        double _half = _price.GetBidOfferSpread() / 2;
+        _prices[i] = (_inquiry.GetSide() == BUY) ? _mid + _half : _mid - _half;
+    }
+}
+
 /**
  * Service for customer inquirry objects.
  * Keyed on inquiry identifier (NOTE: this is NOT a product identifier since each inquiry must be unique).
+ * Live inquiries sit in pooled slots found through an identifier table; an inquiry reaching
+ * DONE, REJECTED or CUSTOMER_REJECTED is handed to the listeners and its slot goes back to the pool.
+ * State changes follow INQUIRY_TRANSITIONS, and client responses queued by the connector are
+ * processed in a loop rather than by re-entering OnMessage.
  * Type T is the product type.
  */
 template<typename T>
 class InquiryService : public Service<string,Inquiry <T> >
 {
 private:
-    map<string, Inquiry<T>> inquiries;
+    // Pooled slot of a live inquiry
+    struct Slot
+    {
+        Inquiry<T> inquiry;
+        long deadline = 0;
+        unsigned generation = 0;
+    };
+
+    // Reference to a slot as it was when queued, stale once the slot is released
+    struct SlotRef
+    {
+        int slot;
+        unsigned generation;
+        long deadline;
+    };
+
+    vector<Slot> slots;
+    vector<int> freeSlots;
+    IdHashTable<int> indices;
+    vector<SlotRef> pending;
+    deque<SlotRef> expiries;
+    vector<int> quoting;
+    vector<Inquiry<T>*> quoteInquiries;
+    vector<double> quotePrices;
+    Inquiry<T> missing;
+    Inquiry<T> response;
     vector<ServiceListener<Inquiry<T>>*> listeners;
     InquiryConnector<T>* connector;
+    InquiryQuoter<T>* quoter;
+    size_t quoteBatch;
+    long timeout;
+
+    // Apply one client message, leaving the responses it triggers queued
+    void Apply(Inquiry<T>& _data);
+
+    // Apply an event to a live inquiry through the transition table, return false if it does not apply
+    bool Transition(int _slot, InquiryEvent _event);
+
+    // Take a slot from the pool for a new inquiry
+    int Acquire(Inquiry<T>& _data);
+
+    // Return the slot of a finished inquiry to the pool
+    void Release(int _slot);
+
+    // Start the timeout of a live inquiry
+    void Arm(int _slot);
+
+    // Quote a live inquiry and publish the quote to the client
+    void Quote(int _slot, double _price);
+
+    // Quote the inquiries waiting for the quoter, leaving the client responses queued
+    void FlushQuotes();
+
+    // Process the client responses queued by the connector
+    void DrainResponses();
+
 public:
     InquiryService();
     // Send a quote back to the client
@@ -179,12 +339,42 @@ public:
     // Reject an inquiry from the client
     void RejectInquiry(const string &inquiryId);
 
-    // Get data by our service with a key
-    Inquiry<T>& GetData(string _key);
+    // Get data by our service with a key, an empty inquiry if it is unknown or finished
+    Inquiry<T>& GetData(const string& _key);
+
+    // Find a live inquiry, nullptr if it is unknown or finished
+    Inquiry<T>* Find(string_view _inquiryId);
+
+    // Get a copy of a live inquiry, empty if it is unknown or finished
+    optional<Inquiry<T>> Lookup(string_view _inquiryId);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(Inquiry<T>& _data);
 
+    // The callback for a batch of data, quoting the new inquiries of the batch together
+    void OnMessages(span<Inquiry<T>> _data);
+
+    // Price new inquiries through a quoter in batches of a size; without a quoter they are quoted back at the client's price
+    void SetQuoter(InquiryQuoter<T>* _quoter, size_t _batch = 256);
+
+    // Quote all inquiries waiting for the quoter
+    void QuotePending();
+
+    // Set the nanoseconds an inquiry may wait for a quote or a client response, 0 for no timeout
+    void SetTimeout(long _nanos);
+
+    // Time out the inquiries whose deadline has passed, return how many timed out
+    size_t ExpireInquiries(long _now);
+
+    // Get the number of live inquiries
+    size_t GetLiveCount() const;
+
+    // Copy the live inquiries, in slot order
+    void GetLiveInquiries(vector<Inquiry<T>>& _inquiries) const;
+
+    // Hold a live inquiry restored from a snapshot in its state, without quoting it or notifying listeners
+    void Restore(Inquiry<T>& _data);
+
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<Inquiry<T>>* _listener)
     {
@@ -205,67 +395,255 @@ public:
 template<typename T>
 InquiryService<T>::InquiryService()
 {
-    inquiries = map<string, Inquiry<T>>();
     listeners = vector<ServiceListener<Inquiry<T>>*>();
     connector = new InquiryConnector<T>(this);
+    quoter = nullptr;
+    quoteBatch = 1;
+    timeout = 0;
 }
 
 template<typename T>
-Inquiry<T>& InquiryService<T>::GetData(string _key)
+Inquiry<T>& InquiryService<T>::GetData(const string& _key)
 {
-    return inquiries[_key];
+    Inquiry<T>* _inquiry = Find(_key);
+    return _inquiry ? *_inquiry : missing;
+}
+
+template<typename T>
+Inquiry<T>* InquiryService<T>::Find(string_view _inquiryId)
+{
+    int* _slot = indices.Find(_inquiryId);
+    return _slot ? &slots[*_slot].inquiry : nullptr;
+}
+
+template<typename T>
+optional<Inquiry<T>> InquiryService<T>::Lookup(string_view _inquiryId)
+{
+    Inquiry<T>* _inquiry = Find(_inquiryId);
+    if (!_inquiry) return nullopt;
+    return *_inquiry;
 }
 
 template<typename T>
 void InquiryService<T>::OnMessage(Inquiry<T>& _data)
 {
-    InquiryState _state = _data.GetState();
-    switch (_state)
+    if (timeout > 0) ExpireInquiries(GetNanoseconds());
+    Apply(_data);
+    DrainResponses();
+}
+
+template<typename T>
+void InquiryService<T>::OnMessages(span<Inquiry<T>> _data)
+{
+    if (timeout > 0) ExpireInquiries(GetNanoseconds());
+    for (auto& d : _data)
     {
-        case RECEIVED: // if the inquiry is received, then we need to send the inquiry to the market
-            inquiries[_data.GetInquiryId()] = _data;
-            connector -> Publish(_data);
-            break;
-        case QUOTED: // if the inquiry is quoted, then we need to send the quote back to the client
-            _data.SetState(DONE);
-            inquiries[_data.GetInquiryId()] = _data;
-            for (auto& l : listeners)
-            {
-                l->ProcessAdd(_data);
-            }
-            break;
-        case DONE:
-            // handle DONE
-            break;
-        case REJECTED:
-            // handle REJECTED
-            break;
-        case CUSTOMER_REJECTED:
-            // handle CUSTOMER_REJECTED
-            break;
-        default:
-            // handle other cases
-            break;
+        Apply(d);
+        DrainResponses();
     }
+    QuotePending();
 }
 
 template<typename T>
-void InquiryService<T>::SendQuote(const string& _inquiryId, double _price)
+void InquiryService<T>::Apply(Inquiry<T>& _data)
 {
-    Inquiry<T>& _inquiry = inquiries[_inquiryId];
-    InquiryState _state = _inquiry.GetState();
-    _inquiry.SetPrice(_price);
+    int* _slot = indices.Find(_data.GetInquiryId());
+    if (_data.GetState() == RECEIVED)
+    {
+        // A repeated request for a live inquiry changes nothing
+        if (_slot) return;
+        int _index = Acquire(_data);
+        if (!quoter)
+        {
+            Quote(_index, slots[_index].inquiry.GetPrice());
+            return;
+        }
+        pending.push_back({_index, slots[_index].generation, 0});
+        if (pending.size() >= quoteBatch) FlushQuotes();
+        return;
+    }
+
+    // Messages for unknown or finished inquiries are dropped without touching the store
+    if (!_slot) return;
+    Transition(*_slot, GetClientEvent(_data.GetState()));
+}
+
+template<typename T>
+bool InquiryService<T>::Transition(int _slot, InquiryEvent _event)
+{
+    Inquiry<T>& _inquiry = slots[_slot].inquiry;
+    int _next = INQUIRY_TRANSITIONS[_inquiry.GetState()][_event];
+    if (_next == NO_TRANSITION) return false;
+    _inquiry.SetState(InquiryState(_next));
+    if (!IsTerminal(_inquiry.GetState())) return true;
+
     for (auto& l : listeners)
     {
         l->ProcessAdd(_inquiry);
     }
+    Release(_slot);
+    return true;
+}
+
+template<typename T>
+int InquiryService<T>::Acquire(Inquiry<T>& _data)
+{
+    int _slot;
+    if (freeSlots.empty())
+    {
+        _slot = int(slots.size());
+        slots.emplace_back();
+    }
+    else
+    {
+        _slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    slots[_slot].inquiry = _data;
+    indices[_data.GetInquiryId()] = _slot;
+    Arm(_slot);
+    return _slot;
+}
+
+template<typename T>
+void InquiryService<T>::Release(int _slot)
+{
+    Slot& _entry = slots[_slot];
+    indices.Erase(_entry.inquiry.GetInquiryId());
+    _entry.deadline = 0;
+    _entry.generation++;
+    freeSlots.push_back(_slot);
+}
+
+template<typename T>
+void InquiryService<T>::Arm(int _slot)
+{
+    if (timeout <= 0) return;
+    Slot& _entry = slots[_slot];
+    _entry.deadline = GetNanoseconds() + timeout;
+    expiries.push_back({_slot, _entry.generation, _entry.deadline});
+}
+
+template<typename T>
+void InquiryService<T>::Quote(int _slot, double _price)
+{
+    if (!Transition(_slot, QUOTE)) return;
+    Inquiry<T>& _inquiry = slots[_slot].inquiry;
+    _inquiry.SetPrice(_price);
+    Arm(_slot);
+    connector->Publish(_inquiry);
+}
+
+template<typename T>
+void InquiryService<T>::FlushQuotes()
+{
+    if (!quoter || pending.empty()) return;
+
+    // Inquiries rejected or timed out while they waited are skipped
+    quoting.clear();
+    quoteInquiries.clear();
+    for (auto& p : pending)
+    {
+        Slot& _entry = slots[p.slot];
+        if (_entry.generation != p.generation || _entry.inquiry.GetState() != RECEIVED) continue;
+        quoting.push_back(p.slot);
+        quoteInquiries.push_back(&_entry.inquiry);
+    }
+    pending.clear();
+
+    quotePrices.resize(quoting.size());
+    quoter->Quote(span<Inquiry<T>* const>(quoteInquiries.data(), quoteInquiries.size()), span<double>(quotePrices.data(), quotePrices.size()));
+    for (size_t i = 0; i < quoting.size(); i++)
+    {
+        Quote(quoting[i], quotePrices[i]);
+    }
+}
+
+template<typename T>
+void InquiryService<T>::DrainResponses()
+{
+    while (connector->NextResponse(response))
+    {
+        Apply(response);
+    }
+}
+
+template<typename T>
+void InquiryService<T>::SendQuote(const string& _inquiryId, double _price)
+{
+    int* _slot = indices.Find(_inquiryId);
+    if (!_slot) return;
+    Quote(*_slot, _price);
+    DrainResponses();
 }
 
 template<typename T>
 void InquiryService<T>::RejectInquiry(const string& _inquiryId)
 {
-    Inquiry<T>& _inquiry = inquiries[_inquiryId];
-    _inquiry.SetState(REJECTED);
+    int* _slot = indices.Find(_inquiryId);
+    if (!_slot) return;
+    Transition(*_slot, REJECT);
+}
+
+template<typename T>
+void InquiryService<T>::SetQuoter(InquiryQuoter<T>* _quoter, size_t _batch)
+{
+    quoter = _quoter;
+    quoteBatch = max(_batch, size_t(1));
+    pending.reserve(quoteBatch);
+}
+
+template<typename T>
+void InquiryService<T>::QuotePending()
+{
+    FlushQuotes();
+    DrainResponses();
+}
+
+template<typename T>
+void InquiryService<T>::SetTimeout(long _nanos)
+{
+    timeout = _nanos;
+}
+
+template<typename T>
+size_t InquiryService<T>::ExpireInquiries(long _now)
+{
+    // Deadlines are queued in the order they were armed, so only the front needs checking
+    size_t _count = 0;
+    while (!expiries.empty() && expiries.front().deadline <= _now)
+    {
+        SlotRef _expiry = expiries.front();
+        expiries.pop_front();
+        Slot& _entry = slots[_expiry.slot];
+        if (_entry.generation != _expiry.generation || _entry.deadline != _expiry.deadline) continue;
+        if (Transition(_expiry.slot, TIMEOUT)) _count++;
+    }
+    return _count;
+}
+
+template<typename T>
+size_t InquiryService<T>::GetLiveCount() const
+{
+    return indices.GetSize();
+}
+
+template<typename T>
+void InquiryService<T>::GetLiveInquiries(vector<Inquiry<T>>& _inquiries) const
+{
+    // Released slots keep the final state their inquiry reached
+    _inquiries.clear();
+    for (auto& s : slots)
+    {
+        if (!IsTerminal(s.inquiry.GetState())) _inquiries.push_back(s.inquiry);
+    }
+}
+
+template<typename T>
+void InquiryService<T>::Restore(Inquiry<T>& _data)
+{
+    if (IsTerminal(_data.GetState()) || indices.Find(_data.GetInquiryId())) return;
+    Acquire(_data);
 }
 
 /****************************************************************************************/
@@ -275,17 +653,34 @@ class InquiryConnector : public Connector<Inquiry<T>>
 {
 private:
     InquiryService<T>* service;
+    vector<Inquiry<T>> responses;
+    size_t responseCount;
+    size_t responseNext;
 public:
     InquiryConnector(InquiryService<T>* _service) {
         service = _service;
+        responseCount = 0;
+        responseNext = 0;
     };
 
-    // Publish data to the Connector
+    // Publish a quote to the client; the simulated client accepts every quote and its response is queued
     void Publish(Inquiry<T>& _data);
 
+    // Take the next queued client response, return false once none are left
+    bool NextResponse(Inquiry<T>& _response);
+
     // Subscribe data from the Connector
     void Subscribe(ifstream& _data);
 
+    // Subscribe data from a memory-mapped file, delivered to the service in batches of a size
+    void SubscribeFile(const string& _path, size_t _batch = 256);
+
+    // Parse one line of inquiry data
+    void ProcessLine(string_view _line);
+
+    // Parse one line of inquiry data into an inquiry, return false if the line is malformed
+    bool ParseLine(string_view _line, Inquiry<T>& _inquiry);
+
     // Re-subscribe data from the Connector
     void Subscribe(Inquiry<T>& _data);
 
@@ -294,45 +689,77 @@ public:
 template<typename T>
 void InquiryConnector<T>::Publish(Inquiry<T>& _data)
 {
-    InquiryState _state = _data.GetState();
-    if (_state == RECEIVED)
+    if (_data.GetState() != QUOTED) return;
+    if (responseCount == responses.size()) responses.emplace_back();
+    responses[responseCount++] = _data;
+}
+
+template<typename T>
+bool InquiryConnector<T>::NextResponse(Inquiry<T>& _response)
+{
+    if (responseNext == responseCount)
     {
-        _data.SetState(QUOTED);
-        this->Subscribe(_data);
+        responseNext = 0;
+        responseCount = 0;
+        return false;
     }
+    _response = responses[responseNext++];
+    return true;
 }
 
 template<typename T>
 void InquiryConnector<T>::Subscribe(ifstream& _data)
 {
-    string _line;
-    while (getline(_data, _line))
-    {
-        stringstream _lineStream(_line);
-        string _cell;
-        vector<string> _cells;
-        while (getline(_lineStream, _cell, ','))
-        {
-            _cells.push_back(_cell);
-        }
+    ForEachLine(_data, [&](string_view _line) { ProcessLine(_line); });
+}
 
-        string _inquiryId = _cells[0];
-        string _productId = _cells[1];
-        Side _side;
-        if (_cells[2] == "BUY") _side = BUY;
-        else if (_cells[2] == "SELL") _side = SELL;
-        long _quantity = stol(_cells[3]);
-        double _price = ConvertPrice(_cells[4]);
-        InquiryState _state;
-        if (_cells[5] == "RECEIVED") _state = RECEIVED;
-        else if (_cells[5] == "QUOTED") _state = QUOTED;
-        else if (_cells[5] == "DONE") _state = DONE;
-        else if (_cells[5] == "REJECTED") _state = REJECTED;
-        else if (_cells[5] == "CUSTOMER_REJECTED") _state = CUSTOMER_REJECTED;
-        T _product = GetBond(_productId);
-        Inquiry<T> _inquiry(_inquiryId, _product, _side, _quantity, _price, _state);
-        service->OnMessage(_inquiry);
+template<typename T>
+void InquiryConnector<T>::SubscribeFile(const string& _path, size_t _batch)
+{
+    if (_batch <= 1)
+    {
+        ForEachLine(_path, [&](string_view _line) { ProcessLine(_line); });
+        return;
     }
+
+    vector<Inquiry<T>> _inquiries(_batch);
+    size_t _count = 0;
+    ForEachLine(_path, [&](string_view _line)
+    {
+        if (!ParseLine(_line, _inquiries[_count])) return;
+        if (++_count < _batch) return;
+        service->OnMessages(span<Inquiry<T>>(_inquiries.data(), _count));
+        _count = 0;
+    });
+    if (_count > 0) service->OnMessages(span<Inquiry<T>>(_inquiries.data(), _count));
+}
+
+template<typename T>
+void InquiryConnector<T>::ProcessLine(string_view _line)
+{
+    Inquiry<T> _inquiry;
+    if (!ParseLine(_line, _inquiry)) return;
+    service->OnMessage(_inquiry);
+}
+
+template<typename T>
+bool InquiryConnector<T>::ParseLine(string_view _line, Inquiry<T>& _inquiry)
+{
+    string_view _cells[6];
+    if (SplitCells(_line, _cells, 6) < 6) return false;
+
+    string _inquiryId(_cells[0]);
+    Side _side = (_cells[2] == "SELL") ? SELL : BUY;
+    long _quantity = ParseLong(_cells[3]);
+    double _price = ConvertPrice(_cells[4]);
+    InquiryState _state = RECEIVED;
+    if (_cells[5] == "QUOTED") _state = QUOTED;
+    else if (_cells[5] == "DONE") _state = DONE;
+    else if (_cells[5] == "REJECTED") _state = REJECTED;
+    else if (_cells[5] == "CUSTOMER_REJECTED") _state = CUSTOMER_REJECTED;
+    const T& _product = GetBond(_cells[1]);
+    _inquiry = Inquiry<T>(move(_inquiryId), _product, _side, _quantity, _price, _state);
+    return true;
 }
 
 template<typename T>
@@ -5,82 +5,301 @@
 #include <iostream>
 #include <map>
 
+#include "allocationcounter.hpp"
 #include "soa.hpp"
 #include "products.hpp"
 //#include "algoexecutionservice.hpp"
 #include "algostreamingservice.hpp"
+#include "bondanalytics.hpp"
 #include "executionservice.hpp"
 #include "guiservice.hpp"
 #include "historicaldataservice.hpp"
+#include "ingest.hpp"
 #include "inquiryservice.hpp"
 #include "marketdataservice.hpp"
 #include "positionservice.hpp"
 #include "pricingservice.hpp"
 #include "riskservice.hpp"
+#include "shardedpipeline.hpp"
+#include "sharedmemory.hpp"
+#include "snapshot.hpp"
 #include "streamingservice.hpp"
 #include "tradebookingservice.hpp"
+#include "venuerouter.hpp"
 
 using namespace std;
 
-int main()
+// Services of the single pipeline from market data to risk, typed statically as in a trading shard:
+// each hop is bound to its downstream listener, or to the pipelined stage running it, and called
+// directly. Listeners added at runtime, such as historical data and shared memory, still work on every service.
+typedef RiskService<Bond> MainRiskService;
+typedef PositionService<Bond, RiskToPositionListener<Bond, MainRiskService>, AsyncServiceListener<Position<Bond>>> MainPositionService;
+typedef TradeBookingService<Bond, PositionToTradeBookingListener<Bond, MainPositionService>> MainTradeBookingService;
+typedef ExecutionService<Bond, TradeBookingToExecutionListener<Bond, MainTradeBookingService>> MainExecutionService;
+typedef AlgoExecutionService<Bond, ExecutionToAlgoExecutionListener<Bond, MainExecutionService>> MainAlgoExecutionService;
+typedef MarketDataService<Bond, AlgoExecutionToMarketDataListener<Bond, MainAlgoExecutionService>, AsyncServiceListener<OrderBook<Bond>>> MainMarketDataService;
+typedef ServiceSnapshot<Bond, MainPositionService, MainRiskService, MainMarketDataService, MainAlgoExecutionService, MainTradeBookingService> MainServiceSnapshot;
+
+int main(int argc, char* argv[])
 {
+    // With --shards N, market data through risk run in N shards partitioned by CUSIP
+    // With --ingest arrival|timestamp, the four inputs are read at once on their own threads and merged
+    // by one sequencer in arrival or timestamp order, with every downstream service run on the
+    // sequencer thread (single pipeline only)
+    int _shards = 0;
+    bool _ingest = false;
+    IngestOrder _ingestOrder = ARRIVAL_ORDER;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) == "--shards") _shards = max(0, atoi(argv[i + 1]));
+        if (string(argv[i]) != "--ingest") continue;
+        _ingest = true;
+        _ingestOrder = (string(argv[i + 1]) == "timestamp") ? TIMESTAMP_ORDER : ARRIVAL_ORDER;
+    }
+    if (_shards > 0) _ingest = false;
+
+    // With --delta-streams, price streams are conflated per CUSIP and unchanged quotes are not published;
+    // streaming.txt gets the fields that changed in each stream, streaming.bin the full streams
+    // With --venues, executions are sent to simulated venues and trades are booked on their fills
+    // With --snapshot, state is restored from snapshot.bin, only the unread tails of the inputs are
+    // replayed, and a snapshot is saved after each input (single pipeline only)
+    // With --shared-memory, the latest prices, positions, risk and streams are published to /tradingsystem
+    bool _deltaStreams = false;
+    bool _venues = false;
+    bool _snapshots = false;
+    bool _sharedMemory = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--delta-streams") _deltaStreams = true;
+        if (string(argv[i]) == "--venues") _venues = true;
+        if (string(argv[i]) == "--snapshot") _snapshots = true;
+        if (string(argv[i]) == "--shared-memory") _sharedMemory = true;
+    }
+
     cout << TimeStamp() << "Program Starting..." << endl;
     cout << TimeStamp() << "Program Started." << endl;
 
+    cout << TimeStamp() << "Products Loading..." << endl;
+    GetProductRegistry().Load("bonds.txt");
+    cout << TimeStamp() << "Products Loaded." << endl;
+
     cout << TimeStamp() << "Services Initializing..." << endl;
     PricingService<Bond> pricingService;
-    TradeBookingService<Bond> tradeBookingService;
-    PositionService<Bond> positionService;
-    RiskService<Bond> riskService;
-    MarketDataService<Bond> marketDataService;
-    AlgoExecutionService<Bond> algoExecutionService;
+    MainTradeBookingService tradeBookingService;
+    MainPositionService positionService;
+    MainRiskService riskService;
+    MainMarketDataService marketDataService;
+    MainAlgoExecutionService algoExecutionService;
     AlgoStreamingService<Bond> algoStreamingService;
     GUIService<Bond> guiService;
-    ExecutionService<Bond> executionService;
+    MainExecutionService executionService;
     StreamingService<Bond> streamingService;
     InquiryService<Bond> inquiryService;
-    HistoricalDataService<Position<Bond>> historicalPositionService(POSITION);
-    HistoricalDataService<PV01<Bond>> historicalRiskService(RISK);
-    HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION);
-    HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING);
-    HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY);
+    HistoricalDataService<Position<Bond>> historicalPositionService(POSITION, true, BINARY | TEXT);
+    HistoricalDataService<PV01<Bond>> historicalRiskService(RISK, true, BINARY | TEXT);
+    HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION, true, BINARY | TEXT);
+    HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING, true, _deltaStreams ? BINARY : BINARY | TEXT);
+    HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY, true, BINARY | TEXT);
+    HistoricalDataService<Trade<Bond>> historicalTradeService(TRADE, true, BINARY | TEXT);
+    BondAnalytics bondAnalytics(from_string("2017/12/01"));
+    bondAnalytics.Load();
+    BondAnalyticsToPricingListener bondAnalyticsListener(&bondAnalytics, &riskService);
     cout << TimeStamp() << "Services Initialized." << endl;
 
     cout << TimeStamp() << "Services Linking..." << endl;
-    pricingService.AddListener(algoStreamingService.GetListener());
-    pricingService.AddListener(guiService.GetListener());
-    algoStreamingService.AddListener(streamingService.GetListener());
-    streamingService.AddListener(historicalStreamingService.GetListener());
-    marketDataService.AddListener(algoExecutionService.GetListener());
-    algoExecutionService.AddListener(executionService.GetListener());
-    executionService.AddListener(tradeBookingService.GetListener());
-    executionService.AddListener(historicalExecutionService.GetListener());
-    tradeBookingService.AddListener(positionService.GetListener());
-    positionService.AddListener(riskService.GetListener());
-    positionService.AddListener(historicalPositionService.GetListener());
-    riskService.AddListener(historicalRiskService.GetListener());
-    inquiryService.AddListener(historicalInquiryService.GetListener());
+    riskService.AddSector(BucketedSector<Bond>({GetBond("9128283H1"), GetBond("9128283L2")}, "FrontEnd"));
+    riskService.AddSector(BucketedSector<Bond>({GetBond("912828M80"), GetBond("9128283J7"), GetBond("9128283F5")}, "Belly"));
+    riskService.AddSector(BucketedSector<Bond>({GetBond("912810RZ3")}, "LongEnd"));
+    pricingService.AddListener(Instrument("AlgoStreaming", algoStreamingService.GetListener()));
+    pricingService.AddListener(Instrument("GUI", guiService.GetListener()));
+    pricingService.AddListener(Instrument("BondAnalytics", &bondAnalyticsListener));
+    algoStreamingService.AddListener(Instrument("Streaming", streamingService.GetListener()));
+    streamingService.AddListener(Instrument("HistoricalStreaming", historicalStreamingService.GetListener()));
+    unique_ptr<HistoricalDeltaWriter<Bond>> historicalDeltaWriter;
+    if (_deltaStreams)
+    {
+        historicalDeltaWriter = make_unique<HistoricalDeltaWriter<Bond>>(GetHistoricalFile(STREAMING));
+        streamingService.AddDeltaListener(Instrument("HistoricalStreamingDelta", historicalDeltaWriter.get()));
+        streamingService.SetMode(DELTA_STREAMS);
+    }
+    inquiryService.AddListener(Instrument("HistoricalInquiry", historicalInquiryService.GetListener()));
+    unique_ptr<AsyncServiceListener<OrderBook<Bond>>> algoExecutionStage;
+    unique_ptr<AsyncServiceListener<Position<Bond>>> riskStage;
+    unique_ptr<ShardedPipeline<Bond>> pipeline;
+    unique_ptr<SimulatedVenueTransport> venueTransport;
+    unique_ptr<VenueRouter<Bond>> venueRouter;
+    OnMessageListener<RiskService<Bond>, PV01<Bond>> riskMerge(&riskService);
+    if (_shards > 0)
+    {
+        // Shards risk their own positions; merged risk feeds the bucketed sectors and persistence
+        pipeline = make_unique<ShardedPipeline<Bond>>(_shards, 4096, (thread::hardware_concurrency() > unsigned(_shards) + 3) ? 1 : -1);
+        pipeline->AddExecutionListener(Instrument("HistoricalExecution", historicalExecutionService.GetListener()));
+        pipeline->AddPositionListener(Instrument("HistoricalPosition", historicalPositionService.GetListener()));
+        pipeline->AddRiskListener(Instrument("Risk", &riskMerge));
+        pipeline->AddRiskListener(Instrument("HistoricalRisk", historicalRiskService.GetListener()));
+        pipeline->AddEvictedTradeListener(Instrument("HistoricalTrade", historicalTradeService.GetListener()));
+        marketDataService.GetConnector()->SetRouter(pipeline->GetOrderBookRouter());
+        tradeBookingService.GetConnector()->SetRouter(pipeline->GetTradeRouter());
+    }
+    else if (_ingest)
+    {
+        // Prices update the PV01s risk reads, so the services run on the sequencer thread
+        marketDataService.BindListeners(algoExecutionService.GetListener(), nullptr);
+        positionService.BindListeners(riskService.GetListener(), nullptr);
+    }
+    else
+    {
+        // Market data and risk run as pipelined stages on their own threads
+        algoExecutionStage = make_unique<AsyncServiceListener<OrderBook<Bond>>>(Instrument("AlgoExecution", algoExecutionService.GetListener()), 4096, 1);
+        algoExecutionStage->Prime(SampleOrderBook<Bond>(marketDataService.GetBookDepth()));
+        riskStage = make_unique<AsyncServiceListener<Position<Bond>>>(Instrument("Risk", riskService.GetListener()), 4096, 2);
+        marketDataService.BindListeners(nullptr, algoExecutionStage.get());
+        positionService.BindListeners(nullptr, riskStage.get());
+    }
+    if (!pipeline)
+    {
+        algoExecutionService.BindListeners(executionService.GetListener());
+        if (_venues)
+        {
+            venueTransport = make_unique<SimulatedVenueTransport>();
+            venueRouter = make_unique<VenueRouter<Bond>>(venueTransport.get());
+            executionService.AddListener(Instrument("VenueRouter", venueRouter.get()));
+            venueRouter->AddFillListener(Instrument("TradeBooking", tradeBookingService.GetListener()));
+        }
+        else executionService.BindListeners(tradeBookingService.GetListener());
+        executionService.AddListener(Instrument("HistoricalExecution", historicalExecutionService.GetListener()));
+        tradeBookingService.BindListeners(positionService.GetListener());
+        tradeBookingService.SetEvictionListener(Instrument("HistoricalTrade", historicalTradeService.GetListener()));
+        positionService.AddListener(Instrument("HistoricalPosition", historicalPositionService.GetListener()));
+        riskService.AddListener(Instrument("HistoricalRisk", historicalRiskService.GetListener()));
+    }
+    unique_ptr<SharedMemoryPublisher> sharedMemory;
+    unique_ptr<SharedMemoryListener<Price<Bond>>> sharedPrices;
+    unique_ptr<SharedMemoryListener<Position<Bond>>> sharedPositions;
+    unique_ptr<SharedMemoryListener<PV01<Bond>>> sharedRisk;
+    unique_ptr<SharedMemoryListener<PriceStream<Bond>>> sharedStreams;
+    if (_sharedMemory)
+    {
+        // Each product's positions and risk are written by one thread, in either pipeline
+        sharedMemory = make_unique<SharedMemoryPublisher>("/tradingsystem");
+        sharedPrices = make_unique<SharedMemoryListener<Price<Bond>>>(sharedMemory.get());
+        sharedPositions = make_unique<SharedMemoryListener<Position<Bond>>>(sharedMemory.get());
+        sharedRisk = make_unique<SharedMemoryListener<PV01<Bond>>>(sharedMemory.get());
+        sharedStreams = make_unique<SharedMemoryListener<PriceStream<Bond>>>(sharedMemory.get());
+        guiService.AddListener(Instrument("SharedPrices", sharedPrices.get()));
+        streamingService.AddListener(Instrument("SharedStreams", sharedStreams.get()));
+        if (pipeline)
+        {
+            pipeline->AddPositionListener(Instrument("SharedPositions", sharedPositions.get()));
+            pipeline->AddRiskListener(Instrument("SharedRisk", sharedRisk.get()));
+        }
+        else
+        {
+            positionService.AddListener(Instrument("SharedPositions", sharedPositions.get()));
+            riskService.AddListener(Instrument("SharedRisk", sharedRisk.get()));
+        }
+    }
     cout << TimeStamp() << "Services Linked." << endl;
 
-    cout << TimeStamp() << "Price Data Processing..." << endl;
-    ifstream priceData("prices.txt");
-    pricingService.GetConnector()->Subscribe(priceData);
-    cout << TimeStamp() << "Price Data Processed." << endl;
-
-    cout << TimeStamp() << "Trade Data Processing..." << endl;
-    ifstream tradeData("trades.txt");
-    tradeBookingService.GetConnector()->Subscribe(tradeData);
-    cout << TimeStamp() << "Trade Data Processed." << endl;
-
-    cout << TimeStamp() << "Market Data Processing..." << endl;
-    ifstream marketData("marketdata.txt");
-    marketDataService.GetConnector()->Subscribe(marketData);
-    cout << TimeStamp() << "Market Data Processed." << endl;
-
-    cout << TimeStamp() << "Inquiry Data Processing..." << endl;
-    ifstream inquiryData("inquiries.txt");
-    inquiryService.GetConnector()->Subscribe(inquiryData);
-    cout << TimeStamp() << "Inquiry Data Processed." << endl;
+    unique_ptr<MainServiceSnapshot> snapshot;
+    if (_snapshots && !pipeline)
+    {
+        snapshot = make_unique<MainServiceSnapshot>("snapshot.bin", &positionService, &riskService, &marketDataService, &inquiryService,
+                                                    &algoExecutionService, &algoStreamingService, &tradeBookingService);
+        for (auto& _input : {"prices.txt", "trades.txt", "marketdata.txt", "inquiries.txt"}) GetInputOffsets().Track(_input);
+        cout << TimeStamp() << "Snapshot Loading..." << endl;
+        cout << TimeStamp() << (snapshot->Load() ? "Snapshot Loaded." : "No Snapshot Found.") << endl;
+    }
+
+    if (_ingest)
+    {
+        cout << TimeStamp() << "Input Data Processing..." << endl;
+        long _records;
+        {
+            ScopedLatency _latency(GetStageMetrics("IngestSequencer::Run"));
+            IngestSequencer _sequencer(_ingestOrder);
+            _sequencer.AddFeed(MakePriceFeed("prices.txt", &pricingService, _ingestOrder));
+            _sequencer.AddFeed(MakeTradeFeed("trades.txt", &tradeBookingService, _ingestOrder));
+            _sequencer.AddFeed(MakeOrderBookFeed("marketdata.txt", &marketDataService, _ingestOrder));
+            _sequencer.AddFeed(MakeInquiryFeed("inquiries.txt", &inquiryService, _ingestOrder));
+            _records = _sequencer.Run();
+            bondAnalyticsListener.Recompute();
+            if (venueRouter) venueRouter->Drain();
+        }
+        if (snapshot) snapshot->Save();
+        cout << TimeStamp() << "Input Data Processed with " << _records << " Records." << endl;
+    }
+    else
+    {
+        cout << TimeStamp() << "Price Data Processing..." << endl;
+        {
+            ScopedLatency _latency(GetStageMetrics("PricingConnector::Subscribe"));
+            pricingService.GetConnector()->SubscribeFile("prices.txt");
+            bondAnalyticsListener.Recompute();
+        }
+        if (snapshot) snapshot->Save();
+        cout << TimeStamp() << "Price Data Processed." << endl;
+
+        cout << TimeStamp() << "Trade Data Processing..." << endl;
+        {
+            ScopedLatency _latency(GetStageMetrics("TradeBookingConnector::Subscribe"));
+            tradeBookingService.GetConnector()->SubscribeFile("trades.txt");
+            if (pipeline) pipeline->Drain();
+            else riskStage->Drain();
+        }
+        if (snapshot) snapshot->Save();
+        cout << TimeStamp() << "Trade Data Processed." << endl;
+
+        cout << TimeStamp() << "Market Data Processing..." << endl;
+        long _allocations = GetAllocationCount();
+        {
+            ScopedLatency _latency(GetStageMetrics("MarketDataConnector::Subscribe"));
+            marketDataService.GetConnector()->SubscribeFile("marketdata.txt", thread::hardware_concurrency());
+            if (pipeline) pipeline->Drain();
+            else
+            {
+                algoExecutionStage->Drain();
+                if (venueRouter) venueRouter->Drain();
+                riskStage->Drain();
+            }
+        }
+        if (snapshot) snapshot->Save();
+        cout << TimeStamp() << "Market Data Processed with " << GetAllocationCount() - _allocations << " Heap Allocations." << endl;
+    }
+
+    for (auto& _sector : {"FrontEnd", "Belly", "LongEnd"})
+    {
+        cout << TimeStamp() << "Bucketed Risk " << _sector << ": " << riskService.GetBucketedPV01(riskService.GetSectorIndex(_sector)) << endl;
+    }
+
+    if (!_ingest)
+    {
+        cout << TimeStamp() << "Inquiry Data Processing..." << endl;
+        {
+            ScopedLatency _latency(GetStageMetrics("InquiryConnector::Subscribe"));
+            inquiryService.GetConnector()->SubscribeFile("inquiries.txt");
+        }
+        if (snapshot) snapshot->Save();
+        cout << TimeStamp() << "Inquiry Data Processed." << endl;
+    }
+
+    cout << TimeStamp() << "Historical Data Persisting..." << endl;
+    if (pipeline) pipeline->Stop();
+    else
+    {
+        if (algoExecutionStage) algoExecutionStage->Stop();
+        if (venueTransport) venueTransport->Stop();
+        if (riskStage) riskStage->Stop();
+    }
+    streamingService.Stop();
+    if (historicalDeltaWriter) historicalDeltaWriter->Close();
+    guiService.Stop();
+    ShutdownHistoricalWriters();
+    cout << TimeStamp() << "Historical Data Persisted." << endl;
+
+    if (sharedMemory) cout << TimeStamp() << "Shared Memory " << (sharedMemory->IsOpen() ? "Published to " : "Not Opened: ") << sharedMemory->GetName() << endl;
+    if (_deltaStreams) cout << TimeStamp() << "Price Streams Conflated: " << streamingService.GetConflatedCount() << ", Unchanged: " << streamingService.GetSuppressedCount() << endl;
+    DumpMetrics(cout);
 
     cout << TimeStamp() << "Program Ending..." << endl;
     cout << TimeStamp() << "Program Ended." << endl;
@@ -9,13 +9,22 @@
 
 #include <string>
 #include <vector>
+#include <future>
+#include <span>
+#include <algorithm>
+#include <cmath>
 #include "soa.hpp"
+#include "filereader.hpp"
+#include "metrics.hpp"
 
 using namespace std;
 
 // Side for market data
 enum PricingSide { BID, OFFER };
 
+// Names of the pricing sides, by side
+constexpr string_view PRICING_SIDE_NAMES[] = { "BID", "OFFER" };
+
 /**
  * A market data order with price, quantity, and side.
  */
@@ -38,9 +47,9 @@ public:
   PricingSide GetSide() const;
 
 private:
-  double price;
-  long quantity;
-  PricingSide side;
+  double price = 0;
+  long quantity = 0;
+  PricingSide side = BID;
 
 };
 
@@ -74,6 +83,7 @@ class BidOffer
 public:
 
   // ctor for bid/offer
+  BidOffer() = default;
   BidOffer(const Order &_bidOrder, const Order &_offerOrder):
     bidOrder(_bidOrder), offerOrder(_offerOrder)
     {};
@@ -110,6 +120,12 @@ public:
   OrderBook() = default;
   OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack);
 
+  // Rebuild the book in place, swapping the stacks in; the vectors get the previous stacks back
+  void Assign(const T &_product, vector<Order> &_bidStack, vector<Order> &_offerStack);
+
+  // Rebuild the book in place, copying the orders into the capacity of the current stacks
+  void Assign(const T &_product, span<const Order> _bidStack, span<const Order> _offerStack);
+
   // Get the product
   const T& GetProduct() const
   {
@@ -128,13 +144,33 @@ public:
       return offerStack;
   };
 
-  // Get the best bid/offer order
-  const BidOffer GetBidOffer() const;
+  // Get the best bid/offer order, found once when the book is built
+  const BidOffer& GetBidOffer() const
+  {
+      return bidOffer;
+  };
+
+  // Get the time the book was read from the feed, in monotonic nanoseconds
+  long GetTimestamp() const
+  {
+      return timestamp;
+  };
+
+  // Set the time the book was read from the feed
+  void SetTimestamp(long _timestamp)
+  {
+      timestamp = _timestamp;
+  };
 
 private:
   T product;
   vector<Order> bidStack;
   vector<Order> offerStack;
+  BidOffer bidOffer;
+  long timestamp = 0;
+
+  // Find the best bid/offer order on the stacks
+  BidOffer FindBidOffer() const;
 
 };
 
@@ -142,75 +178,295 @@ template<typename T>
 OrderBook<T>::OrderBook(const T& _product, const vector<Order>& _bidStack, const vector<Order>& _offerStack) :
         product(_product), bidStack(_bidStack), offerStack(_offerStack)
 {
+    bidOffer = FindBidOffer();
+}
+
+template<typename T>
+void OrderBook<T>::Assign(const T& _product, vector<Order>& _bidStack, vector<Order>& _offerStack)
+{
+    product = _product;
+    bidStack.swap(_bidStack);
+    offerStack.swap(_offerStack);
+    bidOffer = FindBidOffer();
 }
 
 template<typename T>
-const BidOffer OrderBook<T>::GetBidOffer() const
+void OrderBook<T>::Assign(const T& _product, span<const Order> _bidStack, span<const Order> _offerStack)
 {
-    double _bidPrice = INT_MIN;
-    Order _bidOrder;
-    for (auto& b : bidStack)
+    product = _product;
+    bidStack.assign(_bidStack.begin(), _bidStack.end());
+    offerStack.assign(_offerStack.begin(), _offerStack.end());
+    bidOffer = FindBidOffer();
+}
+
+template<typename T>
+BidOffer OrderBook<T>::FindBidOffer() const
+{
+    Order _bidOrder(0, 0, BID);
+    for (size_t i = 0; i < bidStack.size(); i++)
     {
-        double _price = b.GetPrice();
-        if (_price > _bidPrice)
-        {
-            _bidPrice = _price;
-            _bidOrder = b;
-        }
+        if (i == 0 || bidStack[i].GetPrice() > _bidOrder.GetPrice()) _bidOrder = bidStack[i];
     }
 
-    double _offerPrice = INT_MAX;
-    Order _offerOrder;
-    for (auto& o : offerStack)
+    Order _offerOrder(0, 0, OFFER);
+    for (size_t i = 0; i < offerStack.size(); i++)
     {
-        double _price = o.GetPrice();
-        if (_price < _offerPrice)
-        {
-            _offerPrice = _price;
-            _offerOrder = o;
-        }
+        if (i == 0 || offerStack[i].GetPrice() < _offerOrder.GetPrice()) _offerOrder = offerStack[i];
     }
 
     return BidOffer(_bidOrder, _offerOrder);
 }
 
+// Get a book with _bookDepth orders a side, copied into queued books to size their stacks up front
 template<typename T>
+OrderBook<T> SampleOrderBook(int _bookDepth)
+{
+    return OrderBook<T>(T(), vector<Order>(_bookDepth, Order(0, 0, BID)), vector<Order>(_bookDepth, Order(0, 0, OFFER)));
+}
+
+/**
+ * Price level book keyed on integer 1/256 ticks, with incremental updates.
+ * Each side keeps its aggregated levels sorted best first, so the best bid/offer is
+ * cached at the front and depth is read without rescanning or allocating.
+ */
+class PriceLevelBook
+{
+
+public:
+
+  // ctor for the price level book
+  PriceLevelBook(int _bookDepth = 5);
+
+  // Replace the book with a full snapshot of bid and offer stacks
+  void ApplySnapshot(const vector<Order> &_bidStack, const vector<Order> &_offerStack);
+
+  // Add quantity at a price level, removing the level when its quantity drops to zero
+  void AddOrder(PricingSide _side, double _price, long _quantity);
+
+  // Set the quantity at a price level, deleting the level when the quantity is zero
+  void ModifyLevel(PricingSide _side, double _price, long _quantity);
+
+  // Delete a price level
+  void DeleteLevel(PricingSide _side, double _price);
+
+  // Remove all levels
+  void Clear();
+
+  // Set the number of levels reported as depth
+  void SetBookDepth(int _bookDepth)
+  {
+      bookDepth = _bookDepth;
+  };
+
+  // Get the cached best bid/offer
+  const BidOffer& GetBidOffer() const
+  {
+      return bidOffer;
+  };
+
+  // Get the number of aggregated levels on a side, up to the book depth
+  int GetLevelCount(PricingSide _side) const;
+
+  // Get an aggregated level on a side, 0 being the best
+  Order GetLevel(PricingSide _side, int _level) const;
+
+private:
+
+  struct Level
+  {
+      long ticks;
+      long quantity;
+  };
+
+  // Get the levels of a side
+  vector<Level>& GetLevels(PricingSide _side)
+  {
+      return (_side == BID) ? bids : offers;
+  };
+
+  // Find the position of a price on a side, keeping bids descending and offers ascending
+  size_t FindLevel(PricingSide _side, long _ticks);
+
+  // Refresh the cached best order of a side
+  void UpdateBest(PricingSide _side);
+
+  int bookDepth;
+  vector<Level> bids;
+  vector<Level> offers;
+  BidOffer bidOffer;
+
+};
+
+PriceLevelBook::PriceLevelBook(int _bookDepth)
+{
+    bookDepth = _bookDepth;
+    bids.reserve(_bookDepth * 2);
+    offers.reserve(_bookDepth * 2);
+    bidOffer = BidOffer(Order(0, 0, BID), Order(0, 0, OFFER));
+}
+
+void PriceLevelBook::ApplySnapshot(const vector<Order> &_bidStack, const vector<Order> &_offerStack)
+{
+    bids.clear();
+    offers.clear();
+    for (auto& b : _bidStack) AddOrder(BID, b.GetPrice(), b.GetQuantity());
+    for (auto& o : _offerStack) AddOrder(OFFER, o.GetPrice(), o.GetQuantity());
+    UpdateBest(BID);
+    UpdateBest(OFFER);
+}
+
+size_t PriceLevelBook::FindLevel(PricingSide _side, long _ticks)
+{
+    vector<Level>& _levels = GetLevels(_side);
+    size_t _low = 0;
+    size_t _high = _levels.size();
+    while (_low < _high)
+    {
+        size_t _mid = (_low + _high) / 2;
+        bool _better = (_side == BID) ? _levels[_mid].ticks > _ticks : _levels[_mid].ticks < _ticks;
+        if (_better) _low = _mid + 1;
+        else _high = _mid;
+    }
+    return _low;
+}
+
+void PriceLevelBook::AddOrder(PricingSide _side, double _price, long _quantity)
+{
+    vector<Level>& _levels = GetLevels(_side);
+    long _ticks = llround(_price * 256.0);
+    size_t i = FindLevel(_side, _ticks);
+    if (i < _levels.size() && _levels[i].ticks == _ticks)
+    {
+        _levels[i].quantity += _quantity;
+        if (_levels[i].quantity <= 0) _levels.erase(_levels.begin() + i);
+    }
+    else if (_quantity > 0)
+    {
+        _levels.insert(_levels.begin() + i, Level{_ticks, _quantity});
+    }
+    if (i == 0) UpdateBest(_side);
+}
+
+void PriceLevelBook::ModifyLevel(PricingSide _side, double _price, long _quantity)
+{
+    vector<Level>& _levels = GetLevels(_side);
+    long _ticks = llround(_price * 256.0);
+    size_t i = FindLevel(_side, _ticks);
+    if (i < _levels.size() && _levels[i].ticks == _ticks)
+    {
+        if (_quantity > 0) _levels[i].quantity = _quantity;
+        else _levels.erase(_levels.begin() + i);
+    }
+    else if (_quantity > 0)
+    {
+        _levels.insert(_levels.begin() + i, Level{_ticks, _quantity});
+    }
+    if (i == 0) UpdateBest(_side);
+}
+
+void PriceLevelBook::DeleteLevel(PricingSide _side, double _price)
+{
+    ModifyLevel(_side, _price, 0);
+}
+
+void PriceLevelBook::Clear()
+{
+    bids.clear();
+    offers.clear();
+    UpdateBest(BID);
+    UpdateBest(OFFER);
+}
+
+int PriceLevelBook::GetLevelCount(PricingSide _side) const
+{
+    int _count = (_side == BID) ? bids.size() : offers.size();
+    return (_count < bookDepth) ? _count : bookDepth;
+}
+
+Order PriceLevelBook::GetLevel(PricingSide _side, int _level) const
+{
+    const Level& _l = (_side == BID) ? bids[_level] : offers[_level];
+    return Order(_l.ticks / 256.0, _l.quantity, _side);
+}
+
+void PriceLevelBook::UpdateBest(PricingSide _side)
+{
+    vector<Level>& _levels = GetLevels(_side);
+    Order _best = _levels.empty() ? Order(0, 0, _side) : Order(_levels[0].ticks / 256.0, _levels[0].quantity, _side);
+    if (_side == BID) bidOffer = BidOffer(_best, bidOffer.GetOfferOrder());
+    else bidOffer = BidOffer(bidOffer.GetBidOrder(), _best);
+}
+
+template<typename T, typename... L>
+class MarketDataService;
+template<typename T, typename S = MarketDataService<T>>
 class MarketDataConnector;
 
 /**
  * Market Data Service which distributes market data
  * Keyed on product identifier.
- * Type T is the product type.
+ * Type T is the product type, types L the listener types dispatched statically.
  */
-template<typename T>
+template<typename T, typename... L>
 class MarketDataService : public Service<string,OrderBook <T> >
 {
 private:
-    map<string, OrderBook<T>> orderBooks;
-    vector<ServiceListener<OrderBook<T>>*> listeners;
-    MarketDataConnector<T>* connector;
+    ProductStore<OrderBook<T>> orderBooks;
+    ProductStore<PriceLevelBook> levelBooks;
+    OrderBook<T> missing;
+    vector<Order> levelBids;
+    vector<Order> levelOffers;
+    ListenerList<OrderBook<T>, L...> listeners;
+    MarketDataConnector<T, MarketDataService>* connector;
     int bookDepth;
 public:
     MarketDataService();
-    OrderBook<T>& GetData(string _key);
+
+    // Get data on our service given a key, a default value if none was stored for it
+    OrderBook<T>& GetData(const string& _key);
+
+    // Get data on our service given a product index
+    OrderBook<T>& GetData(int _index);
+
+    // Check if the service holds a book for a product index
+    bool Contains(int _index) const
+    {
+        return orderBooks.Contains(_index);
+    };
+
+    // Store a book restored from a snapshot, without notifying listeners
+    void Restore(OrderBook<T>&& _data);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(OrderBook<T>& _data);
 
+    // The callback for a book the caller gives up: it is swapped into the store without
+    // copying, and _data is left holding the previous book, whose buffers can be reused
+    void OnMessage(OrderBook<T>&& _data);
+
+    // The callback for a batch of books, each swapped into the store as with the rvalue OnMessage
+    void OnMessages(span<OrderBook<T>> _data);
+
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<OrderBook<T>>* _listener)
     {
-        listeners.push_back(_listener);
+        listeners.Add(_listener);
+    };
+
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners)
+    {
+        listeners.Bind(_listeners...);
     };
 
     // Get all listeners on the Service
     const vector<ServiceListener<OrderBook<T>>*>& GetListeners() const
     {
-        return listeners;
+        return listeners.GetDynamic();
     };
 
     // Get the connector of the service
-    MarketDataConnector<T>* GetConnector()
+    MarketDataConnector<T, MarketDataService>* GetConnector()
     {
         return connector;
     } ;
@@ -221,146 +477,382 @@ public:
         return bookDepth;
     };
 
-    // Get the best bid/offer order
+    // Get the best bid/offer order, cached on the price level book; an empty one if the product has no book
     const BidOffer& GetBestBidOffer(const string &productId)
     {
-        return orderBooks[productId].GetBidOffer();
+        PriceLevelBook* _levelBook = levelBooks.Find(productId);
+        return _levelBook ? _levelBook->GetBidOffer() : missing.GetBidOffer();
     }
 
-    // Aggregate the order book
-    const OrderBook<T>& AggregateDepth(const string &productId);
+    // Get the price level book of a product
+    PriceLevelBook& GetLevelBook(const T &_product);
+
+    // Apply an incremental update to a price level, a zero quantity deleting the level.
+    // The stored order book is rebuilt from the level book and listeners get it as an update.
+    void OnLevelUpdate(const T &_product, PricingSide _side, double _price, long _quantity);
+
+    // Aggregate the order book to the book depth
+    OrderBook<T> AggregateDepth(const string &productId);
 
 };
 
-template<typename T>
-MarketDataService<T>::MarketDataService()
+template<typename T, typename... L>
+MarketDataService<T, L...>::MarketDataService()
 {
-    orderBooks = map<string, OrderBook<T>>();
-    listeners = vector<ServiceListener<OrderBook<T>>*>();
-    connector = new MarketDataConnector<T>(this);
+    orderBooks = ProductStore<OrderBook<T>>();
+    levelBooks = ProductStore<PriceLevelBook>();
     bookDepth = 5;
+    connector = new MarketDataConnector<T, MarketDataService>(this);
 }
 
-template<typename T>
-OrderBook<T>& MarketDataService<T>::GetData(string _key)
+template<typename T, typename... L>
+OrderBook<T>& MarketDataService<T, L...>::GetData(const string& _key)
 {
-    return orderBooks[_key];
+    OrderBook<T>* _orderBook = orderBooks.Find(_key);
+    return _orderBook ? *_orderBook : missing;
 }
 
-template<typename T>
-void MarketDataService<T>::OnMessage(OrderBook<T>& _data)
+template<typename T, typename... L>
+OrderBook<T>& MarketDataService<T, L...>::GetData(int _index)
 {
-    orderBooks[_data.GetProduct().GetProductId()] = _data;
-    for (auto& l : listeners)
-    {
-        l->ProcessAdd(_data);
-    }
+    return orderBooks[_index];
 }
 
-template<typename T>
-const OrderBook<T>& MarketDataService<T>::AggregateDepth(const std::string &productId)
+template<typename T, typename... L>
+void MarketDataService<T, L...>::OnMessage(OrderBook<T>& _data)
 {
-    T& _product = orderBooks[productId].GetProduct();
+    // Store the book and notify listeners with the stored copy
+    OrderBook<T>& _orderBook = orderBooks.Get(_data.GetProduct());
+    _orderBook = _data;
+    GetLevelBook(_orderBook.GetProduct()).ApplySnapshot(_orderBook.GetBidStack(), _orderBook.GetOfferStack());
+    listeners.ProcessAdd(_orderBook);
+}
 
-    vector<Order>& _bidStackFrom = orderBooks[productId].GetBidStack();
-    unordered_map<double,long> _bidHashTable;
-    for (auto& b: _bidStackFrom)
-    {
-        double _price = b.GetPrice();
-        long _quantity = b.GetQuantity();
-        _bidHashTable[_price] += _quantity;
-    }
-    vector<Order> _bidStackTo;
-    for (auto& b: _bidHashTable)
+template<typename T, typename... L>
+void MarketDataService<T, L...>::OnMessage(OrderBook<T>&& _data)
+{
+    OrderBook<T>& _orderBook = orderBooks.Get(_data.GetProduct());
+    swap(_orderBook, _data);
+    GetLevelBook(_orderBook.GetProduct()).ApplySnapshot(_orderBook.GetBidStack(), _orderBook.GetOfferStack());
+    listeners.ProcessAdd(_orderBook);
+}
+
+template<typename T, typename... L>
+void MarketDataService<T, L...>::Restore(OrderBook<T>&& _data)
+{
+    OrderBook<T>& _orderBook = orderBooks.Get(_data.GetProduct());
+    swap(_orderBook, _data);
+    GetLevelBook(_orderBook.GetProduct()).ApplySnapshot(_orderBook.GetBidStack(), _orderBook.GetOfferStack());
+}
+
+template<typename T, typename... L>
+void MarketDataService<T, L...>::OnMessages(span<OrderBook<T>> _data)
+{
+    for (auto& b : _data)
     {
-        _bidStackTo.push_back(Order(b.first, b.second, BID));
+        OnMessage(move(b));
     }
+}
+
+template<typename T, typename... L>
+PriceLevelBook& MarketDataService<T, L...>::GetLevelBook(const T& _product)
+{
+    PriceLevelBook& _levelBook = levelBooks.Get(_product);
+    _levelBook.SetBookDepth(bookDepth);
+    return _levelBook;
+}
+
+template<typename T, typename... L>
+void MarketDataService<T, L...>::OnLevelUpdate(const T& _product, PricingSide _side, double _price, long _quantity)
+{
+    PriceLevelBook& _levelBook = GetLevelBook(_product);
+    _levelBook.ModifyLevel(_side, _price, _quantity);
+
+    // The stacks are rebuilt in the scratch vectors and swapped in, so the book's previous ones are reused next time
+    levelBids.clear();
+    levelOffers.clear();
+    for (int i = 0; i < _levelBook.GetLevelCount(BID); i++) levelBids.push_back(_levelBook.GetLevel(BID, i));
+    for (int i = 0; i < _levelBook.GetLevelCount(OFFER); i++) levelOffers.push_back(_levelBook.GetLevel(OFFER, i));
+    OrderBook<T>& _orderBook = orderBooks.Get(_product);
+    _orderBook.Assign(_product, levelBids, levelOffers);
+    _orderBook.SetTimestamp(GetNanoseconds());
+    listeners.ProcessUpdate(_orderBook);
+}
 
-    // Same for offer stack
-    vector<Order>& _offerStackFrom = orderBooks[productId].GetOfferStack();
-    unordered_map<double,long> _offerHashTable;
-    for (auto& o: _offerStackFrom)
+template<typename T, typename... L>
+OrderBook<T> MarketDataService<T, L...>::AggregateDepth(const std::string &productId)
+{
+    const T& _product = orderBooks.Get(productId).GetProduct();
+    PriceLevelBook& _levelBook = GetLevelBook(_product);
+
+    vector<Order> _bidStack;
+    for (int i = 0; i < _levelBook.GetLevelCount(BID); i++) _bidStack.push_back(_levelBook.GetLevel(BID, i));
+    vector<Order> _offerStack;
+    for (int i = 0; i < _levelBook.GetLevelCount(OFFER); i++) _offerStack.push_back(_levelBook.GetLevel(OFFER, i));
+
+    return OrderBook<T>(_product, _bidStack, _offerStack);
+}
+
+/**
+ * Order book parser turning market data lines into order books.
+ * Every bookDepth*2 lines make up one order book.
+ * Type T is the product type.
+ */
+template<typename T>
+class OrderBookParser
+{
+private:
+    int lines;
+    long count;
+    long start;
+    vector<Order> bidStack;
+    vector<Order> offerStack;
+public:
+    OrderBookParser(int _bookDepth)
     {
-        double _price = o.GetPrice();
-        long _quantity = o.GetQuantity();
-        _offerHashTable[_price] += _quantity;
-    }
-    vector<Order> _offerStackTo;
-    for (auto& o: _offerHashTable)
+        lines = _bookDepth * 2;
+        count = 0;
+        bidStack.reserve(_bookDepth);
+        offerStack.reserve(_bookDepth);
+    };
+
+    // Parse a line, return true and fill _orderBook when an order book is complete
+    bool ParseLine(string_view _line, OrderBook<T>& _orderBook);
+};
+
+template<typename T>
+bool OrderBookParser<T>::ParseLine(string_view _line, OrderBook<T>& _orderBook)
+{
+    string_view _cells[4];
+    if (SplitCells(_line, _cells, 4) < 4) return false;
+
+    double _price = ConvertPrice(_cells[1]);
+    long _quantity = ParseLong(_cells[2]);
+    PricingSide _side = (_cells[3] == "BID") ? BID : OFFER;
+
+    Order _order(_price, _quantity, _side);
+    switch(_side)
     {
-        _offerStackTo.push_back(Order(o.first, o.second, OFFER));
+        case BID:
+            bidStack.push_back(_order);
+            break;
+        case OFFER:
+            offerStack.push_back(_order);
+            break;
     }
-
-    return OrderBook<T>(_product, _bidStackTo, _offerStackTo);
+    if (count == 0) start = GetNanoseconds();
+    count++;
+    if (count < lines) return false;
+
+    // The stacks are swapped into the book, and come back with the capacity of its previous ones;
+    // the reserve only allocates while the book had no stacks of its own yet
+    const T& _product = GetBond(_cells[0]);
+    _orderBook.Assign(_product, bidStack, offerStack);
+    _orderBook.SetTimestamp(start);
+    count = 0;
+    bidStack.clear();
+    offerStack.clear();
+    bidStack.reserve(lines / 2);
+    offerStack.reserve(lines / 2);
+    return true;
 }
 
 /**
- * Market Data Connector
- **/
+ * Market Data Connector subscribing order books to the Market Data Service.
+ * Type T is the product type, type S the market data service type.
+ */
 
-template<typename T>
+template<typename T, typename S>
 class MarketDataConnector : public Connector<OrderBook<T>>
 {
 private:
-    MarketDataService<T>* service;
+    S* service;
+    ServiceListener<OrderBook<T>>* router;
+
+    // Books are parsed into these reused slots, sized from the service's book depth, and delivered
+    // a batch at a time; a delivered book comes back holding the stacks it replaced, so parsing does not allocate
+    static constexpr size_t BATCH_SIZE = 256;
+    vector<OrderBook<T>> batch;
+    size_t batchCount;
+
+    // A chunk parsed ahead of its delivery, with the orders of all its books kept in one vector
+    struct ParsedBook
+    {
+        T product;
+        long timestamp;
+        size_t bids;
+        size_t offers;
+    };
+    struct ParsedChunk
+    {
+        vector<ParsedBook> books;
+        vector<Order> orders;
+    };
+
+    // Hand a batch of parsed books to the router if one is set, to the service otherwise
+    void DeliverBatch(span<OrderBook<T>> _orderBooks)
+    {
+        if (router) router->ProcessAddBatch(_orderBooks);
+        else service->OnMessages(_orderBooks);
+    };
+
+    // Deliver the books parsed into the batch so far
+    void FlushBatch()
+    {
+        if (batchCount > 0) DeliverBatch(span<OrderBook<T>>(batch.data(), batchCount));
+        batchCount = 0;
+    };
+
+    // Get the next free slot of the batch
+    OrderBook<T>& NextSlot()
+    {
+        if (batchCount == batch.size()) FlushBatch();
+        return batch[batchCount++];
+    };
+
+    // Parse a chunk, delivering its books through the batch
+    void ParseInto(string_view _chunk, int _bookDepth);
+
+    // Parse a chunk ahead of its delivery
+    ParsedChunk ParseAhead(string_view _chunk, int _bookDepth) const;
+
+    // Deliver a chunk parsed ahead through the batch
+    void DeliverChunk(const ParsedChunk& _chunk);
 public:
-    MarketDataConnector(MarketDataService<T>* _service)
+    MarketDataConnector(S* _service) : batch(BATCH_SIZE, SampleOrderBook<T>(_service->GetBookDepth()))
     {
         service = _service;
+        router = nullptr;
+        batchCount = 0;
     };
     void Publish(OrderBook<T>& _data){}; // No need for Publish
+
+    // Hand a parsed book to the router if one is set, to the service otherwise
+    void Deliver(OrderBook<T>& _orderBook)
+    {
+        if (router) router->ProcessAdd(_orderBook);
+        else service->OnMessage(move(_orderBook));
+    };
+
     void Subscribe(ifstream& _data);
+
+    // Route parsed books to a listener, such as the shard router of a sharded pipeline, instead of the service
+    void SetRouter(ServiceListener<OrderBook<T>>* _router)
+    {
+        router = _router;
+    };
+
+    // Subscribe data from a memory-mapped file.
+    // With more than one thread, the file is split into CUSIP-aligned chunks that are parsed
+    // in parallel and delivered in file order, so each CUSIP still sees its updates in order.
+    void SubscribeFile(const string& _path, int _threads = 1);
 };
 
-template<typename T>
-void MarketDataConnector<T>::Subscribe(ifstream& _data)
+template<typename T, typename S>
+void MarketDataConnector<T, S>::Subscribe(ifstream& _data)
 {
-    int _bookDepth = service->GetBookDepth();
-    int _thread = _bookDepth*2;
-    long _count = 0;
-    vector<Order> _bidStack;
-    vector<Order> _offerStack;
-    string _line;
-    while (getline(_data, _line))
+    OrderBookParser<T> _parser(service->GetBookDepth());
+    OrderBook<T> _orderBook;
+    ForEachLine(_data, [&](string_view _line)
     {
-        string _productId;
-        stringstream _lineStream(_line);
+        if (_parser.ParseLine(_line, _orderBook)) Deliver(_orderBook);
+    });
+}
 
-        string _cell;
-        vector<string> _cells;
+template<typename T, typename S>
+void MarketDataConnector<T, S>::SubscribeFile(const string& _path, int _threads)
+{
+    MappedFile _file(_path);
+    if (!_file.IsOpen()) return;
+    string_view _data = GetInputOffsets().GetTail(_path, _file.GetData());
+    int _bookDepth = service->GetBookDepth();
 
-        while (getline(_lineStream, _cell, ','))
+    // Start chunks at lines whose CUSIP differs from the previous line
+    vector<size_t> _bounds = {0};
+    for (int i = 1; i < _threads; i++)
+    {
+        size_t _offset = _data.size() * i / _threads;
+        if (_offset <= _bounds.back()) continue;
+        _offset = _data.find('\n', _offset);
+        while (_offset != string_view::npos && _offset + 1 < _data.size())
         {
-            _cells.push_back(_cell);
+            size_t _previous = _data.rfind('\n', _offset - 1);
+            _previous = (_previous == string_view::npos) ? 0 : _previous + 1;
+            string_view _previousId = _data.substr(_previous, _data.find(',', _previous) - _previous);
+            string_view _nextId = _data.substr(_offset + 1, _data.find(',', _offset + 1) - _offset - 1);
+            if (_previousId != _nextId) break;
+            _offset = _data.find('\n', _offset + 1);
         }
+        if (_offset == string_view::npos || _offset + 1 >= _data.size()) break;
+        _bounds.push_back(_offset + 1);
+    }
+    _bounds.push_back(_data.size());
 
-        _productId = _cells[0];
-        double _price = ConvertPrice(_cells[1]);
-        long _quantity = stol(_cells[2]);
-        PricingSide _side = (_cells[3] == "BID") ? BID : OFFER;
+    vector<future<ParsedChunk>> _chunks;
+    for (size_t i = 1; i + 1 < _bounds.size(); i++)
+    {
+        string_view _chunk = _data.substr(_bounds[i], _bounds[i + 1] - _bounds[i]);
+        _chunks.push_back(async(launch::async, &MarketDataConnector::ParseAhead, this, _chunk, _bookDepth));
+    }
 
-        Order _order(_price, _quantity, _side);
-        switch(_side)
-        {
-            case BID:
-                _bidStack.push_back(_order);
-                break;
-            case OFFER:
-                _offerStack.push_back(_order);
-                break;
-        }
-        _count++;
-        if (_count == _thread)
-        {
-            T _product = GetBond(_productId);
-            OrderBook<T> _orderBook(_product, _bidStack, _offerStack);
-            service->OnMessage(_orderBook);
-            _count = 0;
-            _bidStack.clear();
-            _offerStack.clear();
-        }
+    // The first chunk is parsed and delivered on the calling thread while the others are parsed
+    ParseInto(_data.substr(_bounds[0], _bounds[1] - _bounds[0]), _bookDepth);
+    for (auto& c : _chunks)
+    {
+        DeliverChunk(c.get());
+    }
+    FlushBatch();
+    GetInputOffsets().Advance(_path, _file.GetData().size());
+}
 
+template<typename T, typename S>
+void MarketDataConnector<T, S>::ParseInto(string_view _chunk, int _bookDepth)
+{
+    OrderBookParser<T> _parser(_bookDepth);
+    LineReader _reader(_chunk);
+    string_view _line;
+    while (_reader.Next(_line))
+    {
+        if (batchCount == batch.size()) FlushBatch();
+        if (_parser.ParseLine(_line, batch[batchCount])) batchCount++;
+    }
+}
 
+template<typename T, typename S>
+typename MarketDataConnector<T, S>::ParsedChunk MarketDataConnector<T, S>::ParseAhead(string_view _chunk, int _bookDepth) const
+{
+    ParsedChunk _parsed;
+    size_t _lines = count(_chunk.begin(), _chunk.end(), '\n') + 1;
+    _parsed.orders.reserve(_lines);
+    _parsed.books.reserve(_lines / (2 * _bookDepth) + 1);
+
+    OrderBookParser<T> _parser(_bookDepth);
+    OrderBook<T> _orderBook;
+    LineReader _reader(_chunk);
+    string_view _line;
+    while (_reader.Next(_line))
+    {
+        if (!_parser.ParseLine(_line, _orderBook)) continue;
+        const vector<Order>& _bids = _orderBook.GetBidStack();
+        const vector<Order>& _offers = _orderBook.GetOfferStack();
+        _parsed.books.push_back({_orderBook.GetProduct(), _orderBook.GetTimestamp(), _bids.size(), _offers.size()});
+        _parsed.orders.insert(_parsed.orders.end(), _bids.begin(), _bids.end());
+        _parsed.orders.insert(_parsed.orders.end(), _offers.begin(), _offers.end());
+    }
+    return _parsed;
+}
+
+template<typename T, typename S>
+void MarketDataConnector<T, S>::DeliverChunk(const ParsedChunk& _chunk)
+{
+    span<const Order> _orders(_chunk.orders);
+    size_t _offset = 0;
+    for (const ParsedBook& b : _chunk.books)
+    {
+        OrderBook<T>& _slot = NextSlot();
+        _slot.Assign(b.product, _orders.subspan(_offset, b.bids), _orders.subspan(_offset + b.bids, b.offers));
+        _slot.SetTimestamp(b.timestamp);
+        _offset += b.bids + b.offers;
     }
 }
 
@@ -8,14 +8,108 @@
 #define POSITION_SERVICE_HPP
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 #include "soa.hpp"
 #include "tradebookingservice.hpp"
 
 using namespace std;
 
+/**
+* Book Registry assigning each trading book a small dense index.
+* TRSY1, TRSY2 and TRSY3 are registered up front, other books on first use.
+* Lookups do not lock: names are published before the count that makes them visible.
+*/
+class BookRegistry
+{
+
+public:
+
+    static const int MAX_BOOKS = 16;
+
+    // Constructor, seeded with TRSY1, TRSY2 and TRSY3
+    BookRegistry();
+
+    // Get the index of a book, registering it if it is new; -1 if the registry is full
+    int GetIndex(string_view _book);
+
+    // Get the index of a registered book, -1 if it is not registered; never registers
+    int FindIndex(string_view _book) const;
+
+    // Get the name of the book at an index
+    const string& GetName(int _index) const;
+
+    // Get the number of registered books
+    int GetSize() const;
+
+private:
+
+    string names[MAX_BOOKS];
+    atomic<int> count;
+    mutex registerMutex;
+
+};
+
+BookRegistry::BookRegistry()
+{
+    names[0] = "TRSY1";
+    names[1] = "TRSY2";
+    names[2] = "TRSY3";
+    count.store(3, memory_order_release);
+}
+
+int BookRegistry::GetIndex(string_view _book)
+{
+    int _index = FindIndex(_book);
+    if (_index >= 0) return _index;
+
+    lock_guard<mutex> _lock(registerMutex);
+    int _count = count.load(memory_order_relaxed);
+    for (int i = 0; i < _count; i++)
+    {
+        if (names[i] == _book) return i;
+    }
+    if (_count == MAX_BOOKS) return -1;
+    names[_count] = _book;
+    count.store(_count + 1, memory_order_release);
+    return _count;
+}
+
+int BookRegistry::FindIndex(string_view _book) const
+{
+    int _count = count.load(memory_order_acquire);
+    for (int i = 0; i < _count; i++)
+    {
+        if (names[i] == _book) return i;
+    }
+    return -1;
+}
+
+const string& BookRegistry::GetName(int _index) const
+{
+    return names[_index];
+}
+
+int BookRegistry::GetSize() const
+{
+    return count.load(memory_order_acquire);
+}
+
+// Get the book registry
+BookRegistry& GetBookRegistry()
+{
+    static BookRegistry _registry;
+    return _registry;
+}
+
 /**
 * Position class in a particular book.
+* Quantities are held in a fixed array indexed by book, with a running aggregate,
+* so adding a trade is a couple of adds. Books past the registry's capacity
+* fall back to a map.
 * Type T is the product type.
 */
 template<typename T>
@@ -32,24 +126,36 @@ public:
     const T& GetProduct() const;
 
     // Get the position quantity
-    long GetPosition(string& _book);
+    long GetPosition(string_view _book) const;
 
     // Get the positions over books
-    map<string, long> GetPositions();
+    map<string, long> GetPositions() const;
 
     // Set the position quantity
-    void AddPosition(string& _book, long _position);
+    void AddPosition(string_view _book, long _position);
 
     // Get the aggregate position
-    long GetAggregatePosition();
+    long GetAggregatePosition() const;
+
+    // Check if the book at a registry index holds a position
+    bool HasBook(int _book) const;
+
+    // Get the position quantity of the book at a registry index
+    long GetBookPosition(int _book) const;
 
     // Change attributes to strings
     vector<string> ToStrings() const;
 
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
 private:
 
     T product;
-    map<string, long> positions;
+    long quantities[BookRegistry::MAX_BOOKS] = {};
+    unsigned int books = 0;
+    long aggregate = 0;
+    map<string, long, less<>> overflow;
 
 };
 
@@ -64,32 +170,60 @@ const T& Position<T>::GetProduct() const
 }
 
 template<typename T>
-long Position<T>::GetPosition(string& _book)
+long Position<T>::GetPosition(string_view _book) const
 {
-    return positions[_book];
+    // Reading a book must not register it; only AddPosition does
+    int _index = GetBookRegistry().FindIndex(_book);
+    if (_index >= 0) return quantities[_index];
+    auto _it = overflow.find(_book);
+    return (_it == overflow.end()) ? 0 : _it->second;
 }
 
 template<typename T>
-map<string, long> Position<T>::GetPositions()
+map<string, long> Position<T>::GetPositions() const
 {
-    return positions;
+    map<string, long> _positions(overflow.begin(), overflow.end());
+    for (int i = 0; i < BookRegistry::MAX_BOOKS; i++)
+    {
+        if (books & (1u << i)) _positions[GetBookRegistry().GetName(i)] = quantities[i];
+    }
+    return _positions;
 }
 
 template<typename T>
-void Position<T>::AddPosition(string& _book, long _position)
+void Position<T>::AddPosition(string_view _book, long _position)
 {
-    positions[_book] += _position;
+    int _index = GetBookRegistry().GetIndex(_book);
+    if (_index >= 0)
+    {
+        quantities[_index] += _position;
+        books |= 1u << _index;
+    }
+    else
+    {
+        auto _it = overflow.find(_book);
+        if (_it == overflow.end()) _it = overflow.emplace(string(_book), 0).first;
+        _it->second += _position;
+    }
+    aggregate += _position;
 }
 
 template<typename T>
-long Position<T>::GetAggregatePosition()
+long Position<T>::GetAggregatePosition() const
 {
-    long aggregatePosition = 0;
-    for (auto& p : positions)
-    {
-        aggregatePosition += p.second;
-    }
-    return aggregatePosition;
+    return aggregate;
+}
+
+template<typename T>
+bool Position<T>::HasBook(int _book) const
+{
+    return books & (1u << _book);
+}
+
+template<typename T>
+long Position<T>::GetBookPosition(int _book) const
+{
+    return quantities[_book];
 }
 
 template<typename T>
@@ -97,7 +231,15 @@ vector<string> Position<T>::ToStrings() const
 {
     string _product = product.GetProductId();
     vector<string> _positions;
-    for (auto& p : positions)
+    for (int i = 0; i < BookRegistry::MAX_BOOKS; i++)
+    {
+        if (!(books & (1u << i))) continue;
+        string _book = GetBookRegistry().GetName(i);
+        string _position = to_string(quantities[i]);
+        _positions.push_back(_book);
+        _positions.push_back(_position);
+    }
+    for (auto& p : overflow)
     {
         string _book = p.first;
         string _position = to_string(p.second);
@@ -111,26 +253,52 @@ vector<string> Position<T>::ToStrings() const
     return _strings;
 }
 
+template<typename T>
+void Position<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    for (int i = 0; i < BookRegistry::MAX_BOOKS; i++)
+    {
+        if (!(books & (1u << i))) continue;
+        _formatter.Field(GetBookRegistry().GetName(i));
+        _formatter.IntegerField(quantities[i]);
+    }
+    for (auto& p : overflow)
+    {
+        _formatter.Field(p.first);
+        _formatter.IntegerField(p.second);
+    }
+}
+
 /**
 * Pre-declearations to avoid errors.
 */
-template<typename T>
+template<typename T, typename... L>
+class PositionService;
+template<typename T, typename S = PositionService<T>>
 class PositionToTradeBookingListener;
 
 /**
 * Position Service to manage positions across multiple books and secruties.
 * Keyed on product identifier.
-* Type T is the product type.
+* Type T is the product type, types L the listener types dispatched statically.
 */
-template<typename T>
+template<typename T, typename... L>
 class PositionService : public Service<string, Position<T>>
 {
 
 private:
 
-    map<string, Position<T>> positions;
-    vector<ServiceListener<Position<T>>*> listeners;
-    PositionToTradeBookingListener<T>* listener;
+    ProductStore<Position<T>> positions;
+    Position<T> missing;
+    vector<Position<T>*> touched;
+    vector<char> touchedFlags;
+    vector<Position<T>> batch;
+    ListenerList<Position<T>, L...> listeners;
+    PositionToTradeBookingListener<T, PositionService>* listener;
+
+    // Add a trade to its position and return the position
+    Position<T>& ApplyTrade(const Trade<T>& _trade);
 
 public:
 
@@ -138,8 +306,14 @@ public:
     PositionService();
     ~PositionService();
 
-    // Get data on our service given a key
-    Position<T>& GetData(string _key);
+    // Get data on our service given a key, a default value if none was stored for it
+    Position<T>& GetData(const string& _key);
+
+    // Get data on our service given a product index
+    Position<T>& GetData(int _index);
+
+    // Check if the service holds a position for a product index
+    bool Contains(int _index) const;
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(Position<T>& _data);
@@ -147,115 +321,161 @@ public:
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<Position<T>>* _listener);
 
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners);
+
     // Get all listeners on the Service
     const vector<ServiceListener<Position<T>>*>& GetListeners() const;
 
     // Get the listener of the service
-    PositionToTradeBookingListener<T>* GetListener();
+    PositionToTradeBookingListener<T, PositionService>* GetListener();
 
     // Add a trade to the service
-    virtual void AddTrade(const Trade<T>& _trade);
+    void AddTrade(const Trade<T>& _trade);
+
+    // Add a batch of trades to the service; each position the batch touches is updated by
+    // all of its trades first, then listeners get the touched positions as one batch
+    void AddTrades(span<Trade<T>> _trades);
 
 };
 
-template<typename T>
-PositionService<T>::PositionService()
+template<typename T, typename... L>
+PositionService<T, L...>::PositionService()
 {
-    positions = map<string, Position<T>>();
-    listeners = vector<ServiceListener<Position<T>>*>();
-    listener = new PositionToTradeBookingListener<T>(this);
+    positions = ProductStore<Position<T>>();
+    listener = new PositionToTradeBookingListener<T, PositionService>(this);
 }
 
-template<typename T>
-PositionService<T>::~PositionService() {}
+template<typename T, typename... L>
+PositionService<T, L...>::~PositionService() {}
 
-template<typename T>
-Position<T>& PositionService<T>::GetData(string _key)
+template<typename T, typename... L>
+Position<T>& PositionService<T, L...>::GetData(const string& _key)
 {
-    return positions[_key];
+    Position<T>* _position = positions.Find(_key);
+    return _position ? *_position : missing;
 }
 
-template<typename T>
-void PositionService<T>::OnMessage(Position<T>& _data)
+template<typename T, typename... L>
+Position<T>& PositionService<T, L...>::GetData(int _index)
 {
-    positions[_data.GetProduct().GetProductId()] = _data;
+    return positions[_index];
 }
 
-template<typename T>
-void PositionService<T>::AddListener(ServiceListener<Position<T>>* _listener)
+template<typename T, typename... L>
+bool PositionService<T, L...>::Contains(int _index) const
 {
-    listeners.push_back(_listener);
+    return positions.Contains(_index);
 }
 
-template<typename T>
-PositionToTradeBookingListener<T>* PositionService<T>::GetListener()
+template<typename T, typename... L>
+void PositionService<T, L...>::OnMessage(Position<T>& _data)
+{
+    positions.Get(_data.GetProduct()) = _data;
+}
+
+template<typename T, typename... L>
+void PositionService<T, L...>::AddListener(ServiceListener<Position<T>>* _listener)
+{
+    listeners.Add(_listener);
+}
+
+template<typename T, typename... L>
+void PositionService<T, L...>::BindListeners(L*... _listeners)
+{
+    listeners.Bind(_listeners...);
+}
+
+template<typename T, typename... L>
+PositionToTradeBookingListener<T, PositionService<T, L...>>* PositionService<T, L...>::GetListener()
 {
     return listener;
 }
 
-template<typename T>
-const vector<ServiceListener<Position<T>>*>& PositionService<T>::GetListeners() const
+template<typename T, typename... L>
+const vector<ServiceListener<Position<T>>*>& PositionService<T, L...>::GetListeners() const
 {
-    return listeners;
+    return listeners.GetDynamic();
 }
 
-template<typename T>
-void PositionService<T>::AddTrade(const Trade<T>& _trade)
+template<typename T, typename... L>
+Position<T>& PositionService<T, L...>::ApplyTrade(const Trade<T>& _trade)
 {
-    T _product = _trade.GetProduct();
-    string _productId = _product.GetProductId();
-    double _price = _trade.GetPrice();
-    string _book = _trade.GetBook();
+    const T& _product = _trade.GetProduct();
+    Position<T>& _position = positions.Get(_product);
+    if (_position.GetProduct().GetProductId().empty()) _position = Position<T>(_product);
+
     long _quantity = _trade.GetQuantity();
-    Side _side = _trade.GetSide();
-    Position<T> _positionTo(_product);
-    switch (_side)
+    switch (_trade.GetSide())
     {
         case BUY:
-            _positionTo.AddPosition(_book, _quantity);
+            _position.AddPosition(_trade.GetBook(), _quantity);
             break;
         case SELL:
-            _positionTo.AddPosition(_book, -_quantity);
+            _position.AddPosition(_trade.GetBook(), -_quantity);
             break;
     }
+    return _position;
+}
+
+template<typename T, typename... L>
+void PositionService<T, L...>::AddTrade(const Trade<T>& _trade)
+{
+    listeners.ProcessAdd(ApplyTrade(_trade));
+}
 
-    Position<T> _positionFrom = positions[_productId];
-    map <string, long> _positionMap = _positionFrom.GetPositions();
-    for (auto& p : _positionMap)
+template<typename T, typename... L>
+void PositionService<T, L...>::AddTrades(span<Trade<T>> _trades)
+{
+    touched.clear();
+    for (auto& t : _trades)
     {
-        _book = p.first;
-        _quantity = p.second;
-        _positionTo.AddPosition(_book, _quantity);
+        int _index = ResolveProductIndex(t.GetProduct());
+        Position<T>& _position = ApplyTrade(t);
+        if (_index >= 0)
+        {
+            if (size_t(_index) >= touchedFlags.size()) touchedFlags.resize(_index + 1, 0);
+            if (touchedFlags[_index]) continue;
+            touchedFlags[_index] = 1;
+        }
+        else if (find(touched.begin(), touched.end(), &_position) != touched.end()) continue;
+        touched.push_back(&_position);
     }
-    positions[_productId] = _positionTo;
 
-    for (auto& l : listeners)
+    batch.clear();
+    for (auto& p : touched)
     {
-        l->ProcessAdd(_positionTo);
+        batch.push_back(*p);
+        int _index = ResolveProductIndex(p->GetProduct());
+        if (_index >= 0) touchedFlags[_index] = 0;
     }
+    listeners.ProcessAddBatch(span<Position<T>>(batch));
 }
 
 /**
 * Position Service Listener subscribing data from Trading Booking Service to Position Service.
-* Type T is the product type.
+* Type T is the product type, type S the position service type.
 */
-template<typename T>
-class PositionToTradeBookingListener : public ServiceListener<Trade<T>>
+template<typename T, typename S>
+class PositionToTradeBookingListener final : public ServiceListener<Trade<T>>
 {
 
 private:
 
-    PositionService<T>* service;
+    S* service;
 
 public:
 
     // Connector and Destructor
-    PositionToTradeBookingListener(PositionService<T>* _service);
+    PositionToTradeBookingListener(S* _service);
     ~PositionToTradeBookingListener();
 
     // Listener callback to process an add event to the Service
     void ProcessAdd(Trade<T>& _data);
 
+    // Listener callback to process add events for a batch of trades
+    void ProcessAddBatch(span<Trade<T>> _data);
+
     // Listener callback to process a remove event to the Service
     void ProcessRemove(Trade<T>& _data);
 
@@ -264,25 +484,31 @@ public:
 
 };
 
-template<typename T>
-PositionToTradeBookingListener<T>::PositionToTradeBookingListener(PositionService<T>* _service)
+template<typename T, typename S>
+PositionToTradeBookingListener<T, S>::PositionToTradeBookingListener(S* _service)
 {
     service = _service;
 }
 
-template<typename T>
-PositionToTradeBookingListener<T>::~PositionToTradeBookingListener() {}
+template<typename T, typename S>
+PositionToTradeBookingListener<T, S>::~PositionToTradeBookingListener() {}
 
-template<typename T>
-void PositionToTradeBookingListener<T>::ProcessAdd(Trade<T>& _data)
+template<typename T, typename S>
+void PositionToTradeBookingListener<T, S>::ProcessAdd(Trade<T>& _data)
 {
     service->AddTrade(_data);
 }
 
-template<typename T>
-void PositionToTradeBookingListener<T>::ProcessRemove(Trade<T>& _data) {}
+template<typename T, typename S>
+void PositionToTradeBookingListener<T, S>::ProcessAddBatch(span<Trade<T>> _data)
+{
+    service->AddTrades(_data);
+}
 
-template<typename T>
-void PositionToTradeBookingListener<T>::ProcessUpdate(Trade<T>& _data) {}
+template<typename T, typename S>
+void PositionToTradeBookingListener<T, S>::ProcessRemove(Trade<T>& _data) {}
+
+template<typename T, typename S>
+void PositionToTradeBookingListener<T, S>::ProcessUpdate(Trade<T>& _data) {}
 
 #endif
\ No newline at end of file
@@ -9,6 +9,8 @@
 
 #include <string>
 #include "soa.hpp"
+#include "filereader.hpp"
+#include "metrics.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
@@ -35,10 +37,20 @@ public:
 
   vector<string> ToStrings() const;
 
+  // Write attributes as the fields of a row
+  void Format(RowFormatter& _formatter) const;
+
+  // Get the time the price entered the system, in monotonic nanoseconds
+  long GetTimestamp() const;
+
+  // Set the time the price entered the system
+  void SetTimestamp(long _timestamp);
+
 private:
   T product;
-  double mid;
-  double bidOfferSpread;
+  double mid = 0;
+  double bidOfferSpread = 0;
+  long timestamp = 0;
 
 };
 
@@ -74,6 +86,18 @@ double Price<T>::GetBidOfferSpread() const
   return bidOfferSpread;
 }
 
+template<typename T>
+long Price<T>::GetTimestamp() const
+{
+  return timestamp;
+}
+
+template<typename T>
+void Price<T>::SetTimestamp(long _timestamp)
+{
+  timestamp = _timestamp;
+}
+
 template<typename T>
 vector<string> Price<T>::ToStrings() const {
     string _product = product.GetProductId();
@@ -87,6 +111,14 @@ vector<string> Price<T>::ToStrings() const {
     return _strings; // a vector of strings of product, mid, bidOfferSpread
 }
 
+template<typename T>
+void Price<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    _formatter.PriceField(mid);
+    _formatter.PriceField(bidOfferSpread);
+}
+
 template<typename T>
 class PricingConnector;
 
@@ -95,7 +127,8 @@ template<typename T>
 class PricingService : public Service<string, Price<T>>
 {
 private:
-    map<string, Price<T>> prices;
+    ProductStore<Price<T>> prices;
+    Price<T> missing;
     vector<ServiceListener<Price<T>>*> listeners;
     PricingConnector<T>* connector;
 
@@ -103,12 +136,18 @@ public:
     PricingService();
     ~PricingService();
 
-    // First, get the data
-    Price<T>& GetData(string _key);
+    // First, get the data; a default price if none was stored for the key
+    Price<T>& GetData(const string& _key);
+
+    // Get the data of a product index
+    Price<T>& GetData(int _index);
 
     // callback function of a Connector that should invoke for any new data
     void OnMessage(Price<T>& _data);
 
+    // callback for a price the caller gives up, moved into the store
+    void OnMessage(Price<T>&& _data);
+
     // Add a listener to the Service for callbacks
     void AddListener(ServiceListener<Price<T>>* _listener);
 
@@ -122,7 +161,7 @@ public:
 template<typename T>
 PricingService<T>::PricingService()
 {
-    prices = map<string, Price<T>>();
+    prices = ProductStore<Price<T>>();
     listeners =vector<ServiceListener<Price<T>>*>();
     connector = new PricingConnector<T>(this);
 }
@@ -131,19 +170,40 @@ template<typename T>
 PricingService<T>::~PricingService() {}
 
 template<typename T>
-Price<T>& PricingService<T>::GetData(string _key)
+Price<T>& PricingService<T>::GetData(const string& _key)
 {
-    return prices[_key];
+    Price<T>* _price = prices.Find(_key);
+    return _price ? *_price : missing;
+}
+
+template<typename T>
+Price<T>& PricingService<T>::GetData(int _index)
+{
+    return prices[_index];
 }
 
 template<typename T>
 void PricingService<T>::OnMessage(Price<T> &_data)
 {
-    prices[_data.GetProduct().GetProductId()] = _data;
+    // Listeners see the stored price
+    Price<T>& _price = prices.Get(_data.GetProduct());
+    _price = _data;
+
+    for (auto& l: listeners)
+    {
+        l->ProcessAdd(_price);
+    }
+}
+
+template<typename T>
+void PricingService<T>::OnMessage(Price<T> &&_data)
+{
+    Price<T>& _price = prices.Get(_data.GetProduct());
+    _price = move(_data);
 
     for (auto& l: listeners)
     {
-        l->ProcessAdd(_data);
+        l->ProcessAdd(_price);
     }
 }
 
@@ -185,31 +245,51 @@ public:
     // Subscribe a connector
     void Subscribe(ifstream& _data);
 
+    // Subscribe data from a memory-mapped file
+    void SubscribeFile(const string& _path);
+
+    // Parse one line of price data
+    void ProcessLine(string_view _line);
+
+    // Parse one line of price data into a price, return false if the line is malformed
+    bool ParseLine(string_view _line, Price<T>& _price);
+
 };
 
 template<typename T>
 void PricingConnector<T>::Subscribe(ifstream& _data)
 {
-    string _line;
-    while (getline(_data,_line))
-    {
-        stringstream _lineStream(_line);
-        string _cell;
-        vector<string> _tmps;
-        while (getline(_lineStream, _cell, ','))
-        {
-            _tmps.push_back(_cell);
-        }
-
-        string _productId = _tmps[0];
-        double _bid = stod(_tmps[1]);
-        double _offer = stod(_tmps[2]);
-        double _mid = (_bid + _offer) / 2.0;
-        double _spread = _offer - _bid;
-        T _product = GetBond(_productId);
-        Price<T> _price(_product, _mid, _spread);
-        service->OnMessage(_price);
-    }
+    ForEachLine(_data, [&](string_view _line) { ProcessLine(_line); });
+}
+
+template<typename T>
+void PricingConnector<T>::SubscribeFile(const string& _path)
+{
+    ForEachLine(_path, [&](string_view _line) { ProcessLine(_line); });
+}
+
+template<typename T>
+void PricingConnector<T>::ProcessLine(string_view _line)
+{
+    Price<T> _price;
+    if (!ParseLine(_line, _price)) return;
+    service->OnMessage(move(_price));
+}
+
+template<typename T>
+bool PricingConnector<T>::ParseLine(string_view _line, Price<T>& _price)
+{
+    string_view _cells[3];
+    if (SplitCells(_line, _cells, 3) < 3) return false;
+
+    double _bid = ConvertPrice(_cells[1]);
+    double _offer = ConvertPrice(_cells[2]);
+    double _mid = (_bid + _offer) / 2.0;
+    double _spread = _offer - _bid;
+    const T& _product = GetBond(_cells[0]);
+    _price = Price<T>(_product, _mid, _spread);
+    _price.SetTimestamp(GetNanoseconds());
+    return true;
 }
 
 #endif
@@ -0,0 +1,201 @@
+/**
+ * productregistry.hpp
+ * Defines the registry interning every traded product once under a dense product index.
+ *
+ */
+#ifndef PRODUCT_REGISTRY_HPP
+#define PRODUCT_REGISTRY_HPP
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <charconv>
+#include "products.hpp"
+
+using namespace std;
+
+/**
+* Product Registry interning each bond once.
+* Every bond gets a dense product index, stored on the bond itself, and a stable
+* address, so services can key state by index and hand out const references.
+* The registry is populated at startup; lookups are read-only and safe to run
+* from several threads once loading is done.
+*/
+class ProductRegistry
+{
+
+public:
+
+    // Constructor, seeded with the US Treasury 2Y, 3Y, 5Y, 7Y, 10Y, and 30Y
+    ProductRegistry();
+
+    // Load bonds from a reference file with lines "cusip,ticker,coupon,maturity[,pv01]",
+    // maturity as "yyyy/mm/dd". Malformed lines are reported and skipped. Return the number of bonds loaded.
+    size_t Load(const string& _path);
+
+    // Intern a bond, return its index (the existing index if the CUSIP is already known)
+    int AddBond(const Bond& _bond, double _pv01 = 0);
+
+    // Get the index of a CUSIP, -1 if it is unknown
+    int GetIndex(string_view _cusip) const;
+
+    // Get the bond at an index, a default bond if it is out of range
+    const Bond& GetBond(int _index) const;
+
+    // Get the bond of a CUSIP, a default bond if it is unknown
+    const Bond& GetBond(string_view _cusip) const;
+
+    // Get the PV01 value at an index, 0 if it is out of range
+    double GetPV01(int _index) const;
+
+    // Set the PV01 value at an index, ignored if it is out of range
+    void SetPV01(int _index, double _pv01);
+
+    // Get the number of products in the registry
+    size_t GetSize() const;
+
+private:
+
+    // Check if an index is in range
+    bool Contains(int _index) const;
+
+    deque<Bond> bonds;
+    vector<double> pv01s;
+    unordered_map<string_view, int> indices;
+    Bond unknown;
+
+};
+
+ProductRegistry::ProductRegistry()
+{
+    AddBond(Bond("9128283H1", CUSIP, "US2Y", 0.01750, from_string("2019/11/30")), 0.01948992);
+    AddBond(Bond("9128283L2", CUSIP, "US3Y", 0.01875, from_string("2020/12/15")), 0.02865304);
+    AddBond(Bond("912828M80", CUSIP, "US5Y", 0.02000, from_string("2022/11/30")), 0.04581119);
+    AddBond(Bond("9128283J7", CUSIP, "US7Y", 0.02125, from_string("2024/11/30")), 0.06127718);
+    AddBond(Bond("9128283F5", CUSIP, "US10Y", 0.02250, from_string("2027/12/15")), 0.08161449);
+    AddBond(Bond("912810RZ3", CUSIP, "US30Y", 0.02750, from_string("2047/12/15")), 0.15013155);
+}
+
+size_t ProductRegistry::Load(const string& _path)
+{
+    ifstream _file(_path);
+    string _line;
+    size_t _count = 0;
+    size_t _number = 0;
+    while (getline(_file, _line))
+    {
+        _number++;
+        if (!_line.empty() && _line.back() == '\r') _line.pop_back();
+        if (_line.empty()) continue;
+        stringstream _lineStream(_line);
+        string _cell;
+        vector<string> _cells;
+        while (getline(_lineStream, _cell, ','))
+        {
+            _cells.push_back(_cell);
+        }
+
+        // Each field is checked, so a malformed line is skipped rather than failing the load
+        auto _parse = [](const string& _text, auto& _value)
+        {
+            const char* _end = _text.data() + _text.size();
+            from_chars_result _result = from_chars(_text.data(), _end, _value);
+            return _result.ec == errc() && _result.ptr == _end;
+        };
+        string _error;
+        float _coupon = 0;
+        double _pv01 = 0;
+        date _maturity;
+        if (_cells.size() < 4) _error = "expected at least 4 fields";
+        else if (_cells[0].empty()) _error = "empty CUSIP";
+        else if (!_parse(_cells[2], _coupon)) _error = "bad coupon \"" + _cells[2] + "\"";
+        else if (_cells.size() > 4 && !_parse(_cells[4], _pv01)) _error = "bad PV01 \"" + _cells[4] + "\"";
+        else
+        {
+            try
+            {
+                _maturity = from_string(_cells[3]);
+                if (_maturity.is_special()) _error = "bad maturity \"" + _cells[3] + "\"";
+            }
+            catch (const exception&)
+            {
+                _error = "bad maturity \"" + _cells[3] + "\"";
+            }
+        }
+        if (!_error.empty())
+        {
+            cerr << "Products: skipped line " << _number << " of " << _path << ": " << _error << endl;
+            continue;
+        }
+
+        Bond _bond(_cells[0], CUSIP, _cells[1], _coupon, _maturity);
+        int _index = AddBond(_bond, _pv01);
+        if (_cells.size() > 4) SetPV01(_index, _pv01);
+        _count++;
+    }
+    return _count;
+}
+
+int ProductRegistry::AddBond(const Bond& _bond, double _pv01)
+{
+    int _index = GetIndex(_bond.GetProductId());
+    if (_index >= 0) return _index;
+
+    _index = bonds.size();
+    bonds.push_back(_bond);
+    bonds.back().SetProductIndex(_index);
+    pv01s.push_back(_pv01);
+    indices[bonds.back().GetProductId()] = _index;
+    return _index;
+}
+
+int ProductRegistry::GetIndex(string_view _cusip) const
+{
+    auto _it = indices.find(_cusip);
+    return (_it == indices.end()) ? -1 : _it->second;
+}
+
+bool ProductRegistry::Contains(int _index) const
+{
+    return _index >= 0 && size_t(_index) < bonds.size();
+}
+
+const Bond& ProductRegistry::GetBond(int _index) const
+{
+    return Contains(_index) ? bonds[_index] : unknown;
+}
+
+const Bond& ProductRegistry::GetBond(string_view _cusip) const
+{
+    int _index = GetIndex(_cusip);
+    return (_index < 0) ? unknown : bonds[_index];
+}
+
+double ProductRegistry::GetPV01(int _index) const
+{
+    return Contains(_index) ? pv01s[_index] : 0;
+}
+
+void ProductRegistry::SetPV01(int _index, double _pv01)
+{
+    if (Contains(_index)) pv01s[_index] = _pv01;
+}
+
+size_t ProductRegistry::GetSize() const
+{
+    return bonds.size();
+}
+
+// Get the registry of all products in the trading system
+ProductRegistry& GetProductRegistry()
+{
+    static ProductRegistry _registry;
+    return _registry;
+}
+
+#endif
@@ -34,9 +34,16 @@ public:
   // Ge the product type
   ProductType GetProductType() const;
 
+  // Get the dense index of the product in the product registry, -1 if not registered
+  int GetProductIndex() const;
+
+  // Set the dense index of the product in the product registry
+  void SetProductIndex(int _productIndex);
+
 private:
   string productId;
   ProductType productType;
+  int productIndex;
 
 };
 
@@ -163,6 +170,7 @@ Product::Product(string _productId, ProductType _productType)
 {
   productId = _productId;
   productType = _productType;
+  productIndex = -1;
 }
 
 const string& Product::GetProductId() const
@@ -175,6 +183,16 @@ ProductType Product::GetProductType() const
   return productType;
 }
 
+int Product::GetProductIndex() const
+{
+  return productIndex;
+}
+
+void Product::SetProductIndex(int _productIndex)
+{
+  productIndex = _productIndex;
+}
+
 Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate) : Product(_productId, BOND)
 {
   bondIdType = _bondIdType;
@@ -183,8 +201,10 @@ Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _cou
   maturityDate =_maturityDate;
 }
 
-Bond::Bond() : Product(0, BOND)
+Bond::Bond() : Product("", BOND)
 {
+  bondIdType = CUSIP;
+  coupon = 0;
 }
 
 const string& Bond::GetTicker() const
@@ -231,7 +251,7 @@ IRSwap::IRSwap(string _productId, DayCountConvention _fixedLegDayCountConvention
   terminationDate =_terminationDate;
 }
 
-IRSwap::IRSwap() : Product(0, IRSWAP)
+IRSwap::IRSwap() : Product("", IRSWAP)
 {
 }
 
@@ -0,0 +1,278 @@
+/**
+ * replay.hpp
+ * Defines the replay of recorded market data from an in-memory tick store, and backtests of algo execution parameters over it.
+ *
+ */
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "filereader.hpp"
+#include "metrics.hpp"
+#include "compactmessages.hpp"
+#include "ingest.hpp"
+#include "marketdataservice.hpp"
+#include "executionservice.hpp"
+
+using namespace std;
+
+/**
+* Tick store holding the order books of a market data file as compact messages, loaded once.
+* Each tick is stamped with its session time, taken from its position in the file as in
+* timestamp-ordered ingest. The store is not changed after loading, so any number of
+* replays can read it at once.
+*/
+class TickStore
+{
+
+public:
+
+    // Load the order books of a market data file, return the number of ticks loaded
+    size_t Load(const string& _path, int _bookDepth = COMPACT_BOOK_DEPTH);
+
+    // Get the ticks in file order
+    const vector<CompactOrderBook>& GetTicks() const;
+
+    // Get the number of ticks
+    size_t GetSize() const;
+
+private:
+
+    vector<CompactOrderBook> ticks;
+
+};
+
+size_t TickStore::Load(const string& _path, int _bookDepth)
+{
+    ticks.clear();
+    MappedFile _file(_path);
+    if (!_file.IsOpen()) return 0;
+    string_view _data = _file.GetData();
+    LineReader _reader(_data);
+    OrderBookParser<Bond> _parser(_bookDepth);
+    OrderBook<Bond> _orderBook;
+    string_view _line;
+    while (_reader.Next(_line))
+    {
+        if (!_parser.ParseLine(_line, _orderBook)) continue;
+        ticks.push_back(ToCompact(_orderBook));
+        ticks.back().timestamp = GetSessionTimestamp(_reader.GetOffset(), _data.size());
+    }
+    return ticks.size();
+}
+
+const vector<CompactOrderBook>& TickStore::GetTicks() const
+{
+    return ticks;
+}
+
+size_t TickStore::GetSize() const
+{
+    return ticks.size();
+}
+
+/**
+* Replay of a tick store into a market data service, as fast as possible or paced at a
+* multiple of the session's time. Books are rebuilt in place and handed over by move,
+* and are stamped when they are delivered so the latency metrics downstream hold.
+* Type S is the market data service type.
+*/
+template<typename S>
+class MarketDataReplay
+{
+
+public:
+
+    // ctor for a replay of a tick store into a market data service
+    MarketDataReplay(const TickStore& _store, S* _service);
+
+    // Replay every tick, at a multiple of the session's time or as fast as possible if the speed is 0, return the nanoseconds taken
+    long Run(double _speed = 0);
+
+private:
+
+    const TickStore& store;
+    S* service;
+    OrderBookExpander expander;
+    OrderBook<Bond> orderBook;
+
+};
+
+template<typename S>
+MarketDataReplay<S>::MarketDataReplay(const TickStore& _store, S* _service) : store(_store), service(_service)
+{
+}
+
+template<typename S>
+long MarketDataReplay<S>::Run(double _speed)
+{
+    long _start = GetNanoseconds();
+    for (auto& t : store.GetTicks())
+    {
+        if (_speed > 0)
+        {
+            // Sleep while the tick is far off, then spin to its due time
+            long _due = _start + long(t.timestamp / _speed);
+            long _now;
+            while ((_now = GetNanoseconds()) < _due)
+            {
+                if (_due - _now > 200000) this_thread::sleep_for(chrono::nanoseconds(_due - _now - 100000));
+                else this_thread::yield();
+            }
+        }
+        expander.Expand(t, orderBook);
+        orderBook.SetTimestamp(GetNanoseconds());
+        service->OnMessage(move(orderBook));
+    }
+    return GetNanoseconds() - _start;
+}
+
+/**
+* Summary of a backtest of algo execution parameters.
+* Every order is taken as filled in full at its price, as by the simulated venues: a bid is
+* hit by selling and an offer lifted by buying. Cash is per 100 face, and PnL marks the
+* position in each product to the mid of its last book.
+*/
+struct AlgoBacktestResult
+{
+    AlgoExecutionParameters parameters;
+    long orders = 0;
+    long buys = 0;
+    long sells = 0;
+    long quantity = 0;
+    long position = 0;
+    double pnl = 0;
+    long nanos = 0;
+};
+
+/**
+* Algo Execution Service Listener accumulating the fills of a backtest by product.
+*/
+class AlgoBacktestListener : public ServiceListener<AlgoExecution<Bond>>
+{
+
+public:
+
+    // ctor for a backtest of the products in the registry
+    AlgoBacktestListener();
+
+    // Listener callback to process an add event to the Service, filling the order
+    void ProcessAdd(AlgoExecution<Bond>& _data);
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(AlgoExecution<Bond>& _data) {};
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(AlgoExecution<Bond>& _data) {};
+
+    // Get the summary of the fills, marking the positions to the last books of a market data service
+    template<typename S>
+    AlgoBacktestResult GetResult(S* _marketDataService) const;
+
+private:
+
+    vector<long> positions;
+    vector<double> cash;
+    long orders;
+    long buys;
+    long sells;
+    long quantity;
+
+};
+
+AlgoBacktestListener::AlgoBacktestListener() :
+        positions(GetProductRegistry().GetSize(), 0), cash(GetProductRegistry().GetSize(), 0), orders(0), buys(0), sells(0), quantity(0)
+{
+}
+
+void AlgoBacktestListener::ProcessAdd(AlgoExecution<Bond>& _data)
+{
+    const ExecutionOrder<Bond>& _order = _data.GetExecutionOrder();
+    int _index = ResolveProductIndex(_order.GetProduct());
+    if (_index < 0 || size_t(_index) >= positions.size()) return;
+
+    long _quantity = _order.GetVisibleQuantity() + _order.GetHiddenQuantity();
+    double _value = _order.GetPrice() * _quantity / 100;
+    orders++;
+    quantity += _quantity;
+    if (_order.GetPricingSide() == BID)
+    {
+        sells++;
+        positions[_index] -= _quantity;
+        cash[_index] += _value;
+    }
+    else
+    {
+        buys++;
+        positions[_index] += _quantity;
+        cash[_index] -= _value;
+    }
+}
+
+template<typename S>
+AlgoBacktestResult AlgoBacktestListener::GetResult(S* _marketDataService) const
+{
+    AlgoBacktestResult _result;
+    _result.orders = orders;
+    _result.buys = buys;
+    _result.sells = sells;
+    _result.quantity = quantity;
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        double _mid = 0;
+        if (_marketDataService->Contains(int(i)))
+        {
+            const BidOffer& _bidOffer = _marketDataService->GetData(int(i)).GetBidOffer();
+            _mid = (_bidOffer.GetBidOrder().GetPrice() + _bidOffer.GetOfferOrder().GetPrice()) / 2;
+        }
+        _result.position += positions[i];
+        _result.pnl += cash[i] + positions[i] * _mid / 100;
+    }
+    return _result;
+}
+
+// Backtest a set of algo execution parameters over a tick store, replayed as fast as possible
+AlgoBacktestResult RunAlgoBacktest(const TickStore& _store, const AlgoExecutionParameters& _parameters)
+{
+    MarketDataService<Bond> _marketDataService;
+    AlgoExecutionService<Bond> _algoExecutionService(_parameters);
+    AlgoBacktestListener _listener;
+    _marketDataService.AddListener(_algoExecutionService.GetListener());
+    _algoExecutionService.AddListener(&_listener);
+
+    MarketDataReplay<MarketDataService<Bond>> _replay(_store, &_marketDataService);
+    long _nanos = _replay.Run();
+    AlgoBacktestResult _result = _listener.GetResult(&_marketDataService);
+    _result.parameters = _parameters;
+    _result.nanos = _nanos;
+    return _result;
+}
+
+// Backtest each set of parameters over a shared tick store, in parallel on up to a number
+// of threads, as many as there are cores if 0; results come back in the order of the sets
+vector<AlgoBacktestResult> RunAlgoSweep(const TickStore& _store, const vector<AlgoExecutionParameters>& _variants, int _threads = 0)
+{
+    vector<AlgoBacktestResult> _results(_variants.size());
+    if (_threads <= 0) _threads = max(1, int(thread::hardware_concurrency()));
+    _threads = min(_threads, int(_variants.size()));
+
+    // Workers take the next variant as they finish one, so slow variants do not hold up a fixed share
+    atomic<size_t> _next(0);
+    auto _work = [&]()
+    {
+        size_t _variant;
+        while ((_variant = _next.fetch_add(1, memory_order_relaxed)) < _variants.size())
+        {
+            _results[_variant] = RunAlgoBacktest(_store, _variants[_variant]);
+        }
+    };
+    vector<thread> _workers;
+    for (int i = 0; i < _threads; i++) _workers.emplace_back(_work);
+    for (auto& w : _workers) w.join();
+    return _results;
+}
+
+#endif
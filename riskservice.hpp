@@ -7,6 +7,10 @@
 #ifndef RISK_SERVICE_HPP
 #define RISK_SERVICE_HPP
 
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <cmath>
 #include "soa.hpp"
 #include "positionservice.hpp"
 
@@ -36,13 +40,26 @@ public:
     // Set the quantity that this risk value is associated with
     void SetQuantity(long _quantity);
 
+    // Set the PV01 value
+    void SetPV01(double _pv01);
+
+    // Add to the quantity, remembering the change
+    void AddQuantity(long _change);
+
+    // Get the quantity change of the last update
+    long GetQuantityChange() const;
+
     // Change attributes to strings
     vector<string> ToStrings() const;
 
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
 private:
     T product;
-    double pv01;
-    long quantity;
+    double pv01 = 0;
+    long quantity = 0;
+    long quantityChange = 0;
 
 };
 
@@ -52,6 +69,7 @@ PV01<T>::PV01(const T& _product, double _pv01, long _quantity) :
 {
     pv01 = _pv01;
     quantity = _quantity;
+    quantityChange = _quantity;
 }
 
 template<typename T>
@@ -78,6 +96,25 @@ void PV01<T>::SetQuantity(long _quantity)
     quantity = _quantity;
 }
 
+template<typename T>
+void PV01<T>::SetPV01(double _pv01)
+{
+    pv01 = _pv01;
+}
+
+template<typename T>
+void PV01<T>::AddQuantity(long _change)
+{
+    quantity += _change;
+    quantityChange = _change;
+}
+
+template<typename T>
+long PV01<T>::GetQuantityChange() const
+{
+    return quantityChange;
+}
+
 template<typename T>
 vector<string> PV01<T>::ToStrings() const
 {
@@ -92,6 +129,14 @@ vector<string> PV01<T>::ToStrings() const
     return _strings;
 }
 
+template<typename T>
+void PV01<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    _formatter.DecimalField(pv01);
+    _formatter.IntegerField(quantity);
+}
+
 /**
 * A bucket sector to bucket a group of securities.
 * We can then aggregate bucketed risk to this bucket.
@@ -141,23 +186,59 @@ const string& BucketedSector<T>::GetName() const
 /**
 * Pre-declearations to avoid errors.
 */
-template<typename T>
+template<typename T, typename... L>
+class RiskService;
+template<typename T, typename S = RiskService<T>>
 class RiskToPositionListener;
 
 /**
 * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
+* Sectors are registered up front with AddSector. Their aggregate PV01 is updated by the
+* change of a member's risk whenever a position changes, and published to the sector
+* listeners, so reading a bucket's risk is one atomic load and never walks the sector.
+* Risk is summed in integer units of 1/RISK_UNITS, each member contributing its rounded risk,
+* so a sector always equals the sum of its members and does not drift with updates.
+* A member's risk is clamped to RISK_LIMIT units, far beyond any real book, so that it and
+* the sum of a sector of up to a thousand members stay within a long.
 * Keyed on product identifier.
-* Type T is the product type.
+* Type T is the product type, types L the listener types dispatched statically.
 */
-template<typename T>
+template<typename T, typename... L>
 class RiskService : public Service<string, PV01<T>>
 {
 
 private:
 
-    map<string, PV01<T>> pv01s;
-    vector<ServiceListener<PV01<T>>*> listeners;
-    RiskToPositionListener<T>* listener;
+    static constexpr double RISK_UNITS = 1e4;
+    static constexpr double RISK_LIMIT = 9007199254740992.0;
+
+    struct Sector
+    {
+        Sector(const BucketedSector<T>& _sector) : risk(_sector, 0, 1), units(0) {};
+
+        PV01<BucketedSector<T>> risk;
+        atomic<long> units;
+    };
+
+    // Get the stored risk of the product at an index, in risk units
+    long GetRiskUnits(int _index);
+
+    // Move the sectors of the product at an index to its stored risk
+    void UpdateSectors(int _index);
+
+    // Update the stored risk of a position and return it
+    PV01<T>& RiskPosition(const Position<T>& _position);
+
+    ProductStore<PV01<T>> pv01s;
+    PV01<T> missing;
+    vector<PV01<T>> batch;
+    ListenerList<PV01<T>, L...> listeners;
+    RiskToPositionListener<T, RiskService>* listener;
+    deque<Sector> sectors;
+    vector<vector<int>> productSectors;
+    vector<long> productUnits;
+    map<string, int, less<>> sectorIndices;
+    vector<ServiceListener<PV01<BucketedSector<T>>>*> sectorListeners;
 
 public:
 
@@ -165,8 +246,14 @@ public:
     RiskService();
     ~RiskService();
 
-    // Get data on our service given a key
-    PV01<T>& GetData(string _key);
+    // Get data on our service given a key, a default value if none was stored for it
+    PV01<T>& GetData(const string& _key);
+
+    // Get data on our service given a product index
+    PV01<T>& GetData(int _index);
+
+    // Check if the service holds risk for a product index
+    bool Contains(int _index) const;
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(PV01<T>& _data);
@@ -174,115 +261,248 @@ public:
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<PV01<T>>* _listener);
 
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners);
+
     // Get all listeners on the Service
     const vector<ServiceListener<PV01<T>>*>& GetListeners() const;
 
     // Get the listener of the service
-    RiskToPositionListener<T>* GetListener();
+    RiskToPositionListener<T, RiskService>* GetListener();
 
     // Add a position that the service will risk
     void AddPosition(Position<T>& _position);
 
-    // Get the bucketed risk for the bucket sector
-    const PV01<BucketedSector<T>>& GetBucketedRisk(const BucketedSector<T>& _sector) const;
+    // Add a batch of positions, notifying listeners with their risk as one batch
+    void AddPositions(span<Position<T>> _positions);
+
+    // Update the PV01 value of the product at an index, and the risk of its sectors
+    void UpdatePV01(int _index, double _pv01);
+
+    // Register a bucket sector, return its sector index.
+    // Sectors must be registered before positions are risked from other threads.
+    int AddSector(const BucketedSector<T>& _sector);
+
+    // Add a listener for the bucketed risk updates of every sector
+    void AddSectorListener(ServiceListener<PV01<BucketedSector<T>>>* _listener);
+
+    // Get the index of a registered sector by name, -1 if it is unknown
+    int GetSectorIndex(string_view _name) const;
+
+    // Get the aggregate PV01 of the sector at an index
+    double GetBucketedPV01(int _sector) const;
+
+    // Get the bucketed risk for the bucket sector, zero if the sector is not registered
+    PV01<BucketedSector<T>> GetBucketedRisk(const BucketedSector<T>& _sector) const;
 
 };
 
-template<typename T>
-RiskService<T>::RiskService()
+template<typename T, typename... L>
+RiskService<T, L...>::RiskService()
 {
-    pv01s = map<string, PV01<T>>();
-    listeners = vector<ServiceListener<PV01<T>>*>();
-    listener = new RiskToPositionListener<T>(this);
+    pv01s = ProductStore<PV01<T>>();
+    listener = new RiskToPositionListener<T, RiskService>(this);
 }
 
-template<typename T>
-RiskService<T>::~RiskService() {}
+template<typename T, typename... L>
+RiskService<T, L...>::~RiskService() {}
 
-template<typename T>
-PV01<T>& RiskService<T>::GetData(string _key)
+template<typename T, typename... L>
+PV01<T>& RiskService<T, L...>::GetData(const string& _key)
 {
-    return pv01s[_key];
+    PV01<T>* _pv01 = pv01s.Find(_key);
+    return _pv01 ? *_pv01 : missing;
 }
 
-template<typename T>
-void RiskService<T>::OnMessage(PV01<T>& _data)
+template<typename T, typename... L>
+PV01<T>& RiskService<T, L...>::GetData(int _index)
 {
-    pv01s[_data.GetProduct().GetProductId()] = _data;
+    return pv01s[_index];
 }
 
-template<typename T>
-void RiskService<T>::AddListener(ServiceListener<PV01<T>>* _listener)
+template<typename T, typename... L>
+bool RiskService<T, L...>::Contains(int _index) const
 {
-    listeners.push_back(_listener);
+    return pv01s.Contains(_index);
 }
 
-template<typename T>
-const vector<ServiceListener<PV01<T>>*>& RiskService<T>::GetListeners() const
+template<typename T, typename... L>
+void RiskService<T, L...>::OnMessage(PV01<T>& _data)
 {
-    return listeners;
+    pv01s.Get(_data.GetProduct()) = _data;
+    UpdateSectors(ResolveProductIndex(_data.GetProduct()));
 }
 
-template<typename T>
-RiskToPositionListener<T>* RiskService<T>::GetListener()
+template<typename T, typename... L>
+void RiskService<T, L...>::AddListener(ServiceListener<PV01<T>>* _listener)
+{
+    listeners.Add(_listener);
+}
+
+template<typename T, typename... L>
+void RiskService<T, L...>::BindListeners(L*... _listeners)
+{
+    listeners.Bind(_listeners...);
+}
+
+template<typename T, typename... L>
+const vector<ServiceListener<PV01<T>>*>& RiskService<T, L...>::GetListeners() const
+{
+    return listeners.GetDynamic();
+}
+
+template<typename T, typename... L>
+RiskToPositionListener<T, RiskService<T, L...>>* RiskService<T, L...>::GetListener()
 {
     return listener;
 }
 
-template<typename T>
-void RiskService<T>::AddPosition(Position<T>& _position)
+template<typename T, typename... L>
+PV01<T>& RiskService<T, L...>::RiskPosition(const Position<T>& _position)
+{
+    // Update the stored risk in place by the change in aggregate position;
+    // listeners see the new total along with the change
+    const T& _product = _position.GetProduct();
+    PV01<T>& _pv01 = pv01s.Get(_product);
+    if (_pv01.GetProduct().GetProductId().empty()) _pv01 = PV01<T>(_product, GetPV01Value(_product.GetProductId()), 0);
+    _pv01.AddQuantity(_position.GetAggregatePosition() - _pv01.GetQuantity());
+    UpdateSectors(ResolveProductIndex(_product));
+    return _pv01;
+}
+
+template<typename T, typename... L>
+void RiskService<T, L...>::AddPosition(Position<T>& _position)
 {
-    T _product = _position.GetProduct();
-    string _productId = _product.GetProductId();
-    double _pv01Value = GetPV01Value(_productId);
-    long _quantity = _position.GetAggregatePosition();
-    PV01<T> _pv01(_product, _pv01Value, _quantity);
-    pv01s[_productId] = _pv01;
+    listeners.ProcessAdd(RiskPosition(_position));
+}
 
-    for (auto& l : listeners)
+template<typename T, typename... L>
+void RiskService<T, L...>::AddPositions(span<Position<T>> _positions)
+{
+    batch.clear();
+    for (auto& p : _positions)
     {
-        l->ProcessAdd(_pv01);
+        batch.push_back(RiskPosition(p));
     }
+    listeners.ProcessAddBatch(span<PV01<T>>(batch));
 }
 
-template<typename T>
-const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T>& _sector) const
+template<typename T, typename... L>
+void RiskService<T, L...>::UpdatePV01(int _index, double _pv01)
+{
+    // Products not risked yet pick the new value up from the registry
+    if (!pv01s.Contains(_index)) return;
+    pv01s[_index].SetPV01(_pv01);
+    UpdateSectors(_index);
+}
+
+template<typename T, typename... L>
+int RiskService<T, L...>::AddSector(const BucketedSector<T>& _sector)
 {
-    BucketedSector<T> _product = _sector;
-    double _pv01 = 0;
-    long _quantity = 1;
+    int _sectorIndex = sectors.size();
+    Sector& _entry = sectors.emplace_back(_sector);
+    sectorIndices[_sector.GetName()] = _sectorIndex;
 
-    vector<T>& _products = _sector.GetProducts();
-    for (auto& p : _products)
+    long _units = 0;
+    for (auto& p : _sector.GetProducts())
     {
-        string _pId = p.GetProductId();
-        _pv01 += pv01s[_pId].GetPV01() * pv01s[_pId].GetQuantity();
+        int _index = ResolveProductIndex(p);
+        if (_index < 0) continue;
+        if (size_t(_index) >= productSectors.size())
+        {
+            productSectors.resize(_index + 1);
+            productUnits.resize(_index + 1);
+        }
+        productSectors[_index].push_back(_sectorIndex);
+        productUnits[_index] = GetRiskUnits(_index);
+        _units += productUnits[_index];
     }
+    _entry.risk.SetPV01(_units / RISK_UNITS);
+    _entry.units.store(_units, memory_order_release);
+    return _sectorIndex;
+}
+
+template<typename T, typename... L>
+void RiskService<T, L...>::AddSectorListener(ServiceListener<PV01<BucketedSector<T>>>* _listener)
+{
+    sectorListeners.push_back(_listener);
+}
+
+template<typename T, typename... L>
+int RiskService<T, L...>::GetSectorIndex(string_view _name) const
+{
+    auto _it = sectorIndices.find(_name);
+    return (_it == sectorIndices.end()) ? -1 : _it->second;
+}
+
+template<typename T, typename... L>
+double RiskService<T, L...>::GetBucketedPV01(int _sector) const
+{
+    return sectors[_sector].units.load(memory_order_acquire) / RISK_UNITS;
+}
+
+template<typename T, typename... L>
+PV01<BucketedSector<T>> RiskService<T, L...>::GetBucketedRisk(const BucketedSector<T>& _sector) const
+{
+    int _sectorIndex = GetSectorIndex(_sector.GetName());
+    double _pv01 = (_sectorIndex < 0) ? 0 : GetBucketedPV01(_sectorIndex);
+    return PV01<BucketedSector<T>>(_sector, _pv01, 1);
+}
+
+template<typename T, typename... L>
+long RiskService<T, L...>::GetRiskUnits(int _index)
+{
+    if (!pv01s.Contains(_index)) return 0;
+    const PV01<T>& _risk = pv01s[_index];
+    double _units = _risk.GetPV01() * _risk.GetQuantity() * RISK_UNITS;
+    return llround(clamp(_units, -RISK_LIMIT, RISK_LIMIT));
+}
 
-    return PV01<BucketedSector<T>>(_product, _pv01, _quantity);
+template<typename T, typename... L>
+void RiskService<T, L...>::UpdateSectors(int _index)
+{
+    if (_index < 0 || size_t(_index) >= productSectors.size()) return;
+    long _units = GetRiskUnits(_index);
+    long _change = _units - productUnits[_index];
+    productUnits[_index] = _units;
+    for (int i : productSectors[_index])
+    {
+        // Only the risk thread writes, so a load and a store keep the aggregate consistent
+        Sector& _sector = sectors[i];
+        long _total = _sector.units.load(memory_order_relaxed) + _change;
+        _sector.units.store(_total, memory_order_release);
+        _sector.risk.SetPV01(_total / RISK_UNITS);
+        for (auto& l : sectorListeners)
+        {
+            l->ProcessAdd(_sector.risk);
+        }
+    }
 }
 
 /**
 * Risk Service Listener subscribing data from Position Service to Risk Service.
-* Type T is the product type.
+* Type T is the product type, type S the risk service type.
 */
-template<typename T>
-class RiskToPositionListener : public ServiceListener<Position<T>>
+template<typename T, typename S>
+class RiskToPositionListener final : public ServiceListener<Position<T>>
 {
 
 private:
 
-    RiskService<T>* service;
+    S* service;
 
 public:
 
     // Connector and Destructor
-    RiskToPositionListener(RiskService<T>* _service);
+    RiskToPositionListener(S* _service);
     ~RiskToPositionListener();
 
     // Listener callback to process an add event to the Service
     void ProcessAdd(Position<T>& _data);
 
+    // Listener callback to process add events for a batch of positions
+    void ProcessAddBatch(span<Position<T>> _data);
+
     // Listener callback to process a remove event to the Service
     void ProcessRemove(Position<T>& _data);
 
@@ -291,25 +511,31 @@ public:
 
 };
 
-template<typename T>
-RiskToPositionListener<T>::RiskToPositionListener(RiskService<T>* _service)
+template<typename T, typename S>
+RiskToPositionListener<T, S>::RiskToPositionListener(S* _service)
 {
     service = _service;
 }
 
-template<typename T>
-RiskToPositionListener<T>::~RiskToPositionListener() {}
+template<typename T, typename S>
+RiskToPositionListener<T, S>::~RiskToPositionListener() {}
 
-template<typename T>
-void RiskToPositionListener<T>::ProcessAdd(Position<T>& _data)
+template<typename T, typename S>
+void RiskToPositionListener<T, S>::ProcessAdd(Position<T>& _data)
 {
     service->AddPosition(_data);
 }
 
-template<typename T>
-void RiskToPositionListener<T>::ProcessRemove(Position<T>& _data) {}
+template<typename T, typename S>
+void RiskToPositionListener<T, S>::ProcessAddBatch(span<Position<T>> _data)
+{
+    service->AddPositions(_data);
+}
 
-template<typename T>
-void RiskToPositionListener<T>::ProcessUpdate(Position<T>& _data) {}
+template<typename T, typename S>
+void RiskToPositionListener<T, S>::ProcessRemove(Position<T>& _data) {}
+
+template<typename T, typename S>
+void RiskToPositionListener<T, S>::ProcessUpdate(Position<T>& _data) {}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,535 @@
+/**
+ * servicestore.hpp
+ * Defines the state stores used by services: a flat store keyed by product index,
+ * an open-addressing hash table keyed by trade or inquiry identifier, and a store
+ * retaining identified entries within a size and age bound.
+ *
+ */
+#ifndef SERVICE_STORE_HPP
+#define SERVICE_STORE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <climits>
+#include <optional>
+#include <chrono>
+#include <functional>
+#include "products.hpp"
+#include "productregistry.hpp"
+
+using namespace std;
+
+// Get the dense product index of a product, looking it up in the registry if it was not set
+int ResolveProductIndex(const Product& _product)
+{
+    int _index = _product.GetProductIndex();
+    return (_index >= 0) ? _index : GetProductRegistry().GetIndex(_product.GetProductId());
+}
+
+/**
+* Flat store with one cache-line aligned slot per product, keyed by product index.
+* Lookups by index are plain array indexing; lookups by product identifier go through
+* the product registry once. Products unknown to the registry fall back to a map.
+* The slots are sized once from the registry, and products registered later get slots
+* appended to a deque, so no reference handed out is ever invalidated by a lookup.
+* Type V is the value type.
+*/
+template<typename V>
+class ProductStore
+{
+
+public:
+
+    // Constructor, sized from the product registry
+    ProductStore();
+
+    // Get the value of a product index
+    V& operator[](int _index);
+
+    // Get the value of a product
+    V& Get(const Product& _product);
+
+    // Get the value of a product identifier
+    V& Get(string_view _productId);
+
+    // Find the value of a product identifier without inserting, nullptr if none was stored
+    V* Find(string_view _productId);
+
+    // Check if a value was stored for a product index
+    bool Contains(int _index) const;
+
+    // Get the number of slots
+    size_t GetSize() const;
+
+private:
+
+    struct alignas(64) Slot
+    {
+        V value;
+        bool present = false;
+    };
+
+    // Get the slot of a product index, appending late slots as needed
+    Slot& GetSlot(int _index);
+
+    vector<Slot> slots;
+    deque<Slot> lateSlots;
+    map<string, V, less<>> overflow;
+
+};
+
+template<typename V>
+ProductStore<V>::ProductStore()
+{
+    slots = vector<Slot>(GetProductRegistry().GetSize());
+}
+
+template<typename V>
+typename ProductStore<V>::Slot& ProductStore<V>::GetSlot(int _index)
+{
+    if (size_t(_index) < slots.size()) return slots[_index];
+
+    // Growing a deque at its end leaves the existing elements where they are
+    size_t _late = size_t(_index) - slots.size();
+    if (_late >= lateSlots.size()) lateSlots.resize(_late + 1);
+    return lateSlots[_late];
+}
+
+template<typename V>
+V& ProductStore<V>::operator[](int _index)
+{
+    Slot& _slot = GetSlot(_index);
+    _slot.present = true;
+    return _slot.value;
+}
+
+template<typename V>
+V& ProductStore<V>::Get(const Product& _product)
+{
+    int _index = ResolveProductIndex(_product);
+    if (_index < 0) return overflow[_product.GetProductId()];
+    return (*this)[_index];
+}
+
+template<typename V>
+V& ProductStore<V>::Get(string_view _productId)
+{
+    int _index = GetProductRegistry().GetIndex(_productId);
+    if (_index < 0)
+    {
+        auto _it = overflow.find(_productId);
+        if (_it == overflow.end()) _it = overflow.emplace(string(_productId), V()).first;
+        return _it->second;
+    }
+    return (*this)[_index];
+}
+
+template<typename V>
+V* ProductStore<V>::Find(string_view _productId)
+{
+    int _index = GetProductRegistry().GetIndex(_productId);
+    if (_index < 0)
+    {
+        auto _it = overflow.find(_productId);
+        return (_it == overflow.end()) ? nullptr : &_it->second;
+    }
+    return Contains(_index) ? &GetSlot(_index).value : nullptr;
+}
+
+template<typename V>
+bool ProductStore<V>::Contains(int _index) const
+{
+    if (_index < 0) return false;
+    if (size_t(_index) < slots.size()) return slots[_index].present;
+    size_t _late = size_t(_index) - slots.size();
+    return _late < lateSlots.size() && lateSlots[_late].present;
+}
+
+template<typename V>
+size_t ProductStore<V>::GetSize() const
+{
+    return slots.size() + lateSlots.size();
+}
+
+/**
+* Open-addressing hash table keyed by identifier, with linear probing.
+* Slots are allocated up front for the reserved capacity, so inserting does not
+* allocate a node per entry. Short identifiers fit the string's inline buffer.
+* Type V is the value type.
+*/
+template<typename V>
+class IdHashTable
+{
+
+public:
+
+    // Constructor reserving room for _capacity entries
+    IdHashTable(size_t _capacity = 1024);
+
+    // Reserve room for _capacity entries
+    void Reserve(size_t _capacity);
+
+    // Get the value of an identifier, inserting a default value if it is missing
+    V& operator[](string_view _key);
+
+    // Find the value of an identifier, nullptr if it is missing
+    V* Find(string_view _key);
+
+    // Erase the entry of an identifier, return false if it is missing
+    bool Erase(string_view _key);
+
+    // Get the number of entries
+    size_t GetSize() const;
+
+private:
+
+    struct Slot
+    {
+        string key;
+        V value;
+        size_t hash = 0;
+        bool used = false;
+    };
+
+    // Find the slot of a key, or the empty slot where it would go
+    size_t Probe(string_view _key, size_t _hash) const;
+
+    vector<Slot> slots;
+    size_t count;
+
+};
+
+template<typename V>
+IdHashTable<V>::IdHashTable(size_t _capacity)
+{
+    count = 0;
+    Reserve(_capacity);
+}
+
+template<typename V>
+void IdHashTable<V>::Reserve(size_t _capacity)
+{
+    // Keep the load factor at or below one half
+    size_t _size = 16;
+    while (_size < _capacity * 2) _size *= 2;
+    if (_size <= slots.size()) return;
+
+    vector<Slot> _old = move(slots);
+    slots = vector<Slot>(_size);
+    for (auto& s : _old)
+    {
+        if (!s.used) continue;
+        Slot& _slot = slots[Probe(s.key, s.hash)];
+        _slot = move(s);
+    }
+}
+
+template<typename V>
+size_t IdHashTable<V>::Probe(string_view _key, size_t _hash) const
+{
+    size_t _mask = slots.size() - 1;
+    size_t i = _hash & _mask;
+    while (slots[i].used && (slots[i].hash != _hash || slots[i].key != _key))
+    {
+        i = (i + 1) & _mask;
+    }
+    return i;
+}
+
+template<typename V>
+V& IdHashTable<V>::operator[](string_view _key)
+{
+    size_t _hash = hash<string_view>()(_key);
+    size_t i = Probe(_key, _hash);
+    if (slots[i].used) return slots[i].value;
+
+    if ((count + 1) * 2 > slots.size())
+    {
+        Reserve(count + 1);
+        i = Probe(_key, _hash);
+    }
+    Slot& _slot = slots[i];
+    _slot.key = _key;
+    _slot.hash = _hash;
+    _slot.used = true;
+    count++;
+    return _slot.value;
+}
+
+template<typename V>
+V* IdHashTable<V>::Find(string_view _key)
+{
+    size_t i = Probe(_key, hash<string_view>()(_key));
+    return slots[i].used ? &slots[i].value : nullptr;
+}
+
+template<typename V>
+bool IdHashTable<V>::Erase(string_view _key)
+{
+    size_t _mask = slots.size() - 1;
+    size_t i = Probe(_key, hash<string_view>()(_key));
+    if (!slots[i].used) return false;
+
+    // Shift later entries of the probe run back into the gap, so no tombstones are left
+    size_t j = i;
+    while (true)
+    {
+        j = (j + 1) & _mask;
+        if (!slots[j].used) break;
+        size_t _home = slots[j].hash & _mask;
+        bool _stays = (i <= j) ? (i < _home && _home <= j) : (i < _home || _home <= j);
+        if (_stays) continue;
+        slots[i] = move(slots[j]);
+        i = j;
+    }
+    slots[i].used = false;
+    slots[i].key.clear();
+    slots[i].value = V();
+    count--;
+    return true;
+}
+
+template<typename V>
+size_t IdHashTable<V>::GetSize() const
+{
+    return count;
+}
+
+/**
+* Bounds on the entries a retention store keeps: at most a number of entries, and none
+* older than a time to live. A bound of 0 is no bound.
+*/
+struct RetentionPolicy
+{
+    size_t maxEntries = 0;
+    long ttlNanos = 0;
+};
+
+/**
+* Store of entries keyed by identifier, retained within a size and age bound.
+* Entries are evicted oldest first, as new ones are stored, once the store is over its size
+* or the oldest is past its time to live; an eviction handler can take each one first, to
+* persist it. The table is reserved for the size bound, and erasing leaves no tombstones,
+* so memory and lookup time stay flat however long the session runs.
+* Type V is the value type.
+*/
+template<typename V>
+class RetentionStore
+{
+
+public:
+
+    // ctor for a store retaining entries within a policy's bounds
+    RetentionStore(const RetentionPolicy& _policy = {});
+
+    // Set the bounds of the store, evicting the entries now outside them
+    void SetPolicy(const RetentionPolicy& _policy);
+
+    // Get the bounds of the store
+    const RetentionPolicy& GetPolicy() const;
+
+    // Set the handler taking each entry as it is evicted
+    void SetEvictionHandler(function<void(V&)> _handler);
+
+    // Get the value of an identifier, inserting a default value if it is missing
+    V& operator[](string_view _key);
+
+    // Find the value of an identifier without inserting, nullptr if it is missing
+    V* Find(string_view _key);
+
+    // Get a copy of the value of an identifier without inserting, empty if it is missing
+    optional<V> Lookup(string_view _key);
+
+    // Erase the entry of an identifier, return false if it is missing
+    bool Erase(string_view _key);
+
+    // Evict the entries outside the bounds, return how many were evicted
+    size_t Evict();
+
+    // Get the number of entries
+    size_t GetSize() const;
+
+    // Get the number of entries evicted so far
+    long GetEvictedCount() const;
+
+private:
+
+    struct Entry
+    {
+        V value;
+        long stored = 0;
+    };
+
+    // Key and store time of an entry, in the order entries were stored
+    struct Arrival
+    {
+        string key;
+        long stored;
+    };
+
+    // Get the time in monotonic nanoseconds
+    static long Now();
+
+    // Evict the oldest arrival if it is outside the bounds at a time, return false if none is
+    bool EvictOldest(long _now);
+
+    // Append an arrival to the ring, growing it if it is full
+    void PushArrival(string_view _key, long _stored);
+
+    RetentionPolicy policy;
+    IdHashTable<Entry> entries;
+    vector<Arrival> arrivals;
+    size_t head;
+    size_t pending;
+    long lastStored;
+    long evicted;
+    function<void(V&)> handler;
+
+};
+
+template<typename V>
+RetentionStore<V>::RetentionStore(const RetentionPolicy& _policy) :
+        policy(_policy), entries(_policy.maxEntries ? _policy.maxEntries : 1024), arrivals(16), head(0), pending(0), lastStored(0), evicted(0)
+{
+}
+
+template<typename V>
+void RetentionStore<V>::SetPolicy(const RetentionPolicy& _policy)
+{
+    policy = _policy;
+    if (policy.maxEntries) entries.Reserve(policy.maxEntries);
+    Evict();
+}
+
+template<typename V>
+const RetentionPolicy& RetentionStore<V>::GetPolicy() const
+{
+    return policy;
+}
+
+template<typename V>
+void RetentionStore<V>::SetEvictionHandler(function<void(V&)> _handler)
+{
+    handler = move(_handler);
+}
+
+template<typename V>
+long RetentionStore<V>::Now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<typename V>
+V& RetentionStore<V>::operator[](string_view _key)
+{
+    Entry* _entry = entries.Find(_key);
+    if (_entry) return _entry->value;
+
+    // Make room first, since erasing moves entries and would move the new one
+    long _now = policy.ttlNanos ? Now() : 0;
+    while (policy.maxEntries && entries.GetSize() >= policy.maxEntries && EvictOldest(LONG_MAX)) {}
+    while (policy.ttlNanos && EvictOldest(_now)) {}
+
+    // Store times are unique and increasing, so an arrival matches only the entry it was pushed for
+    long _stored = max(_now, lastStored + 1);
+    lastStored = _stored;
+    Entry& _new = entries[_key];
+    _new.stored = _stored;
+    PushArrival(_key, _stored);
+    return _new.value;
+}
+
+template<typename V>
+V* RetentionStore<V>::Find(string_view _key)
+{
+    Entry* _entry = entries.Find(_key);
+    return _entry ? &_entry->value : nullptr;
+}
+
+template<typename V>
+optional<V> RetentionStore<V>::Lookup(string_view _key)
+{
+    Entry* _entry = entries.Find(_key);
+    if (!_entry) return nullopt;
+    return _entry->value;
+}
+
+template<typename V>
+bool RetentionStore<V>::Erase(string_view _key)
+{
+    // The arrival stays in the ring and is skipped when it comes up
+    return entries.Erase(_key);
+}
+
+template<typename V>
+size_t RetentionStore<V>::Evict()
+{
+    long _start = evicted;
+    long _now = policy.ttlNanos ? Now() : 0;
+    while (policy.maxEntries && entries.GetSize() > policy.maxEntries && EvictOldest(LONG_MAX)) {}
+    while (policy.ttlNanos && EvictOldest(_now)) {}
+    return size_t(evicted - _start);
+}
+
+template<typename V>
+bool RetentionStore<V>::EvictOldest(long _now)
+{
+    while (pending > 0)
+    {
+        Arrival& _arrival = arrivals[head];
+        if (_now != LONG_MAX && _now - _arrival.stored <= policy.ttlNanos) return false;
+        head = (head + 1) % arrivals.size();
+        pending--;
+
+        // Arrivals of erased or replaced entries are stale
+        Entry* _entry = entries.Find(_arrival.key);
+        if (!_entry || _entry->stored != _arrival.stored) continue;
+        if (handler) handler(_entry->value);
+        entries.Erase(_arrival.key);
+        evicted++;
+        return true;
+    }
+    return false;
+}
+
+template<typename V>
+void RetentionStore<V>::PushArrival(string_view _key, long _stored)
+{
+    if (pending == arrivals.size())
+    {
+        // Drop the arrivals of erased entries, and grow only if the live ones fill half the ring
+        size_t _size = (entries.GetSize() * 2 > arrivals.size()) ? arrivals.size() * 2 : arrivals.size();
+        vector<Arrival> _kept(_size);
+        size_t _count = 0;
+        for (size_t i = 0; i < pending; i++)
+        {
+            Arrival& _old = arrivals[(head + i) % arrivals.size()];
+            Entry* _entry = entries.Find(_old.key);
+            if (_entry && _entry->stored == _old.stored) _kept[_count++] = move(_old);
+        }
+        arrivals = move(_kept);
+        head = 0;
+        pending = _count;
+    }
+    Arrival& _arrival = arrivals[(head + pending) % arrivals.size()];
+    _arrival.key = _key;
+    _arrival.stored = _stored;
+    pending++;
+}
+
+template<typename V>
+size_t RetentionStore<V>::GetSize() const
+{
+    return entries.GetSize();
+}
+
+template<typename V>
+long RetentionStore<V>::GetEvictedCount() const
+{
+    return evicted;
+}
+
+#endif
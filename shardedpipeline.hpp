@@ -0,0 +1,570 @@
+/**
+ * shardedpipeline.hpp
+ * Defines the sharded deployment of the trading services, partitioned by product.
+ *
+ */
+#ifndef SHARDED_PIPELINE_HPP
+#define SHARDED_PIPELINE_HPP
+
+#include <vector>
+#include <memory>
+#include <variant>
+#include <atomic>
+#include <thread>
+#include "soa.hpp"
+#include "marketdataservice.hpp"
+#include "executionservice.hpp"
+#include "tradebookingservice.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+
+using namespace std;
+
+/**
+* Listener adapter handing the events it receives to a service's OnMessage.
+* Type S is the service type, type V the data type.
+*/
+template<typename S, typename V>
+class OnMessageListener : public ServiceListener<V>
+{
+
+private:
+
+    S* service;
+
+public:
+
+    // Connector and Destructor
+    OnMessageListener(S* _service) : service(_service) {};
+
+    // Listener callback to process an add event to the Service
+    void ProcessAdd(V& _data)
+    {
+        service->OnMessage(_data);
+    };
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(V& _data) {};
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(V& _data) {};
+
+};
+
+/**
+* Merge stage joining the outputs of several shards into one stream.
+* Each shard notifies its own input, backed by a SPSC ring, and one thread hands the
+* events of all inputs to the merge stage's listeners, so consumers that are not
+* sharded, such as persistence and bucketed risk, only ever run on that thread.
+* Events of one input keep their order; events of different inputs interleave.
+* Type V is the data type.
+*/
+template<typename V>
+class MergeStage
+{
+
+public:
+
+    // ctor for a stage of _inputs inputs with rings of _capacity events, and the cpu to pin to
+    MergeStage(int _inputs, size_t _capacity = 4096, int _cpu = -1);
+    ~MergeStage();
+
+    // Get the listener a shard notifies; each input takes events from one thread only
+    ServiceListener<V>* GetInput(int _input);
+
+    // Add a listener receiving the merged events, before any event is merged
+    void AddListener(ServiceListener<V>* _listener);
+
+    // Wait until every event pushed so far has been handed to the listeners
+    void Drain();
+
+    // Drain the inputs and stop the stage thread
+    void Stop();
+
+private:
+
+    /**
+    * Input of a merge stage, pushing the events of one shard into its ring.
+    */
+    class Input : public ServiceListener<V>
+    {
+
+    public:
+
+        Input(size_t _capacity) : queue(_capacity), pushedCount(0) {};
+
+        // Listener callback to process an add event to the Service
+        void ProcessAdd(V& _data)
+        {
+            while (!queue.TryPush(_data)) this_thread::yield();
+            pushedCount.fetch_add(1, memory_order_release);
+        };
+
+        // Listener callback to process a remove event to the Service
+        void ProcessRemove(V& _data) {};
+
+        // Listener callback to process an update event to the Service
+        void ProcessUpdate(V& _data) {};
+
+        SPSCQueue<V> queue;
+        atomic<long> pushedCount;
+
+    };
+
+    // Body of the stage thread
+    void Run(int _cpu);
+
+    vector<unique_ptr<Input>> inputs;
+    vector<ServiceListener<V>*> listeners;
+    atomic<long> processedCount;
+    atomic<bool> running;
+    thread worker;
+
+};
+
+template<typename V>
+MergeStage<V>::MergeStage(int _inputs, size_t _capacity, int _cpu) : processedCount(0), running(true)
+{
+    for (int i = 0; i < _inputs; i++)
+    {
+        inputs.push_back(make_unique<Input>(_capacity));
+    }
+    worker = thread(&MergeStage<V>::Run, this, _cpu);
+}
+
+template<typename V>
+MergeStage<V>::~MergeStage()
+{
+    Stop();
+}
+
+template<typename V>
+ServiceListener<V>* MergeStage<V>::GetInput(int _input)
+{
+    return inputs[_input].get();
+}
+
+template<typename V>
+void MergeStage<V>::AddListener(ServiceListener<V>* _listener)
+{
+    listeners.push_back(_listener);
+}
+
+template<typename V>
+void MergeStage<V>::Drain()
+{
+    long _pushed = 0;
+    for (auto& i : inputs) _pushed += i->pushedCount.load(memory_order_acquire);
+    while (processedCount.load(memory_order_acquire) < _pushed) this_thread::yield();
+}
+
+template<typename V>
+void MergeStage<V>::Stop()
+{
+    if (!worker.joinable()) return;
+    Drain();
+    running.store(false, memory_order_release);
+    worker.join();
+}
+
+template<typename V>
+void MergeStage<V>::Run(int _cpu)
+{
+    PinThread(_cpu);
+    V _data;
+    IdleBackoff _backoff;
+    while (true)
+    {
+        bool _stopping = !running.load(memory_order_acquire);
+        bool _merged = false;
+
+        // Take a bounded batch from each input in turn, so a busy shard cannot starve the others
+        for (auto& i : inputs)
+        {
+            for (int n = 0; n < 64 && i->queue.TryPop(_data); n++)
+            {
+                for (auto& l : listeners)
+                {
+                    l->ProcessAdd(_data);
+                }
+                processedCount.fetch_add(1, memory_order_release);
+                _merged = true;
+            }
+        }
+
+        if (_merged)
+        {
+            _backoff.Reset();
+            continue;
+        }
+        if (_stopping) break;
+        _backoff.Wait();
+    }
+}
+
+/**
+* Trading Shard owning the market data, algo execution, execution, trade booking, position
+* and risk services of the products hashed to it, wired as in the single-instance system.
+* Order books and trades routed to the shard are queued in one SPSC ring and processed in
+* order on the shard's own thread, which is the only thread touching the shard's services.
+* The chain from market data to risk is typed statically, so each hop is a direct call
+* the compiler can inline; listeners added at runtime still work on every service.
+* Type T is the product type.
+*/
+template<typename T>
+class TradingShard
+{
+
+public:
+
+    typedef RiskService<T> ShardRiskService;
+    typedef PositionService<T, RiskToPositionListener<T, ShardRiskService>> ShardPositionService;
+    typedef TradeBookingService<T, PositionToTradeBookingListener<T, ShardPositionService>> ShardTradeBookingService;
+    typedef ExecutionService<T, TradeBookingToExecutionListener<T, ShardTradeBookingService>> ShardExecutionService;
+    typedef AlgoExecutionService<T, ExecutionToAlgoExecutionListener<T, ShardExecutionService>> ShardAlgoExecutionService;
+    typedef MarketDataService<T, AlgoExecutionToMarketDataListener<T, ShardAlgoExecutionService>> ShardMarketDataService;
+
+    // ctor for a shard with a ring of _capacity events, and the cpu to pin to
+    TradingShard(size_t _capacity = 4096, int _cpu = -1);
+    ~TradingShard();
+
+    // Queue an order book or a trade for the shard; only one thread may push
+    void Push(const OrderBook<T>& _orderBook);
+    void Push(const Trade<T>& _trade);
+
+    // Wait until every event pushed so far has been processed
+    void Drain();
+
+    // Drain the queue and stop the shard thread
+    void Stop();
+
+    // Get the services of the shard
+    ShardMarketDataService& GetMarketDataService();
+    ShardAlgoExecutionService& GetAlgoExecutionService();
+    ShardExecutionService& GetExecutionService();
+    ShardTradeBookingService& GetTradeBookingService();
+    ShardPositionService& GetPositionService();
+    ShardRiskService& GetRiskService();
+
+private:
+
+    typedef variant<OrderBook<T>, Trade<T>> Event;
+
+    // Body of the shard thread
+    void Run(int _cpu);
+
+    ShardMarketDataService marketDataService;
+    ShardAlgoExecutionService algoExecutionService;
+    ShardExecutionService executionService;
+    ShardTradeBookingService tradeBookingService;
+    ShardPositionService positionService;
+    ShardRiskService riskService;
+
+    SPSCQueue<Event> queue;
+    long pushedCount;
+    atomic<long> processedCount;
+    atomic<bool> running;
+    thread worker;
+
+};
+
+template<typename T>
+TradingShard<T>::TradingShard(size_t _capacity, int _cpu) :
+        queue(_capacity), pushedCount(0), processedCount(0), running(true)
+{
+    marketDataService.BindListeners(algoExecutionService.GetListener());
+    algoExecutionService.BindListeners(executionService.GetListener());
+    executionService.BindListeners(tradeBookingService.GetListener());
+    tradeBookingService.BindListeners(positionService.GetListener());
+    positionService.BindListeners(riskService.GetListener());
+    worker = thread(&TradingShard<T>::Run, this, _cpu);
+}
+
+template<typename T>
+TradingShard<T>::~TradingShard()
+{
+    Stop();
+}
+
+template<typename T>
+void TradingShard<T>::Push(const OrderBook<T>& _orderBook)
+{
+    while (!queue.TryPush(Event(_orderBook))) this_thread::yield();
+    pushedCount++;
+}
+
+template<typename T>
+void TradingShard<T>::Push(const Trade<T>& _trade)
+{
+    while (!queue.TryPush(Event(_trade))) this_thread::yield();
+    pushedCount++;
+}
+
+template<typename T>
+void TradingShard<T>::Drain()
+{
+    while (processedCount.load(memory_order_acquire) < pushedCount) this_thread::yield();
+}
+
+template<typename T>
+void TradingShard<T>::Stop()
+{
+    if (!worker.joinable()) return;
+    Drain();
+    running.store(false, memory_order_release);
+    worker.join();
+}
+
+template<typename T>
+void TradingShard<T>::Run(int _cpu)
+{
+    PinThread(_cpu);
+    Event _event;
+    IdleBackoff _backoff;
+    while (running.load(memory_order_acquire) || !queue.IsEmpty())
+    {
+        if (!queue.TryPop(_event))
+        {
+            _backoff.Wait();
+            continue;
+        }
+        _backoff.Reset();
+        if (OrderBook<T>* _orderBook = get_if<OrderBook<T>>(&_event)) marketDataService.OnMessage(move(*_orderBook));
+        else tradeBookingService.OnMessage(move(get<Trade<T>>(_event)));
+        processedCount.fetch_add(1, memory_order_release);
+    }
+}
+
+template<typename T>
+typename TradingShard<T>::ShardMarketDataService& TradingShard<T>::GetMarketDataService()
+{
+    return marketDataService;
+}
+
+template<typename T>
+typename TradingShard<T>::ShardAlgoExecutionService& TradingShard<T>::GetAlgoExecutionService()
+{
+    return algoExecutionService;
+}
+
+template<typename T>
+typename TradingShard<T>::ShardExecutionService& TradingShard<T>::GetExecutionService()
+{
+    return executionService;
+}
+
+template<typename T>
+typename TradingShard<T>::ShardTradeBookingService& TradingShard<T>::GetTradeBookingService()
+{
+    return tradeBookingService;
+}
+
+template<typename T>
+typename TradingShard<T>::ShardPositionService& TradingShard<T>::GetPositionService()
+{
+    return positionService;
+}
+
+template<typename T>
+typename TradingShard<T>::ShardRiskService& TradingShard<T>::GetRiskService()
+{
+    return riskService;
+}
+
+/**
+* Pre-declearations to avoid errors.
+*/
+template<typename T, typename V>
+class ShardRouter;
+
+/**
+* Sharded Pipeline partitioning products over a number of trading shards.
+* Connectors route parsed order books and trades to the shard owning the product with
+* SetRouter. Executions, positions and risk of all shards come together in merge stages,
+* whose listeners see one stream per data type on one thread; so do the trades the shards
+* evict, on an unpinned stage as evictions are rare.
+* Type T is the product type.
+*/
+template<typename T>
+class ShardedPipeline
+{
+
+public:
+
+    // ctor for _shards shards with rings of _capacity events, pinned from _cpu on if it is not negative
+    ShardedPipeline(int _shards, size_t _capacity = 4096, int _cpu = -1);
+    ~ShardedPipeline();
+
+    // Get the number of shards
+    int GetShardCount() const;
+
+    // Get the shard owning a product
+    int GetShardIndex(const T& _product) const;
+
+    // Get a shard
+    TradingShard<T>& GetShard(int _shard);
+
+    // Get the routers to hand to the market data and trade booking connectors
+    ServiceListener<OrderBook<T>>* GetOrderBookRouter();
+    ServiceListener<Trade<T>>* GetTradeRouter();
+
+    // Add listeners to the merged executions, positions and risk of all shards
+    void AddExecutionListener(ServiceListener<ExecutionOrder<T>>* _listener);
+    void AddPositionListener(ServiceListener<Position<T>>* _listener);
+    void AddRiskListener(ServiceListener<PV01<T>>* _listener);
+
+    // Add a listener to the merged trades evicted by the trade booking services of all shards
+    void AddEvictedTradeListener(ServiceListener<Trade<T>>* _listener);
+
+    // Wait until everything routed so far went through the shards and the merge stages
+    void Drain();
+
+    // Drain and stop the shard and merge threads
+    void Stop();
+
+private:
+
+    vector<unique_ptr<TradingShard<T>>> shards;
+    MergeStage<ExecutionOrder<T>> executions;
+    MergeStage<Position<T>> positions;
+    MergeStage<PV01<T>> risks;
+    MergeStage<Trade<T>> evictedTrades;
+    ShardRouter<T, OrderBook<T>>* orderBookRouter;
+    ShardRouter<T, Trade<T>>* tradeRouter;
+
+};
+
+template<typename T>
+ShardedPipeline<T>::ShardedPipeline(int _shards, size_t _capacity, int _cpu) :
+        executions(_shards, _capacity, (_cpu < 0) ? -1 : _cpu + _shards),
+        positions(_shards, _capacity, (_cpu < 0) ? -1 : _cpu + _shards + 1),
+        risks(_shards, _capacity, (_cpu < 0) ? -1 : _cpu + _shards + 2),
+        evictedTrades(_shards, _capacity, -1)
+{
+    for (int i = 0; i < _shards; i++)
+    {
+        TradingShard<T>* _shard = new TradingShard<T>(_capacity, (_cpu < 0) ? -1 : _cpu + i);
+        shards.emplace_back(_shard);
+        _shard->GetExecutionService().AddListener(executions.GetInput(i));
+        _shard->GetPositionService().AddListener(positions.GetInput(i));
+        _shard->GetRiskService().AddListener(risks.GetInput(i));
+        _shard->GetTradeBookingService().SetEvictionListener(evictedTrades.GetInput(i));
+    }
+    orderBookRouter = new ShardRouter<T, OrderBook<T>>(this);
+    tradeRouter = new ShardRouter<T, Trade<T>>(this);
+}
+
+template<typename T>
+ShardedPipeline<T>::~ShardedPipeline()
+{
+    Stop();
+}
+
+template<typename T>
+int ShardedPipeline<T>::GetShardCount() const
+{
+    return shards.size();
+}
+
+template<typename T>
+int ShardedPipeline<T>::GetShardIndex(const T& _product) const
+{
+    int _index = ResolveProductIndex(_product);
+    size_t _hash = (_index >= 0) ? size_t(_index) : hash<string>()(_product.GetProductId());
+    return _hash % shards.size();
+}
+
+template<typename T>
+TradingShard<T>& ShardedPipeline<T>::GetShard(int _shard)
+{
+    return *shards[_shard];
+}
+
+template<typename T>
+ServiceListener<OrderBook<T>>* ShardedPipeline<T>::GetOrderBookRouter()
+{
+    return orderBookRouter;
+}
+
+template<typename T>
+ServiceListener<Trade<T>>* ShardedPipeline<T>::GetTradeRouter()
+{
+    return tradeRouter;
+}
+
+template<typename T>
+void ShardedPipeline<T>::AddExecutionListener(ServiceListener<ExecutionOrder<T>>* _listener)
+{
+    executions.AddListener(_listener);
+}
+
+template<typename T>
+void ShardedPipeline<T>::AddPositionListener(ServiceListener<Position<T>>* _listener)
+{
+    positions.AddListener(_listener);
+}
+
+template<typename T>
+void ShardedPipeline<T>::AddRiskListener(ServiceListener<PV01<T>>* _listener)
+{
+    risks.AddListener(_listener);
+}
+
+template<typename T>
+void ShardedPipeline<T>::AddEvictedTradeListener(ServiceListener<Trade<T>>* _listener)
+{
+    evictedTrades.AddListener(_listener);
+}
+
+template<typename T>
+void ShardedPipeline<T>::Drain()
+{
+    for (auto& s : shards) s->Drain();
+    executions.Drain();
+    positions.Drain();
+    risks.Drain();
+    evictedTrades.Drain();
+}
+
+template<typename T>
+void ShardedPipeline<T>::Stop()
+{
+    for (auto& s : shards) s->Stop();
+    executions.Stop();
+    positions.Stop();
+    risks.Stop();
+    evictedTrades.Stop();
+}
+
+/**
+* Shard Router handing each record to the shard owning its product.
+* Type T is the product type, type V the data type.
+*/
+template<typename T, typename V>
+class ShardRouter : public ServiceListener<V>
+{
+
+private:
+
+    ShardedPipeline<T>* pipeline;
+
+public:
+
+    // Connector and Destructor
+    ShardRouter(ShardedPipeline<T>* _pipeline) : pipeline(_pipeline) {};
+
+    // Listener callback to process an add event to the Service
+    void ProcessAdd(V& _data)
+    {
+        pipeline->GetShard(pipeline->GetShardIndex(_data.GetProduct())).Push(_data);
+    };
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(V& _data) {};
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(V& _data) {};
+
+};
+
+#endif
@@ -0,0 +1,487 @@
+/**
+ * sharedmemory.hpp
+ * Defines the shared-memory publication of the latest prices, positions, risk and price streams for out-of-process readers.
+ *
+ */
+#ifndef SHARED_MEMORY_HPP
+#define SHARED_MEMORY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "soa.hpp"
+#include "productregistry.hpp"
+#include "compactmessages.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+
+using namespace std;
+
+// Sections of the shared-memory region, each a slot per product
+enum SharedSection { SHARED_PRICES, SHARED_POSITIONS, SHARED_RISK, SHARED_STREAMS, SHARED_SECTIONS };
+
+const uint32_t SHARED_MEMORY_MAGIC = 0x4d485354;
+const uint32_t SHARED_MEMORY_VERSION = 1;
+
+/**
+* Header of the shared-memory region. It is followed by the product directory, the
+* product ID of each index in 16 characters, then by the sections at their offsets.
+* The magic is written last, so a reader seeing it sees the whole layout.
+*/
+struct SharedMemoryHeader
+{
+    atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t products;
+    uint32_t sections;
+    uint64_t size;
+    uint64_t offsets[SHARED_SECTIONS];
+    uint32_t slotSizes[SHARED_SECTIONS];
+};
+
+/**
+* Position as published, with the books of the book registry; books past its capacity
+* count in the aggregate only.
+*/
+struct SharedPosition
+{
+    ProductHandle product;
+    uint32_t books;
+    int64_t aggregate;
+    int64_t quantities[BookRegistry::MAX_BOOKS];
+};
+
+/**
+* PV01 risk as published.
+*/
+struct SharedRisk
+{
+    ProductHandle product;
+    uint32_t reserved;
+    double pv01;
+    int64_t quantity;
+};
+
+/**
+* Slot of a value guarded by a sequence lock. The sequence is odd while the value is
+* being written and moves on by two with every write. A reader copies the value between
+* two reads of an even sequence, and retries if they differ. The value is stored in
+* 8-byte words with relaxed atomic accesses, so a torn read is caught, never undefined.
+* Each slot must have a single writer at a time.
+* Type V is the trivially copyable value type.
+*/
+template<typename V>
+struct alignas(64) SeqlockSlot
+{
+    static_assert(is_trivially_copyable_v<V> && sizeof(V) % sizeof(uint64_t) == 0);
+    static const size_t WORDS = sizeof(V) / sizeof(uint64_t);
+
+    atomic<uint32_t> sequence;
+    uint64_t words[WORDS];
+
+    // Write a value, never waiting on readers
+    void Write(const V& _value)
+    {
+        uint64_t _words[WORDS];
+        memcpy(_words, &_value, sizeof(V));
+        uint32_t _sequence = sequence.load(memory_order_relaxed);
+        sequence.store(_sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) atomic_ref<uint64_t>(words[i]).store(_words[i], memory_order_relaxed);
+        sequence.store(_sequence + 2, memory_order_release);
+    };
+
+    // Read a consistent copy of the value, return false if it was never written
+    bool Read(V& _value) const
+    {
+        uint64_t _words[WORDS];
+        while (true)
+        {
+            uint32_t _before = sequence.load(memory_order_acquire);
+            if (_before & 1)
+            {
+                this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++) _words[i] = atomic_ref<uint64_t>(const_cast<uint64_t&>(words[i])).load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (sequence.load(memory_order_relaxed) != _before) continue;
+            if (_before == 0) return false;
+            memcpy(&_value, _words, sizeof(V));
+            return true;
+        }
+    };
+};
+
+static_assert(atomic<uint32_t>::is_always_lock_free);
+
+/**
+* Layout of the shared-memory region for a number of products.
+*/
+class SharedMemoryLayout
+{
+
+public:
+
+    // ctor for a region of a number of products
+    SharedMemoryLayout(uint32_t _products);
+
+    // Get the size of the region in bytes
+    size_t GetSize() const;
+
+    // Get the offset of a section
+    size_t GetOffset(SharedSection _section) const;
+
+    // Get the size of a slot of a section
+    size_t GetSlotSize(SharedSection _section) const;
+
+    // Get the offset of the product directory
+    static size_t GetDirectoryOffset();
+
+private:
+
+    size_t offsets[SHARED_SECTIONS];
+    size_t slotSizes[SHARED_SECTIONS];
+    size_t size;
+
+};
+
+SharedMemoryLayout::SharedMemoryLayout(uint32_t _products)
+{
+    slotSizes[SHARED_PRICES] = sizeof(SeqlockSlot<CompactPrice>);
+    slotSizes[SHARED_POSITIONS] = sizeof(SeqlockSlot<SharedPosition>);
+    slotSizes[SHARED_RISK] = sizeof(SeqlockSlot<SharedRisk>);
+    slotSizes[SHARED_STREAMS] = sizeof(SeqlockSlot<CompactPriceStream>);
+
+    // Sections start on cache lines so no two products share one
+    size_t _offset = GetDirectoryOffset() + size_t(_products) * COMPACT_ID_SIZE;
+    for (int s = 0; s < SHARED_SECTIONS; s++)
+    {
+        _offset = (_offset + 63) / 64 * 64;
+        offsets[s] = _offset;
+        _offset += slotSizes[s] * _products;
+    }
+    size = _offset;
+}
+
+size_t SharedMemoryLayout::GetSize() const
+{
+    return size;
+}
+
+size_t SharedMemoryLayout::GetOffset(SharedSection _section) const
+{
+    return offsets[_section];
+}
+
+size_t SharedMemoryLayout::GetSlotSize(SharedSection _section) const
+{
+    return slotSizes[_section];
+}
+
+size_t SharedMemoryLayout::GetDirectoryOffset()
+{
+    return (sizeof(SharedMemoryHeader) + 63) / 64 * 64;
+}
+
+/**
+* Publisher of the latest value of each product to a POSIX shared-memory region, sized
+* from the product registry when it is created. Products outside the registry are not
+* published. Writers only store into their product's slot and never wait on readers.
+* The region outlives the publisher, so readers keep their mapping across restarts
+* until it is replaced.
+*/
+class SharedMemoryPublisher
+{
+
+public:
+
+    // ctor creating a region of a name, such as "/tradingsystem", replacing any previous one
+    SharedMemoryPublisher(const string& _name);
+    ~SharedMemoryPublisher();
+
+    // Check if the region was created and mapped
+    bool IsOpen() const;
+
+    // Publish the latest price of a product
+    void Publish(const Price<Bond>& _price);
+
+    // Publish the latest position of a product
+    void Publish(const Position<Bond>& _position);
+
+    // Publish the latest risk of a product
+    void Publish(const PV01<Bond>& _pv01);
+
+    // Publish the latest price stream of a product
+    void Publish(const PriceStream<Bond>& _priceStream);
+
+    // Get the name of the region
+    const string& GetName() const;
+
+    // Remove the region's name, so no new reader can open it
+    void Unlink();
+
+private:
+
+    // Get the slot of a product in a section, null if the product is not in the region
+    template<typename V>
+    SeqlockSlot<V>* GetSlot(SharedSection _section, const Product& _product);
+
+    string name;
+    uint32_t products;
+    SharedMemoryLayout layout;
+    char* data;
+
+};
+
+SharedMemoryPublisher::SharedMemoryPublisher(const string& _name) :
+        name(_name), products(uint32_t(GetProductRegistry().GetSize())), layout(products), data(nullptr)
+{
+    shm_unlink(name.c_str());
+    int _descriptor = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (_descriptor < 0) return;
+    if (ftruncate(_descriptor, layout.GetSize()) == 0)
+    {
+        void* _address = mmap(nullptr, layout.GetSize(), PROT_READ | PROT_WRITE, MAP_SHARED, _descriptor, 0);
+        if (_address != MAP_FAILED) data = static_cast<char*>(_address);
+    }
+    close(_descriptor);
+    if (!data) return;
+
+    // A new mapping is zeroed, so every slot starts at sequence 0, never written
+    SharedMemoryHeader* _header = reinterpret_cast<SharedMemoryHeader*>(data);
+    _header->version = SHARED_MEMORY_VERSION;
+    _header->products = products;
+    _header->sections = SHARED_SECTIONS;
+    _header->size = layout.GetSize();
+    for (int s = 0; s < SHARED_SECTIONS; s++)
+    {
+        _header->offsets[s] = layout.GetOffset(SharedSection(s));
+        _header->slotSizes[s] = uint32_t(layout.GetSlotSize(SharedSection(s)));
+    }
+    char* _directory = data + SharedMemoryLayout::GetDirectoryOffset();
+    for (uint32_t i = 0; i < products; i++)
+    {
+        CopyCompactId(GetProductRegistry().GetBond(int(i)).GetProductId(), _directory + size_t(i) * COMPACT_ID_SIZE);
+    }
+    _header->magic.store(SHARED_MEMORY_MAGIC, memory_order_release);
+}
+
+SharedMemoryPublisher::~SharedMemoryPublisher()
+{
+    if (data) munmap(data, layout.GetSize());
+}
+
+bool SharedMemoryPublisher::IsOpen() const
+{
+    return data != nullptr;
+}
+
+template<typename V>
+SeqlockSlot<V>* SharedMemoryPublisher::GetSlot(SharedSection _section, const Product& _product)
+{
+    ProductHandle _handle = GetProductHandle(_product);
+    if (!data || _handle >= products) return nullptr;
+    return reinterpret_cast<SeqlockSlot<V>*>(data + layout.GetOffset(_section) + size_t(_handle) * layout.GetSlotSize(_section));
+}
+
+void SharedMemoryPublisher::Publish(const Price<Bond>& _price)
+{
+    SeqlockSlot<CompactPrice>* _slot = GetSlot<CompactPrice>(SHARED_PRICES, _price.GetProduct());
+    if (_slot) _slot->Write(ToCompact(_price));
+}
+
+void SharedMemoryPublisher::Publish(const Position<Bond>& _position)
+{
+    SeqlockSlot<SharedPosition>* _slot = GetSlot<SharedPosition>(SHARED_POSITIONS, _position.GetProduct());
+    if (!_slot) return;
+    SharedPosition _shared = {};
+    _shared.product = GetProductHandle(_position.GetProduct());
+    _shared.books = uint32_t(GetBookRegistry().GetSize());
+    _shared.aggregate = _position.GetAggregatePosition();
+    for (uint32_t b = 0; b < _shared.books; b++) _shared.quantities[b] = _position.GetBookPosition(int(b));
+    _slot->Write(_shared);
+}
+
+void SharedMemoryPublisher::Publish(const PV01<Bond>& _pv01)
+{
+    SeqlockSlot<SharedRisk>* _slot = GetSlot<SharedRisk>(SHARED_RISK, _pv01.GetProduct());
+    if (_slot) _slot->Write({ GetProductHandle(_pv01.GetProduct()), 0, _pv01.GetPV01(), _pv01.GetQuantity() });
+}
+
+void SharedMemoryPublisher::Publish(const PriceStream<Bond>& _priceStream)
+{
+    SeqlockSlot<CompactPriceStream>* _slot = GetSlot<CompactPriceStream>(SHARED_STREAMS, _priceStream.GetProduct());
+    if (_slot) _slot->Write(ToCompact(_priceStream));
+}
+
+const string& SharedMemoryPublisher::GetName() const
+{
+    return name;
+}
+
+void SharedMemoryPublisher::Unlink()
+{
+    shm_unlink(name.c_str());
+}
+
+/**
+* Service Listener publishing the data of a service to shared memory.
+* Type V is the data type, one the publisher has a Publish for.
+*/
+template<typename V>
+class SharedMemoryListener : public ServiceListener<V>
+{
+
+public:
+
+    // ctor for a listener publishing to a publisher
+    SharedMemoryListener(SharedMemoryPublisher* _publisher) : publisher(_publisher) {};
+
+    // Listener callback to process an add event to the Service
+    void ProcessAdd(V& _data)
+    {
+        publisher->Publish(_data);
+    };
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(V& _data) {};
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(V& _data) {};
+
+private:
+
+    SharedMemoryPublisher* publisher;
+
+};
+
+/**
+* Reader of a shared-memory region, for dashboards and risk tools in other processes.
+* Reads copy a product's latest value out of its slot without locking or writing to the region.
+*/
+class SharedMemoryReader
+{
+
+public:
+
+    // ctor mapping the region of a name read-only
+    SharedMemoryReader(const string& _name);
+    ~SharedMemoryReader();
+
+    // Check if the region was mapped and is complete
+    bool IsOpen() const;
+
+    // Get the number of products in the region
+    uint32_t GetProductCount() const;
+
+    // Get the product ID at an index
+    string GetProductId(uint32_t _index) const;
+
+    // Get the index of a product ID, -1 if it is not in the region
+    int GetIndex(string_view _productId) const;
+
+    // Read the latest value of the product at an index, return false if none was published
+    bool Read(uint32_t _index, CompactPrice& _price) const;
+    bool Read(uint32_t _index, SharedPosition& _position) const;
+    bool Read(uint32_t _index, SharedRisk& _risk) const;
+    bool Read(uint32_t _index, CompactPriceStream& _priceStream) const;
+
+private:
+
+    // Read the latest value of the product at an index in a section
+    template<typename V>
+    bool ReadSlot(SharedSection _section, uint32_t _index, V& _value) const;
+
+    const char* data;
+    size_t size;
+
+};
+
+SharedMemoryReader::SharedMemoryReader(const string& _name) : data(nullptr), size(0)
+{
+    int _descriptor = shm_open(_name.c_str(), O_RDONLY, 0);
+    if (_descriptor < 0) return;
+    struct stat _stat;
+    if (fstat(_descriptor, &_stat) == 0 && size_t(_stat.st_size) >= sizeof(SharedMemoryHeader))
+    {
+        void* _address = mmap(nullptr, _stat.st_size, PROT_READ, MAP_SHARED, _descriptor, 0);
+        if (_address != MAP_FAILED)
+        {
+            data = static_cast<const char*>(_address);
+            size = _stat.st_size;
+        }
+    }
+    close(_descriptor);
+}
+
+SharedMemoryReader::~SharedMemoryReader()
+{
+    if (data) munmap(const_cast<char*>(data), size);
+}
+
+bool SharedMemoryReader::IsOpen() const
+{
+    if (!data) return false;
+    const SharedMemoryHeader* _header = reinterpret_cast<const SharedMemoryHeader*>(data);
+    return _header->magic.load(memory_order_acquire) == SHARED_MEMORY_MAGIC && _header->version == SHARED_MEMORY_VERSION && _header->size <= size;
+}
+
+uint32_t SharedMemoryReader::GetProductCount() const
+{
+    return IsOpen() ? reinterpret_cast<const SharedMemoryHeader*>(data)->products : 0;
+}
+
+string SharedMemoryReader::GetProductId(uint32_t _index) const
+{
+    if (_index >= GetProductCount()) return "";
+    return GetCompactId(data + SharedMemoryLayout::GetDirectoryOffset() + size_t(_index) * COMPACT_ID_SIZE);
+}
+
+int SharedMemoryReader::GetIndex(string_view _productId) const
+{
+    uint32_t _products = GetProductCount();
+    for (uint32_t i = 0; i < _products; i++)
+    {
+        if (GetProductId(i) == _productId) return int(i);
+    }
+    return -1;
+}
+
+template<typename V>
+bool SharedMemoryReader::ReadSlot(SharedSection _section, uint32_t _index, V& _value) const
+{
+    if (_index >= GetProductCount()) return false;
+    const SharedMemoryHeader* _header = reinterpret_cast<const SharedMemoryHeader*>(data);
+    if (_header->slotSizes[_section] != sizeof(SeqlockSlot<V>)) return false;
+    const SeqlockSlot<V>* _slot = reinterpret_cast<const SeqlockSlot<V>*>(data + _header->offsets[_section] + size_t(_index) * _header->slotSizes[_section]);
+    return _slot->Read(_value);
+}
+
+bool SharedMemoryReader::Read(uint32_t _index, CompactPrice& _price) const
+{
+    return ReadSlot(SHARED_PRICES, _index, _price);
+}
+
+bool SharedMemoryReader::Read(uint32_t _index, SharedPosition& _position) const
+{
+    return ReadSlot(SHARED_POSITIONS, _index, _position);
+}
+
+bool SharedMemoryReader::Read(uint32_t _index, SharedRisk& _risk) const
+{
+    return ReadSlot(SHARED_RISK, _index, _risk);
+}
+
+bool SharedMemoryReader::Read(uint32_t _index, CompactPriceStream& _priceStream) const
+{
+    return ReadSlot(SHARED_STREAMS, _index, _priceStream);
+}
+
+#endif
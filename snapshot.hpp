@@ -0,0 +1,281 @@
+/**
+ * snapshot.hpp
+ * Defines binary snapshots of service state, restored on start so only the unread tails of the inputs are replayed.
+ *
+ */
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <streambuf>
+#include <istream>
+#include "filereader.hpp"
+#include "historicalwriter.hpp"
+#include "historicalrecord.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "marketdataservice.hpp"
+#include "inquiryservice.hpp"
+#include "executionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+/**
+* Header of a snapshot file. It is followed by `inputs` SnapshotInput entries, then by
+* `books` SnapshotBook entries in registry order, then by historical blocks of positions,
+* PV01s, order book levels and live inquiries. The counts are those the algo execution,
+* algo streaming and trade booking alternate sides, quantities and books by.
+*/
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t inputs;
+    uint32_t books;
+    uint32_t reserved;
+    uint64_t algoExecutions;
+    uint64_t algoStreams;
+    uint64_t tradeBookings;
+};
+
+// An input file and the offset up to which the snapshot covers it
+struct SnapshotInput
+{
+    char path[56];
+    uint64_t offset;
+};
+
+// A book of the book registry
+struct SnapshotBook
+{
+    char name[16];
+};
+
+const uint32_t SNAPSHOT_MAGIC = 0x32504e53;
+
+/**
+* Read-only stream buffer over a block of memory, such as a mapped file.
+*/
+class MemoryBuffer : public streambuf
+{
+
+public:
+
+    // Constructor for the memory to read
+    MemoryBuffer(string_view _data)
+    {
+        char* _begin = const_cast<char*>(_data.data());
+        setg(_begin, _begin, _begin + _data.size());
+    };
+
+};
+
+/**
+* Snapshot of the position, risk, market data and inquiry services, the counts of the algo
+* and trade booking services, and the book registry, tagged with the offsets of the tracked
+* input files it covers. Records use the historical block format; books are restored by name
+* in their registry order, so a restored run registers them at the same indices.
+* A snapshot is written to a temporary file and renamed into place, so a crash while
+* saving leaves the previous snapshot intact. Loading maps the file, restores the services
+* without notifying listeners, and tracks each input from its covered offset.
+* Snapshots must be taken while no stage is processing messages.
+* Type T is the product type; types P, R, M, A and B the position, risk, market data,
+* algo execution and trade booking service types, which may dispatch listeners statically.
+*/
+template<typename T, typename P = PositionService<T>, typename R = RiskService<T>, typename M = MarketDataService<T>,
+         typename A = AlgoExecutionService<T>, typename B = TradeBookingService<T>>
+class ServiceSnapshot
+{
+
+public:
+
+    // Constructor for a snapshot file of the services
+    ServiceSnapshot(const string& _path, P* _positionService, R* _riskService, M* _marketDataService, InquiryService<T>* _inquiryService,
+                    A* _algoExecutionService, AlgoStreamingService<T>* _algoStreamingService, B* _tradeBookingService);
+
+    // Write the state of the services and the offsets of the tracked inputs, replacing the previous snapshot
+    void Save();
+
+    // Restore the services and track the inputs from the offsets covered, return false if there is no valid snapshot
+    bool Load();
+
+    // Get the path of the snapshot file
+    const string& GetPath() const;
+
+private:
+
+    // Run the records of a data type in the blocks of a snapshot through a handler
+    template<typename V, typename F>
+    void ReadRecords(string_view _blocks, F&& _handler);
+
+    string path;
+    P* positionService;
+    R* riskService;
+    M* marketDataService;
+    InquiryService<T>* inquiryService;
+    A* algoExecutionService;
+    AlgoStreamingService<T>* algoStreamingService;
+    B* tradeBookingService;
+
+};
+
+template<typename T, typename P, typename R, typename M, typename A, typename B>
+ServiceSnapshot<T, P, R, M, A, B>::ServiceSnapshot(const string& _path, P* _positionService, R* _riskService, M* _marketDataService, InquiryService<T>* _inquiryService,
+                                                   A* _algoExecutionService, AlgoStreamingService<T>* _algoStreamingService, B* _tradeBookingService) :
+        path(_path), positionService(_positionService), riskService(_riskService), marketDataService(_marketDataService), inquiryService(_inquiryService),
+        algoExecutionService(_algoExecutionService), algoStreamingService(_algoStreamingService), tradeBookingService(_tradeBookingService)
+{
+}
+
+template<typename T, typename P, typename R, typename M, typename A, typename B>
+void ServiceSnapshot<T, P, R, M, A, B>::Save()
+{
+    string _temporary = path + ".tmp";
+    remove(_temporary.c_str());
+    {
+        HistoricalWriter _writer(_temporary);
+        const map<string, size_t>& _offsets = GetInputOffsets().GetOffsets();
+        BookRegistry& _registry = GetBookRegistry();
+        SnapshotHeader _header = { SNAPSHOT_MAGIC, uint32_t(_offsets.size()), uint32_t(_registry.GetSize()), 0,
+                                   uint64_t(algoExecutionService->GetCount()), uint64_t(algoStreamingService->GetCount()),
+                                   uint64_t(tradeBookingService->GetListener()->GetCount()) };
+        _writer.Write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+        for (auto& o : _offsets)
+        {
+            SnapshotInput _input = {};
+            memcpy(_input.path, o.first.data(), min(o.first.size(), sizeof(_input.path) - 1));
+            _input.offset = o.second;
+            _writer.Write(reinterpret_cast<const char*>(&_input), sizeof(_input));
+        }
+        for (int b = 0; b < _registry.GetSize(); b++)
+        {
+            SnapshotBook _book = {};
+            const string& _name = _registry.GetName(b);
+            memcpy(_book.name, _name.data(), min(_name.size(), sizeof(_book.name)));
+            _writer.Write(reinterpret_cast<const char*>(&_book), sizeof(_book));
+        }
+
+        // Products unknown to the registry are not indexed and are left out
+        long _timestamp = GetEpochNanoseconds();
+        int _products = GetProductRegistry().GetSize();
+        HistoricalBlockWriter<Position<T>> _positions(_writer);
+        for (int i = 0; i < _products; i++)
+        {
+            if (positionService->Contains(i)) _positions.Append(positionService->GetData(i), _timestamp);
+        }
+        _positions.Flush();
+
+        HistoricalBlockWriter<PV01<T>> _pv01s(_writer);
+        for (int i = 0; i < _products; i++)
+        {
+            if (riskService->Contains(i)) _pv01s.Append(riskService->GetData(i), _timestamp);
+        }
+        _pv01s.Flush();
+
+        HistoricalBlockWriter<OrderBookLevel> _levels(_writer);
+        for (int i = 0; i < _products; i++)
+        {
+            if (!marketDataService->Contains(i)) continue;
+            const OrderBook<T>& _orderBook = marketDataService->GetData(i);
+            for (auto& o : _orderBook.GetBidStack()) _levels.Append({ i, o }, _timestamp);
+            for (auto& o : _orderBook.GetOfferStack()) _levels.Append({ i, o }, _timestamp);
+        }
+        _levels.Flush();
+
+        vector<Inquiry<T>> _live;
+        inquiryService->GetLiveInquiries(_live);
+        HistoricalBlockWriter<Inquiry<T>> _inquiries(_writer);
+        for (auto& q : _live) _inquiries.Append(q, _timestamp);
+        _inquiries.Flush();
+
+        _writer.Shutdown();
+    }
+    rename(_temporary.c_str(), path.c_str());
+}
+
+template<typename T, typename P, typename R, typename M, typename A, typename B>
+bool ServiceSnapshot<T, P, R, M, A, B>::Load()
+{
+    MappedFile _file(path);
+    if (!_file.IsOpen()) return false;
+    string_view _data = _file.GetData();
+    SnapshotHeader _header;
+    if (_data.size() < sizeof(_header)) return false;
+    memcpy(&_header, _data.data(), sizeof(_header));
+    size_t _books = sizeof(_header) + size_t(_header.inputs) * sizeof(SnapshotInput);
+    size_t _start = _books + size_t(_header.books) * sizeof(SnapshotBook);
+    if (_header.magic != SNAPSHOT_MAGIC || _header.books > uint32_t(BookRegistry::MAX_BOOKS) || _data.size() < _start) return false;
+
+    for (uint32_t i = 0; i < _header.inputs; i++)
+    {
+        SnapshotInput _input;
+        memcpy(&_input, _data.data() + sizeof(_header) + i * sizeof(SnapshotInput), sizeof(_input));
+        GetInputOffsets().Track(string(_input.path, strnlen(_input.path, sizeof(_input.path))), _input.offset);
+    }
+
+    // Books are registered in their saved order before any position names them
+    for (uint32_t i = 0; i < _header.books; i++)
+    {
+        SnapshotBook _book;
+        memcpy(&_book, _data.data() + _books + i * sizeof(SnapshotBook), sizeof(_book));
+        GetBookRegistry().GetIndex(string_view(_book.name, strnlen(_book.name, sizeof(_book.name))));
+    }
+    algoExecutionService->SetCount(long(_header.algoExecutions));
+    algoStreamingService->SetCount(long(_header.algoStreams));
+    tradeBookingService->GetListener()->SetCount(long(_header.tradeBookings));
+
+    string_view _blocks = _data.substr(_start);
+    ReadRecords<Position<T>>(_blocks, [&](Position<T>& _position) { positionService->OnMessage(_position); });
+    ReadRecords<PV01<T>>(_blocks, [&](PV01<T>& _pv01) { riskService->OnMessage(_pv01); });
+
+    // Levels come grouped by product, so a book is complete when the product changes
+    int _product = -1;
+    vector<Order> _bidStack;
+    vector<Order> _offerStack;
+    auto _restoreBook = [&]()
+    {
+        if (_product < 0) return;
+        OrderBook<T> _orderBook;
+        _orderBook.Assign(GetProductRegistry().GetBond(_product), _bidStack, _offerStack);
+        marketDataService->Restore(move(_orderBook));
+        _bidStack.clear();
+        _offerStack.clear();
+    };
+    ReadRecords<OrderBookLevel>(_blocks, [&](OrderBookLevel& _level)
+    {
+        if (_level.productIndex != _product) _restoreBook();
+        _product = _level.productIndex;
+        if (_level.order.GetSide() == BID) _bidStack.push_back(_level.order);
+        else _offerStack.push_back(_level.order);
+    });
+    _restoreBook();
+
+    ReadRecords<Inquiry<T>>(_blocks, [&](Inquiry<T>& _inquiry) { inquiryService->Restore(_inquiry); });
+    return true;
+}
+
+template<typename T, typename P, typename R, typename M, typename A, typename B>
+const string& ServiceSnapshot<T, P, R, M, A, B>::GetPath() const
+{
+    return path;
+}
+
+template<typename T, typename P, typename R, typename M, typename A, typename B>
+template<typename V, typename F>
+void ServiceSnapshot<T, P, R, M, A, B>::ReadRecords(string_view _blocks, F&& _handler)
+{
+    // Each pass reads the blocks of one data type, skipping the others
+    MemoryBuffer _buffer(_blocks);
+    istream _input(&_buffer);
+    HistoricalBlockReader<V> _reader(_input);
+    V _record;
+    long _timestamp;
+    while (_reader.Next(_record, _timestamp))
+    {
+        _handler(_record);
+    }
+}
+
+#endif
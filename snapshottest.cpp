@@ -0,0 +1,204 @@
+//
+// Snapshot test for the trading system.
+// Checks that a run restored from a snapshot ends in the state of a cold run over the same inputs.
+// A warm run reads the first half of every input and saves a snapshot; a restarted run loads
+// it and reads the full inputs, replaying only their tails. Each run is a process of its own,
+// so services and the book registry start from scratch as they would after a restart.
+//
+// Usage: snapshottest
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "soa.hpp"
+#include "products.hpp"
+#include "algostreamingservice.hpp"
+#include "executionservice.hpp"
+#include "inquiryservice.hpp"
+#include "marketdataservice.hpp"
+#include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+#include "snapshot.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+// Get a price 99 plus a number of 1/256 ticks
+string TickPrice(int _ticks)
+{
+    return ConvertPrice(99.0 + _ticks / 256.0);
+}
+
+// Get the lines of the test inputs by file name
+map<string, vector<string>> MakeInputs()
+{
+    map<string, vector<string>> _inputs;
+    ProductRegistry& _registry = GetProductRegistry();
+    int _products = _registry.GetSize();
+    for (int i = 0; i < 600; i++)
+    {
+        const string& _cusip = _registry.GetBond(i % _products).GetProductId();
+        int _mid = 128 + (i * 37) % 96;
+        int _spread = (i % 3 == 0) ? 2 : 4;
+        _inputs["prices.txt"].push_back(_cusip + "," + TickPrice(_mid - _spread / 2) + "," + TickPrice(_mid + _spread / 2));
+
+        // Books alternate tight and wide spreads, so only some of them are executed
+        for (int l = 0; l < 5; l++)
+        {
+            string _quantity = to_string((l + 1) * 10000000);
+            _inputs["marketdata.txt"].push_back(_cusip + "," + TickPrice(_mid - _spread / 2 - 2 * l) + "," + _quantity + ",BID");
+            _inputs["marketdata.txt"].push_back(_cusip + "," + TickPrice(_mid + _spread / 2 + 2 * l) + "," + _quantity + ",OFFER");
+        }
+    }
+    for (int i = 0; i < 60; i++)
+    {
+        const string& _cusip = _registry.GetBond(i % _products).GetProductId();
+        string _book = "TRSY" + to_string(i % 3 + 1);
+        _inputs["trades.txt"].push_back(_cusip + ",TRADE" + to_string(i) + "," + TickPrice(i * 7 % 256) + "," + _book + "," + to_string((i % 5 + 1) * 1000000) + "," + ((i % 2) ? "SELL" : "BUY"));
+        _inputs["inquiries.txt"].push_back("INQUIRY" + to_string(i) + "," + _cusip + "," + ((i % 2) ? "SELL" : "BUY") + "," + to_string((i % 3 + 1) * 1000000) + "," + TickPrice(i * 11 % 256) + ",RECEIVED");
+    }
+    return _inputs;
+}
+
+// Write the inputs into a directory, keeping the given fraction of each; market data keeps whole books
+void WriteInputs(const string& _directory, const map<string, vector<string>>& _inputs, double _fraction)
+{
+    for (auto& [_name, _lines] : _inputs)
+    {
+        size_t _count = size_t(_lines.size() * _fraction);
+        if (_name == "marketdata.txt") _count -= _count % 10;
+        ofstream _file(_directory + "/" + _name);
+        for (size_t i = 0; i < _count; i++) _file << _lines[i] << "\n";
+    }
+}
+
+// Run the services over the inputs of the working directory, restoring the snapshot first if asked, and save one after
+void RunServices(bool _restore)
+{
+    PricingService<Bond> pricingService;
+    TradeBookingService<Bond> tradeBookingService;
+    PositionService<Bond> positionService;
+    RiskService<Bond> riskService;
+    MarketDataService<Bond> marketDataService;
+    AlgoExecutionService<Bond> algoExecutionService;
+    AlgoStreamingService<Bond> algoStreamingService;
+    ExecutionService<Bond> executionService;
+    InquiryService<Bond> inquiryService;
+
+    pricingService.AddListener(algoStreamingService.GetListener());
+    marketDataService.AddListener(algoExecutionService.GetListener());
+    algoExecutionService.AddListener(executionService.GetListener());
+    executionService.AddListener(tradeBookingService.GetListener());
+    tradeBookingService.AddListener(positionService.GetListener());
+    positionService.AddListener(riskService.GetListener());
+
+    ServiceSnapshot<Bond> snapshot("snapshot.bin", &positionService, &riskService, &marketDataService, &inquiryService,
+                                   &algoExecutionService, &algoStreamingService, &tradeBookingService);
+    for (auto& _input : {"prices.txt", "trades.txt", "marketdata.txt", "inquiries.txt"}) GetInputOffsets().Track(_input);
+    if (_restore && !snapshot.Load())
+    {
+        cerr << "No snapshot to restore" << endl;
+        _exit(2);
+    }
+
+    pricingService.GetConnector()->SubscribeFile("prices.txt");
+    tradeBookingService.GetConnector()->SubscribeFile("trades.txt");
+    marketDataService.GetConnector()->SubscribeFile("marketdata.txt");
+    inquiryService.GetConnector()->SubscribeFile("inquiries.txt");
+    snapshot.Save();
+
+    // Dump the state a restart must carry over, leaving out the random order IDs
+    ofstream _state("state.txt");
+    ProductRegistry& _registry = GetProductRegistry();
+    for (int i = 0; i < int(_registry.GetSize()); i++)
+    {
+        const string& _cusip = _registry.GetBond(i).GetProductId();
+        _state << _cusip;
+        if (positionService.Contains(i))
+        {
+            for (auto& [_book, _quantity] : positionService.GetData(i).GetPositions()) _state << " " << _book << "=" << _quantity;
+        }
+        if (riskService.Contains(i)) _state << " pv01=" << riskService.GetData(i).GetPV01() << "x" << riskService.GetData(i).GetQuantity();
+        const ExecutionOrder<Bond>& _execution = algoExecutionService.GetData(i).GetExecutionOrder();
+        _state << " execution=" << _execution.GetPricingSide() << "@" << _execution.GetPrice() << "x" << _execution.GetVisibleQuantity();
+        const PriceStream<Bond>& _stream = algoStreamingService.GetData(_cusip).GetPriceStream();
+        _state << " stream=" << _stream.GetBidOrder().GetVisibleQuantity();
+        const vector<Order>& _bids = marketDataService.GetData(i).GetBidStack();
+        _state << " book=" << _bids.size() << "@" << (_bids.empty() ? 0.0 : _bids.front().GetPrice()) << endl;
+    }
+    vector<Inquiry<Bond>> _live;
+    inquiryService.GetLiveInquiries(_live);
+    for (auto& q : _live) _state << q.GetInquiryId() << " " << q.GetState() << " " << q.GetPrice() << endl;
+    _state << "counts " << algoExecutionService.GetCount() << " " << algoStreamingService.GetCount() << " " << tradeBookingService.GetListener()->GetCount() << endl;
+    for (int b = 0; b < GetBookRegistry().GetSize(); b++) _state << "book " << GetBookRegistry().GetName(b) << endl;
+}
+
+// Run the services in a child process working in a directory, return true if it succeeded
+bool RunChild(const string& _directory, bool _restore)
+{
+    pid_t _pid = fork();
+    if (_pid == 0)
+    {
+        if (chdir(_directory.c_str()) != 0) _exit(2);
+        RunServices(_restore);
+        _exit(0);
+    }
+    int _status = 0;
+    waitpid(_pid, &_status, 0);
+    return WIFEXITED(_status) && WEXITSTATUS(_status) == 0;
+}
+
+// Get the content of a file
+string ReadFile(const string& _path)
+{
+    ifstream _file(_path);
+    stringstream _content;
+    _content << _file.rdbuf();
+    return _content.str();
+}
+
+int main()
+{
+    char _root[] = "/tmp/snapshottestXXXXXX";
+    if (!mkdtemp(_root))
+    {
+        cerr << "Cannot create a working directory" << endl;
+        return 1;
+    }
+    string _cold = string(_root) + "/cold";
+    string _warm = string(_root) + "/warm";
+    filesystem::create_directory(_cold);
+    filesystem::create_directory(_warm);
+    map<string, vector<string>> _inputs = MakeInputs();
+
+    WriteInputs(_cold, _inputs, 1.0);
+    WriteInputs(_warm, _inputs, 0.5);
+    if (!RunChild(_cold, false) || !RunChild(_warm, false))
+    {
+        cerr << "Run failed" << endl;
+        return 1;
+    }
+    WriteInputs(_warm, _inputs, 1.0);
+    if (!RunChild(_warm, true))
+    {
+        cerr << "Restarted run failed" << endl;
+        return 1;
+    }
+
+    string _coldState = ReadFile(_cold + "/state.txt");
+    string _warmState = ReadFile(_warm + "/state.txt");
+    if (_coldState.empty() || _coldState != _warmState)
+    {
+        cerr << "Warm restart differs from the cold run" << endl << "cold:" << endl << _coldState << "warm:" << endl << _warmState;
+        return 1;
+    }
+    cout << "Warm restart matches the cold run" << endl;
+    filesystem::remove_all(_root);
+    return 0;
+}
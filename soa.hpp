@@ -14,8 +14,18 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <tuple>
+#include <span>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "products.hpp"
 #include "functions.hpp"
+#include "servicestore.hpp"
 
 
 using namespace std;
@@ -40,8 +50,97 @@ public:
   // Listener callback to process an update event to the Service
   virtual void ProcessUpdate(V &data) = 0;
 
+  // Listener callback to process add events for a batch of data, one at a time unless overridden
+  virtual void ProcessAddBatch(span<V> data)
+  {
+    for (auto& d : data) ProcessAdd(d);
+  }
+
+};
+
+/**
+ * Listeners of a Service. The listener types L form a compile-time list: each is bound to
+ * one listener and dispatched with a direct call, which the compiler can inline when the
+ * type is final, so a fixed topology notifies its stages without virtual calls. Listeners
+ * added at runtime follow the static ones and are dispatched through ServiceListener.
+ * Type V is the data type.
+ */
+template<typename V, typename... L>
+class ListenerList
+{
+
+public:
+
+  // Bind the static listeners, one for each listener type
+  void Bind(L*... _listeners);
+
+  // Add a listener at runtime
+  void Add(ServiceListener<V> *_listener);
+
+  // Get the listeners added at runtime
+  const vector< ServiceListener<V>* >& GetDynamic() const;
+
+  // Notify every listener of an add, remove or update event
+  void ProcessAdd(V &data);
+  void ProcessRemove(V &data);
+  void ProcessUpdate(V &data);
+
+  // Notify every listener of add events for a batch of data
+  void ProcessAddBatch(span<V> data);
+
+private:
+
+  tuple<L*...> statics;
+  vector< ServiceListener<V>* > dynamics;
+
 };
 
+template<typename V, typename... L>
+void ListenerList<V, L...>::Bind(L*... _listeners)
+{
+  statics = tuple<L*...>(_listeners...);
+}
+
+template<typename V, typename... L>
+void ListenerList<V, L...>::Add(ServiceListener<V> *_listener)
+{
+  dynamics.push_back(_listener);
+}
+
+template<typename V, typename... L>
+const vector< ServiceListener<V>* >& ListenerList<V, L...>::GetDynamic() const
+{
+  return dynamics;
+}
+
+template<typename V, typename... L>
+void ListenerList<V, L...>::ProcessAdd(V &data)
+{
+  apply([&](auto*... _listeners) { ((_listeners ? _listeners->ProcessAdd(data) : void()), ...); }, statics);
+  for (auto& l : dynamics) l->ProcessAdd(data);
+}
+
+template<typename V, typename... L>
+void ListenerList<V, L...>::ProcessAddBatch(span<V> data)
+{
+  apply([&](auto*... _listeners) { ((_listeners ? _listeners->ProcessAddBatch(data) : void()), ...); }, statics);
+  for (auto& l : dynamics) l->ProcessAddBatch(data);
+}
+
+template<typename V, typename... L>
+void ListenerList<V, L...>::ProcessRemove(V &data)
+{
+  apply([&](auto*... _listeners) { ((_listeners ? _listeners->ProcessRemove(data) : void()), ...); }, statics);
+  for (auto& l : dynamics) l->ProcessRemove(data);
+}
+
+template<typename V, typename... L>
+void ListenerList<V, L...>::ProcessUpdate(V &data)
+{
+  apply([&](auto*... _listeners) { ((_listeners ? _listeners->ProcessUpdate(data) : void()), ...); }, statics);
+  for (auto& l : dynamics) l->ProcessUpdate(data);
+}
+
 /**
  * Definition of a generic base class Service.
  * Uses key generic type K and value generic type V.
@@ -53,11 +152,18 @@ class Service
 public:
 
   // Get data on our service given a key
-  virtual V& GetData(K key) = 0;
+  virtual V& GetData(const K& key) = 0;
 
   // The callback that a Connector should invoke for any new or updated data
   virtual void OnMessage(V &data) = 0;
 
+  // The callback that a Connector may invoke for a batch of new or updated data,
+  // one at a time unless the Service amortizes work across the batch
+  virtual void OnMessages(span<V> data)
+  {
+    for (auto& d : data) OnMessage(d);
+  }
+
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
   virtual void AddListener(ServiceListener<V> *listener) = 0;
@@ -89,4 +195,273 @@ public:
 
 };
 
+/**
+ * Bounded single-producer/single-consumer ring buffer.
+ * One thread may push and one other thread may pop without locking.
+ * Type V is the element type.
+ */
+template<typename V>
+class SPSCQueue
+{
+
+public:
+
+  // ctor for a queue holding at least _capacity elements
+  SPSCQueue(size_t _capacity);
+
+  // Push an element, return false if the queue is full
+  bool TryPush(const V &data);
+
+  // Pop an element, return false if the queue is empty
+  bool TryPop(V &data);
+
+  // Check if the queue is empty
+  bool IsEmpty() const;
+
+  // Fill every slot of an empty queue with a copy of data, so the storage slots own is
+  // allocated up front and pushes only copy into it; producer thread only
+  void Prime(const V &data);
+
+private:
+
+  vector<V> slots;
+  size_t mask;
+  alignas(64) atomic<size_t> head;
+  alignas(64) atomic<size_t> tail;
+
+};
+
+template<typename V>
+SPSCQueue<V>::SPSCQueue(size_t _capacity) : head(0), tail(0)
+{
+  size_t _size = 2;
+  while (_size < _capacity) _size *= 2;
+  slots = vector<V>(_size);
+  mask = _size - 1;
+}
+
+template<typename V>
+bool SPSCQueue<V>::TryPush(const V &data)
+{
+  size_t _tail = tail.load(memory_order_relaxed);
+  if (_tail - head.load(memory_order_acquire) > mask) return false;
+  slots[_tail & mask] = data;
+  tail.store(_tail + 1, memory_order_release);
+  return true;
+}
+
+template<typename V>
+bool SPSCQueue<V>::TryPop(V &data)
+{
+  size_t _head = head.load(memory_order_relaxed);
+  if (_head == tail.load(memory_order_acquire)) return false;
+  data = slots[_head & mask];
+  head.store(_head + 1, memory_order_release);
+  return true;
+}
+
+template<typename V>
+bool SPSCQueue<V>::IsEmpty() const
+{
+  return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+}
+
+template<typename V>
+void SPSCQueue<V>::Prime(const V &data)
+{
+  if (!IsEmpty()) return;
+  for (V& _slot : slots) _slot = data;
+}
+
+// Pin the calling thread to a cpu, ignored if the cpu is negative, the cpu count is unknown or pinning is not supported
+void PinThread(int cpu)
+{
+#ifdef __linux__
+  unsigned _cpus = thread::hardware_concurrency();
+  if (cpu < 0 || _cpus == 0) return;
+  cpu_set_t _set;
+  CPU_ZERO(&_set);
+  CPU_SET(cpu % _cpus, &_set);
+  pthread_setaffinity_np(pthread_self(), sizeof(_set), &_set);
+#endif
+}
+
+/**
+ * Backoff of a polling worker thread between polls that found no work.
+ * It spins with yields for a while, then sleeps between polls, so an idle worker does not burn its core.
+ */
+class IdleBackoff
+{
+
+public:
+
+  // Wait before the next poll; without _sleep it only yields, for a worker with work coming due
+  void Wait(bool _sleep = true)
+  {
+    if (_sleep && ++idle >= SPIN_POLLS) this_thread::sleep_for(chrono::microseconds(50));
+    else this_thread::yield();
+  };
+
+  // Restart the spin after a poll that found work
+  void Reset()
+  {
+    idle = 0;
+  };
+
+private:
+
+  static const int SPIN_POLLS = 1000;
+  int idle = 0;
+
+};
+
+/**
+ * Asynchronous listener adapter.
+ * Events are copied into a bounded SPSC ring and handed to the wrapped listener on a
+ * dedicated, optionally pinned thread, so the service that notifies it does not wait for
+ * the downstream stage. Events are delivered in order, which keeps per-product ordering.
+ * Register it with AddListener, or bind it as a static listener, in place of the wrapped listener;
+ * only one thread may notify it.
+ * Type V is the data type.
+ */
+template<typename V>
+class AsyncServiceListener final : public ServiceListener<V>
+{
+
+public:
+
+  // ctor for an adapter around a listener, with a ring of _capacity events and the cpu to pin to
+  AsyncServiceListener(ServiceListener<V> *_listener, size_t _capacity = 4096, int _cpu = -1);
+  ~AsyncServiceListener();
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(V &data);
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(V &data);
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(V &data);
+
+  // Wait until every event pushed so far has been processed
+  void Drain();
+
+  // Size the ring's events up front from a sample, before the first event is pushed
+  void Prime(const V &_data);
+
+  // Drain the queue and stop the stage thread
+  void Stop();
+
+private:
+
+  enum EventType { ADD, REMOVE, UPDATE };
+
+  struct Event
+  {
+    EventType type;
+    V data;
+  };
+
+  // Push an event, waiting while the ring is full
+  void Push(EventType _type, V &_data);
+
+  // Body of the stage thread
+  void Run(int _cpu);
+
+  ServiceListener<V>* listener;
+  SPSCQueue<Event> queue;
+  Event pushed;
+  long pushedCount;
+  atomic<long> processedCount;
+  atomic<bool> running;
+  thread worker;
+
+};
+
+template<typename V>
+AsyncServiceListener<V>::AsyncServiceListener(ServiceListener<V> *_listener, size_t _capacity, int _cpu) :
+  listener(_listener), queue(_capacity), pushedCount(0), processedCount(0), running(true)
+{
+  worker = thread(&AsyncServiceListener<V>::Run, this, _cpu);
+}
+
+template<typename V>
+AsyncServiceListener<V>::~AsyncServiceListener()
+{
+  Stop();
+}
+
+template<typename V>
+void AsyncServiceListener<V>::ProcessAdd(V &data)
+{
+  Push(ADD, data);
+}
+
+template<typename V>
+void AsyncServiceListener<V>::ProcessRemove(V &data)
+{
+  Push(REMOVE, data);
+}
+
+template<typename V>
+void AsyncServiceListener<V>::ProcessUpdate(V &data)
+{
+  Push(UPDATE, data);
+}
+
+template<typename V>
+void AsyncServiceListener<V>::Push(EventType _type, V &_data)
+{
+  pushed.type = _type;
+  pushed.data = _data;
+  while (!queue.TryPush(pushed)) this_thread::yield();
+  pushedCount++;
+}
+
+template<typename V>
+void AsyncServiceListener<V>::Prime(const V &_data)
+{
+  pushed.data = _data;
+  queue.Prime(pushed);
+}
+
+template<typename V>
+void AsyncServiceListener<V>::Drain()
+{
+  while (processedCount.load(memory_order_acquire) < pushedCount) this_thread::yield();
+}
+
+template<typename V>
+void AsyncServiceListener<V>::Stop()
+{
+  if (!worker.joinable()) return;
+  Drain();
+  running.store(false, memory_order_release);
+  worker.join();
+}
+
+template<typename V>
+void AsyncServiceListener<V>::Run(int _cpu)
+{
+  PinThread(_cpu);
+  Event _event;
+  IdleBackoff _backoff;
+  while (running.load(memory_order_acquire) || !queue.IsEmpty())
+  {
+    if (!queue.TryPop(_event))
+    {
+      _backoff.Wait();
+      continue;
+    }
+    _backoff.Reset();
+    switch (_event.type)
+    {
+      case ADD: listener->ProcessAdd(_event.data); break;
+      case REMOVE: listener->ProcessRemove(_event.data); break;
+      case UPDATE: listener->ProcessUpdate(_event.data); break;
+    }
+    processedCount.fetch_add(1, memory_order_release);
+  }
+}
+
 #endif
@@ -7,8 +7,176 @@
 #ifndef STREAMING_SERVICE_HPP
 #define STREAMING_SERVICE_HPP
 
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "soa.hpp"
 #include "algostreamingservice.hpp"
+#include "metrics.hpp"
+#include "historicalwriter.hpp"
+
+// How the streaming service publishes: every stream in full, or conflated per product with deltas
+enum StreamingMode { FULL_STREAMS, DELTA_STREAMS };
+
+// Fields of a two-way price stream, combined into the mask of a delta
+enum PriceStreamField
+{
+    BID_PRICE = 1, BID_VISIBLE = 2, BID_HIDDEN = 4,
+    OFFER_PRICE = 8, OFFER_VISIBLE = 16, OFFER_HIDDEN = 32,
+    ALL_STREAM_FIELDS = 63
+};
+
+// Get the mask of fields that differ between two price streams
+template<typename T>
+int DiffPriceStreams(const PriceStream<T>& _previous, const PriceStream<T>& _next)
+{
+    const PriceStreamOrder& _bid = _previous.GetBidOrder();
+    const PriceStreamOrder& _offer = _previous.GetOfferOrder();
+    const PriceStreamOrder& _nextBid = _next.GetBidOrder();
+    const PriceStreamOrder& _nextOffer = _next.GetOfferOrder();
+    int _fields = 0;
+    if (_bid.GetPrice() != _nextBid.GetPrice()) _fields |= BID_PRICE;
+    if (_bid.GetVisibleQuantity() != _nextBid.GetVisibleQuantity()) _fields |= BID_VISIBLE;
+    if (_bid.GetHiddenQuantity() != _nextBid.GetHiddenQuantity()) _fields |= BID_HIDDEN;
+    if (_offer.GetPrice() != _nextOffer.GetPrice()) _fields |= OFFER_PRICE;
+    if (_offer.GetVisibleQuantity() != _nextOffer.GetVisibleQuantity()) _fields |= OFFER_VISIBLE;
+    if (_offer.GetHiddenQuantity() != _nextOffer.GetHiddenQuantity()) _fields |= OFFER_HIDDEN;
+    return _fields;
+}
+
+/**
+* Delta of a price stream against the last stream published for its product,
+* masking the prices and quantities that changed. The first stream of a product has every field.
+* The product reference is valid for the listener callback.
+* Type T is the product type.
+*/
+template<typename T>
+class PriceStreamDelta
+{
+
+public:
+
+    // ctor for a delta of the fields of a stream
+    PriceStreamDelta() = default;
+    PriceStreamDelta(int _fields, const PriceStream<T>& _stream);
+
+    // Get the product
+    const T& GetProduct() const;
+
+    // Get the mask of PriceStreamField values carried
+    int GetFields() const;
+
+    // Check if a field changed
+    bool Has(PriceStreamField _field) const;
+
+    // Get the stream the delta was taken from
+    const PriceStream<T>& GetPriceStream() const;
+
+    // Get the time the price entered the system, in monotonic nanoseconds
+    long GetTimestamp() const;
+
+    // Change the changed attributes to strings, as field=value pairs after the product
+    vector<string> ToStrings() const;
+
+    // Write the changed attributes as the fields of a row, as field=value pairs after the product
+    void Format(RowFormatter& _formatter) const;
+
+private:
+    const PriceStream<T>* stream = nullptr;
+    int fields = 0;
+
+};
+
+template<typename T>
+PriceStreamDelta<T>::PriceStreamDelta(int _fields, const PriceStream<T>& _stream)
+{
+    stream = &_stream;
+    fields = _fields;
+}
+
+template<typename T>
+const T& PriceStreamDelta<T>::GetProduct() const
+{
+    return stream->GetProduct();
+}
+
+template<typename T>
+int PriceStreamDelta<T>::GetFields() const
+{
+    return fields;
+}
+
+template<typename T>
+bool PriceStreamDelta<T>::Has(PriceStreamField _field) const
+{
+    return (fields & _field) != 0;
+}
+
+template<typename T>
+const PriceStream<T>& PriceStreamDelta<T>::GetPriceStream() const
+{
+    return *stream;
+}
+
+template<typename T>
+long PriceStreamDelta<T>::GetTimestamp() const
+{
+    return stream->GetTimestamp();
+}
+
+template<typename T>
+vector<string> PriceStreamDelta<T>::ToStrings() const
+{
+    const PriceStreamOrder& _bid = stream->GetBidOrder();
+    const PriceStreamOrder& _offer = stream->GetOfferOrder();
+    vector<string> _strings;
+    _strings.push_back(stream->GetProduct().GetProductId());
+    if (Has(BID_PRICE)) _strings.push_back("BID_PRICE=" + ConvertPrice(_bid.GetPrice()));
+    if (Has(BID_VISIBLE)) _strings.push_back("BID_VISIBLE=" + to_string(_bid.GetVisibleQuantity()));
+    if (Has(BID_HIDDEN)) _strings.push_back("BID_HIDDEN=" + to_string(_bid.GetHiddenQuantity()));
+    if (Has(OFFER_PRICE)) _strings.push_back("OFFER_PRICE=" + ConvertPrice(_offer.GetPrice()));
+    if (Has(OFFER_VISIBLE)) _strings.push_back("OFFER_VISIBLE=" + to_string(_offer.GetVisibleQuantity()));
+    if (Has(OFFER_HIDDEN)) _strings.push_back("OFFER_HIDDEN=" + to_string(_offer.GetHiddenQuantity()));
+    return _strings;
+}
+
+template<typename T>
+void PriceStreamDelta<T>::Format(RowFormatter& _formatter) const
+{
+    const PriceStreamOrder& _bid = stream->GetBidOrder();
+    const PriceStreamOrder& _offer = stream->GetOfferOrder();
+    _formatter.Field(stream->GetProduct().GetProductId());
+    if (Has(BID_PRICE))
+    {
+        _formatter.Append("BID_PRICE=");
+        _formatter.PriceField(_bid.GetPrice());
+    }
+    if (Has(BID_VISIBLE))
+    {
+        _formatter.Append("BID_VISIBLE=");
+        _formatter.IntegerField(_bid.GetVisibleQuantity());
+    }
+    if (Has(BID_HIDDEN))
+    {
+        _formatter.Append("BID_HIDDEN=");
+        _formatter.IntegerField(_bid.GetHiddenQuantity());
+    }
+    if (Has(OFFER_PRICE))
+    {
+        _formatter.Append("OFFER_PRICE=");
+        _formatter.PriceField(_offer.GetPrice());
+    }
+    if (Has(OFFER_VISIBLE))
+    {
+        _formatter.Append("OFFER_VISIBLE=");
+        _formatter.IntegerField(_offer.GetVisibleQuantity());
+    }
+    if (Has(OFFER_HIDDEN))
+    {
+        _formatter.Append("OFFER_HIDDEN=");
+        _formatter.IntegerField(_offer.GetHiddenQuantity());
+    }
+}
 
 /**
 * Pre-declearations to avoid errors.
@@ -18,6 +186,11 @@ class StreamingToAlgoStreamingListener;
 
 /**
 * Streaming service to publish two-way prices.
+* With FULL_STREAMS every stream goes to the listeners on the calling thread.
+* With DELTA_STREAMS the latest stream of each product is kept and a publisher thread
+* sends the products updated since its last pass, so a burst collapses to its latest quote
+* while the publisher is behind. Streams equal to the last one published for a product are
+* dropped, and delta listeners get only the fields that changed.
 * Keyed on product identifier.
 * Type T is the product type.
 */
@@ -27,9 +200,40 @@ class StreamingService : public Service<string, PriceStream<T>>
 
 private:
 
-map<string, PriceStream<T>> priceStreams;
+ProductStore<PriceStream<T>> priceStreams;
+PriceStream<T> missing;
 vector<ServiceListener<PriceStream<T>>*> listeners;
 ServiceListener<AlgoStream<T>>* listener;
+StageMetrics& priceToStream;
+StreamingMode mode;
+vector<ServiceListener<PriceStreamDelta<T>>*> deltaListeners;
+
+mutex latestMutex;
+condition_variable wakeup;
+ProductStore<PriceStream<T>> latest;
+vector<int> dirty;
+vector<char> dirtyFlags;
+map<string, PriceStream<T>> dirtyOverflow;
+vector<PriceStream<T>> snapshot;
+bool stopping;
+thread publisher;
+
+ProductStore<PriceStream<T>> published;
+map<string, PriceStream<T>, less<>> publishedOverflow;
+atomic<long> conflatedCount;
+atomic<long> suppressedCount;
+
+// Keep a stream as the latest of its product for the publisher thread
+void Conflate(PriceStream<T>& _priceStream);
+
+// Body of the publisher thread
+void Run();
+
+// Publish the streams taken from the latest, dropping those that did not change
+void PublishDirty();
+
+// Send a stream and its delta to the listeners
+void Send(PriceStream<T>& _priceStream, int _fields);
 
 public:
 
@@ -37,8 +241,8 @@ public:
 StreamingService();
 ~StreamingService();
 
-// Get data on our service given a key
-PriceStream<T>& GetData(string _key);
+// Get data on our service given a key, a default value if none was stored for it
+PriceStream<T>& GetData(const string& _key);
 
 // The callback that a Connector should invoke for any new or updated data
 void OnMessage(PriceStream<T>& _data);
@@ -55,29 +259,55 @@ ServiceListener<AlgoStream<T>>* GetListener();
 // Publish two-way prices
 void PublishPrice(PriceStream<T>& _priceStream);
 
+// Set how streams are published; DELTA_STREAMS starts the publisher thread
+void SetMode(StreamingMode _mode);
+
+// Get how streams are published
+StreamingMode GetMode() const;
+
+// Add a listener for the deltas of published streams
+void AddDeltaListener(ServiceListener<PriceStreamDelta<T>>* _listener);
+
+// Get the number of streams replaced by a later one before they were published
+long GetConflatedCount() const;
+
+// Get the number of streams dropped as equal to the last one published
+long GetSuppressedCount() const;
+
+// Publish the streams still pending and stop the publisher thread
+void Stop();
+
 };
 
 template<typename T>
-StreamingService<T>::StreamingService()
+StreamingService<T>::StreamingService() : priceToStream(GetStageMetrics("PriceToStream"))
 {
-    priceStreams = map<string, PriceStream<T>>();
+    priceStreams = ProductStore<PriceStream<T>>();
     listeners = vector<ServiceListener<PriceStream<T>>*>();
     listener = new StreamingToAlgoStreamingListener<T>(this);
+    mode = FULL_STREAMS;
+    stopping = false;
+    conflatedCount = 0;
+    suppressedCount = 0;
 }
 
 template<typename T>
-StreamingService<T>::~StreamingService() {}
+StreamingService<T>::~StreamingService()
+{
+    Stop();
+}
 
 template<typename T>
-PriceStream<T>& StreamingService<T>::GetData(string _key)
+PriceStream<T>& StreamingService<T>::GetData(const string& _key)
 {
-    return priceStreams[_key];
+    PriceStream<T>* _priceStream = priceStreams.Find(_key);
+    return _priceStream ? *_priceStream : missing;
 }
 
 template<typename T>
 void StreamingService<T>::OnMessage(PriceStream<T>& _data)
 {
-    priceStreams[_data.GetProduct().GetProductId()] = _data;
+    priceStreams.Get(_data.GetProduct()) = _data;
 }
 
 template<typename T>
@@ -101,10 +331,166 @@ ServiceListener<AlgoStream<T>>* StreamingService<T>::GetListener()
 template<typename T>
 void StreamingService<T>::PublishPrice(PriceStream<T>& _priceStream)
 {
+    if (mode == DELTA_STREAMS)
+    {
+        Conflate(_priceStream);
+        return;
+    }
+
     for (auto& l : listeners)
     {
         l->ProcessAdd(_priceStream);
     }
+
+    // Time from the internal price to the published, persisted stream
+    if (_priceStream.GetTimestamp() > 0) priceToStream.Record(GetNanoseconds() - _priceStream.GetTimestamp());
+}
+
+template<typename T>
+void StreamingService<T>::SetMode(StreamingMode _mode)
+{
+    mode = _mode;
+    if (mode == DELTA_STREAMS && !publisher.joinable()) publisher = thread(&StreamingService<T>::Run, this);
+}
+
+template<typename T>
+StreamingMode StreamingService<T>::GetMode() const
+{
+    return mode;
+}
+
+template<typename T>
+void StreamingService<T>::AddDeltaListener(ServiceListener<PriceStreamDelta<T>>* _listener)
+{
+    deltaListeners.push_back(_listener);
+}
+
+template<typename T>
+long StreamingService<T>::GetConflatedCount() const
+{
+    return conflatedCount.load(memory_order_relaxed);
+}
+
+template<typename T>
+long StreamingService<T>::GetSuppressedCount() const
+{
+    return suppressedCount.load(memory_order_relaxed);
+}
+
+template<typename T>
+void StreamingService<T>::Stop()
+{
+    {
+        lock_guard<mutex> _lock(latestMutex);
+        if (stopping) return;
+        stopping = true;
+    }
+    wakeup.notify_one();
+    if (publisher.joinable()) publisher.join();
+}
+
+template<typename T>
+void StreamingService<T>::Conflate(PriceStream<T>& _priceStream)
+{
+    const T& _product = _priceStream.GetProduct();
+    int _index = ResolveProductIndex(_product);
+    bool _wake = false;
+    {
+        lock_guard<mutex> _lock(latestMutex);
+        if (_index < 0)
+        {
+            auto _inserted = dirtyOverflow.insert_or_assign(_product.GetProductId(), _priceStream);
+            if (!_inserted.second) conflatedCount.fetch_add(1, memory_order_relaxed);
+            _wake = _inserted.second;
+        }
+        else
+        {
+            latest[_index] = _priceStream;
+            if (size_t(_index) >= dirtyFlags.size()) dirtyFlags.resize(_index + 1, 0);
+            if (dirtyFlags[_index]) conflatedCount.fetch_add(1, memory_order_relaxed);
+            else
+            {
+                dirtyFlags[_index] = 1;
+                dirty.push_back(_index);
+                _wake = true;
+            }
+        }
+    }
+    if (_wake) wakeup.notify_one();
+}
+
+template<typename T>
+void StreamingService<T>::Run()
+{
+    bool _stopping = false;
+    while (!_stopping)
+    {
+        {
+            unique_lock<mutex> _lock(latestMutex);
+            wakeup.wait(_lock, [this] { return stopping || !dirty.empty() || !dirtyOverflow.empty(); });
+            _stopping = stopping;
+
+            // Take the pending streams under the lock, publish them outside of it
+            snapshot.clear();
+            for (int i : dirty)
+            {
+                snapshot.push_back(latest[i]);
+                dirtyFlags[i] = 0;
+            }
+            dirty.clear();
+            for (auto& p : dirtyOverflow) snapshot.push_back(move(p.second));
+            dirtyOverflow.clear();
+        }
+        PublishDirty();
+    }
+}
+
+template<typename T>
+void StreamingService<T>::PublishDirty()
+{
+    for (auto& s : snapshot)
+    {
+        const T& _product = s.GetProduct();
+        int _index = ResolveProductIndex(_product);
+        if (_index < 0)
+        {
+            auto _it = publishedOverflow.find(_product.GetProductId());
+            int _fields = (_it == publishedOverflow.end()) ? ALL_STREAM_FIELDS : DiffPriceStreams(_it->second, s);
+            if (_fields == 0)
+            {
+                suppressedCount.fetch_add(1, memory_order_relaxed);
+                continue;
+            }
+            if (_it == publishedOverflow.end()) _it = publishedOverflow.emplace(_product.GetProductId(), s).first;
+            else _it->second = s;
+            Send(_it->second, _fields);
+            continue;
+        }
+
+        int _fields = published.Contains(_index) ? DiffPriceStreams(published[_index], s) : ALL_STREAM_FIELDS;
+        if (_fields == 0)
+        {
+            suppressedCount.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        published[_index] = s;
+        Send(published[_index], _fields);
+    }
+}
+
+template<typename T>
+void StreamingService<T>::Send(PriceStream<T>& _priceStream, int _fields)
+{
+    for (auto& l : listeners)
+    {
+        l->ProcessAdd(_priceStream);
+    }
+    PriceStreamDelta<T> _delta(_fields, _priceStream);
+    for (auto& l : deltaListeners)
+    {
+        l->ProcessAdd(_delta);
+    }
+    if (_priceStream.GetTimestamp() > 0) priceToStream.Record(GetNanoseconds() - _priceStream.GetTimestamp());
 }
 
 /**
@@ -148,9 +534,9 @@ StreamingToAlgoStreamingListener<T>::~StreamingToAlgoStreamingListener() {}
 template<typename T>
 void StreamingToAlgoStreamingListener<T>::ProcessAdd(AlgoStream<T>& _data)
 {
-    PriceStream<T>* _priceStream = _data.GetPriceStream();
-    service->OnMessage(*_priceStream);
-    service->PublishPrice(*_priceStream);
+    PriceStream<T>& _priceStream = _data.GetPriceStream();
+    service->OnMessage(_priceStream);
+    service->PublishPrice(_priceStream);
 }
 
 template<typename T>
@@ -159,4 +545,89 @@ void StreamingToAlgoStreamingListener<T>::ProcessRemove(AlgoStream<T>& _data) {}
 template<typename T>
 void StreamingToAlgoStreamingListener<T>::ProcessUpdate(AlgoStream<T>& _data) {}
 
+/**
+* Historical Delta Writer persisting the deltas of published price streams as text rows:
+* the product, then the fields that changed as field=value pairs. It keeps its own writer
+* on its file, written from the publisher thread of the streaming service.
+* Type T is the product type.
+*/
+template<typename T>
+class HistoricalDeltaWriter : public ServiceListener<PriceStreamDelta<T>>
+{
+
+private:
+
+    HistoricalWriter writer;
+    string record;
+    char row[ROW_CAPACITY];
+    StageMetrics& stage;
+
+public:
+
+    // Connector and Destructor
+    HistoricalDeltaWriter(const string& _path);
+    ~HistoricalDeltaWriter();
+
+    // Listener callback to process an add event to the Service
+    void ProcessAdd(PriceStreamDelta<T>& _data);
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(PriceStreamDelta<T>& _data);
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(PriceStreamDelta<T>& _data);
+
+    // Flush and close the output file, once the publisher thread is stopped
+    void Close();
+
+};
+
+template<typename T>
+HistoricalDeltaWriter<T>::HistoricalDeltaWriter(const string& _path) : writer(_path), stage(GetStageMetrics("HistoricalDeltaWriter::ProcessAdd " + _path))
+{
+}
+
+template<typename T>
+HistoricalDeltaWriter<T>::~HistoricalDeltaWriter() {}
+
+template<typename T>
+void HistoricalDeltaWriter<T>::ProcessAdd(PriceStreamDelta<T>& _data)
+{
+    ScopedLatency _latency(stage);
+    RowFormatter _formatter(row, ROW_CAPACITY);
+    _formatter.AppendTimeStamp();
+    _formatter.Append(",");
+    _data.Format(_formatter);
+    _formatter.Append("\n");
+    if (!_formatter.IsTruncated())
+    {
+        string_view _row = _formatter.GetRow();
+        writer.Write(_row.data(), _row.size());
+        return;
+    }
+
+    record = TimeStamp();
+    record += ",";
+    vector<string> _strings = _data.ToStrings();
+    for (auto& s : _strings)
+    {
+        record += s;
+        record += ",";
+    }
+    record += "\n";
+    writer.Write(record);
+}
+
+template<typename T>
+void HistoricalDeltaWriter<T>::ProcessRemove(PriceStreamDelta<T>& _data) {}
+
+template<typename T>
+void HistoricalDeltaWriter<T>::ProcessUpdate(PriceStreamDelta<T>& _data) {}
+
+template<typename T>
+void HistoricalDeltaWriter<T>::Close()
+{
+    writer.Shutdown();
+}
+
 #endif
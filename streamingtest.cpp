@@ -0,0 +1,123 @@
+//
+// Streaming test for the trading system.
+// Checks delta streaming: the streams of a product published while the publisher thread is
+// busy conflate to the latest one, a stream equal to the last one published is dropped, and
+// each delta written carries only the fields that changed against that last stream.
+//
+// Usage: streamingtest
+//
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+
+#include "soa.hpp"
+#include "products.hpp"
+#include "streamingservice.hpp"
+
+using namespace std;
+
+/**
+* Listener keeping the field masks of the deltas it gets, holding the publisher thread
+* on the first one until it is released.
+*/
+class DeltaRecorder : public ServiceListener<PriceStreamDelta<Bond>>
+{
+
+public:
+
+    mutex deltaMutex;
+    vector<pair<string, int>> deltas;
+    atomic<int> count = 0;
+    atomic<bool> released = false;
+
+    void ProcessAdd(PriceStreamDelta<Bond>& _data) override
+    {
+        {
+            lock_guard<mutex> _lock(deltaMutex);
+            deltas.emplace_back(_data.GetProduct().GetProductId(), _data.GetFields());
+        }
+        count.fetch_add(1, memory_order_release);
+        while (!released.load(memory_order_acquire)) this_thread::yield();
+    }
+    void ProcessRemove(PriceStreamDelta<Bond>& _data) override {}
+    void ProcessUpdate(PriceStreamDelta<Bond>& _data) override {}
+
+};
+
+// Get a price stream of a product
+PriceStream<Bond> MakeStream(int _product, double _bid, long _bidVisible, double _offer, long _offerVisible)
+{
+    return PriceStream<Bond>(GetProductRegistry().GetBond(_product), PriceStreamOrder(_bid, _bidVisible, 2 * _bidVisible, BID),
+                             PriceStreamOrder(_offer, _offerVisible, 2 * _offerVisible, OFFER));
+}
+
+// Wait until a recorder has got a number of deltas
+void WaitForDeltas(DeltaRecorder& _recorder, int _count)
+{
+    while (_recorder.count.load(memory_order_acquire) < _count) this_thread::yield();
+}
+
+// Check a condition, reporting it if it fails
+bool Check(bool _condition, const string& _message)
+{
+    if (!_condition) cerr << _message << endl;
+    return _condition;
+}
+
+int main()
+{
+    char _root[] = "/tmp/streamingtestXXXXXX";
+    if (!mkdtemp(_root) || chdir(_root) != 0)
+    {
+        cerr << "Cannot create a working directory" << endl;
+        return 1;
+    }
+
+    StreamingService<Bond> streamingService;
+    DeltaRecorder recorder;
+    HistoricalDeltaWriter<Bond> deltaWriter("deltas.txt");
+    streamingService.AddDeltaListener(&recorder);
+    streamingService.AddDeltaListener(&deltaWriter);
+    streamingService.SetMode(DELTA_STREAMS);
+
+    // The first stream holds the publisher thread in the recorder while three more arrive:
+    // two of the first product, the earlier of which is conflated, and one of another product
+    PriceStream<Bond> _first = MakeStream(0, 99.5, 1000000, 99.625, 1000000);
+    PriceStream<Bond> _replaced = MakeStream(0, 99.25, 1000000, 99.625, 1000000);
+    PriceStream<Bond> _latest = MakeStream(0, 99.5, 1000000, 99.625, 3000000);
+    PriceStream<Bond> _other = MakeStream(1, 98.0, 1000000, 98.125, 1000000);
+    streamingService.PublishPrice(_first);
+    WaitForDeltas(recorder, 1);
+    streamingService.PublishPrice(_replaced);
+    streamingService.PublishPrice(_latest);
+    streamingService.PublishPrice(_other);
+    recorder.released.store(true, memory_order_release);
+    WaitForDeltas(recorder, 3);
+
+    // The latest stream again changes nothing and is not published
+    PriceStream<Bond> _repeated = _latest;
+    streamingService.PublishPrice(_repeated);
+    streamingService.Stop();
+    deltaWriter.Close();
+
+    const string& _product = GetProductRegistry().GetBond(0).GetProductId();
+    const string& _otherProduct = GetProductRegistry().GetBond(1).GetProductId();
+    bool _passed = true;
+    _passed &= Check(recorder.deltas == vector<pair<string, int>>{ { _product, ALL_STREAM_FIELDS }, { _product, OFFER_VISIBLE | OFFER_HIDDEN }, { _otherProduct, ALL_STREAM_FIELDS } },
+                     "Deltas do not carry the fields changed against the last stream published");
+    _passed &= Check(streamingService.GetConflatedCount() == 1, "Streams published while the publisher was busy were not conflated");
+    _passed &= Check(streamingService.GetSuppressedCount() == 1, "A stream equal to the last one published was not dropped");
+
+    ifstream _file("deltas.txt");
+    vector<string> _rows;
+    for (string _line; getline(_file, _line); ) _rows.push_back(_line.substr(_line.find(',') + 1));
+    _passed &= Check(_rows.size() == 3 && _rows[1] == _product + ",OFFER_VISIBLE=3000000,OFFER_HIDDEN=6000000,",
+                     "Written deltas do not hold only the changed fields");
+
+    if (!_passed) return 1;
+    cout << "Delta streams conflate and drop unchanged quotes" << endl;
+    filesystem::remove_all(_root);
+    return 0;
+}
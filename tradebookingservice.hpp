@@ -10,11 +10,18 @@
 #include <string>
 #include <vector>
 #include "soa.hpp"
+#include "filereader.hpp"
 #include "executionservice.hpp"
 
 // Trade sides
 enum Side { BUY, SELL };
 
+// Number of booked trades the trade booking service retains by default
+const size_t TRADE_RETENTION_ENTRIES = 1 << 16;
+
+// Names of the trade sides, by side
+constexpr string_view SIDE_NAMES[] = { "BUY", "SELL" };
+
 /**
 * Trade object with a price, side, and quantity on a particular book.
 * Type T is the product type.
@@ -47,6 +54,12 @@ public:
     // Get the side
     Side GetSide() const;
 
+    // Change attributes to strings
+    vector<string> ToStrings() const;
+
+    // Write attributes as the fields of a row
+    void Format(RowFormatter& _formatter) const;
+
 private:
 
     T product;
@@ -60,11 +73,9 @@ private:
 
 template<typename T>
 Trade<T>::Trade(const T& _product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
-        product(_product)
+        product(_product), tradeId(move(_tradeId)), book(move(_book))
 {
-    tradeId = _tradeId;
     price = _price;
-    book = _book;
     quantity = _quantity;
     side = _side;
 }
@@ -105,29 +116,59 @@ Side Trade<T>::GetSide() const
     return side;
 }
 
+template<typename T>
+vector<string> Trade<T>::ToStrings() const
+{
+    string _product = product.GetProductId();
+    string _tradeId = tradeId;
+    string _price = ConvertPrice(price);
+    string _book = book;
+    string _quantity = to_string(quantity);
+    string _side(SIDE_NAMES[side]);
+
+    vector<string> _strings = {_product, _tradeId, _price, _book, _quantity, _side};
+    return _strings;
+}
+
+template<typename T>
+void Trade<T>::Format(RowFormatter& _formatter) const
+{
+    _formatter.Field(product.GetProductId());
+    _formatter.Field(tradeId);
+    _formatter.PriceField(price);
+    _formatter.Field(book);
+    _formatter.IntegerField(quantity);
+    _formatter.Field(SIDE_NAMES[side]);
+}
+
 /**
 * Pre-declearations to avoid errors.
 */
-template<typename T>
+template<typename T, typename... L>
+class TradeBookingService;
+template<typename T, typename S = TradeBookingService<T>>
 class TradeBookingConnector;
-template<typename T>
+template<typename T, typename S = TradeBookingService<T>>
 class TradeBookingToExecutionListener;
 
 /**
 * Trade Booking Service to book trades to a particular book.
-* Keyed on trade identifier.
-* Type T is the product type.
+* Keyed on trade identifier. A trade is final once booked and its positions updated, so
+* only the latest trades are retained, within the bounds of a retention policy; an eviction
+* listener, such as a historical data service, takes each trade as it is evicted.
+* Type T is the product type, types L the listener types dispatched statically.
 */
-template<typename T>
+template<typename T, typename... L>
 class TradeBookingService : public Service<string, Trade<T>>
 {
 
 private:
 
-    map<string, Trade<T>> trades;
-    vector<ServiceListener<Trade<T>>*> listeners;
-    TradeBookingConnector<T>* connector;
-    TradeBookingToExecutionListener<T>* listener;
+    RetentionStore<Trade<T>> trades;
+    Trade<T> missing;
+    ListenerList<Trade<T>, L...> listeners;
+    TradeBookingConnector<T, TradeBookingService>* connector;
+    TradeBookingToExecutionListener<T, TradeBookingService>* listener;
 
 public:
 
@@ -135,107 +176,192 @@ public:
     TradeBookingService();
     ~TradeBookingService();
 
-    // Get data on our service given a key
-    Trade<T>& GetData(string _key);
+    // Get data on our service given a key, a default trade if it is not retained
+    Trade<T>& GetData(const string& _key);
+
+    // Find a retained trade without inserting, nullptr if it is not retained
+    Trade<T>* Find(string_view _tradeId);
+
+    // Get a copy of a retained trade without inserting, empty if it is not retained
+    optional<Trade<T>> Lookup(string_view _tradeId);
+
+    // Set the bounds on the trades retained, evicting those now outside them
+    void SetRetention(const RetentionPolicy& _policy);
+
+    // Get the number of trades retained
+    size_t GetRetainedCount() const;
+
+    // Get the number of trades evicted so far
+    long GetEvictedCount() const;
+
+    // Set the listener taking each trade as it is evicted
+    void SetEvictionListener(ServiceListener<Trade<T>>* _listener);
 
     // The callback that a Connector should invoke for any new or updated data
     void OnMessage(Trade<T>& _data);
 
+    // The callback for a trade the caller gives up, moved into the store
+    void OnMessage(Trade<T>&& _data);
+
+    // The callback for a batch of trades: all are stored, then listeners get the batch at once
+    void OnMessages(span<Trade<T>> _data);
+
     // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
     void AddListener(ServiceListener<Trade<T>>* _listener);
 
+    // Bind the listeners of the static listener types
+    void BindListeners(L*... _listeners);
+
     // Get all listeners on the Service
     const vector<ServiceListener<Trade<T>>*>& GetListeners() const;
 
     // Get the connector of the service
-    TradeBookingConnector<T>* GetConnector();
+    TradeBookingConnector<T, TradeBookingService>* GetConnector();
 
     // Get the listener of the service
-    TradeBookingToExecutionListener<T>* GetListener();
+    TradeBookingToExecutionListener<T, TradeBookingService>* GetListener();
 
     // Book the trade
     void BookTrade(Trade<T>& _trade);
 
 };
 
-template<typename T>
-TradeBookingService<T>::TradeBookingService()
+template<typename T, typename... L>
+TradeBookingService<T, L...>::TradeBookingService() : trades(RetentionPolicy{ TRADE_RETENTION_ENTRIES, 0 })
 {
-    trades = map<string, Trade<T>>();
-    listeners = vector<ServiceListener<Trade<T>>*>();
-    connector = new TradeBookingConnector<T>(this);
-    listener = new TradeBookingToExecutionListener<T>(this);
+    connector = new TradeBookingConnector<T, TradeBookingService>(this);
+    listener = new TradeBookingToExecutionListener<T, TradeBookingService>(this);
 }
 
-template<typename T>
-TradeBookingService<T>::~TradeBookingService() {}
+template<typename T, typename... L>
+TradeBookingService<T, L...>::~TradeBookingService() {}
 
-template<typename T>
-Trade<T>& TradeBookingService<T>::GetData(string _key)
+template<typename T, typename... L>
+Trade<T>& TradeBookingService<T, L...>::GetData(const string& _key)
 {
-    return trades[_key];
+    Trade<T>* _trade = trades.Find(_key);
+    return _trade ? *_trade : missing;
 }
 
-template<typename T>
-void TradeBookingService<T>::OnMessage(Trade<T>& _data)
+template<typename T, typename... L>
+Trade<T>* TradeBookingService<T, L...>::Find(string_view _tradeId)
+{
+    return trades.Find(_tradeId);
+}
+
+template<typename T, typename... L>
+optional<Trade<T>> TradeBookingService<T, L...>::Lookup(string_view _tradeId)
+{
+    return trades.Lookup(_tradeId);
+}
+
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::SetRetention(const RetentionPolicy& _policy)
+{
+    trades.SetPolicy(_policy);
+}
+
+template<typename T, typename... L>
+size_t TradeBookingService<T, L...>::GetRetainedCount() const
+{
+    return trades.GetSize();
+}
+
+template<typename T, typename... L>
+long TradeBookingService<T, L...>::GetEvictedCount() const
+{
+    return trades.GetEvictedCount();
+}
+
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::SetEvictionListener(ServiceListener<Trade<T>>* _listener)
+{
+    trades.SetEvictionHandler([_listener](Trade<T>& _trade) { _listener->ProcessAdd(_trade); });
+}
+
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::OnMessage(Trade<T>& _data)
+{
+    // Listeners see the stored trade
+    Trade<T>& _trade = trades[_data.GetTradeId()];
+    _trade = _data;
+
+    listeners.ProcessAdd(_trade);
+}
+
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::OnMessage(Trade<T>&& _data)
 {
-    trades[_data.GetTradeId()] = _data;
+    Trade<T>& _trade = trades[_data.GetTradeId()];
+    _trade = move(_data);
+
+    listeners.ProcessAdd(_trade);
+}
 
-    for (auto& l : listeners)
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::OnMessages(span<Trade<T>> _data)
+{
+    for (auto& t : _data)
     {
-        l->ProcessAdd(_data);
+        trades[t.GetTradeId()] = t;
     }
+
+    listeners.ProcessAddBatch(_data);
 }
 
-template<typename T>
-void TradeBookingService<T>::AddListener(ServiceListener<Trade<T>>* _listener)
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::AddListener(ServiceListener<Trade<T>>* _listener)
 {
-    listeners.push_back(_listener);
+    listeners.Add(_listener);
 }
 
-template<typename T>
-const vector<ServiceListener<Trade<T>>*>& TradeBookingService<T>::GetListeners() const
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::BindListeners(L*... _listeners)
 {
-    return listeners;
+    listeners.Bind(_listeners...);
 }
 
-template<typename T>
-TradeBookingConnector<T>* TradeBookingService<T>::GetConnector()
+template<typename T, typename... L>
+const vector<ServiceListener<Trade<T>>*>& TradeBookingService<T, L...>::GetListeners() const
+{
+    return listeners.GetDynamic();
+}
+
+template<typename T, typename... L>
+TradeBookingConnector<T, TradeBookingService<T, L...>>* TradeBookingService<T, L...>::GetConnector()
 {
     return connector;
 }
 
-template<typename T>
-TradeBookingToExecutionListener<T>* TradeBookingService<T>::GetListener()
+template<typename T, typename... L>
+TradeBookingToExecutionListener<T, TradeBookingService<T, L...>>* TradeBookingService<T, L...>::GetListener()
 {
     return listener;
 }
 
-template<typename T>
-void TradeBookingService<T>::BookTrade(Trade<T>& _trade)
+template<typename T, typename... L>
+void TradeBookingService<T, L...>::BookTrade(Trade<T>& _trade)
 {
-    for (auto& l : listeners)
-    {
-        l->ProcessAdd(_trade);
-    }
+    listeners.ProcessAdd(_trade);
 }
 
 /**
 * Trade Booking Connector subscribing data to Trading Booking Service.
-* Type T is the product type.
+* Type T is the product type, type S the trade booking service type.
 */
-template<typename T>
+template<typename T, typename S>
 class TradeBookingConnector : public Connector<Trade<T>>
 {
 
 private:
 
-    TradeBookingService<T>* service;
+    S* service;
+    ServiceListener<Trade<T>>* router;
 
 public:
 
     // Connector and Destructor
-    TradeBookingConnector(TradeBookingService<T>* _service);
+    TradeBookingConnector(S* _service);
     ~TradeBookingConnector();
 
     // Publish data to the Connector
@@ -244,65 +370,128 @@ public:
     // Subscribe data from the Connector
     void Subscribe(ifstream& _data);
 
+    // Subscribe data from a memory-mapped file.
+    // With a batch size above one, trades are delivered to OnMessages that many at a time.
+    void SubscribeFile(const string& _path, size_t _batch = 1);
+
+    // Parse one line of trade data
+    void ProcessLine(string_view _line);
+
+    // Parse one line of trade data into a trade, return false if the line is malformed
+    bool ParseLine(string_view _line, Trade<T>& _trade);
+
+    // Deliver a parsed trade
+    void Deliver(Trade<T>& _trade);
+
+    // Deliver a batch of parsed trades
+    void ProcessBatch(span<Trade<T>> _trades);
+
+    // Route parsed trades to a listener, such as the shard router of a sharded pipeline, instead of the service
+    void SetRouter(ServiceListener<Trade<T>>* _router);
+
 };
 
-template<typename T>
-TradeBookingConnector<T>::TradeBookingConnector(TradeBookingService<T>* _service)
+template<typename T, typename S>
+TradeBookingConnector<T, S>::TradeBookingConnector(S* _service)
 {
     service = _service;
+    router = nullptr;
 }
 
-template<typename T>
-TradeBookingConnector<T>::~TradeBookingConnector() {}
+template<typename T, typename S>
+TradeBookingConnector<T, S>::~TradeBookingConnector() {}
 
-template<typename T>
-void TradeBookingConnector<T>::Publish(Trade<T>& _data) {}
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::Publish(Trade<T>& _data) {}
 
-template<typename T>
-void TradeBookingConnector<T>::Subscribe(ifstream& _data)
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::Subscribe(ifstream& _data)
 {
-    string _line;
-    while (getline(_data, _line))
+    ForEachLine(_data, [&](string_view _line) { ProcessLine(_line); });
+}
+
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::SubscribeFile(const string& _path, size_t _batch)
+{
+    if (_batch <= 1)
     {
-        stringstream _lineStream(_line);
-        string _cell;
-        vector<string> _cells;
-        while (getline(_lineStream, _cell, ','))
-        {
-            _cells.push_back(_cell);
-        }
-
-        string _productId = _cells[0];
-        string _tradeId = _cells[1];
-        double _price = ConvertPrice(_cells[2]);
-        string _book = _cells[3];
-        long _quantity = stol(_cells[4]);
-        Side _side;
-        if (_cells[5] == "BUY") _side = BUY;
-        else if (_cells[5] == "SELL") _side = SELL;
-        T _product = GetBond(_productId);
-        Trade<T> _trade(_product, _tradeId, _price, _book, _quantity, _side);
-        service->OnMessage(_trade);
+        ForEachLine(_path, [&](string_view _line) { ProcessLine(_line); });
+        return;
     }
+
+    vector<Trade<T>> _trades(_batch);
+    size_t _count = 0;
+    ForEachLine(_path, [&](string_view _line)
+    {
+        if (!ParseLine(_line, _trades[_count])) return;
+        if (++_count < _batch) return;
+        ProcessBatch(span<Trade<T>>(_trades.data(), _count));
+        _count = 0;
+    });
+    if (_count > 0) ProcessBatch(span<Trade<T>>(_trades.data(), _count));
+}
+
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::ProcessLine(string_view _line)
+{
+    Trade<T> _trade;
+    if (!ParseLine(_line, _trade)) return;
+    Deliver(_trade);
+}
+
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::Deliver(Trade<T>& _trade)
+{
+    if (router) router->ProcessAdd(_trade);
+    else service->OnMessage(move(_trade));
+}
+
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::ProcessBatch(span<Trade<T>> _trades)
+{
+    if (router) router->ProcessAddBatch(_trades);
+    else service->OnMessages(_trades);
+}
+
+template<typename T, typename S>
+bool TradeBookingConnector<T, S>::ParseLine(string_view _line, Trade<T>& _trade)
+{
+    string_view _cells[6];
+    if (SplitCells(_line, _cells, 6) < 6) return false;
+
+    string _tradeId(_cells[1]);
+    double _price = ConvertPrice(_cells[2]);
+    string _book(_cells[3]);
+    long _quantity = ParseLong(_cells[4]);
+    Side _side = (_cells[5] == "SELL") ? SELL : BUY;
+    const T& _product = GetBond(_cells[0]);
+    _trade = Trade<T>(_product, move(_tradeId), _price, move(_book), _quantity, _side);
+    return true;
+}
+
+template<typename T, typename S>
+void TradeBookingConnector<T, S>::SetRouter(ServiceListener<Trade<T>>* _router)
+{
+    router = _router;
 }
 
 /**
 * Trade Booking Service Listener subscribing data from Execution Service to Trading Booking Service.
-* Type T is the product type.
+* Type T is the product type, type S the trade booking service type.
 */
-template<typename T>
-class TradeBookingToExecutionListener : public ServiceListener<ExecutionOrder<T>>
+template<typename T, typename S>
+class TradeBookingToExecutionListener final : public ServiceListener<ExecutionOrder<T>>
 {
 
 private:
 
-    TradeBookingService<T>* service;
+    S* service;
     long count;
 
 public:
 
     // Connector and Destructor
-    TradeBookingToExecutionListener(TradeBookingService<T>* _service);
+    TradeBookingToExecutionListener(S* _service);
     ~TradeBookingToExecutionListener();
 
     // Listener callback to process an add event to the Service
@@ -314,25 +503,31 @@ public:
     // Listener callback to process an update event to the Service
     void ProcessUpdate(ExecutionOrder<T>& _data);
 
+    // Get the number of execution orders booked, which rotates their books
+    long GetCount() const;
+
+    // Set the number of execution orders booked, as restored from a snapshot
+    void SetCount(long _count);
+
 };
 
-template<typename T>
-TradeBookingToExecutionListener<T>::TradeBookingToExecutionListener(TradeBookingService<T>* _service)
+template<typename T, typename S>
+TradeBookingToExecutionListener<T, S>::TradeBookingToExecutionListener(S* _service)
 {
     service = _service;
     count = 0;
 }
 
-template<typename T>
-TradeBookingToExecutionListener<T>::~TradeBookingToExecutionListener() {}
+template<typename T, typename S>
+TradeBookingToExecutionListener<T, S>::~TradeBookingToExecutionListener() {}
 
-template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
+template<typename T, typename S>
+void TradeBookingToExecutionListener<T, S>::ProcessAdd(ExecutionOrder<T>& _data)
 {
     count++;
-    T _product = _data.GetProduct();
+    const T& _product = _data.GetProduct();
     PricingSide _pricingSide = _data.GetPricingSide();
-    string _orderId = _data.GetOrderId();
+    const string& _orderId = _data.GetOrderId();
     double _price = _data.GetPrice();
     long _visibleQuantity = _data.GetVisibleQuantity();
     long _hiddenQuantity = _data.GetHiddenQuantity();
@@ -347,7 +542,7 @@ void TradeBookingToExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
             _side = BUY;
             break;
     }
-    string _book;
+    const char* _book = "";
     switch (count % 3)
     {
         case 0:
@@ -362,15 +557,27 @@ void TradeBookingToExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
     }
     long _quantity = _visibleQuantity + _hiddenQuantity;
 
-    Trade<T> _trade(_product, _orderId, _price, _book, _quantity, _side);
-    service->OnMessage(_trade);
-    service->BookTrade(_trade);
+    // Book the stored trade rather than a second copy
+    service->OnMessage(Trade<T>(_product, _orderId, _price, _book, _quantity, _side));
+    service->BookTrade(service->GetData(_orderId));
 }
 
-template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessRemove(ExecutionOrder<T>& _data) {}
+template<typename T, typename S>
+void TradeBookingToExecutionListener<T, S>::ProcessRemove(ExecutionOrder<T>& _data) {}
 
-template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessUpdate(ExecutionOrder<T>& _data) {}
+template<typename T, typename S>
+void TradeBookingToExecutionListener<T, S>::ProcessUpdate(ExecutionOrder<T>& _data) {}
+
+template<typename T, typename S>
+long TradeBookingToExecutionListener<T, S>::GetCount() const
+{
+    return count;
+}
+
+template<typename T, typename S>
+void TradeBookingToExecutionListener<T, S>::SetCount(long _count)
+{
+    count = _count;
+}
 
 #endif
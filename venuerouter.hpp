@@ -0,0 +1,420 @@
+/**
+ * venuerouter.hpp
+ * Defines the routing of execution orders to venues over a non-blocking transport.
+ *
+ */
+#ifndef VENUE_ROUTER_HPP
+#define VENUE_ROUTER_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include "soa.hpp"
+#include "executionservice.hpp"
+#include "metrics.hpp"
+
+const int VENUE_COUNT = CME + 1;
+
+/**
+* Order as sent to a venue.
+*/
+struct VenueOrder
+{
+    string orderId;
+    PricingSide side;
+    double price;
+    long quantity;
+};
+
+// Kinds of event a venue sends back for an order
+enum VenueEventType { VENUE_ACK, VENUE_FILL };
+
+/**
+* Acknowledgement or fill a venue sends back for an order.
+*/
+struct VenueEvent
+{
+    VenueEventType type;
+    Market venue;
+    string orderId;
+    double price;
+    long quantity;
+};
+
+/**
+* Non-blocking transport carrying orders to venues and their events back.
+* Neither call may wait on a venue.
+*/
+class VenueTransport
+{
+
+public:
+
+    virtual ~VenueTransport() = default;
+
+    // Try to send an order to a venue, return false if the venue's queue is full
+    virtual bool TrySend(Market _venue, const VenueOrder& _order) = 0;
+
+    // Try to take the next event from any venue, return false if none is ready
+    virtual bool TryReceive(VenueEvent& _event) = 0;
+
+};
+
+/**
+* Transport to simulated venues, each a thread with its own queues of orders in and events out.
+* A venue acknowledges an order on arrival and fills it in full after a fixed latency.
+*/
+class SimulatedVenueTransport : public VenueTransport
+{
+
+public:
+
+    // ctor for venues with queues of _capacity messages, filling orders _latency nanoseconds after they arrive
+    SimulatedVenueTransport(size_t _capacity = 4096, long _latency = 20000);
+    ~SimulatedVenueTransport();
+
+    // Try to send an order to a venue, return false if the venue's queue is full
+    bool TrySend(Market _venue, const VenueOrder& _order) override;
+
+    // Try to take the next event from any venue, return false if none is ready
+    bool TryReceive(VenueEvent& _event) override;
+
+    // Stop the venue threads
+    void Stop();
+
+private:
+
+    struct PendingFill
+    {
+        long due;
+        VenueEvent fill;
+    };
+
+    struct Venue
+    {
+        Venue(size_t _capacity) : orders(_capacity), events(_capacity) {}
+
+        SPSCQueue<VenueOrder> orders;
+        SPSCQueue<VenueEvent> events;
+        thread worker;
+    };
+
+    // Body of the thread of a venue
+    void Run(Market _venue);
+
+    vector<unique_ptr<Venue>> venues;
+    long latency;
+    int next;
+    atomic<bool> running;
+
+};
+
+SimulatedVenueTransport::SimulatedVenueTransport(size_t _capacity, long _latency) : latency(_latency), next(0), running(true)
+{
+    for (int i = 0; i < VENUE_COUNT; i++) venues.push_back(make_unique<Venue>(_capacity));
+    for (int i = 0; i < VENUE_COUNT; i++) venues[i]->worker = thread(&SimulatedVenueTransport::Run, this, Market(i));
+}
+
+SimulatedVenueTransport::~SimulatedVenueTransport()
+{
+    Stop();
+}
+
+bool SimulatedVenueTransport::TrySend(Market _venue, const VenueOrder& _order)
+{
+    return venues[_venue]->orders.TryPush(_order);
+}
+
+bool SimulatedVenueTransport::TryReceive(VenueEvent& _event)
+{
+    // Venues are polled in turn so a busy venue does not starve the others
+    for (int i = 0; i < VENUE_COUNT; i++)
+    {
+        int _venue = next;
+        next = (next + 1) % VENUE_COUNT;
+        if (venues[_venue]->events.TryPop(_event)) return true;
+    }
+    return false;
+}
+
+void SimulatedVenueTransport::Stop()
+{
+    if (!running.exchange(false, memory_order_acq_rel)) return;
+    for (auto& v : venues) v->worker.join();
+}
+
+void SimulatedVenueTransport::Run(Market _venue)
+{
+    Venue& _queues = *venues[_venue];
+    deque<PendingFill> _fills;
+    VenueOrder _order;
+    VenueEvent _ack;
+    IdleBackoff _backoff;
+    while (running.load(memory_order_acquire))
+    {
+        bool _busy = false;
+        if (_queues.orders.TryPop(_order))
+        {
+            _busy = true;
+            _ack = { VENUE_ACK, _venue, _order.orderId, _order.price, 0 };
+            while (!_queues.events.TryPush(_ack)) this_thread::yield();
+            _fills.push_back({ GetNanoseconds() + latency, { VENUE_FILL, _venue, move(_order.orderId), _order.price, _order.quantity } });
+        }
+
+        // Fills are due in arrival order, since every order waits the same latency
+        long _now = GetNanoseconds();
+        while (!_fills.empty() && _fills.front().due <= _now && _queues.events.TryPush(_fills.front().fill))
+        {
+            _fills.pop_front();
+            _busy = true;
+        }
+
+        if (_busy)
+        {
+            _backoff.Reset();
+            continue;
+        }
+        // Pending fills come due within the latency, so the venue only sleeps with none left
+        _backoff.Wait(_fills.empty());
+    }
+}
+
+/**
+* Policy choosing the venue an order is sent to.
+* Type T is the product type.
+*/
+template<typename T>
+class VenueRouting
+{
+
+public:
+
+    virtual ~VenueRouting() = default;
+
+    // Get the venue to send an order to
+    virtual Market Route(const ExecutionOrder<T>& _order) = 0;
+
+};
+
+/**
+* Routing sending the orders of a product to the venue picked by its product index,
+* and orders of unindexed products to the venues in turn.
+* Type T is the product type.
+*/
+template<typename T>
+class ProductVenueRouting : public VenueRouting<T>
+{
+
+public:
+
+    // Get the venue to send an order to
+    Market Route(const ExecutionOrder<T>& _order) override
+    {
+        int _index = ResolveProductIndex(_order.GetProduct());
+        if (_index < 0) _index = int(count++);
+        return Market(_index % VENUE_COUNT);
+    };
+
+private:
+
+    long count = 0;
+
+};
+
+/**
+* Router sending executed orders to venues, listening on the Execution Service.
+* Orders stay in an outstanding table keyed by order ID until their fill comes back.
+* Sending never waits: an order the transport cannot take is kept in its venue's backlog
+* and retried on later calls. Events are delivered on the thread calling ProcessAdd, Poll or Drain;
+* fill listeners get the filled order, event listeners every acknowledgement and fill.
+* Type T is the product type.
+*/
+template<typename T>
+class VenueRouter : public ServiceListener<ExecutionOrder<T>>
+{
+
+public:
+
+    // ctor for a router over a transport, routing by product unless a routing policy is given
+    VenueRouter(VenueTransport* _transport, VenueRouting<T>* _routing = nullptr);
+    ~VenueRouter();
+
+    // Listener callback to process an add event to the Service, sending the order to its venue
+    void ProcessAdd(ExecutionOrder<T>& _data);
+
+    // Listener callback to process a remove event to the Service
+    void ProcessRemove(ExecutionOrder<T>& _data) {};
+
+    // Listener callback to process an update event to the Service
+    void ProcessUpdate(ExecutionOrder<T>& _data) {};
+
+    // Retry backlogged orders and deliver the events ready, return the number of events delivered
+    size_t Poll();
+
+    // Poll until no order is outstanding
+    void Drain();
+
+    // Add a listener for filled orders
+    void AddFillListener(ServiceListener<ExecutionOrder<T>>* _listener);
+
+    // Add a listener for acknowledgements and fills
+    void AddEventListener(ServiceListener<VenueEvent>* _listener);
+
+    // Get the number of orders sent or backlogged and not yet filled
+    size_t GetOutstandingCount() const;
+
+    // Get the number of orders a venue has acknowledged and not yet filled
+    long GetAcknowledgedCount() const;
+
+private:
+
+    struct Outstanding
+    {
+        ExecutionOrder<T> order;
+        Market venue;
+        bool acknowledged;
+        long sent;
+    };
+
+    // Send the backlog of a venue until the transport is full
+    void SendBacklog(int _venue);
+
+    // Apply an event to the outstanding table and notify the listeners
+    void Deliver(VenueEvent& _event);
+
+    VenueTransport* transport;
+    VenueRouting<T>* routing;
+    bool ownsRouting;
+    IdHashTable<Outstanding> outstanding;
+    vector<deque<VenueOrder>> backlogs;
+    vector<ServiceListener<ExecutionOrder<T>>*> fillListeners;
+    vector<ServiceListener<VenueEvent>*> eventListeners;
+    VenueOrder sending;
+    VenueEvent received;
+    long acknowledged;
+    StageMetrics& roundTrip;
+
+};
+
+template<typename T>
+VenueRouter<T>::VenueRouter(VenueTransport* _transport, VenueRouting<T>* _routing) :
+        transport(_transport), routing(_routing), ownsRouting(_routing == nullptr), backlogs(VENUE_COUNT), acknowledged(0), roundTrip(GetStageMetrics("VenueRoundTrip"))
+{
+    if (ownsRouting) routing = new ProductVenueRouting<T>();
+}
+
+template<typename T>
+VenueRouter<T>::~VenueRouter()
+{
+    if (ownsRouting) delete routing;
+}
+
+template<typename T>
+void VenueRouter<T>::ProcessAdd(ExecutionOrder<T>& _data)
+{
+    Market _venue = routing->Route(_data);
+    Outstanding& _entry = outstanding[_data.GetOrderId()];
+    _entry.order = _data;
+    _entry.venue = _venue;
+    _entry.acknowledged = false;
+    _entry.sent = GetNanoseconds();
+
+    sending.orderId = _data.GetOrderId();
+    sending.side = _data.GetPricingSide();
+    sending.price = _data.GetPrice();
+    sending.quantity = _data.GetVisibleQuantity() + _data.GetHiddenQuantity();
+
+    // Orders queue behind the venue's backlog so each venue sees them in order
+    if (!backlogs[_venue].empty() || !transport->TrySend(_venue, sending)) backlogs[_venue].push_back(sending);
+    Poll();
+}
+
+template<typename T>
+size_t VenueRouter<T>::Poll()
+{
+    for (int i = 0; i < VENUE_COUNT; i++)
+    {
+        if (!backlogs[i].empty()) SendBacklog(i);
+    }
+    size_t _count = 0;
+    while (transport->TryReceive(received))
+    {
+        Deliver(received);
+        _count++;
+    }
+    return _count;
+}
+
+template<typename T>
+void VenueRouter<T>::Drain()
+{
+    while (outstanding.GetSize() > 0)
+    {
+        if (Poll() == 0) this_thread::yield();
+    }
+}
+
+template<typename T>
+void VenueRouter<T>::SendBacklog(int _venue)
+{
+    deque<VenueOrder>& _backlog = backlogs[_venue];
+    while (!_backlog.empty() && transport->TrySend(Market(_venue), _backlog.front()))
+    {
+        _backlog.pop_front();
+    }
+}
+
+template<typename T>
+void VenueRouter<T>::Deliver(VenueEvent& _event)
+{
+    // Events for orders no longer outstanding are dropped
+    Outstanding* _entry = outstanding.Find(_event.orderId);
+    if (!_entry) return;
+
+    for (auto& l : eventListeners)
+    {
+        l->ProcessAdd(_event);
+    }
+    if (_event.type == VENUE_ACK)
+    {
+        if (!_entry->acknowledged) acknowledged++;
+        _entry->acknowledged = true;
+        return;
+    }
+
+    if (_entry->acknowledged) acknowledged--;
+    roundTrip.Record(GetNanoseconds() - _entry->sent);
+    for (auto& l : fillListeners)
+    {
+        l->ProcessAdd(_entry->order);
+    }
+    outstanding.Erase(_event.orderId);
+}
+
+template<typename T>
+void VenueRouter<T>::AddFillListener(ServiceListener<ExecutionOrder<T>>* _listener)
+{
+    fillListeners.push_back(_listener);
+}
+
+template<typename T>
+void VenueRouter<T>::AddEventListener(ServiceListener<VenueEvent>* _listener)
+{
+    eventListeners.push_back(_listener);
+}
+
+template<typename T>
+size_t VenueRouter<T>::GetOutstandingCount() const
+{
+    return outstanding.GetSize();
+}
+
+template<typename T>
+long VenueRouter<T>::GetAcknowledgedCount() const
+{
+    return acknowledged;
+}
+
+#endif